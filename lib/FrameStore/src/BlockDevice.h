@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Erasable storage with NOR flash semantics.
+ * @note Erased bytes are `0xff`, and `program` can only clear bits (write each byte once after erase).
+ */
+class BlockDevice {
+public:
+  /**
+   * @brief Get the erase unit size in bytes.
+   */
+  virtual uint32_t getSectorSize() const = 0;
+
+  /**
+   * @brief Get the count of sectors.
+   */
+  virtual uint32_t getSectorCount() const = 0;
+
+  /**
+   * @brief Read bytes.
+   * @param offset Byte offset from the start of the device
+   * @param data Destination
+   * @param length Byte count
+   */
+  virtual bool read(uint32_t offset, uint8_t *data, uint32_t length) = 0;
+
+  /**
+   * @brief Program bytes into erased area.
+   * @param offset Byte offset from the start of the device
+   * @param data Source
+   * @param length Byte count
+   */
+  virtual bool program(uint32_t offset, const uint8_t *data, uint32_t length) = 0;
+
+  /**
+   * @brief Erase a sector (fill with `0xff`).
+   * @param sector Sector number
+   */
+  virtual bool erase(uint32_t sector) = 0;
+};
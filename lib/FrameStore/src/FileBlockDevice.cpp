@@ -0,0 +1,83 @@
+#ifndef ARDUINO
+#include <string.h>
+#include "FileBlockDevice.h"
+
+FileBlockDevice::~FileBlockDevice() {
+  close();
+}
+
+/**
+ * @brief Open the image file (created and filled with `0xff` if it does not exist).
+ * @param path Image file path
+ * @param sectorCount Count of sectors
+ * @param sectorSize Sector size in bytes
+ */
+bool FileBlockDevice::open(const char *path, uint32_t sectorCount, uint32_t sectorSize) {
+  close();
+  __sectorCount = sectorCount;
+  __sectorSize = sectorSize;
+  __file = fopen(path, "r+b");
+  if (__file == nullptr) {
+    __file = fopen(path, "w+b");
+    if (__file == nullptr) return false;
+  }
+  // Extend with erased sectors
+  fseek(__file, 0, SEEK_END);
+  long size = ftell(__file);
+  for (long i = size; i < (long)sectorCount * sectorSize; i++) fputc(0xff, __file);
+  return fflush(__file) == 0;
+}
+
+void FileBlockDevice::close() {
+  if (__file != nullptr) fclose(__file);
+  __file = nullptr;
+}
+
+uint32_t FileBlockDevice::getSectorSize() const {
+  return __sectorSize;
+}
+
+uint32_t FileBlockDevice::getSectorCount() const {
+  return __sectorCount;
+}
+
+bool FileBlockDevice::read(uint32_t offset, uint8_t *data, uint32_t length) {
+  if (!__isInRange(offset, length)) return false;
+  return fseek(__file, offset, SEEK_SET) == 0 && fread(data, 1, length, __file) == length;
+}
+
+bool FileBlockDevice::program(uint32_t offset, const uint8_t *data, uint32_t length) {
+  if (!__isInRange(offset, length)) return false;
+  uint8_t buffer[256];
+  for (uint32_t done = 0; done < length;) {
+    uint32_t chunk = length - done < sizeof(buffer) ? length - done : sizeof(buffer);
+    if (!read(offset + done, buffer, chunk)) return false;
+    // Programming can only clear bits
+    for (uint32_t i = 0; i < chunk; i++) buffer[i] &= data[done + i];
+    if (fseek(__file, offset + done, SEEK_SET) != 0 || fwrite(buffer, 1, chunk, __file) != chunk) return false;
+    done += chunk;
+  }
+  __statistics.programmedBytes += length;
+  return fflush(__file) == 0;
+}
+
+bool FileBlockDevice::erase(uint32_t sector) {
+  if (sector >= __sectorCount || __file == nullptr) return false;
+  uint8_t buffer[256];
+  memset(buffer, 0xff, sizeof(buffer));
+  if (fseek(__file, sector * __sectorSize, SEEK_SET) != 0) return false;
+  for (uint32_t done = 0; done < __sectorSize; done += sizeof(buffer)) {
+    if (fwrite(buffer, 1, sizeof(buffer), __file) != sizeof(buffer)) return false;
+  }
+  __statistics.erasedSectors++;
+  return fflush(__file) == 0;
+}
+
+const FileBlockDevice::Statistics &FileBlockDevice::getStatistics() const {
+  return __statistics;
+}
+
+bool FileBlockDevice::__isInRange(uint32_t offset, uint32_t length) const {
+  return __file != nullptr && offset <= __sectorCount * __sectorSize && length <= __sectorCount * __sectorSize - offset;
+}
+#endif
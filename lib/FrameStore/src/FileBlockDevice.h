@@ -0,0 +1,50 @@
+#pragma once
+
+#ifndef ARDUINO
+#include <stdio.h>
+#include <stdint.h>
+#include "BlockDevice.h"
+
+/**
+ * @brief `BlockDevice` backed by a file (for running `FrameStore` on a host).
+ * @note NOR flash behavior is emulated: `program` only clears bits, `erase` fills the sector with `0xff`.
+ */
+class FileBlockDevice : public BlockDevice {
+public:
+  /**
+   * @brief Device counters
+   */
+  struct Statistics {
+    uint32_t programmedBytes;
+    uint32_t erasedSectors;
+  };
+
+  ~FileBlockDevice();
+
+  /**
+   * @brief Open the image file (created and filled with `0xff` if it does not exist).
+   * @param path Image file path
+   * @param sectorCount Count of sectors
+   * @param sectorSize Sector size in bytes
+   */
+  bool open(const char *path, uint32_t sectorCount, uint32_t sectorSize = 4096);
+
+  void close();
+
+  uint32_t getSectorSize() const override;
+  uint32_t getSectorCount() const override;
+  bool read(uint32_t offset, uint8_t *data, uint32_t length) override;
+  bool program(uint32_t offset, const uint8_t *data, uint32_t length) override;
+  bool erase(uint32_t sector) override;
+
+  const Statistics &getStatistics() const;
+
+private:
+  FILE *__file = nullptr;
+  uint32_t __sectorCount = 0;
+  uint32_t __sectorSize = 0;
+  Statistics __statistics = {};
+
+  bool __isInRange(uint32_t offset, uint32_t length) const;
+};
+#endif
@@ -0,0 +1,66 @@
+#ifdef ARDUINO_ARCH_RP2040
+#include <Arduino.h>
+#include <string.h>
+#include <hardware/flash.h>
+#include "FlashBlockDevice.h"
+
+/**
+ * @brief Use the last `sectorCount` sectors of the flash.
+ * @param sectorCount Count of sectors
+ */
+void FlashBlockDevice::begin(uint32_t sectorCount) {
+  __sectorCount = sectorCount;
+  __offset = PICO_FLASH_SIZE_BYTES - sectorCount * FLASH_SECTOR_SIZE;
+}
+
+uint32_t FlashBlockDevice::getSectorSize() const {
+  return FLASH_SECTOR_SIZE;
+}
+
+uint32_t FlashBlockDevice::getSectorCount() const {
+  return __sectorCount;
+}
+
+bool FlashBlockDevice::read(uint32_t offset, uint8_t *data, uint32_t length) {
+  if (!__isInRange(offset, length)) return false;
+  memcpy(data, (const uint8_t *)(XIP_BASE + __offset + offset), length);
+  return true;
+}
+
+bool FlashBlockDevice::program(uint32_t offset, const uint8_t *data, uint32_t length) {
+  if (!__isInRange(offset, length)) return false;
+  // Flash is programmed in pages, bytes outside of `data` are left as 0xff (unchanged)
+  uint8_t page[FLASH_PAGE_SIZE];
+  while (length > 0) {
+    uint32_t pageOffset = offset % FLASH_PAGE_SIZE;
+    uint32_t chunk = FLASH_PAGE_SIZE - pageOffset < length ? FLASH_PAGE_SIZE - pageOffset : length;
+    memset(page, 0xff, sizeof(page));
+    memcpy(page + pageOffset, data, chunk);
+
+    noInterrupts();
+    rp2040.idleOtherCore();
+    flash_range_program(__offset + offset - pageOffset, page, FLASH_PAGE_SIZE);
+    rp2040.resumeOtherCore();
+    interrupts();
+
+    offset += chunk;
+    data += chunk;
+    length -= chunk;
+  }
+  return true;
+}
+
+bool FlashBlockDevice::erase(uint32_t sector) {
+  if (sector >= __sectorCount) return false;
+  noInterrupts();
+  rp2040.idleOtherCore();
+  flash_range_erase(__offset + sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+  rp2040.resumeOtherCore();
+  interrupts();
+  return true;
+}
+
+bool FlashBlockDevice::__isInRange(uint32_t offset, uint32_t length) const {
+  return offset <= __sectorCount * FLASH_SECTOR_SIZE && length <= __sectorCount * FLASH_SECTOR_SIZE - offset;
+}
+#endif
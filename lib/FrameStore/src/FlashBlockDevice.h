@@ -0,0 +1,39 @@
+#pragma once
+
+#ifdef ARDUINO_ARCH_RP2040
+#include <stdint.h>
+#include "BlockDevice.h"
+#include "FrameStore.h"
+
+#ifndef FLASH_BLOCK_DEVICE_SECTORS
+// Sectors at the end of QSPI flash used by the device (128 sectors = 512KB)
+#define FLASH_BLOCK_DEVICE_SECTORS FRAME_STORE_MAX_SEGMENTS
+#endif
+
+/**
+ * @brief `BlockDevice` on the end of RP2040 QSPI flash.
+ * @note Reads go through XIP. Program and erase pause the other core and interrupts (DMA keeps running),
+ * the area must not overlap the sketch or the filesystem configured by `board_build.filesystem_size`.
+ */
+class FlashBlockDevice : public BlockDevice {
+public:
+  /**
+   * @brief Use the last `sectorCount` sectors of the flash.
+   * @param sectorCount Count of sectors
+   */
+  void begin(uint32_t sectorCount = FLASH_BLOCK_DEVICE_SECTORS);
+
+  uint32_t getSectorSize() const override;
+  uint32_t getSectorCount() const override;
+  bool read(uint32_t offset, uint8_t *data, uint32_t length) override;
+  bool program(uint32_t offset, const uint8_t *data, uint32_t length) override;
+  bool erase(uint32_t sector) override;
+
+private:
+  // Flash offset of the first sector
+  uint32_t __offset = 0;
+  uint32_t __sectorCount = 0;
+
+  bool __isInRange(uint32_t offset, uint32_t length) const;
+};
+#endif
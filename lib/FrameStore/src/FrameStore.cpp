@@ -0,0 +1,366 @@
+#include <string.h>
+#include "FrameStore.h"
+
+// Segment header: magic, erase count, inverted erase count, reserved
+#define FRAME_STORE_HEADER_SIZE 16
+#define FRAME_STORE_MAGIC 0x5346354b
+// Record: key (2 bytes), CRC (2 bytes), sequence (4 bytes), frame data
+#define FRAME_STORE_RECORD_HEADER_SIZE 8
+#define FRAME_STORE_RECORD_SIZE (FRAME_STORE_RECORD_HEADER_SIZE + FRAME_STORE_FRAME_SIZE)
+#define FRAME_STORE_RECORDS ((FRAME_STORE_SEGMENT_SIZE - FRAME_STORE_HEADER_SIZE) / FRAME_STORE_RECORD_SIZE)
+// Key of unwritten record
+#define FRAME_STORE_KEY_ERASED 0xffff
+
+// private functions
+namespace {
+  uint16_t __keyOf(int slot, uint16_t address) {
+    return (slot << 10) | address;
+  }
+
+  void __write16(uint8_t *data, uint16_t value) {
+    data[0] = value & 0xff;
+    data[1] = value >> 8;
+  }
+
+  void __write32(uint8_t *data, uint32_t value) {
+    for (int i = 0; i < 4; i++) data[i] = value >> (i * 8);
+  }
+
+  uint16_t __read16(const uint8_t *data) {
+    return data[0] | (data[1] << 8);
+  }
+
+  uint32_t __read32(const uint8_t *data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+  }
+
+  /**
+   * @brief CRC-16/CCITT-FALSE of the record (key, sequence and data).
+   */
+  uint16_t __crc(const uint8_t *record) {
+    uint16_t crc = 0xffff;
+    for (int i = 0; i < FRAME_STORE_RECORD_SIZE; i++) {
+      // CRC field itself is skipped
+      if (i == 2 || i == 3) continue;
+      crc ^= record[i] << 8;
+      for (int bit = 0; bit < 8; bit++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+  }
+
+  /**
+   * @brief Build the frame of a freshly formatted card.
+   * @param address Frame address
+   * @param data Destination (128 bytes)
+   */
+  void __formatted(uint16_t address, uint8_t *data) {
+    memset(data, 0, FRAME_STORE_FRAME_SIZE);
+    if (address >= 64) return;
+    if (address == 0 || address == 63) {
+      // Header frame and write test frame
+      data[0] = 'M';
+      data[1] = 'C';
+    } else if (address <= 15) {
+      // Directory frame: free block, no next block
+      data[0] = 0xa0;
+      data[8] = 0xff;
+      data[9] = 0xff;
+    } else if (address <= 35) {
+      // Broken sector list: no broken sector
+      memset(data, 0xff, 4);
+      data[8] = 0xff;
+      data[9] = 0xff;
+    } else {
+      return;
+    }
+    uint8_t checksum = 0;
+    for (int i = 0; i < FRAME_STORE_FRAME_SIZE - 1; i++) checksum ^= data[i];
+    data[FRAME_STORE_FRAME_SIZE - 1] = checksum;
+  }
+}
+
+/**
+ * @brief Mount the store, rebuild the index from the journal.
+ * @param device Block device (sector size must be `FRAME_STORE_SEGMENT_SIZE`)
+ * @return `false` if the device can not be used
+ */
+bool FrameStore::begin(BlockDevice &device) {
+  if (device.getSectorSize() != FRAME_STORE_SEGMENT_SIZE || device.getSectorCount() < 4) return false;
+  __device = &device;
+  __segmentCount = device.getSectorCount() < FRAME_STORE_MAX_SEGMENTS ? device.getSectorCount() : FRAME_STORE_MAX_SEGMENTS;
+  memset(__index, 0, sizeof(__index));
+  __head = -1;
+  __headRecords = 0;
+  __sequence = 0;
+
+  uint8_t record[FRAME_STORE_RECORD_SIZE];
+  for (int segment = 0; segment < __segmentCount; segment++) {
+    Segment &state = __segments[segment];
+    state.live = 0;
+    uint32_t base = segment * FRAME_STORE_SEGMENT_SIZE;
+    uint8_t header[FRAME_STORE_HEADER_SIZE];
+    if (!__device->read(base, header, sizeof(header))
+        || __read32(header) != FRAME_STORE_MAGIC || __read32(header + 4) != ~__read32(header + 8)) {
+      // Never used or erase was interrupted
+      state.eraseCount = 0;
+      state.state = SegmentState::Dirty;
+      continue;
+    }
+    state.eraseCount = __read32(header + 4);
+    state.state = SegmentState::Erased;
+
+    for (int i = 0; i < FRAME_STORE_RECORDS; i++) {
+      if (!__device->read(base + FRAME_STORE_HEADER_SIZE + i * FRAME_STORE_RECORD_SIZE, record, sizeof(record))) break;
+      uint16_t key = __read16(record);
+      if (key == FRAME_STORE_KEY_ERASED) break;
+      // Segment is closed even if the last record is torn
+      state.state = SegmentState::Used;
+      if (__read16(record + 2) != __crc(record)) continue;
+
+      int slot = key >> 10;
+      uint16_t address = key & (FRAME_STORE_FRAMES - 1);
+      if (slot >= FRAME_STORE_SLOT_COUNTS) continue;
+      uint32_t sequence = __read32(record + 4);
+      if (sequence > __sequence) __sequence = sequence;
+
+      // Keep the latest copy
+      uint16_t &location = __index[slot][address];
+      uint16_t existingKey;
+      uint32_t existingSequence;
+      if (location && __readHeader(location, existingKey, existingSequence) && existingSequence > sequence) continue;
+      location = segment * FRAME_STORE_RECORDS + i + 1;
+    }
+  }
+
+  for (int slot = 0; slot < FRAME_STORE_SLOT_COUNTS; slot++) {
+    for (int address = 0; address < FRAME_STORE_FRAMES; address++) {
+      if (__index[slot][address]) __segments[(__index[slot][address] - 1) / FRAME_STORE_RECORDS].live++;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Read a frame.
+ * @param slot Card number
+ * @param address Frame address (`0x00`-`0x3ff`)
+ * @param data Destination (128 bytes)
+ */
+bool FrameStore::read(int slot, uint16_t address, uint8_t *data) {
+  if (__device == nullptr || slot < 0 || slot >= FRAME_STORE_SLOT_COUNTS || address >= FRAME_STORE_FRAMES) return false;
+  uint16_t location = __index[slot][address];
+  if (!location) {
+    __formatted(address, data);
+    return true;
+  }
+  uint32_t offset = ((location - 1) / FRAME_STORE_RECORDS) * FRAME_STORE_SEGMENT_SIZE + FRAME_STORE_HEADER_SIZE
+                    + ((location - 1) % FRAME_STORE_RECORDS) * FRAME_STORE_RECORD_SIZE;
+  return __device->read(offset + FRAME_STORE_RECORD_HEADER_SIZE, data, FRAME_STORE_FRAME_SIZE);
+}
+
+/**
+ * @brief Write a frame.
+ * @param slot Card number
+ * @param address Frame address (`0x00`-`0x3ff`)
+ * @param data Frame data (128 bytes)
+ * @return `false` if the device failed or the store is full
+ */
+bool FrameStore::write(int slot, uint16_t address, const uint8_t *data) {
+  if (__device == nullptr || slot < 0 || slot >= FRAME_STORE_SLOT_COUNTS || address >= FRAME_STORE_FRAMES) return false;
+  __statistics.hostWrites++;
+
+  // Rewriting the same data only wears the flash
+  uint8_t current[FRAME_STORE_FRAME_SIZE];
+  if (read(slot, address, current) && memcmp(current, data, FRAME_STORE_FRAME_SIZE) == 0) {
+    __statistics.skipped++;
+    return true;
+  }
+  return __append(__keyOf(slot, address), ++__sequence, data, false);
+}
+
+/**
+ * @brief Compact or erase one segment if needed. (call when idle, may block for a sector erase)
+ * @return `true` if something is done
+ */
+bool FrameStore::service() {
+  if (__device == nullptr) return false;
+
+  // Erase in advance, so writes do not wait for it
+  int dirty = -1;
+  for (int segment = 0; segment < __segmentCount; segment++) {
+    if (__segments[segment].state != SegmentState::Dirty) continue;
+    if (dirty < 0 || __segments[segment].eraseCount < __segments[dirty].eraseCount) dirty = segment;
+  }
+  if (dirty >= 0) return __erase(dirty);
+
+  if (__countErased() < FRAME_STORE_FREE_TARGET) {
+    int victim = __chooseVictim(false);
+    if (victim >= 0) return __compact(victim);
+  }
+
+  // Static wear levelling: move cold data out of the least worn segment
+  if (__countErased() < 2) return false;
+  int coldest = -1;
+  uint32_t mostWorn = 0;
+  for (int segment = 0; segment < __segmentCount; segment++) {
+    const Segment &state = __segments[segment];
+    if (state.eraseCount > mostWorn) mostWorn = state.eraseCount;
+    if (state.state == SegmentState::Used && (coldest < 0 || state.eraseCount < __segments[coldest].eraseCount)) coldest = segment;
+  }
+  if (coldest >= 0 && mostWorn - __segments[coldest].eraseCount > FRAME_STORE_WEAR_DELTA) return __compact(coldest);
+  return false;
+}
+
+const FrameStore::Statistics &FrameStore::getStatistics() const {
+  return __statistics;
+}
+
+/**
+ * @brief Erase the segment and write its header.
+ */
+bool FrameStore::__erase(int segment) {
+  Segment &state = __segments[segment];
+  if (!__device->erase(segment)) return false;
+  __statistics.erases++;
+  state.eraseCount++;
+  state.live = 0;
+
+  uint8_t header[FRAME_STORE_HEADER_SIZE];
+  memset(header, 0xff, sizeof(header));
+  __write32(header, FRAME_STORE_MAGIC);
+  __write32(header + 4, state.eraseCount);
+  __write32(header + 8, ~state.eraseCount);
+  if (!__device->program(segment * FRAME_STORE_SEGMENT_SIZE, header, sizeof(header))) return false;
+  state.state = SegmentState::Erased;
+  return true;
+}
+
+/**
+ * @brief Start appending to the least worn erased segment.
+ * @param isCompacting `true` if called from compaction (may use the last erased segment)
+ */
+bool FrameStore::__openHead(bool isCompacting) {
+  while (true) {
+    // The last erased segment is kept for compaction
+    if (__countErased() >= (isCompacting ? 1 : 2)) {
+      int chosen = -1;
+      for (int segment = 0; segment < __segmentCount; segment++) {
+        if (__segments[segment].state != SegmentState::Erased) continue;
+        if (chosen < 0 || __segments[segment].eraseCount < __segments[chosen].eraseCount) chosen = segment;
+      }
+      __segments[chosen].state = SegmentState::Head;
+      __head = chosen;
+      __headRecords = 0;
+      return true;
+    }
+
+    int dirty = -1;
+    for (int segment = 0; segment < __segmentCount && dirty < 0; segment++) {
+      if (__segments[segment].state == SegmentState::Dirty) dirty = segment;
+    }
+    if (dirty >= 0) {
+      if (!__erase(dirty)) return false;
+      continue;
+    }
+    if (isCompacting) return false;
+
+    // Not compacted in the background in time
+    int victim = __chooseVictim(true);
+    if (victim < 0 || !__compact(victim)) return false;
+  }
+}
+
+/**
+ * @brief Append a record to the head segment and point the index to it.
+ * @param key Slot and frame address
+ * @param sequence Write order
+ * @param data Frame data
+ * @param isCompacting `true` if called from compaction
+ */
+bool FrameStore::__append(uint16_t key, uint32_t sequence, const uint8_t *data, bool isCompacting) {
+  if (__head < 0 || __headRecords >= FRAME_STORE_RECORDS) {
+    if (__head >= 0) __segments[__head].state = SegmentState::Used;
+    __head = -1;
+    if (!__openHead(isCompacting)) return false;
+  }
+
+  uint8_t record[FRAME_STORE_RECORD_SIZE];
+  __write16(record, key);
+  __write32(record + 4, sequence);
+  memcpy(record + FRAME_STORE_RECORD_HEADER_SIZE, data, FRAME_STORE_FRAME_SIZE);
+  __write16(record + 2, __crc(record));
+
+  uint32_t offset = __head * FRAME_STORE_SEGMENT_SIZE + FRAME_STORE_HEADER_SIZE + __headRecords * FRAME_STORE_RECORD_SIZE;
+  uint16_t location = __head * FRAME_STORE_RECORDS + __headRecords + 1;
+  // Slot is consumed even if programming fails (bytes might be partially programmed)
+  __headRecords++;
+  if (!__device->program(offset, record, sizeof(record))) return false;
+  __statistics.deviceWrites++;
+
+  uint16_t &entry = __index[key >> 10][key & (FRAME_STORE_FRAMES - 1)];
+  if (entry) __segments[(entry - 1) / FRAME_STORE_RECORDS].live--;
+  entry = location;
+  __segments[__head].live++;
+  return true;
+}
+
+/**
+ * @brief Read key and sequence of the record.
+ * @param location Record location (segment * records + record + 1)
+ */
+bool FrameStore::__readHeader(uint16_t location, uint16_t &key, uint32_t &sequence) {
+  uint8_t header[FRAME_STORE_RECORD_HEADER_SIZE];
+  uint32_t offset = ((location - 1) / FRAME_STORE_RECORDS) * FRAME_STORE_SEGMENT_SIZE + FRAME_STORE_HEADER_SIZE
+                    + ((location - 1) % FRAME_STORE_RECORDS) * FRAME_STORE_RECORD_SIZE;
+  if (!__device->read(offset, header, sizeof(header))) return false;
+  key = __read16(header);
+  sequence = __read32(header + 4);
+  return true;
+}
+
+/**
+ * @brief Choose the closed segment with the fewest live records (less worn one on tie).
+ * @param isUrgent `true` if a segment must be freed now
+ * @return `-1` if compaction frees nothing
+ */
+int FrameStore::__chooseVictim(bool isUrgent) {
+  int chosen = -1;
+  for (int segment = 0; segment < __segmentCount; segment++) {
+    const Segment &state = __segments[segment];
+    if (state.state != SegmentState::Used || state.live >= FRAME_STORE_RECORDS) continue;
+    if (chosen < 0 || state.live < __segments[chosen].live
+        || (state.live == __segments[chosen].live && state.eraseCount < __segments[chosen].eraseCount)) {
+      chosen = segment;
+    }
+  }
+  // Copying almost full segments in the background costs more than it frees
+  if (!isUrgent && chosen >= 0 && __segments[chosen].live > FRAME_STORE_RECORDS / 2) return -1;
+  return chosen;
+}
+
+/**
+ * @brief Copy live records of the segment to the head, and mark it to be erased.
+ */
+bool FrameStore::__compact(int segment) {
+  uint8_t record[FRAME_STORE_RECORD_SIZE];
+  for (int i = 0; i < FRAME_STORE_RECORDS && __segments[segment].live > 0; i++) {
+    uint16_t location = segment * FRAME_STORE_RECORDS + i + 1;
+    uint32_t offset = segment * FRAME_STORE_SEGMENT_SIZE + FRAME_STORE_HEADER_SIZE + i * FRAME_STORE_RECORD_SIZE;
+    if (!__device->read(offset, record, sizeof(record))) return false;
+    uint16_t key = __read16(record);
+    if (key == FRAME_STORE_KEY_ERASED) break;
+    if ((key >> 10) >= FRAME_STORE_SLOT_COUNTS || __index[key >> 10][key & (FRAME_STORE_FRAMES - 1)] != location) continue;
+    // Same sequence: either copy is the latest if power is lost before erase
+    if (!__append(key, __read32(record + 4), record + FRAME_STORE_RECORD_HEADER_SIZE, true)) return false;
+  }
+  __segments[segment].state = SegmentState::Dirty;
+  return true;
+}
+
+int FrameStore::__countErased() const {
+  int count = 0;
+  for (int segment = 0; segment < __segmentCount; segment++) {
+    if (__segments[segment].state == SegmentState::Erased) count++;
+  }
+  return count;
+}
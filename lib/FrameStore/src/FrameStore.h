@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdint.h>
+#include "BlockDevice.h"
+
+#ifndef FRAME_STORE_SLOT_COUNTS
+// Card images in the store
+#define FRAME_STORE_SLOT_COUNTS 2
+#endif
+#ifndef FRAME_STORE_MAX_SEGMENTS
+// Maximum segments (erase sectors) handled by the store
+#define FRAME_STORE_MAX_SEGMENTS 128
+#endif
+#ifndef FRAME_STORE_FREE_TARGET
+// Compaction runs in `service` while erased segments are fewer than this
+#define FRAME_STORE_FREE_TARGET 4
+#endif
+#ifndef FRAME_STORE_WEAR_DELTA
+// Erase count gap that moves cold data out of the least worn segment
+#define FRAME_STORE_WEAR_DELTA 64
+#endif
+// Segment size (must be the sector size of the device)
+#define FRAME_STORE_SEGMENT_SIZE 4096
+// Frame size of PS1 memory card
+#define FRAME_STORE_FRAME_SIZE 128
+// Frames on one card
+#define FRAME_STORE_FRAMES 1024
+
+/**
+ * @brief Log-structured store of memory card frames on a `BlockDevice`.
+ * @note Frames are appended to the journal (never overwritten in place), and the location of the latest copy
+ * is kept in RAM. Segments with the fewest live frames are compacted and erased in the background,
+ * and the least worn segment is recycled when erase counts drift apart, so every sector wears evenly.
+ * Frames never written read as a freshly formatted card.
+ */
+class FrameStore {
+public:
+  /**
+   * @brief Store counters
+   */
+  struct Statistics {
+    // Frames written by `write`
+    uint32_t hostWrites;
+    // Frames written to the device (including copies by compaction)
+    uint32_t deviceWrites;
+    // Sectors erased
+    uint32_t erases;
+    // Writes skipped because the frame is unchanged
+    uint32_t skipped;
+  };
+
+  /**
+   * @brief Mount the store, rebuild the index from the journal.
+   * @param device Block device (sector size must be `FRAME_STORE_SEGMENT_SIZE`)
+   * @return `false` if the device can not be used
+   */
+  bool begin(BlockDevice &device);
+
+  /**
+   * @brief Read a frame.
+   * @param slot Card number
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @param data Destination (128 bytes)
+   */
+  bool read(int slot, uint16_t address, uint8_t *data);
+
+  /**
+   * @brief Write a frame.
+   * @param slot Card number
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @param data Frame data (128 bytes)
+   * @return `false` if the device failed or the store is full
+   */
+  bool write(int slot, uint16_t address, const uint8_t *data);
+
+  /**
+   * @brief Drop the card image (reads as a formatted card again).
+   * @param slot Card number
+   */
+  void clear(int slot);
+
+  /**
+   * @brief Compact or erase one segment if needed. (call when idle, may block for a sector erase)
+   * @return `true` if something is done
+   */
+  bool service();
+
+  const Statistics &getStatistics() const;
+
+private:
+  /**
+   * @brief Segment state (in RAM)
+   */
+  enum SegmentState : uint8_t {
+    // Needs erase before use
+    Dirty = 0,
+    // Erased, header is written
+    Erased = 1,
+    // Records are being appended
+    Head = 2,
+    // Closed, only compaction touches it
+    Used = 3,
+  };
+
+  struct Segment {
+    uint32_t eraseCount;
+    uint8_t live;
+    SegmentState state;
+  };
+
+  BlockDevice *__device = nullptr;
+  uint16_t __segmentCount = 0;
+  Segment __segments[FRAME_STORE_MAX_SEGMENTS];
+  // (slot, frame) -> location (`0`: never written, otherwise segment * records + record + 1)
+  uint16_t __index[FRAME_STORE_SLOT_COUNTS][FRAME_STORE_FRAMES];
+  int __head = -1;
+  uint8_t __headRecords = 0;
+  uint32_t __sequence = 0;
+  Statistics __statistics = {};
+
+  bool __erase(int segment);
+  bool __openHead(bool isCompacting);
+  bool __append(uint16_t key, uint32_t sequence, const uint8_t *data, bool isCompacting);
+  bool __readHeader(uint16_t location, uint16_t &key, uint32_t &sequence);
+  int __chooseVictim(bool isUrgent);
+  bool __compact(int segment);
+  int __countErased() const;
+};
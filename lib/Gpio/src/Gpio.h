@@ -0,0 +1,199 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#if defined(ARDUINO_ARCH_RP2040)
+#include <hardware/gpio.h>
+#include <hardware/structs/sio.h>
+#elif defined(ARDUINO)
+#include <Arduino.h>
+#endif
+
+#ifndef GPIO_TRACE_SIZE
+// Transitions kept by the host backend (oldest are dropped)
+#define GPIO_TRACE_SIZE 4096
+#endif
+
+/**
+ * @brief Direct GPIO access for pins known at compile time.
+ * @note On RP2040 each access is one write (or read) of a SIO register, without the pin lookup of the Arduino core.
+ * Other Arduino boards fall back to `digitalWrite`. On the host, levels are kept in memory and every change of
+ * an output is recorded with a timestamp, so protocol timing can be checked without hardware.
+ */
+namespace Gpio {
+#ifndef ARDUINO
+  /**
+   * @brief Level change recorded by the host backend
+   */
+  struct Transition {
+    /**
+     * @brief Timestamp from the trace clock (microseconds)
+     */
+    uint32_t time;
+    uint8_t pin;
+    bool level;
+  };
+
+  /**
+   * @brief Clock used to timestamp the transitions (microseconds).
+   */
+  typedef uint32_t (*Clock)();
+
+  /**
+   * @brief Replace the trace clock (e.g. by a simulated clock).
+   * @param clock Clock, `nullptr` for the monotonic clock of the host
+   */
+  void setClock(Clock clock);
+
+  /**
+   * @brief Set the level seen by `Pin::read` while the pin is an input.
+   * @param pin GPIO number
+   * @param level Level driven by the outside
+   */
+  void setInput(uint8_t pin, bool level);
+
+  /**
+   * @brief Called after a pin changed its level.
+   * @param pin GPIO number
+   * @param level New level
+   */
+  typedef void (*Listener)(uint8_t pin, bool level);
+
+  /**
+   * @brief Get notified of level changes (e.g. by a simulated device).
+   * @param listener Called after a pin changed its level, `nullptr` to stop
+   */
+  void setListener(Listener listener);
+
+  /**
+   * @brief Count of recorded transitions.
+   */
+  size_t countTransitions();
+
+  /**
+   * @brief Get a recorded transition.
+   * @param index `0`: oldest
+   */
+  const Transition &getTransition(size_t index);
+
+  /**
+   * @brief Drop the recorded transitions.
+   */
+  void clearTrace();
+
+  // Backend of `Pin` (use `Pin` instead)
+  void hostWrite(uint8_t pin, bool level);
+  void hostSetOutput(uint8_t pin, bool isOutput);
+  bool hostRead(uint8_t pin);
+#endif
+
+  /**
+   * @brief GPIO pin
+   * @tparam N GPIO number
+   */
+  template <uint8_t N>
+  class Pin {
+  public:
+    static_assert(N < 30, "GPIO number must be 0-29");
+    static constexpr uint32_t Mask = 1u << N;
+
+    /**
+     * @brief Configure as a software controlled output.
+     * @param level Initial level
+     */
+    static void beginOutput(bool level) {
+#if defined(ARDUINO_ARCH_RP2040)
+      gpio_init(N);
+      write(level);
+      output();
+#elif defined(ARDUINO)
+      pinMode(N, OUTPUT);
+      write(level);
+#else
+      write(level);
+      output();
+#endif
+    }
+
+    /**
+     * @brief Configure as a software controlled input.
+     * @param isPullUp `true` to enable the internal pull-up
+     * @note Output latch is cleared, so `output()` drives LOW (open drain style).
+     */
+    static void beginInput(bool isPullUp = false) {
+#if defined(ARDUINO_ARCH_RP2040)
+      gpio_init(N);
+      if (isPullUp) gpio_pull_up(N);
+#elif defined(ARDUINO)
+      pinMode(N, isPullUp ? INPUT_PULLUP : INPUT);
+      digitalWrite(N, LOW);
+#else
+      // Host levels have no pull-up, inputs are driven with `setInput`
+      (void)isPullUp;
+      low();
+      input();
+#endif
+    }
+
+    static inline void high() {
+#if defined(ARDUINO_ARCH_RP2040)
+      sio_hw->gpio_set = Mask;
+#elif defined(ARDUINO)
+      digitalWrite(N, HIGH);
+#else
+      hostWrite(N, true);
+#endif
+    }
+
+    static inline void low() {
+#if defined(ARDUINO_ARCH_RP2040)
+      sio_hw->gpio_clr = Mask;
+#elif defined(ARDUINO)
+      digitalWrite(N, LOW);
+#else
+      hostWrite(N, false);
+#endif
+    }
+
+    static inline void write(bool level) {
+      if (level) high();
+      else low();
+    }
+
+    static inline bool read() {
+#if defined(ARDUINO_ARCH_RP2040)
+      return sio_hw->gpio_in & Mask;
+#elif defined(ARDUINO)
+      return digitalRead(N) == HIGH;
+#else
+      return hostRead(N);
+#endif
+    }
+
+    /**
+     * @brief Drive the pin with the output latch.
+     */
+    static inline void output() {
+#if defined(ARDUINO_ARCH_RP2040)
+      sio_hw->gpio_oe_set = Mask;
+#elif defined(ARDUINO)
+      pinMode(N, OUTPUT);
+#else
+      hostSetOutput(N, true);
+#endif
+    }
+
+    /**
+     * @brief Release the pin (high impedance).
+     */
+    static inline void input() {
+#if defined(ARDUINO_ARCH_RP2040)
+      sio_hw->gpio_oe_clr = Mask;
+#elif defined(ARDUINO)
+      pinMode(N, INPUT);
+#else
+      hostSetOutput(N, false);
+#endif
+    }
+  };
+}
@@ -0,0 +1,127 @@
+#ifndef ARDUINO
+#include <chrono>
+#include <mutex>
+#include "Gpio.h"
+
+namespace Gpio {
+  // private variables & functions
+  namespace {
+    // Bit per pin
+    uint32_t __latches = 0;
+    uint32_t __outputs = 0;
+    uint32_t __inputs = 0;
+    // Pins are driven from both simulated cores
+    std::mutex __mutex;
+    Listener __listener = nullptr;
+
+    Clock __clock = nullptr;
+    Transition __trace[GPIO_TRACE_SIZE];
+    // Total transitions recorded (`__count % GPIO_TRACE_SIZE` is the next slot)
+    size_t __count = 0;
+
+    uint32_t __now() {
+      if (__clock != nullptr) return __clock();
+      auto elapsed = std::chrono::steady_clock::now().time_since_epoch();
+      return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    }
+
+    bool __levelOf(uint8_t pin) {
+      uint32_t mask = 1u << pin;
+      return ((__outputs & mask) ? __latches : __inputs) & mask;
+    }
+
+    /**
+     * @brief Apply the change and record it if the level of the pin has changed.
+     * @param pin GPIO number
+     * @param bits Bits to update
+     * @param mask Pin mask
+     * @param value New bit value
+     */
+    void __update(uint8_t pin, uint32_t &bits, uint32_t mask, bool value) {
+      Listener listener;
+      bool after;
+      {
+        std::lock_guard<std::mutex> lock(__mutex);
+        bool before = __levelOf(pin);
+        if (value) bits |= mask;
+        else bits &= ~mask;
+        after = __levelOf(pin);
+        if (before == after) return;
+
+        Transition &transition = __trace[__count % GPIO_TRACE_SIZE];
+        transition.time = __now();
+        transition.pin = pin;
+        transition.level = after;
+        __count++;
+        listener = __listener;
+      }
+      // Outside the lock, the listener may read pins
+      if (listener != nullptr) listener(pin, after);
+    }
+  }
+
+  /**
+   * @brief Replace the trace clock (e.g. by a simulated clock).
+   * @param clock Clock, `nullptr` for the monotonic clock of the host
+   */
+  void setClock(Clock clock) {
+    __clock = clock;
+  }
+
+  /**
+   * @brief Set the level seen by `Pin::read` while the pin is an input.
+   * @param pin GPIO number
+   * @param level Level driven by the outside
+   */
+  void setInput(uint8_t pin, bool level) {
+    __update(pin, __inputs, 1u << pin, level);
+  }
+
+  /**
+   * @brief Count of recorded transitions.
+   */
+  size_t countTransitions() {
+    std::lock_guard<std::mutex> lock(__mutex);
+    return __count < GPIO_TRACE_SIZE ? __count : GPIO_TRACE_SIZE;
+  }
+
+  /**
+   * @brief Get a recorded transition.
+   * @param index `0`: oldest
+   */
+  const Transition &getTransition(size_t index) {
+    size_t first = __count < GPIO_TRACE_SIZE ? 0 : __count - GPIO_TRACE_SIZE;
+    return __trace[(first + index) % GPIO_TRACE_SIZE];
+  }
+
+  /**
+   * @brief Drop the recorded transitions.
+   */
+  void clearTrace() {
+    std::lock_guard<std::mutex> lock(__mutex);
+    __count = 0;
+  }
+
+  void hostWrite(uint8_t pin, bool level) {
+    __update(pin, __latches, 1u << pin, level);
+  }
+
+  void hostSetOutput(uint8_t pin, bool isOutput) {
+    __update(pin, __outputs, 1u << pin, isOutput);
+  }
+
+  /**
+   * @brief Get notified of level changes (e.g. by a simulated device).
+   * @param listener Called after a pin changed its level, `nullptr` to stop
+   */
+  void setListener(Listener listener) {
+    std::lock_guard<std::mutex> lock(__mutex);
+    __listener = listener;
+  }
+
+  bool hostRead(uint8_t pin) {
+    std::lock_guard<std::mutex> lock(__mutex);
+    return __levelOf(pin);
+  }
+}
+#endif
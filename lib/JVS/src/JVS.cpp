@@ -1,179 +1,189 @@
+#include <Gpio.h>
+#include <Trace.h>
 #include "JVS.h"
-#include <HardwareSerial.h>
+#include "JVSPacketPool.h"
+#include "JVSParser.h"
+#include "JVSUart.h"
 
 namespace JVS {
   // private
   namespace {
-    /**
-     * @brief Internal received status (used in `isReceivedRequest`)
-     */
-    enum ReceiveStatus {
-      WaitSync = 0,
-      ReceivedSync = 1,
-      ReceivedMyNodeNo = 2,
-      ProcessingData = 3,
-      ProcessedData = 4,
-    };
-
-    /**
-     * @brief Serial port for JVS communication
-     */
-    SerialUART *__serial;
+    // RS485 direction (HIGH: TX)
+    typedef Gpio::Pin<JVS_DATA_MINUS_PIN> __DirectionPin;
+    // Sense line (input: terminated, output LOW: addressed)
+    typedef Gpio::Pin<JVS_SENSE_PIN> __SensePin;
 
     bool __isInitialized = false;
     uint8_t __nodeNo = 0;
+    uint32_t __baudRate = JVS_BAUD_RATE;
+    Parser __parser;
+
+    // Last packet on the wire ([SYNC] + [Node No.] + escaped [Byte Count], [Data] and [SUM]), kept for `Retry`
+    uint8_t __wire[2 + (JVS_MAX_DATA_SIZE + 2) * 2];
+    size_t __wireLength = 0;
 
-    void __writeWithEscape(uint8_t data) {
+    uint32_t __requestTime = 0;
+    volatile Timing __timing;
+
+    /**
+     * @brief Escape a byte into `buffer`.
+     * @return Count of written bytes (1 or 2)
+     */
+    uint8_t __escape(uint8_t data, uint8_t *buffer) {
       if (data == SpecialChar::Sync || data == SpecialChar::Escape) {
-        __serial->write(SpecialChar::Escape);
-        data--;
+        buffer[0] = SpecialChar::Escape;
+        buffer[1] = data - 1;
+        return 2;
       }
-      __serial->write(data);
+      buffer[0] = data;
+      return 1;
     }
-  }
 
-  Packet::Packet(uint8_t nodeNo) {
-    this->nodeNo = nodeNo;
-    this->length = 0;
-    memset(this->data, 0, JVS_MAX_DATA_SIZE);
-    this->sum = nodeNo;
-  }
+    /**
+     * @brief Release RS485 line. (called from interrupt)
+     */
+    void __onSent(uint32_t lateUs) {
+      __DirectionPin::low();  // RS485_RX
+      TRACE_POINT(Trace::Point::Release, lateUs < 0xffff ? lateUs : 0xffff);
+      __timing.lastReleaseUs = lateUs;
+      if (lateUs > __timing.maxReleaseUs) __timing.maxReleaseUs = lateUs;
+    }
 
-  /**
-   * @brief Add a byte to the packet data (and update `length` and `sum`)
-   * @param data Byte to add
-   */
-  void Packet::add(uint8_t data) {
-    this->data[this->length] = data;
-    this->length++;
-    this->sum += data;
-  }
+    void __transmit() {
+      Uart::flush();  // Previous packet should have been sent long ago
+      __DirectionPin::high();  // RS485_TX
+      uint32_t elapsed = micros() - __requestTime;
+      __timing.count++;
+      __timing.lastResponseUs = elapsed;
+      if (elapsed > __timing.maxResponseUs) __timing.maxResponseUs = elapsed;
+      TRACE_CAPTURE(Trace::Direction::Sent, __wire, __wireLength);
+      Uart::startWrite(__wire, __wireLength, __onSent);
+    }
 
-  /**
-   * @brief Add multiple bytes to the packet data (and update `length` and `sum`)
-   * @param data Byte array to add
-   * @param length Length of the byte array
-   */
-  void Packet::add(uint8_t *data, uint8_t length) {
-    memcpy(this->data + this->length, data, length);
-    this->length += length;
-  }
+    /**
+     * @brief Reconfigure UART for the new speed, bytes of a half received packet are dropped.
+     * @param baudRate Baud rate
+     */
+    void __switchBaudRate(uint32_t baudRate) {
+      if (baudRate == __baudRate) return;
+      Uart::setBaudRate(baudRate);
+      __baudRate = baudRate;
+      __parser.reset();
+    }
 
-  /**
-   * @brief Validate the packet by checking the checksum
-   * @return `true` if the checksum is correct
-   */
-  bool Packet::validate() {
-    uint8_t sum = this->nodeNo;
-    for (int i = 0; i < this->length; i++) {
-      sum += this->data[i];
+    /**
+     * @brief Tell master that the request addressed to us was broken.
+     */
+    void __sendSumError() {
+      PacketHandle ack = PacketPool::acquire(0x00);  // to Master
+      // No buffer left, master times out and sends the request again
+      if (!ack) return;
+      ack->add(AckStatus::SumError);
+      sendPacket(*ack);
     }
-    return (sum == this->sum);
   }
 
   void setup() {
-    __serial = &Serial1;
-    __serial->setTX(JVS_TX_PIN);
-    __serial->setRX(JVS_DATA_PLUS_PIN);
-
-    pinMode(JVS_SENSE_PIN, INPUT);
-    pinMode(JVS_DATA_MINUS_PIN, OUTPUT);
-    digitalWrite(JVS_SENSE_PIN, LOW);  // pullup to 5V (terminated)
-    digitalWrite(JVS_DATA_MINUS_PIN, LOW);
+    __SensePin::beginInput();  // pullup to 5V (terminated)
+    __DirectionPin::beginOutput(LOW);
 
-    __serial->begin(JVS_BAUD_RATE);
+    Uart::begin(JVS_BAUD_RATE);
+    __baudRate = JVS_BAUD_RATE;
+    __parser.reset();
+    __parser.setNodeNo(__nodeNo);
     __isInitialized = true;
   }
 
   bool tryGetRequest(Packet &requestPacket) {
-    // Received escape character or not
-    static bool __escaped;
-    // Receive status
-    static int __phase;
-    // Processed packet.data count
-    static uint8_t __dataCount;
-
     if (!__isInitialized) return false;
 
-    // At least 5 bytes are needed ([SYNC], [Node No.], [Byte Count], [Data], [SUM])
-    int available = __serial->available();
-    if (__phase == ReceiveStatus::WaitSync && available < 5) return false;
-
-    for (int i = 0; i < available; i++) {
-      uint8_t b = __serial->read();
-      if (b == SpecialChar::Sync) {
-        // Start of packet
-        __phase = ReceiveStatus::ReceivedSync;
-        __escaped = false;
+    const uint8_t *data;
+    size_t length;
+    // At most 2 spans (ring buffer wraps around once)
+    while ((length = Uart::peek(data)) > 0) {
+      // Bytes are lost, the packet under construction is broken
+      if (Uart::checkOverrun()) __parser.reset();
+      // Master went back to the default speed without `Reset` (restarted), follow it
+      if (Uart::checkLineError() && __baudRate != JVS_BAUD_RATE) {
+        Uart::consume(length);
+        __switchBaudRate(JVS_BAUD_RATE);
         continue;
       }
-      // Wait until [SYNC] is received
-      if (__phase == ReceiveStatus::WaitSync) continue;
 
-      // Escape & Unescape
-      if (b == SpecialChar::Escape) {
-        __escaped = true;
-        continue;
-      }
-      if (__escaped) {
-        b++;
-        __escaped = false;
-      }
-
-      switch (__phase) {
-        case ReceiveStatus::ReceivedSync:  // b is [Node No.]
-          if (b != JVS_ADDRESS_BROADCAST && b != __nodeNo) {
-            // Ignore packets not addressed to us
-            __phase = ReceiveStatus::WaitSync;
-            return false;
-          }
-          requestPacket = Packet(b);
-          __phase = ReceiveStatus::ReceivedMyNodeNo;
-          break;
-        case ReceiveStatus::ReceivedMyNodeNo:  // b is [Byte Count]
-          requestPacket.length = b;
-          __dataCount = 0;
-          __phase = ReceiveStatus::ProcessingData;
-          break;
-        case ReceiveStatus::ProcessingData:  // b is [Data]
-          requestPacket.data[__dataCount] = b;
-          if (requestPacket.length == __dataCount) __phase = ReceiveStatus::ProcessedData;
-          __dataCount++;
-          break;
-        case ReceiveStatus::ProcessedData:  // b is [SUM]
-          requestPacket.sum = b;
-          __phase = ReceiveStatus::WaitSync;
-          return requestPacket.validate();
+      size_t consumed;
+      Parser::Result result = __parser.parse(data, length, requestPacket, consumed);
+      TRACE_CAPTURE(Trace::Direction::Received, data, consumed);
+      Uart::consume(consumed);
+      if (result != Parser::Result::Incomplete) __requestTime = micros();
+      if (result == Parser::Result::Completed) return true;
+      if (result == Parser::Result::ChecksumError) {
+        // Broadcast is not answered (every node would reply at once)
+        if (requestPacket.nodeNo != JVS_ADDRESS_BROADCAST) __sendSumError();
+        return false;
       }
     }
     // Reached end of buffer, continue on next loop
     return false;
   }
 
+  bool hasReceived() {
+    const uint8_t *data;
+    return __isInitialized && Uart::peek(data) > 0;
+  }
+
   void reset() {
+    // Keep receiving, next `SetAddress` is sent as broadcast
     __nodeNo = 0;
-    pinMode(JVS_SENSE_PIN, INPUT);
-    __isInitialized = false;
+    __parser.setNodeNo(0);
+    __SensePin::input();
+    __switchBaudRate(JVS_BAUD_RATE);
   }
 
   void setAddress(uint8_t nodeNo) {
     __nodeNo = nodeNo;
-    pinMode(JVS_SENSE_PIN, OUTPUT);  // Set to 0V
-    __isInitialized = true;
+    __parser.setNodeNo(nodeNo);
+    __SensePin::output();  // Set to 0V
   }
 
-  void sendPacket(Packet &packet) {
-    digitalWrite(JVS_DATA_MINUS_PIN, HIGH);  // RS485_TX
+  bool trySetCommMethod(uint8_t method) {
+    if (method > CommMethod::Baud3M || !(JVS_COMM_METHODS & (1 << method))) return false;
+    static const uint32_t baudRates[] = {JVS_BAUD_RATE, 1000000, 3000000};
+    __switchBaudRate(baudRates[method]);
+    return true;
+  }
 
-    __serial->write(SpecialChar::Sync);
-    __serial->write(packet.nodeNo);  // [Node No.] never to be Sync or Escape (0-31, 0xff)
-    __writeWithEscape(packet.length);
+  uint32_t getBaudRate() {
+    return __baudRate;
+  }
+
+  void sendPacket(Packet &packet) {
+    // DMA might still be reading the previous packet
+    Uart::flush();
+    size_t length = 0;
+    __wire[length++] = SpecialChar::Sync;
+    __wire[length++] = packet.nodeNo;  // [Node No.] never to be Sync or Escape (0-31, 0xff)
+    length += __escape(packet.length + 1, &__wire[length]);  // [Byte Count] ([Data] + [SUM])
     for (int i = 0; i < packet.length; i++) {
-      __writeWithEscape(packet.data[i]);
+      length += __escape(packet.data[i], &__wire[length]);
     }
-    __writeWithEscape(packet.sum);
-    __serial->flush();  // Wait for all data to be sent
+    length += __escape(packet.sum, &__wire[length]);
+    __wireLength = length;
+    __transmit();
+  }
+
+  void resend() {
+    if (__wireLength > 0) __transmit();
+  }
+
+  const Timing &getTiming() {
+    return (const Timing &)__timing;
+  }
 
-    digitalWrite(JVS_DATA_MINUS_PIN, LOW);  // RS485_RX
+  void resetTiming() {
+    __timing.count = 0;
+    __timing.lastResponseUs = 0;
+    __timing.maxResponseUs = 0;
+    __timing.lastReleaseUs = 0;
+    __timing.maxReleaseUs = 0;
   }
 };
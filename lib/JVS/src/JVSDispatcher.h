@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stdint.h>
+#include "JVSProtocol.h"
+
+namespace JVS {
+  /**
+   * @brief Command handler, adds the report to acknowledge packet.
+   * @param command Command bytes (length is already checked)
+   * @param ack Acknowledge packet
+   */
+  typedef void (*Handler)(const uint8_t *command, Packet &ack);
+
+  /**
+   * @brief Command definition for `Dispatcher`.
+   * @tparam Code Command byte
+   * @tparam Length Count of command bytes (including `Code`)
+   * @tparam Fn Handler
+   * @tparam ExtraAt Index of the byte that holds the count of following data (`0`: fixed length)
+   */
+  template <uint8_t Code, uint8_t Length, Handler Fn, uint8_t ExtraAt = 0>
+  struct On {
+    static constexpr bool hasSubCode = false;
+    static constexpr uint8_t code = Code;
+    static constexpr uint8_t subCode = 0;
+    static constexpr uint8_t length = Length;
+    static constexpr uint8_t extraAt = ExtraAt;
+    static constexpr Handler handler = Fn;
+  };
+
+  /**
+   * @brief Sub-command definition for `Dispatcher`. (e.g. `K573MemoryCard` + `K573MemoryCardRead`)
+   * @tparam Code Command byte
+   * @tparam SubCode Second command byte
+   * @tparam Length Count of command bytes (including `Code` and `SubCode`)
+   * @tparam Fn Handler
+   * @tparam ExtraAt Index of the byte that holds the count of following data (`0`: fixed length)
+   */
+  template <uint8_t Code, uint8_t SubCode, uint8_t Length, Handler Fn, uint8_t ExtraAt = 0>
+  struct OnSub {
+    static constexpr bool hasSubCode = true;
+    static constexpr uint8_t code = Code;
+    static constexpr uint8_t subCode = SubCode;
+    static constexpr uint8_t length = Length;
+    static constexpr uint8_t extraAt = ExtraAt;
+    static constexpr Handler handler = Fn;
+  };
+
+  /**
+   * @brief Command dispatcher with the lookup table built at compile time.
+   * @tparam Entries `On` and `OnSub` definitions
+   * @note Top level lookup is a 256 entry table. Sub-commands are searched only within the same command byte.
+   */
+  template <typename... Entries>
+  class Dispatcher {
+  public:
+    /**
+     * @brief Process a command and add the report to acknowledge packet.
+     * @param command Command bytes
+     * @param length Remaining bytes in request packet
+     * @param ack Acknowledge packet
+     * @return Count of processed bytes, `0` if the command is unknown or truncated
+     */
+    static int dispatch(const uint8_t *command, int length, Packet &ack) {
+      const Entry *entry = &__table.top[command[0]];
+      if (entry->handler == nullptr) return 0;
+      if (entry->subCount > 0) {
+        if (length < 2) return 0;
+        entry = __findSub(command[0], command[1]);
+        if (entry == nullptr) return 0;
+      }
+      int needed = entry->length;
+      if (length < needed) return 0;
+      if (entry->extraAt > 0) {
+        needed += command[entry->extraAt];
+        if (length < needed) return 0;
+      }
+      entry->handler(command, ack);
+      return needed;
+    }
+
+    /**
+     * @brief Process all commands in the request and add the reports to one acknowledge packet.
+     * @param request Request packet
+     * @param ack Acknowledge packet (reset to `StatusOK`, `CommandUnknown` if a command is not processed,
+     * or `Overflow` if the reports do not fit in one packet)
+     */
+    static void process(const Packet &request, Packet &ack) {
+      ack.reset(0x00);  // to Master
+      ack.add(AckStatus::StatusOK);
+      int i = 0;
+      while (i < request.length) {
+        int processed = dispatch(request.data + i, request.length - i, ack);
+        if (processed == 0) {
+          // Unknown command, ignore the rest
+          ack.reset(0x00);
+          ack.add(AckStatus::CommandUnknown);
+          return;
+        }
+        if (ack.isOverflowed) {
+          // Reports past the packet are lost, ignore the rest (host splits the request)
+          ack.reset(0x00);
+          ack.add(AckStatus::Overflow);
+          return;
+        }
+        i += processed;
+      }
+    }
+
+  private:
+    struct Entry {
+      uint8_t code;
+      uint8_t subCode;
+      uint8_t length;
+      uint8_t extraAt;
+      // Sub-commands of `code` (top level only)
+      uint8_t subCount;
+      Handler handler;
+    };
+
+    static constexpr int __subCount = (0 + ... + (Entries::hasSubCode ? 1 : 0));
+
+    struct Table {
+      Entry top[256];
+      Entry subs[__subCount > 0 ? __subCount : 1];
+    };
+
+    static constexpr Table __build() {
+      Table table{};
+      const Entry entries[] = {{Entries::code, Entries::subCode, Entries::length, Entries::extraAt, Entries::hasSubCode ? (uint8_t)1 : (uint8_t)0, Entries::handler}...};
+      int subIndex = 0;
+      for (const Entry &entry : entries) {
+        Entry &top = table.top[entry.code];
+        if (entry.subCount > 0) {
+          table.subs[subIndex++] = {entry.code, entry.subCode, entry.length, entry.extraAt, 0, entry.handler};
+          // Top entry only marks that the command has sub-commands
+          top.code = entry.code;
+          top.subCount++;
+          top.handler = entry.handler;
+        } else {
+          top = entry;
+        }
+      }
+      return table;
+    }
+
+    static constexpr Table __table = __build();
+
+    static const Entry *__findSub(uint8_t code, uint8_t subCode) {
+      for (const Entry &entry : __table.subs) {
+        if (entry.code == code && entry.subCode == subCode && entry.handler != nullptr) return &entry;
+      }
+      return nullptr;
+    }
+  };
+}
@@ -0,0 +1,78 @@
+#include <string.h>
+#include "JVSPacketPool.h"
+
+static_assert(JVS_PACKET_POOL_SIZE >= 1 && JVS_PACKET_POOL_SIZE <= 32, "JVS_PACKET_POOL_SIZE must be 1-32");
+
+namespace JVS {
+  // private
+  namespace {
+    Packet __packets[JVS_PACKET_POOL_SIZE];
+    // Bit N: `__packets[N]` is free
+    uint32_t __freeMask = (uint32_t)((1ull << JVS_PACKET_POOL_SIZE) - 1);
+    PacketPool::Statistics __statistics = {};
+  }
+
+  namespace PacketPool {
+    /**
+     * @brief Take an empty packet from the pool.
+     * @param nodeNo Address
+     * @return Handle to the packet, empty if every buffer is in use
+     */
+    PacketHandle acquire(uint8_t nodeNo) {
+      if (__freeMask == 0) {
+        __statistics.exhausted++;
+        return PacketHandle();
+      }
+      int index = __builtin_ctz(__freeMask);
+      __freeMask &= ~(1u << index);
+      __statistics.acquired++;
+      uint8_t inUse = JVS_PACKET_POOL_SIZE - available();
+      if (inUse > __statistics.peakInUse) __statistics.peakInUse = inUse;
+      Packet *packet = &__packets[index];
+      packet->reset(nodeNo);
+      return PacketHandle(packet);
+    }
+
+    /**
+     * @brief Get the count of buffers not in use.
+     */
+    uint8_t available() {
+      return __builtin_popcount(__freeMask);
+    }
+
+    const Statistics &getStatistics() {
+      return __statistics;
+    }
+
+    void resetStatistics() {
+      memset(&__statistics, 0, sizeof(__statistics));
+    }
+  }
+
+  PacketHandle::PacketHandle(PacketHandle &&other)
+    : __packet(other.__packet) {
+    other.__packet = nullptr;
+  }
+
+  PacketHandle &PacketHandle::operator=(PacketHandle &&other) {
+    if (this != &other) {
+      release();
+      __packet = other.__packet;
+      other.__packet = nullptr;
+    }
+    return *this;
+  }
+
+  PacketHandle::~PacketHandle() {
+    release();
+  }
+
+  /**
+   * @brief Return the packet to the pool. (handle becomes empty)
+   */
+  void PacketHandle::release() {
+    if (__packet == nullptr) return;
+    __freeMask |= 1u << (__packet - __packets);
+    __packet = nullptr;
+  }
+}
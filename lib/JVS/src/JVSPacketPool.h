@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include "JVSProtocol.h"
+
+#ifndef JVS_PACKET_POOL_SIZE
+// Packet buffers (request under construction, response being built; 1-32)
+#define JVS_PACKET_POOL_SIZE 2
+#endif
+
+namespace JVS {
+  class PacketHandle;
+
+  /**
+   * @brief Fixed pool of packet buffers, handed out as move-only `PacketHandle`.
+   * @note Request is parsed into one buffer while the response is built in another, buffers are never copied and only
+   * their header is reset when taken. Not interrupt safe, use from the main loop of core 0 only.
+   */
+  namespace PacketPool {
+    /**
+     * @brief Pool counters
+     */
+    struct Statistics {
+      // Buffers handed out
+      uint32_t acquired;
+      // Requests failed because every buffer was in use
+      uint32_t exhausted;
+      // Most buffers in use at once
+      uint8_t peakInUse;
+    };
+
+    /**
+     * @brief Take an empty packet from the pool.
+     * @param nodeNo Address
+     * @return Handle to the packet, empty if every buffer is in use
+     */
+    PacketHandle acquire(uint8_t nodeNo = 0x00);
+
+    /**
+     * @brief Get the count of buffers not in use.
+     */
+    uint8_t available();
+
+    const Statistics &getStatistics();
+    void resetStatistics();
+  }
+
+  /**
+   * @brief Owner of a pooled packet, the buffer returns to the pool when the handle is released or destroyed.
+   */
+  class PacketHandle {
+  public:
+    PacketHandle() = default;
+    PacketHandle(PacketHandle &&other);
+    PacketHandle &operator=(PacketHandle &&other);
+    PacketHandle(const PacketHandle &) = delete;
+    PacketHandle &operator=(const PacketHandle &) = delete;
+    ~PacketHandle();
+
+    Packet &operator*() const {
+      return *__packet;
+    }
+    Packet *operator->() const {
+      return __packet;
+    }
+    /**
+     * @brief Check if the handle owns a packet.
+     */
+    explicit operator bool() const {
+      return __packet != nullptr;
+    }
+
+    /**
+     * @brief Return the packet to the pool. (handle becomes empty)
+     */
+    void release();
+
+  private:
+    friend PacketHandle PacketPool::acquire(uint8_t nodeNo);
+    explicit PacketHandle(Packet *packet)
+      : __packet(packet) {}
+
+    Packet *__packet = nullptr;
+  };
+}
@@ -0,0 +1,91 @@
+#include <Trace.h>
+#include "JVSParser.h"
+
+namespace JVS {
+  /**
+   * @brief Set own node address. (`0`: not assigned, only broadcast is accepted)
+   * @param nodeNo Node address
+   */
+  void Parser::setNodeNo(uint8_t nodeNo) {
+    __nodeNo = nodeNo;
+  }
+
+  /**
+   * @brief Drop the packet under construction and wait for the next [SYNC].
+   */
+  void Parser::reset() {
+    __phase = Phase::WaitSync;
+    __escaped = false;
+  }
+
+  /**
+   * @brief Parse the bytes until a packet is completed.
+   * @param data Received bytes
+   * @param length Count of `data`
+   * @param packet Packet under construction (only header and received data are written)
+   * @param consumed Count of bytes used from `data`
+   * @return `Completed` or `ChecksumError` if the packet ends in `data`, otherwise `Incomplete`
+   */
+  Parser::Result Parser::parse(const uint8_t *data, size_t length, Packet &packet, size_t &consumed) {
+    for (size_t i = 0; i < length; i++) {
+      uint8_t b = data[i];
+      if (b == SpecialChar::Sync) {
+        // Start of packet
+        TRACE_POINT(Trace::Point::Sync, 0);
+        __phase = Phase::ReceivedSync;
+        __escaped = false;
+        continue;
+      }
+      // Wait until [SYNC] is received
+      if (__phase == Phase::WaitSync) continue;
+
+      // Escape & Unescape
+      if (b == SpecialChar::Escape) {
+        __escaped = true;
+        continue;
+      }
+      if (__escaped) {
+        b++;
+        __escaped = false;
+      }
+
+      switch (__phase) {
+        case Phase::ReceivedSync:  // b is [Node No.]
+          if (b != JVS_ADDRESS_BROADCAST && (__nodeNo == 0 || b != __nodeNo)) {
+            // Ignore packets not addressed to us
+            __phase = Phase::WaitSync;
+            break;
+          }
+          packet.nodeNo = b;
+          __sum = b;
+          __phase = Phase::ReceivedMyNodeNo;
+          break;
+        case Phase::ReceivedMyNodeNo:  // b is [Byte Count] ([Data] + [SUM])
+          if (b == 0) {
+            __phase = Phase::WaitSync;
+            break;
+          }
+          packet.length = b - 1;
+          __sum += b;
+          __dataCount = 0;
+          __phase = b == 1 ? Phase::ProcessedData : Phase::ProcessingData;
+          break;
+        case Phase::ProcessingData:  // b is [Data]
+          packet.data[__dataCount++] = b;
+          __sum += b;
+          if (__dataCount == packet.length) __phase = Phase::ProcessedData;
+          break;
+        case Phase::ProcessedData:  // b is [SUM]
+          packet.sum = b;
+          __phase = Phase::WaitSync;
+          consumed = i + 1;
+          return b == __sum ? Result::Completed : Result::ChecksumError;
+        default:
+          break;
+      }
+    }
+    // Reached end of span, continue on next span
+    consumed = length;
+    return Result::Incomplete;
+  }
+}
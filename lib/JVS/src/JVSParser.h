@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "JVSProtocol.h"
+
+namespace JVS {
+  /**
+   * @brief Incremental JVS request parser.
+   * @note Bytes are given as contiguous spans (e.g. from RX ring buffer), unescaped directly into `Packet`,
+   * and the checksum is accumulated while receiving. Does not depend on Arduino, so it runs on any host.
+   */
+  class Parser {
+  public:
+    /**
+     * @brief Result of `parse`
+     */
+    enum Result {
+      /**
+       * @brief Consumed all bytes, packet is not completed yet
+       */
+      Incomplete = 0,
+      /**
+       * @brief Packet is completed and checksum is correct
+       */
+      Completed = 1,
+      /**
+       * @brief Packet is completed but checksum is wrong
+       */
+      ChecksumError = 2,
+    };
+
+    /**
+     * @brief Set own node address. (`0`: not assigned, only broadcast is accepted)
+     * @param nodeNo Node address
+     */
+    void setNodeNo(uint8_t nodeNo);
+
+    /**
+     * @brief Drop the packet under construction and wait for the next [SYNC].
+     */
+    void reset();
+
+    /**
+     * @brief Parse the bytes until a packet is completed.
+     * @param data Received bytes
+     * @param length Count of `data`
+     * @param packet Packet under construction (only header and received data are written)
+     * @param consumed Count of bytes used from `data`
+     * @return `Completed` or `ChecksumError` if the packet ends in `data`, otherwise `Incomplete`
+     */
+    Result parse(const uint8_t *data, size_t length, Packet &packet, size_t &consumed);
+
+  private:
+    /**
+     * @brief Internal received status
+     */
+    enum Phase {
+      WaitSync = 0,
+      ReceivedSync = 1,
+      ReceivedMyNodeNo = 2,
+      ProcessingData = 3,
+      ProcessedData = 4,
+    };
+
+    uint8_t __nodeNo = 0;
+    Phase __phase = Phase::WaitSync;
+    // Received escape character or not
+    bool __escaped = false;
+    // Processed packet.data count
+    uint8_t __dataCount = 0;
+    // Running checksum ([Node No.] + [Byte Count] + [Data])
+    uint8_t __sum = 0;
+  };
+}
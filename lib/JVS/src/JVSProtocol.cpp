@@ -0,0 +1,67 @@
+#include <string.h>
+#include "JVSProtocol.h"
+
+namespace JVS {
+  Packet::Packet(uint8_t nodeNo) {
+    reset(nodeNo);
+  }
+
+  /**
+   * @brief Empty the packet for reuse. (only the header is written, `data` past `length` is never read)
+   * @param nodeNo Address
+   */
+  void Packet::reset(uint8_t nodeNo) {
+    this->nodeNo = nodeNo;
+    this->length = 0;
+    this->sum = nodeNo + 1;  // [Byte Count] is 1 (only [SUM])
+    this->isOverflowed = false;
+  }
+
+  /**
+   * @brief Add a byte to the packet data (and update `length` and `sum`)
+   * @param data Byte to add
+   * @return `false` if the packet is full (nothing is added, `isOverflowed` is set)
+   */
+  bool Packet::add(uint8_t data) {
+    if (this->length >= JVS_MAX_DATA_SIZE) {
+      this->isOverflowed = true;
+      return false;
+    }
+    this->data[this->length] = data;
+    this->length++;
+    this->sum += data + 1;  // data and [Byte Count]
+    return true;
+  }
+
+  /**
+   * @brief Add multiple bytes to the packet data (and update `length` and `sum`)
+   * @param data Byte array to add
+   * @param length Length of the byte array
+   * @return `false` if the bytes do not fit (nothing is added, `isOverflowed` is set)
+   */
+  bool Packet::add(const uint8_t *data, uint8_t length) {
+    if (length > JVS_MAX_DATA_SIZE - this->length) {
+      this->isOverflowed = true;
+      return false;
+    }
+    memcpy(this->data + this->length, data, length);
+    this->length += length;
+    this->sum += length;  // [Byte Count] grows by `length`
+    for (int i = 0; i < length; i++) {
+      this->sum += data[i];
+    }
+    return true;
+  }
+
+  /**
+   * @brief Validate the packet by checking the checksum
+   * @return `true` if the checksum is correct
+   */
+  bool Packet::validate() {
+    uint8_t sum = this->nodeNo + this->length + 1;
+    for (int i = 0; i < this->length; i++) {
+      sum += this->data[i];
+    }
+    return (sum == this->sum);
+  }
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <stdint.h>
+
+// Maximum data size (255 - sum)
+#define JVS_MAX_DATA_SIZE 254
+#define JVS_ADDRESS_BROADCAST 0xff
+
+namespace JVS {
+  /**
+   * @brief JVS Packet
+   */
+  struct Packet {
+    /**
+     * @brief Address (`0xff`: Broadcast)
+     */
+    uint8_t nodeNo;
+    /**
+     * @brief Data length (`data` only, [Byte Count] on the wire is `length + 1` including `sum`)
+     */
+    uint8_t length = 0;
+    /**
+     * @brief Data (in Acknowledge packet, first byte is status)
+     * @note Data is "Raw" and not escaped
+     */
+    uint8_t data[JVS_MAX_DATA_SIZE];
+    /**
+     * @brief Checksum (SUM of [Node No.] + [Byte Count] + [data])
+     */
+    uint8_t sum;
+    /**
+     * @brief `add` refused bytes past `JVS_MAX_DATA_SIZE` since `reset` (the reports do not fit)
+     */
+    bool isOverflowed;
+
+    Packet(uint8_t nodeNo = 0x00);
+    // 258 bytes, packets are built in place (see `PacketPool`) and never copied
+    Packet(const Packet &) = delete;
+    Packet &operator=(const Packet &) = delete;
+
+    /**
+     * @brief Empty the packet for reuse. (only the header is written, `data` past `length` is never read)
+     * @param nodeNo Address
+     */
+    void reset(uint8_t nodeNo = 0x00);
+
+    /**
+     * @brief Add a byte to the packet data (and update `length` and `sum`)
+     * @param data Byte to add
+     * @return `false` if the packet is full (nothing is added, `isOverflowed` is set)
+     */
+    bool add(uint8_t data);
+
+    /**
+     * @brief Add multiple bytes to the packet data (and update `length` and `sum`)
+     * @param data Byte array to add
+     * @param length Length of the byte array
+     * @return `false` if the bytes do not fit (nothing is added, `isOverflowed` is set)
+     */
+    bool add(const uint8_t *data, uint8_t length);
+
+    /**
+     * @brief Validate the packet by checking the checksum
+     * @return `true` if the checksum is correct
+     */
+    bool validate();
+  };
+
+  /**
+   * @brief Special characters on JVS packet
+   */
+  enum SpecialChar {
+    /**
+     * @brief SYNC code (Start of packet)
+     */
+    Sync = 0xe0,
+    /**
+     * @brief Marker code (Escape next byte, next byte is - 1)
+     */
+    Escape = 0xd0,
+  };
+
+  /**
+   * @brief Communication methods (line speed) of `Command.CommMethodChange`
+   */
+  enum CommMethod {
+    /**
+     * @brief 115200 bps (after power on and `Command.Reset`)
+     */
+    Baud115200 = 0x00,
+    /**
+     * @brief 1 Mbps
+     */
+    Baud1M = 0x01,
+    /**
+     * @brief 3 Mbps
+     */
+    Baud3M = 0x02,
+  };
+
+  /**
+   * @brief JVS Commands
+   */
+  enum Command {
+    /**
+     * @brief Reset all JVS devices. {`0xf0`, `0xd9`}
+     * @return None
+     */
+    Reset = 0xf0,
+    /**
+     * @brief Set the JVS node address. {`0xf1`, <Node No.>}
+     * @return `AckReport.OK`
+     */
+    SetAddress = 0xf1,
+    /**
+     * @brief Switch every node to another communication method. (broadcast, switched after this packet) {`0xf2`, <`CommMethod`>}
+     * @return None
+     */
+    CommMethodChange = 0xf2,
+    /**
+     * @brief Get the supported communication methods. {`0xd2`}
+     * @return {`AckReport.OK`, <Supported methods (bit N: `CommMethod` N)>}
+     */
+    CommSupported = 0xd2,
+    /**
+     * @brief Get the JVS device I/O ID. {`0x10`}
+     * @return {`AckReport.OK`, <I/O ID strings (Ascii)>, `0x00`}
+     */
+    IOId = 0x10,
+    /**
+     * @brief Get the JVS device's command format version. {`0x11`}
+     * @return {`AckReport.OK`, <Revision code (1 byte, BCD, lower 4 bits are decimal point)>}
+     */
+    CommandRev = 0x11,
+    /**
+     * @brief Get the JVS revision version. {`0x12`}
+     * @return {`AckReport.OK`, <Revision code (1 byte, BCD, lower 4 bits are decimal point)>}
+     */
+    JvRev = 0x12,
+    /**
+     * @brief Get the JVS protocol version. {`0x13`}
+     * @return {`AckReport.OK`, <Version code (1 byte, BCD, lower 4 bits are decimal point)>}
+     */
+    ProtocolVer = 0x13,
+    /**
+     * @brief Get the I/O function. {`0x14`}
+     * @return {`AckReport.OK`, <Function codes (4 bytes each, Code + Parameter 3 bytes)>, `0x00`}
+     */
+    FunctionCheck = 0x14,
+    /**
+     * @brief Resend previous packet. {`0x2f`}
+     * @return Previous packet
+     */
+    Retry = 0x2f,
+
+    /**
+     * @brief Control RAM buffer. (see `K573BufferRead`, `K573BufferWrite`, and `K573BufferSetAddress`)
+     */
+    K573Buffer = 0x70,
+    /**
+     * @brief Read data from RAM. {`0x70`, `0x00`, <Address (3 bytes)>, <Length>}
+     * @return {`AckReport.OK`, <Data>}
+     */
+    K573BufferRead = 0x00,
+    /**
+     * @brief Write data to RAM. {`0x70`, `0x01`, <Address (3 bytes)>, <Length>, <Data>}
+     * @return {`AckReport.OK`}
+     */
+    K573BufferWrite = 0x01,
+    /**
+     * @brief Set execution address. (use later on `K573Execute`) {`0x70`, `0x02`, <Address (3 bytes)>}
+     * @return {`AckReport.OK`}
+     */
+    K573BufferSetAddress = 0x02,
+    /**
+     * @brief Get memory card status. {`0x71`}
+     * @return {`AckReport.OK`, <Port:1 `MemoryCardStatus` (2 bytes)>, <Port:2 `MemoryCardStatus` (2 bytes)>}
+     * @note Multitap sub-ports B-D are read by `K573MultitapStatus`.
+     */
+    K573Status = 0x71,
+    /**
+     * @brief Control security plate. (see `K573SecurityPlateInsertCheck`, `K573SecurityPlateSetPassword`, `K573SecurityPlateGetData`, and `K573SecurityPlateConfigRegister`)
+     */
+    K573SecurityPlate = 0x72,
+    /**
+     * @brief Check if security plate is inserted? {`0x72`, <`0x00` xor Slot>}
+     * @return {`AckReport.OK`}
+     */
+    K573SecurityPlateInsertCheck = 0x00,
+    /**
+     * @brief Set password to unlock security dongle? {`0x72`, <`0x10` xor Slot>, <Password (8 bytes)>}
+     * @return {`AckReport.OK`}
+     */
+    K573SecurityPlateSetPassword = 0x10,
+    /**
+     * @brief Get dongle data and store in RAM. {`0x72`, <`0x20` xor Slot>, <Unknown (2 bytes)>, <RAM Address (3 bytes)>, <Unknown (2 bytes)>}
+     * @return {`AckReport.OK`}
+     */
+    K573SecurityPlateGetData = 0x20,
+    /**
+     * @brief Get some kind of registration info from dongle? {`0x72`, <`0x40` xor Slot>, <RAM Address (3 bytes)>}
+     * @return {`AckReport.OK`}
+     */
+    K573SecurityPlateConfigRegister = 0x40,
+    /**
+     * @brief Execute from previously set (`K573BufferSetAddress`) address. {`0x73`}
+     * @return {`AckReport.OK`}
+     */
+    K573Execute = 0x73,
+    /**
+     * @brief Control PS1 Memory card. (see `K573MemoryCardRead`, and `K573MemoryCardWrite`)
+     */
+    K573MemoryCard = 0x76,
+    /**
+     * @brief Read from memory card and store in RAM. {`0x76`, `0x74`, <Port xor Address (2 bytes)>, <RAM Address (3 bytes)>, <Flame Count (2 bytes)>}
+     * @return {`AckReport.OK`, `0x01`}
+     * @note Bits 13-14 of <Port xor Address> select the multitap sub-port (`0`: A), see `K573_MEMCARD_SUBPORT_MASK`.
+     */
+    K573MemoryCardRead = 0x74,
+    /**
+     * @brief Write to memory card from RAM. {`0x76`, `0x75`, <RAM Address (3 bytes)>, <Port xor Address (2 bytes)>, <Flame Count (2 bytes)>}
+     * @return {`AckReport.OK`, `0x01`}
+     */
+    K573MemoryCardWrite = 0x75,
+    /**
+     * @brief Read input from PS1 digital controller. {`0x77`}
+     * @return {`AckReport.OK`, <Port:1 Inputs (2 bytes)>, <Port:2 Inputs (2 bytes)>}
+     * @note Multitap sub-ports B-D are read by `K573MultitapController`.
+     */
+    K573Controller = 0x77,
+    /**
+     * @brief Read PS1 multitap sub-ports B-D. (see `K573MultitapStatus`, and `K573MultitapController`)
+     * @note Local extension, not part of the Konami protocol: a stock System 573 never sends it, and it is only
+     * handled when built with `PSX_MULTITAP_SLOTS` (`CommandUnknown` otherwise).
+     * Sub-port A is the port itself, read by `K573Status` and `K573Controller`.
+     */
+    K573Multitap = 0x78,
+    /**
+     * @brief Get memory card status of multitap sub-ports. {`0x78`, `0x71`}
+     * @return {`AckReport.OK`, <Port:1 B `MemoryCardStatus` (2 bytes)>, <Port:2 B `MemoryCardStatus` (2 bytes)>, ..., <Port:2 D `MemoryCardStatus` (2 bytes)>}
+     * @note Sub-ports of a port without multitap (`PSX_MULTITAP_SLOTS`) are `Unavailable`.
+     */
+    K573MultitapStatus = 0x71,
+    /**
+     * @brief Read input from PS1 digital controllers on multitap sub-ports. {`0x78`, `0x77`}
+     * @return {`AckReport.OK`, <Port:1 B Inputs (2 bytes)>, <Port:2 B Inputs (2 bytes)>, ..., <Port:2 D Inputs (2 bytes)>}
+     * @note Sub-ports of a port without multitap (`PSX_MULTITAP_SLOTS`) are `0x0000`.
+     */
+    K573MultitapController = 0x77,
+  };
+
+  /**
+   * @brief Acknowledge status (in `data[0]`)
+   */
+  enum AckStatus {
+    StatusOK = 0x01,
+    CommandUnknown = 0x02,
+    SumError = 0x03,
+    Overflow = 0x04,
+  };
+
+  /**
+   * @brief Acknowledge report for each command
+   */
+  enum AckReport {
+    OK = 0x01,
+    ParamErrorNoResult = 0x02,
+    ParamErrorIgnored = 0x03,
+    Busy = 0x04,
+  };
+}
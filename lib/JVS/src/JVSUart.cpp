@@ -0,0 +1,205 @@
+#ifdef ARDUINO_ARCH_RP2040
+#include <Arduino.h>
+#include <hardware/dma.h>
+#include <hardware/gpio.h>
+#include <hardware/uart.h>
+#include <pico/time.h>
+#include "JVS.h"
+#include "JVSUart.h"
+
+// UART instance connected to the pin (UART0: GPIO 0-3, 12-15, 16-19, 28-29 / UART1: GPIO 4-11, 20-27)
+#define JVS_UART_OF(pin) ((((pin) + 4) >> 3) & 1 ? uart1 : uart0)
+
+namespace JVS {
+  namespace Uart {
+    // private variables & functions
+    namespace {
+      // Written by DMA, must be aligned to its size for ring addressing
+      uint8_t __ring[JVS_RX_RING_SIZE] __attribute__((aligned(JVS_RX_RING_SIZE)));
+      uart_inst_t *__uart;
+      uint32_t __baudRate = 0;
+      int __channel = -1;
+      int __txChannel = -1;
+
+      volatile bool __isWriting = false;
+      // Time the last stop bit should be shifted out
+      uint32_t __expectedEnd = 0;
+      SentCallback __onSent = nullptr;
+
+      // Total bytes received before the current DMA transfer is started
+      uint32_t __armedTotal = 0;
+      // Total bytes consumed
+      uint32_t __readTotal = 0;
+      bool __hasOverrun = false;
+
+      /**
+       * @brief Start RX DMA transfer (ring addressing on write, never ends in practice).
+       */
+      void __arm() {
+        dma_channel_config config = dma_channel_get_default_config(__channel);
+        channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+        channel_config_set_read_increment(&config, false);
+        channel_config_set_write_increment(&config, true);
+        channel_config_set_ring(&config, true, JVS_RX_RING_BITS);
+        channel_config_set_dreq(&config, uart_get_dreq(__uart, false));
+        dma_channel_configure(__channel, &config, &__ring[__armedTotal & (JVS_RX_RING_SIZE - 1)], &uart_get_hw(__uart)->dr, 0xffffffff, true);
+      }
+
+      /**
+       * @brief Get total bytes received.
+       */
+      uint32_t __receivedTotal() {
+        uint32_t remaining = dma_channel_hw_addr(__channel)->transfer_count;
+        uint32_t received = __armedTotal + (0xffffffff - remaining);
+        // Restart before the counter runs out (about 4 days at 115200 bps)
+        if (remaining < 0x80000000) {
+          dma_channel_abort(__channel);
+          received = __armedTotal + (0xffffffff - dma_channel_hw_addr(__channel)->transfer_count);
+          __armedTotal = received;
+          __arm();
+        }
+        return received;
+      }
+
+      bool __isShifting() {
+        return dma_channel_is_busy(__txChannel) || (uart_get_hw(__uart)->fr & UART_UARTFR_BUSY_BITS);
+      }
+
+      /**
+       * @brief Release the line once UART is idle. (UART has no "transmit complete" interrupt)
+       */
+      int64_t __onAlarm(alarm_id_t, void *) {
+        if (__isShifting()) return -JVS_TX_POLL_US;
+        int32_t late = (int32_t)(time_us_32() - __expectedEnd);
+        __isWriting = false;
+        if (__onSent != nullptr) __onSent(late > 0 ? late : 0);
+        return 0;
+      }
+    }
+
+    /**
+     * @brief Setup UART and start RX DMA.
+     * @param baudRate Baud rate
+     */
+    void begin(uint32_t baudRate) {
+      __uart = JVS_UART_OF(JVS_DATA_PLUS_PIN);
+      __baudRate = uart_init(__uart, baudRate);
+      uart_set_format(__uart, 8, 1, UART_PARITY_NONE);
+      uart_set_fifo_enabled(__uart, true);
+      gpio_set_function(JVS_TX_PIN, GPIO_FUNC_UART);
+      gpio_set_function(JVS_DATA_PLUS_PIN, GPIO_FUNC_UART);
+
+      if (__channel < 0) __channel = dma_claim_unused_channel(true);
+      if (__txChannel < 0) __txChannel = dma_claim_unused_channel(true);
+      __armedTotal = 0;
+      __readTotal = 0;
+      __hasOverrun = false;
+      __arm();
+    }
+
+    /**
+     * @brief Change the baud rate without stopping RX DMA. (waits until the current TX is shifted out)
+     * @param baudRate Baud rate
+     * @return Actual baud rate
+     */
+    uint32_t setBaudRate(uint32_t baudRate) {
+      flush();
+      __baudRate = uart_set_baudrate(__uart, baudRate);
+      // Error flags of the bytes received at the old speed
+      uart_get_hw(__uart)->rsr = UART_UARTRSR_BITS;
+      return __baudRate;
+    }
+
+    /**
+     * @brief Check if framing errors or breaks were received since the last call (line speed mismatch).
+     */
+    bool checkLineError() {
+      // DMA reads only the data bits of DR, errors stay latched in RSR until cleared
+      bool hasError = uart_get_hw(__uart)->rsr & (UART_UARTRSR_FE_BITS | UART_UARTRSR_BE_BITS);
+      if (hasError) uart_get_hw(__uart)->rsr = UART_UARTRSR_BITS;
+      return hasError;
+    }
+
+    /**
+     * @brief Get the received bytes as a contiguous span (not consumed).
+     * @param data Pointer to the first received byte
+     * @return Count of contiguous bytes (`0`: nothing received)
+     * @note Bytes wrapped around the end of the ring are returned by the next call after `consume`.
+     */
+    size_t peek(const uint8_t *&data) {
+      uint32_t received = __receivedTotal();
+      uint32_t available = received - __readTotal;
+      if (available > JVS_RX_RING_SIZE) {
+        // DMA has overwritten unread bytes, skip to the oldest byte still in the ring
+        __readTotal = received - JVS_RX_RING_SIZE;
+        available = JVS_RX_RING_SIZE;
+        __hasOverrun = true;
+      }
+      uint32_t offset = __readTotal & (JVS_RX_RING_SIZE - 1);
+      uint32_t contiguous = JVS_RX_RING_SIZE - offset;
+      data = &__ring[offset];
+      return available < contiguous ? available : contiguous;
+    }
+
+    /**
+     * @brief Mark the bytes as read.
+     * @param length Count of bytes returned by `peek`
+     */
+    void consume(size_t length) {
+      __readTotal += length;
+    }
+
+    /**
+     * @brief Check if RX ring has overflowed since the last call (received bytes were lost).
+     */
+    bool checkOverrun() {
+      bool hasOverrun = __hasOverrun;
+      __hasOverrun = false;
+      return hasOverrun;
+    }
+
+    /**
+     * @brief Start sending bytes by DMA (returns immediately).
+     * @param data Bytes to send (must be kept until `onSent` is called)
+     * @param length Count of `data`
+     * @param onSent Called from interrupt when all bytes are sent
+     * @note Waits for the previous transfer if it is still running.
+     */
+    void startWrite(const uint8_t *data, size_t length, SentCallback onSent) {
+      flush();
+      __onSent = onSent;
+      __isWriting = true;
+
+      dma_channel_config config = dma_channel_get_default_config(__txChannel);
+      channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+      channel_config_set_read_increment(&config, true);
+      channel_config_set_write_increment(&config, false);
+      channel_config_set_dreq(&config, uart_get_dreq(__uart, true));
+      // 10 bits per byte (start + 8 data + stop)
+      uint32_t duration = (uint32_t)((uint64_t)length * 10 * 1000000 / __baudRate);
+      __expectedEnd = time_us_32() + duration;
+      dma_channel_configure(__txChannel, &config, &uart_get_hw(__uart)->dr, data, length, true);
+
+      if (add_alarm_in_us(duration, __onAlarm, nullptr, true) < 0) {
+        // No alarm slot left, wait here instead
+        while (__isShifting()) tight_loop_contents();
+        __onAlarm(0, nullptr);
+      }
+    }
+
+    /**
+     * @brief Check if the bytes given to `startWrite` are still being sent.
+     */
+    bool isWriting() {
+      return __isWriting;
+    }
+
+    /**
+     * @brief Wait until all bytes are shifted out.
+     */
+    void flush() {
+      while (__isWriting) tight_loop_contents();
+    }
+  }
+}
+#endif
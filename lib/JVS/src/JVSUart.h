@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef JVS_RX_RING_BITS
+// RX ring buffer size in bits (10: 1024 bytes)
+#define JVS_RX_RING_BITS 10
+#endif
+#define JVS_RX_RING_SIZE (1 << JVS_RX_RING_BITS)
+#ifndef JVS_TX_POLL_US
+// Interval to check the UART is idle after the expected end of transmission
+#define JVS_TX_POLL_US 4
+#endif
+
+namespace JVS {
+  /**
+   * @brief RP2040 UART for JVS, RX is streamed into a ring buffer and TX is sent in one burst by DMA.
+   * @note UART instance is chosen from `JVS_DATA_PLUS_PIN` (RX).
+   * On the host, the line is in memory: RX is fed by `hostReceive` and TX goes to the sink of `hostSetSink`.
+   */
+  namespace Uart {
+    /**
+     * @brief Setup UART and start RX DMA.
+     * @param baudRate Baud rate
+     */
+    void begin(uint32_t baudRate);
+
+    /**
+     * @brief Change the baud rate without stopping RX DMA. (waits until the current TX is shifted out)
+     * @param baudRate Baud rate
+     * @return Actual baud rate
+     */
+    uint32_t setBaudRate(uint32_t baudRate);
+
+    /**
+     * @brief Check if framing errors or breaks were received since the last call (line speed mismatch).
+     */
+    bool checkLineError();
+
+    /**
+     * @brief Get the received bytes as a contiguous span (not consumed).
+     * @param data Pointer to the first received byte
+     * @return Count of contiguous bytes (`0`: nothing received)
+     * @note Bytes wrapped around the end of the ring are returned by the next call after `consume`.
+     */
+    size_t peek(const uint8_t *&data);
+
+    /**
+     * @brief Mark the bytes as read.
+     * @param length Count of bytes returned by `peek`
+     */
+    void consume(size_t length);
+
+    /**
+     * @brief Check if RX ring has overflowed since the last call (received bytes were lost).
+     */
+    bool checkOverrun();
+
+    /**
+     * @brief Called from interrupt when the last stop bit is shifted out.
+     * @param lateUs Delay from the end of the last stop bit to this call (in microseconds)
+     */
+    typedef void (*SentCallback)(uint32_t lateUs);
+
+    /**
+     * @brief Start sending bytes by DMA (returns immediately).
+     * @param data Bytes to send (must be kept until `onSent` is called)
+     * @param length Count of `data`
+     * @param onSent Called from interrupt when all bytes are sent
+     * @note Waits for the previous transfer if it is still running.
+     */
+    void startWrite(const uint8_t *data, size_t length, SentCallback onSent);
+
+    /**
+     * @brief Check if the bytes given to `startWrite` are still being sent.
+     */
+    bool isWriting();
+
+    /**
+     * @brief Wait until all bytes are shifted out.
+     */
+    void flush();
+
+#ifndef ARDUINO
+    /**
+     * @brief Receives the bytes given to `startWrite` on the host.
+     * @param data Bytes on the wire
+     * @param length Count of `data`
+     * @param context User context passed to `hostSetSink`
+     */
+    typedef void (*HostSink)(const uint8_t *data, size_t length, void *context);
+
+    /**
+     * @brief Put bytes into RX ring as if they were received on the line. (host only)
+     * @param data Received bytes
+     * @param length Count of `data`
+     */
+    void hostReceive(const uint8_t *data, size_t length);
+
+    /**
+     * @brief Set where sent bytes go. (host only)
+     * @param sink Sink, `nullptr` to drop sent bytes
+     * @param context User context passed to `sink`
+     */
+    void hostSetSink(HostSink sink, void *context);
+
+    /**
+     * @brief Release the line once the bytes would have been shifted out at the baud rate. (host only)
+     */
+    void hostPoll();
+#endif
+  }
+}
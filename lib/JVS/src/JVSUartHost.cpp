@@ -0,0 +1,162 @@
+#ifndef ARDUINO
+#include <chrono>
+#include "JVS.h"
+#include "JVSUart.h"
+
+namespace JVS {
+  namespace Uart {
+    // private variables & functions
+    namespace {
+      uint8_t __ring[JVS_RX_RING_SIZE];
+      uint32_t __baudRate = JVS_BAUD_RATE;
+
+      bool __isWriting = false;
+      // Time the last stop bit would be shifted out
+      uint32_t __expectedEnd = 0;
+      SentCallback __onSent = nullptr;
+      HostSink __sink = nullptr;
+      void *__sinkContext = nullptr;
+
+      // Total bytes received
+      uint32_t __receivedTotal = 0;
+      // Total bytes consumed
+      uint32_t __readTotal = 0;
+      bool __hasOverrun = false;
+
+      uint32_t __now() {
+        auto elapsed = std::chrono::steady_clock::now().time_since_epoch();
+        return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+      }
+    }
+
+    /**
+     * @brief Setup UART and start RX DMA.
+     * @param baudRate Baud rate
+     */
+    void begin(uint32_t baudRate) {
+      __baudRate = baudRate;
+      __receivedTotal = 0;
+      __readTotal = 0;
+      __hasOverrun = false;
+    }
+
+    /**
+     * @brief Change the baud rate without stopping RX DMA. (waits until the current TX is shifted out)
+     * @param baudRate Baud rate
+     * @return Actual baud rate
+     */
+    uint32_t setBaudRate(uint32_t baudRate) {
+      flush();
+      __baudRate = baudRate;
+      return __baudRate;
+    }
+
+    /**
+     * @brief Check if framing errors or breaks were received since the last call (line speed mismatch).
+     */
+    bool checkLineError() {
+      // Bytes in memory are never garbled
+      return false;
+    }
+
+    /**
+     * @brief Get the received bytes as a contiguous span (not consumed).
+     * @param data Pointer to the first received byte
+     * @return Count of contiguous bytes (`0`: nothing received)
+     * @note Bytes wrapped around the end of the ring are returned by the next call after `consume`.
+     */
+    size_t peek(const uint8_t *&data) {
+      uint32_t available = __receivedTotal - __readTotal;
+      if (available > JVS_RX_RING_SIZE) {
+        __readTotal = __receivedTotal - JVS_RX_RING_SIZE;
+        available = JVS_RX_RING_SIZE;
+        __hasOverrun = true;
+      }
+      uint32_t offset = __readTotal & (JVS_RX_RING_SIZE - 1);
+      uint32_t contiguous = JVS_RX_RING_SIZE - offset;
+      data = &__ring[offset];
+      return available < contiguous ? available : contiguous;
+    }
+
+    /**
+     * @brief Mark the bytes as read.
+     * @param length Count of bytes returned by `peek`
+     */
+    void consume(size_t length) {
+      __readTotal += length;
+    }
+
+    /**
+     * @brief Check if RX ring has overflowed since the last call (received bytes were lost).
+     */
+    bool checkOverrun() {
+      bool hasOverrun = __hasOverrun;
+      __hasOverrun = false;
+      return hasOverrun;
+    }
+
+    /**
+     * @brief Start sending bytes by DMA (returns immediately).
+     * @param data Bytes to send (must be kept until `onSent` is called)
+     * @param length Count of `data`
+     * @param onSent Called from interrupt when all bytes are sent
+     * @note Waits for the previous transfer if it is still running.
+     */
+    void startWrite(const uint8_t *data, size_t length, SentCallback onSent) {
+      flush();
+      __onSent = onSent;
+      __isWriting = true;
+      // 10 bits per byte (start + 8 data + stop)
+      __expectedEnd = __now() + (uint32_t)((uint64_t)length * 10 * 1000000 / __baudRate);
+      if (__sink != nullptr) __sink(data, length, __sinkContext);
+    }
+
+    /**
+     * @brief Check if the bytes given to `startWrite` are still being sent.
+     */
+    bool isWriting() {
+      hostPoll();
+      return __isWriting;
+    }
+
+    /**
+     * @brief Wait until all bytes are shifted out.
+     */
+    void flush() {
+      while (__isWriting) hostPoll();
+    }
+
+    /**
+     * @brief Put bytes into RX ring as if they were received on the line. (host only)
+     * @param data Received bytes
+     * @param length Count of `data`
+     */
+    void hostReceive(const uint8_t *data, size_t length) {
+      for (size_t i = 0; i < length; i++) {
+        __ring[__receivedTotal++ & (JVS_RX_RING_SIZE - 1)] = data[i];
+      }
+    }
+
+    /**
+     * @brief Set where sent bytes go. (host only)
+     * @param sink Sink, `nullptr` to drop sent bytes
+     * @param context User context passed to `sink`
+     */
+    void hostSetSink(HostSink sink, void *context) {
+      __sink = sink;
+      __sinkContext = context;
+    }
+
+    /**
+     * @brief Release the line once the bytes would have been shifted out at the baud rate. (host only)
+     */
+    void hostPoll() {
+      if (!__isWriting) return;
+      int32_t late = (int32_t)(__now() - __expectedEnd);
+      if (late < 0) return;
+      __isWriting = false;
+      if (__onSent != nullptr) __onSent(late);
+    }
+  }
+}
+#endif
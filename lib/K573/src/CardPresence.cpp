@@ -0,0 +1,157 @@
+#include <Arduino.h>
+#include <PSXWorker.h>
+#include "MemoryCardEngine.h"
+#include "CardPresence.h"
+
+namespace CardPresence {
+  // private variables & functions
+  namespace {
+    uint16_t __status[K573_SLOT_COUNTS] = { MemoryCardStatus::Uninitialized, MemoryCardStatus::Uninitialized };
+    uint32_t __lastProbeTime[K573_SLOT_COUNTS];
+    bool __isRequested[K573_SLOT_COUNTS];
+    bool __isWaiting = false;
+    // Last probe found the new card FLAG set
+    bool __isFlagged[K573_SLOT_COUNTS];
+    // New card FLAG to clear
+    bool __isNew[K573_SLOT_COUNTS];
+    // Write test frame was read, it is written back next
+    bool __hasTestFrame[K573_SLOT_COUNTS];
+    // Write test frame being cleared (one slot at a time)
+    uint8_t __testFrame[PSX_MEMCARD_FRAME_SIZE];
+
+    /**
+     * @brief Update the presence, and drop cached data of the slot if the card has changed.
+     * @param slot Slot number
+     * @param status `Available` or `Unavailable`
+     */
+    void __setStatus(int slot, uint16_t status) {
+      if (__status[slot] == status) return;
+      // Nothing has been cached before the first probe
+      if (__status[slot] != MemoryCardStatus::Uninitialized) MemoryCardEngine::onCardRemoved(slot);
+      __status[slot] = status;
+    }
+
+    /**
+     * @brief Queue the next job clearing the new card FLAG of a slot.
+     * @return `true` if a job was queued
+     */
+    bool __trySubmitClearing() {
+      for (int slot = 0; slot < K573_SLOT_COUNTS; slot++) {
+        if (!__isNew[slot]) continue;
+        PSXWorker::Job job;
+        job.type = __hasTestFrame[slot] ? PSXWorker::JobType::WriteMemoryCard : PSXWorker::JobType::ReadMemoryCard;
+        job.slot = slot;
+        job.address = PSX_MEMCARD_WRITE_TEST_FRAME;
+        job.buffer = __testFrame;
+        job.owner = K573::JobOwner::Presence;
+        job.tag = 0;
+        if (!PSXWorker::trySubmit(job)) return false;
+        __isWaiting = true;
+        return true;
+      }
+      return false;
+    }
+
+    /**
+     * @brief Handle finished job clearing the new card FLAG.
+     * @param completion Read or write of the write test frame
+     */
+    void __onCleared(const PSXWorker::Completion &completion) {
+      int slot = completion.job.slot;
+      if (completion.result == PSX::FrameResult::Success && completion.job.type == PSXWorker::JobType::ReadMemoryCard) {
+        __hasTestFrame[slot] = true;
+        return;
+      }
+      // Written, or failed: a FLAG still set is found again by the next probe
+      __isNew[slot] = false;
+      __hasTestFrame[slot] = false;
+      onResult(slot, completion.result);
+    }
+  }
+
+  /**
+   * @brief Queue a probe if a slot is due. (call from main loop)
+   */
+  void service() {
+    if (__isWaiting || __trySubmitClearing()) return;
+
+    uint32_t now = micros();
+    for (int slot = 0; slot < K573_SLOT_COUNTS; slot++) {
+      // Sub-port of a port without multitap
+      if (!PSX::hasSlot(slot)) continue;
+      bool isDue = __isRequested[slot] || __status[slot] == MemoryCardStatus::Uninitialized
+                   || now - __lastProbeTime[slot] >= K573_PRESENCE_PROBE_US;
+      if (!isDue) continue;
+
+      PSXWorker::Job job;
+      job.type = PSXWorker::JobType::ProbeMemoryCard;
+      job.slot = slot;
+      job.address = 0;
+      job.buffer = nullptr;
+      job.owner = K573::JobOwner::Presence;
+      job.tag = 0;
+      if (!PSXWorker::trySubmit(job)) return;
+
+      __isWaiting = true;
+      __isRequested[slot] = false;
+      __lastProbeTime[slot] = now;
+      return;
+    }
+  }
+
+  /**
+   * @brief Handle finished probe job.
+   * @param completion Job returned from PSX core
+   */
+  void onComplete(const PSXWorker::Completion &completion) {
+    __isWaiting = false;
+    if (completion.job.type != PSXWorker::JobType::ProbeMemoryCard) {
+      __onCleared(completion);
+      return;
+    }
+    // Timeout: something is there but not answering, keep the last state until the next probe
+    if (completion.result == PSX::FrameResult::Timeout) return;
+    int slot = completion.job.slot;
+    bool wasAvailable = __status[slot] == MemoryCardStatus::Available;
+    bool wasFlagged = __isFlagged[slot];
+    onResult(slot, completion.result);
+    __isFlagged[slot] = completion.result == PSX::FrameResult::Success && completion.isNewCard;
+    if (!__isFlagged[slot]) return;
+
+    // Card was swapped between two probes (presence did not change, the data did), a FLAG that could not be
+    // cleared is not taken as another swap
+    if (wasAvailable && !wasFlagged) MemoryCardEngine::onCardRemoved(slot);
+    __isNew[slot] = true;
+  }
+
+  /**
+   * @brief Notify the result of a memory card transaction.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param result Result of the transaction
+   * @note `NoDevice` marks the card removed at once, other errors probe the slot as soon as possible.
+   */
+  void onResult(int slot, PSX::FrameResult result) {
+    if (slot < 0 || slot >= K573_SLOT_COUNTS) return;
+    switch (result) {
+      case PSX::FrameResult::Success:
+        __setStatus(slot, MemoryCardStatus::Available);
+        break;
+      case PSX::FrameResult::NoDevice:
+        __setStatus(slot, MemoryCardStatus::Unavailable);
+        break;
+      default:
+        __isRequested[slot] = true;
+        break;
+    }
+  }
+
+  /**
+   * @brief Get the presence status of the slot.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @return `Available`, `Unavailable`, or `Uninitialized` until the first probe
+   */
+  uint16_t getStatus(int slot) {
+    if (!PSX::hasSlot(slot)) return MemoryCardStatus::Unavailable;
+    return __status[slot];
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <PSXJob.h>
+#include "K573.h"
+
+#ifndef K573_PRESENCE_PROBE_US
+// Interval of background presence probe of each slot (microseconds)
+#define K573_PRESENCE_PROBE_US 250000
+#endif
+
+/**
+ * @brief Tracks memory card insertion and removal in the background.
+ * @note Each slot is probed every `K573_PRESENCE_PROBE_US` with a short frame, and right after a failed transaction.
+ * Results of other memory card jobs are also taken as presence evidence.
+ * When a card is removed or inserted, everything cached for the slot is dropped,
+ * so `K573Status` is answered from memory without touching the bus.
+ * A card swapped between two probes is caught by its new card FLAG, which is then cleared by writing the
+ * write test frame back with its own data.
+ */
+namespace CardPresence {
+  /**
+   * @brief Queue a probe if a slot is due. (call from main loop)
+   */
+  void service();
+
+  /**
+   * @brief Handle finished probe job.
+   * @param completion Job returned from PSX core
+   */
+  void onComplete(const PSXWorker::Completion &completion);
+
+  /**
+   * @brief Notify the result of a memory card transaction.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param result Result of the transaction
+   * @note `NoDevice` marks the card removed at once, other errors probe the slot as soon as possible.
+   */
+  void onResult(int slot, PSX::FrameResult result);
+
+  /**
+   * @brief Get the presence status of the slot.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @return `Available`, `Unavailable`, or `Uninitialized` until the first probe
+   */
+  uint16_t getStatus(int slot);
+}
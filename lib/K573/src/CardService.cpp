@@ -0,0 +1,433 @@
+#include <string.h>
+#include <PSXWorker.h>
+#include "CardPresence.h"
+#include "MemoryCardEngine.h"
+#include "WriteBehind.h"
+#include "CardService.h"
+
+namespace CardService {
+  // private variables & functions
+  namespace {
+    enum Mode {
+      Idle = 0,
+      Dumping = 1,
+      Restoring = 2,
+    };
+    // Parameters before the data of `RestoreBlock` (slot, block, CRC-32)
+    const uint8_t __ParamSize = 6;
+    // Header of `DumpBlock` payload (slot, block, status, CRC-32)
+    const uint8_t __DumpHeaderSize = 7;
+
+    struct Dump {
+      uint8_t slot;
+      uint8_t block;
+      // End of the requested blocks (exclusive)
+      uint8_t end;
+      // Next frame in the block to queue
+      uint8_t nextFrame;
+      uint8_t doneFrames;
+      uint8_t inFlight;
+      Status status;
+      uint32_t crc;
+      // Compressed bytes in `__block`
+      size_t length;
+    };
+
+    struct Restore {
+      uint8_t slot;
+      uint8_t block;
+      uint8_t frame;
+      uint8_t written;
+      bool isWaiting;
+      // Card differs from the frame read last
+      bool needsWrite;
+      Status status;
+    };
+
+    Mode __mode = Mode::Idle;
+    Dump __dump;
+    Restore __restore;
+    uint8_t __frames[K573_CARD_SERVICE_FRAMES_IN_FLIGHT][PSX_MEMCARD_FRAME_SIZE];
+    // Dump: `DumpBlock` record being built, Restore: decompressed block
+    uint8_t __block[K573_CARD_SERVICE_HEADER_SIZE + __DumpHeaderSize + K573_CARD_SERVICE_MAX_DATA];
+
+    // Received record
+    uint8_t __header[K573_CARD_SERVICE_HEADER_SIZE];
+    uint8_t __headerCount = 0;
+    uint16_t __payloadLength = 0;
+    uint16_t __payloadCount = 0;
+    uint8_t __params[__ParamSize];
+    // Request arrived while idle (otherwise it is ignored)
+    bool __isAccepted = false;
+
+    // RLE decoder of `RestoreBlock`
+    uint8_t __literalLeft = 0;
+    uint8_t __runLength = 0;
+    size_t __decoded = 0;
+    bool __isOverflow = false;
+
+    // Record being sent
+    uint8_t __reply[K573_CARD_SERVICE_HEADER_SIZE + 4];
+    const uint8_t *__out = nullptr;
+    size_t __outLength = 0;
+    size_t __outOffset = 0;
+
+    void __put32(uint8_t *buffer, uint32_t value) {
+      for (int i = 0; i < 4; i++) buffer[i] = value >> (i * 8);
+    }
+
+    uint32_t __get32(const uint8_t *buffer) {
+      return buffer[0] | buffer[1] << 8 | buffer[2] << 16 | (uint32_t)buffer[3] << 24;
+    }
+
+    /**
+     * @brief Fill the record header and queue the record.
+     * @param record Record (`K573_CARD_SERVICE_HEADER_SIZE` bytes of header, then the payload)
+     */
+    void __send(uint8_t *record, RecordType type, size_t payloadLength) {
+      record[0] = K573_CARD_SERVICE_MAGIC;
+      record[1] = type;
+      record[2] = payloadLength & 0xff;
+      record[3] = payloadLength >> 8;
+      __out = record;
+      __outLength = K573_CARD_SERVICE_HEADER_SIZE + payloadLength;
+      __outOffset = 0;
+    }
+
+    void __reply2(RecordType type, uint8_t first, uint8_t second) {
+      __reply[K573_CARD_SERVICE_HEADER_SIZE] = first;
+      __reply[K573_CARD_SERVICE_HEADER_SIZE + 1] = second;
+      __send(__reply, type, 2);
+    }
+
+    void __replyRestore(Status status) {
+      uint8_t *payload = &__reply[K573_CARD_SERVICE_HEADER_SIZE];
+      payload[0] = __restore.slot;
+      payload[1] = __restore.block;
+      payload[2] = status;
+      payload[3] = __restore.written;
+      __send(__reply, RecordType::RestoreResult, 4);
+    }
+
+    void __flush(Output output) {
+      if (__outLength == 0) return;
+      __outOffset += output(__out + __outOffset, __outLength - __outOffset);
+      if (__outOffset < __outLength) return;
+      __outLength = 0;
+      __outOffset = 0;
+    }
+
+    /**
+     * @brief Check if a game transfer owns the slot, and push buffered writes out so the next request succeeds.
+     */
+    bool __isSlotBusy(int slot) {
+      if (!MemoryCardEngine::isBusy() && !WriteBehind::isPending(slot)) return false;
+      WriteBehind::flush();
+      return true;
+    }
+
+    /**
+     * @brief Compress bytes with RLE.
+     * @param data Bytes
+     * @param length Count of `data`
+     * @param output Output (at least `length + length / 128 + 1` bytes)
+     * @return Count of compressed bytes
+     */
+    size_t __compress(const uint8_t *data, size_t length, uint8_t *output) {
+      size_t in = 0;
+      size_t out = 0;
+      while (in < length) {
+        size_t run = 1;
+        while (in + run < length && run < 130 && data[in + run] == data[in]) run++;
+        if (run >= 3) {
+          output[out++] = 0x80 + run - 3;
+          output[out++] = data[in];
+          in += run;
+          continue;
+        }
+        // Literal until the next run of 3 bytes
+        size_t start = in;
+        while (in < length && in - start < 128) {
+          if (in + 2 < length && data[in] == data[in + 1] && data[in] == data[in + 2]) break;
+          in++;
+        }
+        output[out++] = in - start - 1;
+        memcpy(&output[out], &data[start], in - start);
+        out += in - start;
+      }
+      return out;
+    }
+
+    void __decodeByte(uint8_t data) {
+      uint8_t count = 1;
+      if (__literalLeft > 0) {
+        __literalLeft--;
+      } else if (__runLength > 0) {
+        count = __runLength;
+        __runLength = 0;
+      } else {
+        if (data < 0x80) __literalLeft = data + 1;
+        else __runLength = data - 0x7d;
+        return;
+      }
+      if (__decoded + count > K573_CARD_SERVICE_BLOCK_SIZE) {
+        __isOverflow = true;
+        return;
+      }
+      memset(&__block[__decoded], data, count);
+      __decoded += count;
+    }
+
+    void __startDump() {
+      uint8_t slot = __params[0];
+      uint8_t first = __params[1];
+      uint8_t count = __params[2];
+      if (!PSX::hasSlot(slot) || first >= PSX_MEMCARD_BLOCK_COUNTS || count > PSX_MEMCARD_BLOCK_COUNTS - first) {
+        __reply2(RecordType::DumpEnd, slot, Status::BadRequest);
+        return;
+      }
+      if (__isSlotBusy(slot)) {
+        __reply2(RecordType::DumpEnd, slot, Status::Busy);
+        return;
+      }
+      memset(&__dump, 0, sizeof(Dump));
+      __dump.slot = slot;
+      __dump.block = first;
+      __dump.end = first + count;
+      __mode = Mode::Dumping;
+    }
+
+    void __startRestore() {
+      memset(&__restore, 0, sizeof(Restore));
+      __restore.slot = __params[0];
+      __restore.block = __params[1];
+      if (!PSX::hasSlot(__restore.slot) || __restore.block >= PSX_MEMCARD_BLOCK_COUNTS || __payloadLength < __ParamSize
+          || __isOverflow || __decoded != K573_CARD_SERVICE_BLOCK_SIZE || __literalLeft > 0 || __runLength > 0) {
+        __replyRestore(Status::BadRequest);
+        return;
+      }
+      if (crc32(0, __block, K573_CARD_SERVICE_BLOCK_SIZE) != __get32(&__params[2])) {
+        __replyRestore(Status::BadCrc);
+        return;
+      }
+      if (__isSlotBusy(__restore.slot)) {
+        __replyRestore(Status::Busy);
+        return;
+      }
+      __mode = Mode::Restoring;
+    }
+
+    /**
+     * @brief Handle the completely received record.
+     */
+    void __onRequest() {
+      __headerCount = 0;
+      if (!__isAccepted) return;
+      if (__header[1] == RecordType::DumpRequest) {
+        if (__payloadLength >= 3) __startDump();
+        else __reply2(RecordType::DumpEnd, __params[0], Status::BadRequest);
+      } else {
+        __startRestore();
+      }
+    }
+
+    /**
+     * @brief Send the block record, and stop after it if the card has failed.
+     */
+    void __finishBlock() {
+      uint8_t *payload = &__block[K573_CARD_SERVICE_HEADER_SIZE];
+      payload[0] = __dump.slot;
+      payload[1] = __dump.block;
+      payload[2] = __dump.status;
+      __put32(&payload[3], __dump.crc);
+      size_t length = __dump.status == Status::Ok ? __dump.length : 0;
+      __send(__block, RecordType::DumpBlock, __DumpHeaderSize + length);
+
+      __dump.block = __dump.status == Status::Ok ? __dump.block + 1 : __dump.end;
+      __dump.nextFrame = 0;
+      __dump.doneFrames = 0;
+      __dump.crc = 0;
+      __dump.length = 0;
+    }
+
+    void __serviceDump() {
+      if (__dump.block >= __dump.end) {
+        __reply2(RecordType::DumpEnd, __dump.slot, __dump.status);
+        __mode = Mode::Idle;
+        return;
+      }
+      while (__dump.status == Status::Ok && __dump.inFlight < K573_CARD_SERVICE_FRAMES_IN_FLIGHT
+             && __dump.nextFrame < PSX_MEMCARD_FRAMES_IN_BLOCK) {
+        uint16_t address = __dump.block * PSX_MEMCARD_FRAMES_IN_BLOCK + __dump.nextFrame;
+        PSXWorker::Job job;
+        job.type = PSXWorker::JobType::ReadMemoryCard;
+        job.slot = __dump.slot;
+        job.address = address;
+        job.buffer = __frames[__dump.nextFrame % K573_CARD_SERVICE_FRAMES_IN_FLIGHT];
+        job.owner = K573::JobOwner::Service;
+        job.tag = 0;
+        if (!PSXWorker::trySubmit(job)) return;
+        __dump.inFlight++;
+        __dump.nextFrame++;
+      }
+    }
+
+    void __onDumpFrame(const PSXWorker::Completion &completion) {
+      __dump.inFlight--;
+      if (completion.result != PSX::FrameResult::Success) {
+        __dump.status = Status::CardError;
+      } else if (__dump.status == Status::Ok) {
+        // PSX core runs the jobs in order, frames arrive in address order
+        const uint8_t *frame = completion.job.buffer;
+        __dump.crc = crc32(__dump.crc, frame, PSX_MEMCARD_FRAME_SIZE);
+        uint8_t *data = &__block[K573_CARD_SERVICE_HEADER_SIZE + __DumpHeaderSize];
+        __dump.length += __compress(frame, PSX_MEMCARD_FRAME_SIZE, &data[__dump.length]);
+      }
+      __dump.doneFrames++;
+
+      bool isDrained = __dump.inFlight == 0 && (__dump.status != Status::Ok || __dump.doneFrames == PSX_MEMCARD_FRAMES_IN_BLOCK);
+      if (isDrained) __finishBlock();
+    }
+
+    void __finishRestore(Status status) {
+      // Frames were written behind the caches, forget what is known about the card
+      if (__restore.written > 0) MemoryCardEngine::onCardRemoved(__restore.slot);
+      __replyRestore(status);
+      __mode = Mode::Idle;
+    }
+
+    void __serviceRestore() {
+      if (__restore.isWaiting) return;
+      if (__restore.frame >= PSX_MEMCARD_FRAMES_IN_BLOCK) {
+        __finishRestore(Status::Ok);
+        return;
+      }
+      const uint8_t *data = &__block[__restore.frame * PSX_MEMCARD_FRAME_SIZE];
+      PSXWorker::Job job;
+      job.type = __restore.needsWrite ? PSXWorker::JobType::WriteMemoryCard : PSXWorker::JobType::ReadMemoryCard;
+      job.slot = __restore.slot;
+      job.address = __restore.block * PSX_MEMCARD_FRAMES_IN_BLOCK + __restore.frame;
+      // Write job only reads the buffer
+      job.buffer = __restore.needsWrite ? (uint8_t *)data : __frames[0];
+      job.owner = K573::JobOwner::Service;
+      job.tag = 0;
+      if (!PSXWorker::trySubmit(job)) return;
+      __restore.isWaiting = true;
+    }
+
+    void __onRestoreFrame(const PSXWorker::Completion &completion) {
+      __restore.isWaiting = false;
+      if (completion.result != PSX::FrameResult::Success) {
+        __finishRestore(Status::CardError);
+        return;
+      }
+      const uint8_t *data = &__block[__restore.frame * PSX_MEMCARD_FRAME_SIZE];
+      if (completion.job.type == PSXWorker::JobType::WriteMemoryCard) {
+        __restore.written++;
+        __restore.needsWrite = false;
+        __restore.frame++;
+      } else if (memcmp(completion.job.buffer, data, PSX_MEMCARD_FRAME_SIZE) != 0) {
+        __restore.needsWrite = true;
+      } else {
+        __restore.frame++;
+      }
+    }
+  }
+
+  /**
+   * @brief Take a byte received from the host.
+   * @param data Received byte
+   * @return `false` if the byte is not part of a service record (e.g. `Trace` control byte)
+   */
+  bool receive(uint8_t data) {
+    if (__headerCount < K573_CARD_SERVICE_HEADER_SIZE) {
+      if (__headerCount == 0 && data != K573_CARD_SERVICE_MAGIC) return false;
+      __header[__headerCount++] = data;
+      if (__headerCount < K573_CARD_SERVICE_HEADER_SIZE) return true;
+
+      uint8_t type = __header[1];
+      __payloadLength = __header[2] | __header[3] << 8;
+      __payloadCount = 0;
+      // Garbage on the line: drop the header and wait for the next magic
+      if ((type != RecordType::DumpRequest && type != RecordType::RestoreBlock)
+          || __payloadLength > __ParamSize + K573_CARD_SERVICE_MAX_DATA) {
+        __headerCount = 0;
+        return true;
+      }
+      memset(__params, 0, sizeof(__params));
+      __isAccepted = __mode == Mode::Idle && __outLength == 0;
+      __literalLeft = 0;
+      __runLength = 0;
+      __decoded = 0;
+      __isOverflow = false;
+      if (__payloadLength == 0) __onRequest();
+      return true;
+    }
+
+    if (__payloadCount < __ParamSize) __params[__payloadCount] = data;
+    else if (__isAccepted && __header[1] == RecordType::RestoreBlock) __decodeByte(data);
+    if (++__payloadCount == __payloadLength) __onRequest();
+    return true;
+  }
+
+  /**
+   * @brief Queue frames of the running operation and send the pending record. (call from main loop)
+   * @param output Output to the host
+   */
+  void service(Output output) {
+    __flush(output);
+    // Next block is read after the previous one is on its way (`__block` is reused)
+    if (__outLength > 0) return;
+    switch (__mode) {
+      case Mode::Dumping: __serviceDump(); break;
+      case Mode::Restoring: __serviceRestore(); break;
+      default: break;
+    }
+    __flush(output);
+  }
+
+  /**
+   * @brief Handle finished service job.
+   * @param completion Job returned from PSX core
+   */
+  void onComplete(const PSXWorker::Completion &completion) {
+    CardPresence::onResult(completion.job.slot, completion.result);
+    if (__mode == Mode::Dumping) __onDumpFrame(completion);
+    else if (__mode == Mode::Restoring) __onRestoreFrame(completion);
+  }
+
+  /**
+   * @brief Check if an operation is running.
+   */
+  bool isBusy() {
+    return __mode != Mode::Idle;
+  }
+
+  /**
+   * @brief Check if a record is partially sent (other records must not be interleaved on the stream).
+   */
+  bool isSending() {
+    return __outOffset > 0;
+  }
+
+  /**
+   * @brief CRC-32 (IEEE 802.3, same as zlib `crc32`).
+   * @param crc CRC of the previous bytes (`0` at first)
+   * @param data Bytes
+   * @param length Count of `data`
+   */
+  uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length) {
+    // Half-byte table, small enough to stay in RAM
+    static const uint32_t table[16] = {
+      0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+      0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+      crc ^= data[i];
+      crc = (crc >> 4) ^ table[crc & 0x0f];
+      crc = (crc >> 4) ^ table[crc & 0x0f];
+    }
+    return ~crc;
+  }
+}
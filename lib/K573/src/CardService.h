@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <PSXJob.h>
+#include "K573.h"
+
+#ifndef K573_CARD_SERVICE
+// `1` to serve card dump/restore over USB CDC
+#define K573_CARD_SERVICE 1
+#endif
+#ifndef K573_CARD_SERVICE_FRAMES_IN_FLIGHT
+// Frames queued to PSX core at once while dumping
+#define K573_CARD_SERVICE_FRAMES_IN_FLIGHT 2
+#endif
+// First byte of every record (same framing as `Trace` records)
+#define K573_CARD_SERVICE_MAGIC 0xa5
+// Header of a record: magic, type, payload length (2 bytes, LE)
+#define K573_CARD_SERVICE_HEADER_SIZE 4
+// Block data of a record, compressed (RLE expands by at most 1 byte per 128)
+#define K573_CARD_SERVICE_BLOCK_SIZE (PSX_MEMCARD_FRAMES_IN_BLOCK * PSX_MEMCARD_FRAME_SIZE)
+#define K573_CARD_SERVICE_MAX_DATA (K573_CARD_SERVICE_BLOCK_SIZE + K573_CARD_SERVICE_BLOCK_SIZE / 128)
+
+/**
+ * @brief Service mode for backing up and restoring whole memory cards over USB CDC.
+ * @note Requests and responses are records {`K573_CARD_SERVICE_MAGIC`, `RecordType`, <Payload length (2 bytes, LE)>,
+ * <Payload>}. Cards are transferred in blocks (64 frames), block data is RLE compressed and carries the CRC-32 of the
+ * raw block, so a client resumes an interrupted dump by requesting the missing blocks only.
+ * Restore compares each frame with the card and writes the differing frames only.
+ * <Slot> is `0`: Port 1, `1`: Port 2, and `2`-`7` for multitap sub-ports B-D (see `PSX_SLOT_COUNTS`).
+ * RLE: control byte `N < 0x80` is followed by `N + 1` literal bytes, `N >= 0x80` by one byte repeated `N - 0x7d` times.
+ * Only one operation runs at a time, requests received meanwhile are ignored (client waits for the response).
+ */
+namespace CardService {
+  /**
+   * @brief Record types (`0x10`-, `Trace` records use lower types)
+   */
+  enum RecordType {
+    /**
+     * @brief Host -> device: {<Slot>, <First block>, <Block count>}
+     */
+    DumpRequest = 0x10,
+    /**
+     * @brief Device -> host: {<Slot>, <Block>, `Status`, <CRC-32 (4 bytes, LE)>, <RLE data>} (data only if `Ok`)
+     */
+    DumpBlock = 0x11,
+    /**
+     * @brief Device -> host: {<Slot>, `Status`} after the last block (or instead of blocks if not started)
+     */
+    DumpEnd = 0x12,
+    /**
+     * @brief Host -> device: {<Slot>, <Block>, <CRC-32 (4 bytes, LE)>, <RLE data>}
+     */
+    RestoreBlock = 0x13,
+    /**
+     * @brief Device -> host: {<Slot>, <Block>, `Status`, <Frames written>}
+     */
+    RestoreResult = 0x14,
+  };
+
+  /**
+   * @brief Result of an operation
+   */
+  enum Status {
+    Ok = 0,
+    /**
+     * @brief Game transfer is running or buffered writes are pending (retry later)
+     */
+    Busy = 1,
+    /**
+     * @brief Slot or block is out of range, or the block data does not decompress to one block
+     */
+    BadRequest = 2,
+    /**
+     * @brief CRC-32 of the restored block does not match
+     */
+    BadCrc = 3,
+    /**
+     * @brief Card did not answer a frame (after retries)
+     */
+    CardError = 4,
+  };
+
+  /**
+   * @brief Send bytes to the host without blocking.
+   * @param data Bytes to send
+   * @param length Count of `data`
+   * @return Count of bytes accepted
+   */
+  typedef size_t (*Output)(const uint8_t *data, size_t length);
+
+  /**
+   * @brief Take a byte received from the host.
+   * @param data Received byte
+   * @return `false` if the byte is not part of a service record (e.g. `Trace` control byte)
+   */
+  bool receive(uint8_t data);
+
+  /**
+   * @brief Queue frames of the running operation and send the pending record. (call from main loop)
+   * @param output Output to the host
+   */
+  void service(Output output);
+
+  /**
+   * @brief Handle finished service job.
+   * @param completion Job returned from PSX core
+   */
+  void onComplete(const PSXWorker::Completion &completion);
+
+  /**
+   * @brief Check if an operation is running.
+   */
+  bool isBusy();
+
+  /**
+   * @brief Check if a record is partially sent (other records must not be interleaved on the stream).
+   */
+  bool isSending();
+
+  /**
+   * @brief CRC-32 (IEEE 802.3, same as zlib `crc32`).
+   * @param crc CRC of the previous bytes (`0` at first)
+   * @param data Bytes
+   * @param length Count of `data`
+   */
+  uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length);
+}
@@ -0,0 +1,317 @@
+#include <string.h>
+#include "FrameCache.h"
+#include "PagePool.h"
+
+namespace FrameCache {
+  // private variables & functions
+  namespace {
+    // Entry flags
+    enum EntryFlag {
+      Valid = 0x01,
+      Dirty = 0x02,
+    };
+
+    /**
+     * @brief Cached frame (linked in LRU list by index)
+     */
+    struct Entry {
+      uint8_t slot;
+      uint8_t flags;
+      uint16_t address;
+      // Newer entry (`0`: none, otherwise index + 1)
+      uint16_t prev;
+      // Older entry or next free entry (`0`: none, otherwise index + 1)
+      uint16_t next;
+      // Frame data (may be shared with `RamStore`)
+      PagePool::Page page;
+    };
+
+    Entry __entries[K573_FRAME_CACHE_FRAMES];
+    // (slot, address) -> entry (`0`: not cached, otherwise index + 1)
+    uint16_t __index[K573_SLOT_COUNTS][K573_MEMCARD_FRAMES];
+    // Most recently used (index + 1)
+    uint16_t __newest = 0;
+    // Least recently used (index + 1)
+    uint16_t __oldest = 0;
+    // Entries that have never been used
+    uint16_t __unused = K573_FRAME_CACHE_FRAMES;
+    // Free list of removed entries (index + 1)
+    uint16_t __free = 0;
+
+    uint16_t __dirtyCount[K573_SLOT_COUNTS];
+    Statistics __statistics;
+    EvictionListener __evictionListener = nullptr;
+
+    Entry &__at(uint16_t link) {
+      return __entries[link - 1];
+    }
+
+    void __unlink(uint16_t link) {
+      Entry &entry = __at(link);
+      if (entry.prev) __at(entry.prev).next = entry.next;
+      else __newest = entry.next;
+      if (entry.next) __at(entry.next).prev = entry.prev;
+      else __oldest = entry.prev;
+      entry.prev = 0;
+      entry.next = 0;
+    }
+
+    void __pushNewest(uint16_t link) {
+      Entry &entry = __at(link);
+      entry.prev = 0;
+      entry.next = __newest;
+      if (__newest) __at(__newest).prev = link;
+      __newest = link;
+      if (!__oldest) __oldest = link;
+    }
+
+    /**
+     * @brief Unlink the entry and put it into the free list.
+     * @param link Entry (index + 1)
+     */
+    void __release(uint16_t link) {
+      Entry &entry = __at(link);
+      __unlink(link);
+      __index[entry.slot][entry.address] = 0;
+      if (entry.flags & EntryFlag::Dirty) __dirtyCount[entry.slot]--;
+      PagePool::release(entry.page);
+      entry.page = 0;
+      entry.flags = 0;
+      entry.next = __free;
+      __free = link;
+    }
+
+    /**
+     * @brief Get an unused entry, evict the oldest clean entry if needed.
+     * @return Entry (index + 1), `0` if every entry is dirty
+     */
+    uint16_t __allocate() {
+      if (__free) {
+        uint16_t link = __free;
+        __free = __at(link).next;
+        __at(link).next = 0;
+        return link;
+      }
+      if (__unused > 0) {
+        __unused--;
+        return K573_FRAME_CACHE_FRAMES - __unused;
+      }
+      for (uint16_t link = __oldest; link; link = __at(link).prev) {
+        Entry &entry = __at(link);
+        if (entry.flags & EntryFlag::Dirty) continue;
+        int slot = entry.slot;
+        uint16_t address = entry.address;
+        __statistics.evictions++;
+        __release(link);
+        if (__evictionListener) __evictionListener(slot, address);
+        return __allocate();
+      }
+      return 0;
+    }
+
+    bool __isValid(int slot, uint16_t address) {
+      return slot >= 0 && slot < K573_SLOT_COUNTS && address < K573_MEMCARD_FRAMES;
+    }
+
+    /**
+     * @brief Get the entry of the frame (allocate if not cached), update dirty flag and mark it as newest.
+     * @return Entry (index + 1), `0` if every entry is dirty
+     */
+    uint16_t __prepare(int slot, uint16_t address, bool dirty) {
+      if (!__isValid(slot, address)) return 0;
+
+      uint16_t link = __index[slot][address];
+      if (link) {
+        __unlink(link);
+      } else {
+        link = __allocate();
+        if (!link) return 0;
+        Entry &entry = __at(link);
+        entry.slot = slot;
+        entry.address = address;
+        entry.flags = EntryFlag::Valid;
+        __index[slot][address] = link;
+      }
+
+      Entry &entry = __at(link);
+      if (dirty && !(entry.flags & EntryFlag::Dirty)) {
+        entry.flags |= EntryFlag::Dirty;
+        __dirtyCount[slot]++;
+      } else if (!dirty && (entry.flags & EntryFlag::Dirty)) {
+        entry.flags &= ~EntryFlag::Dirty;
+        __dirtyCount[slot]--;
+      }
+      __pushNewest(link);
+      return link;
+    }
+  }
+
+  /**
+   * @brief Find the frame and mark it as most recently used.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @return Cached page (shared by `PagePool::retain`, copy before writing), `0` if not cached
+   */
+  PagePool::Page findPage(int slot, uint16_t address) {
+    uint16_t link = __isValid(slot, address) ? __index[slot][address] : 0;
+    if (!link) {
+      __statistics.misses++;
+      return 0;
+    }
+    __statistics.hits++;
+    __unlink(link);
+    __pushNewest(link);
+    return __at(link).page;
+  }
+
+  /**
+   * @brief Check if the frame is cached without touching LRU order and counters.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  bool contains(int slot, uint16_t address) {
+    return __isValid(slot, address) && __index[slot][address] != 0;
+  }
+
+  /**
+   * @brief Get the cached frame without touching LRU order and counters.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @return Cached 128 bytes, `nullptr` if not cached
+   */
+  uint8_t *peek(int slot, uint16_t address) {
+    return contains(slot, address) ? PagePool::data(__at(__index[slot][address]).page) : nullptr;
+  }
+
+  /**
+   * @brief Check if the frame is cached and not written to the card yet.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  bool isDirty(int slot, uint16_t address) {
+    return contains(slot, address) && (__at(__index[slot][address]).flags & EntryFlag::Dirty);
+  }
+
+  /**
+   * @brief Find the first dirty frame at or after `from`.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param from Frame address to start searching
+   * @param address Found frame address
+   * @return `false` if no dirty frame at or after `from`
+   */
+  bool findDirty(int slot, uint16_t from, uint16_t &address) {
+    if (slot < 0 || slot >= K573_SLOT_COUNTS || __dirtyCount[slot] == 0) return false;
+    for (uint16_t i = from; i < K573_MEMCARD_FRAMES; i++) {
+      if (!isDirty(slot, i)) continue;
+      address = i;
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Store the frame (replace if already cached).
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @param data Frame data (128 bytes)
+   * @param dirty `true` if the data is not written to the card yet
+   * @return `false` if every cached frame is dirty (nothing can be evicted)
+   */
+  bool store(int slot, uint16_t address, const uint8_t *data, bool dirty) {
+    uint16_t link = __prepare(slot, address, dirty);
+    if (!link) return false;
+
+    Entry &entry = __at(link);
+    if (!entry.page || PagePool::isShared(entry.page)) {
+      // Copy on write, `RamStore` keeps the old data
+      PagePool::Page page = PagePool::allocate();
+      if (!page) {
+        __release(link);
+        return false;
+      }
+      PagePool::release(entry.page);
+      entry.page = page;
+    }
+    uint8_t *frame = PagePool::data(entry.page);
+    if (frame != data) memcpy(frame, data, PSX_MEMCARD_FRAME_SIZE);
+    return true;
+  }
+
+  /**
+   * @brief Store the page as the frame without copying (replace if already cached).
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @param page Page holding the frame data (shared by `PagePool::retain`)
+   * @param dirty `true` if the data is not written to the card yet
+   * @return `false` if every cached frame is dirty (nothing can be evicted)
+   */
+  bool storePage(int slot, uint16_t address, PagePool::Page page, bool dirty) {
+    uint16_t link = __prepare(slot, address, dirty);
+    if (!link) return false;
+
+    Entry &entry = __at(link);
+    PagePool::retain(page);
+    PagePool::release(entry.page);
+    entry.page = page;
+    return true;
+  }
+
+  /**
+   * @brief Mark the frame as written to the card.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  void markClean(int slot, uint16_t address) {
+    if (!contains(slot, address)) return;
+    Entry &entry = __at(__index[slot][address]);
+    if (!(entry.flags & EntryFlag::Dirty)) return;
+    entry.flags &= ~EntryFlag::Dirty;
+    __dirtyCount[slot]--;
+  }
+
+  /**
+   * @brief Drop the frame.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  void remove(int slot, uint16_t address) {
+    if (!contains(slot, address)) return;
+    __release(__index[slot][address]);
+  }
+
+  /**
+   * @brief Drop all frames of the slot. (call when the card is removed or replaced)
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  void invalidate(int slot) {
+    if (slot < 0 || slot >= K573_SLOT_COUNTS) return;
+    __statistics.droppedDirty += __dirtyCount[slot];
+    for (uint16_t address = 0; address < K573_MEMCARD_FRAMES; address++) {
+      if (__index[slot][address]) __release(__index[slot][address]);
+    }
+  }
+
+  /**
+   * @brief Count of dirty frames in the slot.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  uint16_t countDirty(int slot) {
+    return __dirtyCount[slot];
+  }
+
+  /**
+   * @brief Get notified of evictions (e.g. to count read ahead frames that were never used).
+   * @param listener Called after a frame was evicted, `nullptr` to stop
+   */
+  void setEvictionListener(EvictionListener listener) {
+    __evictionListener = listener;
+  }
+
+  const Statistics &getStatistics() {
+    return __statistics;
+  }
+
+  void resetStatistics() {
+    memset(&__statistics, 0, sizeof(__statistics));
+  }
+}
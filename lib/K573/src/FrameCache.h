@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdint.h>
+#include <PSX.h>
+#include "K573.h"
+
+#ifndef K573_FRAME_CACHE_SIZE
+// RAM budget of memory card frame cache in bytes (16KB = 128 frames)
+#define K573_FRAME_CACHE_SIZE 16384
+#endif
+// Cached frame count
+#define K573_FRAME_CACHE_FRAMES (K573_FRAME_CACHE_SIZE / PSX_MEMCARD_FRAME_SIZE)
+// Frames on one memory card
+#define K573_MEMCARD_FRAMES (PSX_MEMCARD_BLOCK_COUNTS * PSX_MEMCARD_FRAMES_IN_BLOCK)
+
+/**
+ * @brief LRU cache of memory card frames, keyed by (slot, frame address).
+ * @note Dirty frames are never evicted, so they must be written back before the cache is filled up with them.
+ * Frame data lives in `PagePool` pages, which can be shared with `RamStore` without copying.
+ */
+namespace FrameCache {
+  /**
+   * @brief Cache counters
+   */
+  struct Statistics {
+    uint32_t hits;
+    uint32_t misses;
+    // Clean frames dropped to make room
+    uint32_t evictions;
+    // Dirty frames dropped by `invalidate` (data lost with removed card)
+    uint32_t droppedDirty;
+  };
+
+  /**
+   * @brief Find the frame and mark it as most recently used.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @return Cached page (shared by `PagePool::retain`, copy before writing), `0` if not cached
+   */
+  uint16_t findPage(int slot, uint16_t address);
+
+  /**
+   * @brief Check if the frame is cached without touching LRU order and counters.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  bool contains(int slot, uint16_t address);
+
+  /**
+   * @brief Get the cached frame without touching LRU order and counters.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @return Cached 128 bytes, `nullptr` if not cached
+   */
+  uint8_t *peek(int slot, uint16_t address);
+
+  /**
+   * @brief Check if the frame is cached and not written to the card yet.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  bool isDirty(int slot, uint16_t address);
+
+  /**
+   * @brief Find the first dirty frame at or after `from`.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param from Frame address to start searching
+   * @param address Found frame address
+   * @return `false` if no dirty frame at or after `from`
+   */
+  bool findDirty(int slot, uint16_t from, uint16_t &address);
+
+  /**
+   * @brief Store the frame (replace if already cached).
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @param data Frame data (128 bytes)
+   * @param dirty `true` if the data is not written to the card yet
+   * @return `false` if every cached frame is dirty (nothing can be evicted)
+   */
+  bool store(int slot, uint16_t address, const uint8_t *data, bool dirty);
+
+  /**
+   * @brief Store the page as the frame without copying (replace if already cached).
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @param page Page holding the frame data (shared by `PagePool::retain`)
+   * @param dirty `true` if the data is not written to the card yet
+   * @return `false` if every cached frame is dirty (nothing can be evicted)
+   */
+  bool storePage(int slot, uint16_t address, uint16_t page, bool dirty);
+
+  /**
+   * @brief Mark the frame as written to the card.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  void markClean(int slot, uint16_t address);
+
+  /**
+   * @brief Drop the frame.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  void remove(int slot, uint16_t address);
+
+  /**
+   * @brief Drop all frames of the slot. (call when the card is removed or replaced)
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  void invalidate(int slot);
+
+  /**
+   * @brief Count of dirty frames in the slot.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  uint16_t countDirty(int slot);
+
+  /**
+   * @brief Called after a clean frame was evicted to make room.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  typedef void (*EvictionListener)(int slot, uint16_t address);
+
+  /**
+   * @brief Get notified of evictions (e.g. to count read ahead frames that were never used).
+   * @param listener Called after a frame was evicted, `nullptr` to stop
+   */
+  void setEvictionListener(EvictionListener listener);
+
+  const Statistics &getStatistics();
+  void resetStatistics();
+}
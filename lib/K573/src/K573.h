@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <PSX.h>
+
+// PSX slots on GE885-PWB(A), and the sub-ports of multitaps (see `PSX_SLOT_COUNTS`)
+#define K573_SLOT_COUNTS PSX_SLOT_COUNTS
+// Slot select bit in <Port xor Address> of memory card commands (set: Port 2)
+#define K573_MEMCARD_PORT_BIT 0x8000
+// Multitap sub-port in <Port xor Address> of memory card commands (`0`: A, the port itself)
+// Local extension, not part of the Konami protocol: stock games leave these bits clear, decoded only with `PSX_MULTITAP_SLOTS`
+#define K573_MEMCARD_SUBPORT_MASK 0x6000
+#define K573_MEMCARD_SUBPORT_SHIFT 13
+// Address bits in <Port xor Address> of memory card commands
+#define K573_MEMCARD_ADDRESS_MASK 0x03ff
+
+/**
+ * @brief Memory card status (reported by `K573Status`)
+ */
+enum MemoryCardStatus {
+  // Default value, also used after writing?
+  Uninitialized = 0x0000,
+  Error = 0x0002,
+  // Card is not inserted
+  Unavailable = 0x0008,
+  // Read request is executing
+  Reading = 0x0200,
+  // Write request is executing
+  Writing = 0x0400,
+  // Can be combined with MEMCARD_READING and MEMCARD_WRITING for busy state
+  Available = 0x8000
+};
+
+namespace K573 {
+  /**
+   * @brief Module that queued the PSX job (`PSXWorker::Job.owner`)
+   */
+  enum JobOwner {
+    Transfer = 0,
+    Prefetch = 1,
+    Flush = 2,
+    Presence = 3,
+    Service = 4,
+  };
+
+  /**
+   * @brief Read 2 bytes big-endian value from the command.
+   * @param data Pointer to MSB
+   */
+  inline uint16_t readUInt16(const uint8_t *data) {
+    return (data[0] << 8) | data[1];
+  }
+
+  /**
+   * @brief Read 3 bytes big-endian RAM address from the command.
+   * @param data Pointer to MSB
+   */
+  inline uint32_t readAddress(const uint8_t *data) {
+    return ((uint32_t)data[0] << 16) | (data[1] << 8) | data[2];
+  }
+}
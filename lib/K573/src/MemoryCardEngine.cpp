@@ -0,0 +1,271 @@
+#include <string.h>
+#include <PSXWorker.h>
+#include "CardPresence.h"
+#include "FrameCache.h"
+#include "PagePool.h"
+#include "Prefetcher.h"
+#include "RamStore.h"
+#include "WriteBehind.h"
+#include "MemoryCardEngine.h"
+
+namespace MemoryCardEngine {
+  // private variables & functions
+  namespace {
+    /**
+     * @brief Multi-frame transfer being executed
+     */
+    struct Transfer {
+      PSXWorker::JobType type;
+      int slot;
+      uint16_t address;
+      uint32_t ramAddress;
+      uint16_t count;
+      // Frames queued to PSX core
+      uint16_t submitted;
+      // Frames returned from PSX core
+      uint16_t completed;
+      // First error (`Success` if no error)
+      PSX::FrameResult result;
+      // Frame index of each job on PSX core (`__NoFrame`: free)
+      uint16_t inFlight[K573_MEMCARD_FRAMES_IN_FLIGHT];
+    };
+    const uint16_t __NoFrame = 0xffff;
+
+    // Used when RAM address is not page aligned (read: DMA destination, write: copy of RAM)
+    uint8_t __bounce[K573_MEMCARD_FRAMES_IN_FLIGHT][PSX_MEMCARD_FRAME_SIZE];
+
+    Transfer __transfer;
+    bool __isRunning = false;
+    // Incremented on each transfer, stored in upper 16 bits of `Job.tag`
+    uint16_t __generation = 0;
+
+    // Last transfer of the slot has failed (cleared by the next transfer or a card change)
+    bool __hasFailed[K573_SLOT_COUNTS];
+
+    StartResult __start(PSXWorker::JobType type, int slot, uint16_t address, uint32_t ramAddress, uint16_t count) {
+      if (__isRunning) return StartResult::Busy;
+      if (!PSX::hasSlot(slot)) return StartResult::InvalidParameter;
+      if (address + count > PSX_MEMCARD_BLOCK_COUNTS * PSX_MEMCARD_FRAMES_IN_BLOCK) return StartResult::InvalidParameter;
+      uint32_t length = (uint32_t)count * PSX_MEMCARD_FRAME_SIZE;
+      if (ramAddress > K573_RAM_SIZE || length > K573_RAM_SIZE - ramAddress) return StartResult::InvalidParameter;
+      // Every destination page must be mappable before starting
+      if (type == PSXWorker::JobType::ReadMemoryCard && !RamStore::canWrite(ramAddress, length)) return StartResult::InvalidParameter;
+      // Do not wait for retries and timeouts again, unless the host has rewritten the frame
+      for (uint16_t i = 0; type == PSXWorker::JobType::ReadMemoryCard && i < count; i++) {
+        if (PSXWorker::isBadFrame(slot, address + i) && !FrameCache::contains(slot, address + i)) return StartResult::BadFrame;
+      }
+      if (count == 0) return StartResult::Started;
+
+      __generation++;
+      __transfer.type = type;
+      __transfer.slot = slot;
+      __transfer.address = address;
+      __transfer.ramAddress = ramAddress;
+      __transfer.count = count;
+      __transfer.submitted = 0;
+      __transfer.completed = 0;
+      __transfer.result = PSX::FrameResult::Success;
+      for (uint16_t &frame : __transfer.inFlight) frame = __NoFrame;
+      __isRunning = true;
+      __hasFailed[slot] = false;
+      return StartResult::Started;
+    }
+
+    /**
+     * @brief Find the in-flight entry (and bounce buffer) of a frame.
+     * @param frame Frame index in the transfer, `__NoFrame` to find a free entry
+     * @return Entry index (a free entry always exists while fewer than `K573_MEMCARD_FRAMES_IN_FLIGHT` jobs are queued)
+     */
+    int __findInFlight(uint16_t frame) {
+      for (int i = 0; i < K573_MEMCARD_FRAMES_IN_FLIGHT; i++) {
+        if (__transfer.inFlight[i] == frame) return i;
+      }
+      return 0;
+    }
+
+    bool __isAligned() {
+      return __transfer.ramAddress % K573_PAGE_SIZE == 0;
+    }
+
+    void __finish() {
+      __isRunning = false;
+      // Card was removed or replaced
+      if (__transfer.result == PSX::FrameResult::NoDevice) onCardRemoved(__transfer.slot);
+      // Removed card is reported as `Unavailable` by presence
+      __hasFailed[__transfer.slot] = __transfer.result != PSX::FrameResult::Success && __transfer.result != PSX::FrameResult::NoDevice;
+      CardPresence::onResult(__transfer.slot, __transfer.result);
+    }
+  }
+
+  /**
+   * @brief Queue reading frames from memory card into RAM.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address First frame address (`0x00`-`0x3ff`)
+   * @param ramAddress Destination RAM address
+   * @param count Frame count
+   */
+  StartResult startRead(int slot, uint16_t address, uint32_t ramAddress, uint16_t count) {
+    return __start(PSXWorker::JobType::ReadMemoryCard, slot, address, ramAddress, count);
+  }
+
+  /**
+   * @brief Queue writing frames from RAM to memory card.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address First frame address (`0x00`-`0x3ff`)
+   * @param ramAddress Source RAM address
+   * @param count Frame count
+   */
+  StartResult startWrite(int slot, uint16_t address, uint32_t ramAddress, uint16_t count) {
+    StartResult result = __start(PSXWorker::JobType::WriteMemoryCard, slot, address, ramAddress, count);
+    if (result == StartResult::Started) WriteBehind::clearError(slot);
+    return result;
+  }
+
+  /**
+   * @brief Queue next frames to PSX core. (call from main loop)
+   */
+  void service() {
+    if (!__isRunning || __transfer.result != PSX::FrameResult::Success) return;
+
+    int hits = 0;
+    while (__transfer.submitted < __transfer.count
+           && __transfer.submitted - __transfer.completed < K573_MEMCARD_FRAMES_IN_FLIGHT) {
+      PSXWorker::Job job;
+      job.type = __transfer.type;
+      job.slot = __transfer.slot;
+      job.address = __transfer.address + __transfer.submitted;
+      uint32_t ramAddress = __transfer.ramAddress + __transfer.submitted * PSX_MEMCARD_FRAME_SIZE;
+      // Cache hits complete out of order, so the entry of the oldest job may still be busy
+      int entry = __findInFlight(__NoFrame);
+      uint8_t *bounce = __bounce[entry];
+      job.owner = K573::JobOwner::Transfer;
+      job.tag = ((uint32_t)__generation << 16) | __transfer.submitted;
+
+      if (job.type == PSXWorker::JobType::WriteMemoryCard) {
+        const uint8_t *frame = RamStore::getFrame(ramAddress, bounce);
+        // Wait for flushing if the cache is full of dirty frames
+        if (!WriteBehind::tryWrite(job.slot, job.address, frame)) break;
+        Prefetcher::onFrame(job.slot, job.address, frame, false);
+        __transfer.submitted++;
+        __transfer.completed++;
+        if (++hits >= K573_MEMCARD_CACHE_HITS_PER_SERVICE) break;
+        continue;
+      }
+
+      if (job.type == PSXWorker::JobType::ReadMemoryCard) {
+        PagePool::Page cached = FrameCache::findPage(job.slot, job.address);
+        if (cached) {
+          // Share the cached page instead of copying (copied when host or card writes it)
+          if (!__isAligned() || !RamStore::mapPage(ramAddress, cached)) RamStore::write(ramAddress, PagePool::data(cached), PSX_MEMCARD_FRAME_SIZE);
+          Prefetcher::onFrame(job.slot, job.address, PagePool::data(cached), true);
+          __transfer.submitted++;
+          __transfer.completed++;
+          // Do not block JVS loop with a long run of cache hits
+          if (++hits >= K573_MEMCARD_CACHE_HITS_PER_SERVICE) break;
+          continue;
+        }
+      }
+
+      // Card reads straight into the RAM page if aligned
+      job.buffer = __isAligned() ? RamStore::getWritablePage(ramAddress) : nullptr;
+      if (job.buffer == nullptr) job.buffer = bounce;
+      if (!PSXWorker::trySubmit(job)) break;
+      __transfer.inFlight[entry] = __transfer.submitted;
+      __transfer.submitted++;
+    }
+
+    if (__transfer.completed == __transfer.count) __finish();
+  }
+
+  /**
+   * @brief Handle finished memory card job.
+   * @param completion Job returned from PSX core
+   */
+  void onComplete(const PSXWorker::Completion &completion) {
+    if (!__isRunning || (completion.job.tag >> 16) != __generation) return;
+
+    __transfer.completed++;
+    if (__transfer.result == PSX::FrameResult::Success) __transfer.result = completion.result;
+
+    const PSXWorker::Job &job = completion.job;
+    int entry = __findInFlight(job.tag & 0xffff);
+    __transfer.inFlight[entry] = __NoFrame;
+    if (completion.result == PSX::FrameResult::Success) {
+      uint32_t ramAddress = __transfer.ramAddress + (job.tag & 0xffff) * PSX_MEMCARD_FRAME_SIZE;
+      PagePool::Page page = 0;
+      if (job.buffer == __bounce[entry]) RamStore::write(ramAddress, job.buffer, PSX_MEMCARD_FRAME_SIZE);
+      else page = RamStore::getPage(ramAddress);
+      // Do not overwrite the frame written by host
+      if (!FrameCache::isDirty(job.slot, job.address)) {
+        // RAM and cache share the page read from the card
+        if (page) FrameCache::storePage(job.slot, job.address, page, false);
+        else FrameCache::store(job.slot, job.address, job.buffer, false);
+      }
+      Prefetcher::onFrame(job.slot, job.address, job.buffer, job.type == PSXWorker::JobType::ReadMemoryCard);
+    } else if (!FrameCache::isDirty(job.slot, job.address)) {
+      FrameCache::remove(job.slot, job.address);
+    }
+
+    // Wait until all queued frames are returned
+    if (__transfer.completed < __transfer.submitted) return;
+    if (__transfer.result == PSX::FrameResult::Success && __transfer.completed < __transfer.count) return;
+    __finish();
+  }
+
+  /**
+   * @brief Get memory card status.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @return Combination of `MemoryCardStatus`
+   * @note Answered from memory, presence is tracked by `CardPresence`.
+   */
+  uint16_t getStatus(int slot) {
+    if (WriteBehind::hasFailed(slot)) return MemoryCardStatus::Error;
+    if (__isRunning && __transfer.slot == slot) {
+      uint16_t busy = __transfer.type == PSXWorker::JobType::ReadMemoryCard ? MemoryCardStatus::Reading : MemoryCardStatus::Writing;
+      return MemoryCardStatus::Available | busy;
+    }
+    // Buffered frames are not on the card yet
+    if (WriteBehind::isPending(slot)) return MemoryCardStatus::Available | MemoryCardStatus::Writing;
+    if (__hasFailed[slot]) return MemoryCardStatus::Error;
+    return CardPresence::getStatus(slot);
+  }
+
+  /**
+   * @brief Check if the RAM range can be read (no frame of the running read transfer is still coming from the card).
+   * @param ramAddress RAM address
+   * @param length Byte count
+   * @note Host may pull frames while the card is still reading the next ones, frames in flight are written by PSX core.
+   */
+  bool isReady(uint32_t ramAddress, uint32_t length) {
+    if (!__isRunning || __transfer.type != PSXWorker::JobType::ReadMemoryCard || length == 0) return true;
+    uint32_t end = __transfer.ramAddress + (uint32_t)__transfer.count * PSX_MEMCARD_FRAME_SIZE;
+    if (ramAddress >= end || ramAddress + length <= __transfer.ramAddress) return true;
+
+    uint32_t first = ramAddress > __transfer.ramAddress ? (ramAddress - __transfer.ramAddress) / PSX_MEMCARD_FRAME_SIZE : 0;
+    uint32_t last = (ramAddress + length < end ? ramAddress + length - 1 : end - 1) - __transfer.ramAddress;
+    last /= PSX_MEMCARD_FRAME_SIZE;
+    if (last >= __transfer.submitted) return false;
+    for (uint16_t frame : __transfer.inFlight) {
+      if (frame != __NoFrame && frame >= first && frame <= last) return false;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Drop everything known about the card. (call when the card is removed or replaced)
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  void onCardRemoved(int slot) {
+    __hasFailed[slot] = false;
+    WriteBehind::invalidate(slot);
+    FrameCache::invalidate(slot);
+    Prefetcher::invalidate(slot);
+  }
+
+  /**
+   * @brief Check if a transfer is running.
+   */
+  bool isBusy() {
+    return __isRunning;
+  }
+}
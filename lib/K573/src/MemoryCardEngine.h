@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <PSXJob.h>
+#include "K573.h"
+
+#ifndef K573_MEMCARD_FRAMES_IN_FLIGHT
+// Frames queued to PSX core at once (keeps PSX core busy while JVS core handles completion)
+#define K573_MEMCARD_FRAMES_IN_FLIGHT 2
+#endif
+#ifndef K573_MEMCARD_CACHE_HITS_PER_SERVICE
+// Frames copied from `FrameCache` in one `service` call
+#define K573_MEMCARD_CACHE_HITS_PER_SERVICE 8
+#endif
+
+/**
+ * @brief Background executor of `K573MemoryCardRead` and `K573MemoryCardWrite`.
+ * @note Command is acknowledged immediately, and frames are transferred by PSX core.
+ * Written frames are buffered by `WriteBehind`, read frames are served from `FrameCache` if possible.
+ * RAM is `RamStore`, page aligned frames are read into RAM pages directly and shared with `FrameCache`.
+ * Host polls the progress with `K573Status`.
+ */
+namespace MemoryCardEngine {
+  /**
+   * @brief Result of starting a transfer
+   */
+  enum StartResult {
+    /**
+     * @brief Transfer is queued
+     */
+    Started = 0,
+    /**
+     * @brief Another transfer is running
+     */
+    Busy = 1,
+    /**
+     * @brief RAM range or frame range is out of bounds
+     */
+    InvalidParameter = 2,
+    /**
+     * @brief Range contains a frame that failed persistently (reported without touching the bus)
+     */
+    BadFrame = 3,
+  };
+
+  /**
+   * @brief Queue reading frames from memory card into RAM.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address First frame address (`0x00`-`0x3ff`)
+   * @param ramAddress Destination RAM address
+   * @param count Frame count
+   */
+  StartResult startRead(int slot, uint16_t address, uint32_t ramAddress, uint16_t count);
+
+  /**
+   * @brief Queue writing frames from RAM to memory card.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address First frame address (`0x00`-`0x3ff`)
+   * @param ramAddress Source RAM address
+   * @param count Frame count
+   */
+  StartResult startWrite(int slot, uint16_t address, uint32_t ramAddress, uint16_t count);
+
+  /**
+   * @brief Queue next frames to PSX core. (call from main loop)
+   */
+  void service();
+
+  /**
+   * @brief Handle finished memory card job.
+   * @param completion Job returned from PSX core
+   */
+  void onComplete(const PSXWorker::Completion &completion);
+
+  /**
+   * @brief Check if the RAM range can be read (no frame of the running read transfer is still coming from the card).
+   * @param ramAddress RAM address
+   * @param length Byte count
+   * @note Host may pull frames while the card is still reading the next ones, frames in flight are written by PSX core.
+   */
+  bool isReady(uint32_t ramAddress, uint32_t length);
+
+  /**
+   * @brief Drop everything known about the card. (call when the card is removed or replaced)
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  void onCardRemoved(int slot);
+
+  /**
+   * @brief Get memory card status.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @return Combination of `MemoryCardStatus`
+   * @note Answered from memory, presence is tracked by `CardPresence`.
+   */
+  uint16_t getStatus(int slot);
+
+  /**
+   * @brief Check if a transfer is running.
+   */
+  bool isBusy();
+}
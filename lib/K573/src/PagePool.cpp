@@ -0,0 +1,75 @@
+#include "PagePool.h"
+
+namespace PagePool {
+  // private variables & functions
+  namespace {
+    uint8_t __pages[K573_PAGE_POOL_PAGES][K573_PAGE_SIZE] __attribute__((aligned(4)));
+    uint8_t __references[K573_PAGE_POOL_PAGES];
+    // Next free page (index + 1)
+    Page __next[K573_PAGE_POOL_PAGES];
+    // Free list of released pages (index + 1)
+    Page __free = 0;
+    // Pages that have never been used
+    uint16_t __unused = K573_PAGE_POOL_PAGES;
+    uint16_t __freeCount = K573_PAGE_POOL_PAGES;
+  }
+
+  /**
+   * @brief Get an unused page (reference count is 1, content is undefined).
+   * @return `0` if no page is left
+   */
+  Page allocate() {
+    Page page = 0;
+    if (__free) {
+      page = __free;
+      __free = __next[page - 1];
+    } else if (__unused > 0) {
+      __unused--;
+      page = K573_PAGE_POOL_PAGES - __unused;
+    } else {
+      return 0;
+    }
+    __references[page - 1] = 1;
+    __freeCount--;
+    return page;
+  }
+
+  /**
+   * @brief Add a reference to the page.
+   */
+  void retain(Page page) {
+    if (page) __references[page - 1]++;
+  }
+
+  /**
+   * @brief Remove a reference, the page is returned to the pool when no one refers to it.
+   */
+  void release(Page page) {
+    if (!page || __references[page - 1] == 0) return;
+    if (--__references[page - 1] > 0) return;
+    __next[page - 1] = __free;
+    __free = page;
+    __freeCount++;
+  }
+
+  /**
+   * @brief Get the page data (`K573_PAGE_SIZE` bytes).
+   */
+  uint8_t *data(Page page) {
+    return __pages[page - 1];
+  }
+
+  /**
+   * @brief Check if the page is referred from more than one place (must be copied before written).
+   */
+  bool isShared(Page page) {
+    return page && __references[page - 1] > 1;
+  }
+
+  /**
+   * @brief Count of unused pages.
+   */
+  uint16_t countFree() {
+    return __freeCount;
+  }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <PSX.h>
+#include "FrameCache.h"
+
+#ifndef K573_RAM_PAGES
+// RAM buffer pages that can be mapped at once (512 pages = 64KB)
+#define K573_RAM_PAGES 512
+#endif
+// Page size (same as memory card frame, so a frame can be shared as a page)
+#define K573_PAGE_SIZE PSX_MEMCARD_FRAME_SIZE
+// Pages shared by RAM buffer and frame cache (each of them never holds more than its own budget)
+#define K573_PAGE_POOL_PAGES (K573_RAM_PAGES + K573_FRAME_CACHE_FRAMES)
+
+/**
+ * @brief Fixed pool of reference counted pages (no heap).
+ * @note A page referenced by both `RamStore` and `FrameCache` is shared, and copied by the writer before modified.
+ */
+namespace PagePool {
+  /**
+   * @brief Page handle (`0`: none, otherwise index + 1)
+   */
+  typedef uint16_t Page;
+
+  /**
+   * @brief Get an unused page (reference count is 1, content is undefined).
+   * @return `0` if no page is left
+   */
+  Page allocate();
+
+  /**
+   * @brief Add a reference to the page.
+   */
+  void retain(Page page);
+
+  /**
+   * @brief Remove a reference, the page is returned to the pool when no one refers to it.
+   */
+  void release(Page page);
+
+  /**
+   * @brief Get the page data (`K573_PAGE_SIZE` bytes).
+   */
+  uint8_t *data(Page page);
+
+  /**
+   * @brief Check if the page is referred from more than one place (must be copied before written).
+   */
+  bool isShared(Page page);
+
+  /**
+   * @brief Count of unused pages.
+   */
+  uint16_t countFree();
+}
@@ -0,0 +1,278 @@
+#include <string.h>
+#include <PSXWorker.h>
+#include "CardPresence.h"
+#include "FrameCache.h"
+#include "Prefetcher.h"
+
+namespace Prefetcher {
+  // private variables & functions
+  namespace {
+    // Directory entry: block allocation state
+    enum BlockState {
+      // In use, first block of the save
+      First = 0x51,
+      // In use, middle block of the save
+      Middle = 0x52,
+      // In use, last block of the save
+      Last = 0x53,
+    };
+    // Directory entry: no next block
+    const uint16_t __NO_NEXT_BLOCK = 0xffff;
+
+    /**
+     * @brief Read ahead stream of the slot
+     */
+    struct Stream {
+      // Last frame read by host (`-1`: none)
+      int16_t lastAddress = -1;
+      // Next frame to read ahead
+      uint16_t cursor = 0;
+      // End of read ahead window (exclusive)
+      uint16_t limit = 0;
+      // Already moved to the next linked block
+      bool hasFollowedLink = false;
+    };
+
+    /**
+     * @brief Directory index of the slot
+     */
+    struct Directory {
+      // Parsed directory frames (bit N: frame N)
+      uint16_t loaded;
+      uint8_t state[PSX_MEMCARD_BLOCK_COUNTS];
+      uint8_t next[PSX_MEMCARD_BLOCK_COUNTS];
+      uint8_t first[PSX_MEMCARD_BLOCK_COUNTS];
+    };
+
+    Stream __streams[K573_SLOT_COUNTS];
+    Directory __directories[K573_SLOT_COUNTS];
+    // Read ahead frames not used yet (bit per frame)
+    uint32_t __prefetched[K573_SLOT_COUNTS][K573_MEMCARD_FRAMES / 32];
+
+    uint8_t __buffer[PSX_MEMCARD_FRAME_SIZE];
+    bool __isWaiting = false;
+    // Incremented on `invalidate` to ignore jobs queued before
+    uint16_t __generation = 0;
+
+    Statistics __statistics;
+
+    bool __isPrefetched(int slot, uint16_t address) {
+      return __prefetched[slot][address / 32] & (1u << (address % 32));
+    }
+
+    void __setPrefetched(int slot, uint16_t address, bool value) {
+      if (value) __prefetched[slot][address / 32] |= 1u << (address % 32);
+      else __prefetched[slot][address / 32] &= ~(1u << (address % 32));
+    }
+
+    /**
+     * @brief Rebuild `first` table by following the links from each first block.
+     * @param directory Directory of the slot
+     */
+    void __buildChains(Directory &directory) {
+      memset(directory.first, 0, sizeof(directory.first));
+      for (uint8_t block = 1; block < PSX_MEMCARD_BLOCK_COUNTS; block++) {
+        if (directory.state[block] != BlockState::First) continue;
+        // At most 15 blocks, guards against broken (looped) links
+        uint8_t current = block;
+        for (int i = 1; i < PSX_MEMCARD_BLOCK_COUNTS && current != 0 && directory.first[current] == 0; i++) {
+          directory.first[current] = block;
+          current = directory.next[current];
+        }
+      }
+    }
+
+    /**
+     * @brief Parse the directory frame.
+     * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+     * @param block Block number described by the frame (`1`-`15`)
+     * @param data Frame data (128 bytes)
+     */
+    void __parseDirectoryFrame(int slot, uint8_t block, const uint8_t *data) {
+      Directory &directory = __directories[slot];
+      // Last byte is XOR of the other bytes
+      uint8_t checksum = 0;
+      for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE; i++) {
+        checksum ^= data[i];
+      }
+      uint16_t next = data[0x08] | (data[0x09] << 8);
+      bool isUsed = checksum == 0 && data[0] >= BlockState::First && data[0] <= BlockState::Last;
+
+      directory.state[block] = isUsed ? data[0] : 0;
+      directory.next[block] = isUsed && next != __NO_NEXT_BLOCK && next < PSX_MEMCARD_BLOCK_COUNTS - 1 ? next + 1 : 0;
+      directory.loaded |= 1u << block;
+      __buildChains(directory);
+    }
+
+    /**
+     * @brief Choose the next frame to read ahead.
+     * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+     * @param address Chosen frame address
+     * @return `false` if nothing to read
+     */
+    bool __tryChoose(int slot, uint16_t &address) {
+      // Directory first, it is needed to follow the links
+      uint16_t missing = ~__directories[slot].loaded;
+      if (missing && __streams[slot].lastAddress >= 0) {
+        for (uint16_t frame = 0; frame < K573_DIRECTORY_FRAMES; frame++) {
+          if (!(missing & (1u << frame)) || FrameCache::contains(slot, frame)) continue;
+          address = frame;
+          return true;
+        }
+      }
+
+      Stream &stream = __streams[slot];
+      for (int i = 0; i < PSX_MEMCARD_FRAMES_IN_BLOCK; i++) {
+        if (stream.cursor >= stream.limit) {
+          // Reached the end of the block, continue to the next linked block once
+          uint8_t block = (stream.limit - 1) / PSX_MEMCARD_FRAMES_IN_BLOCK;
+          uint8_t next = stream.limit > 0 ? __directories[slot].next[block] : 0;
+          if (stream.hasFollowedLink || next == 0) return false;
+          stream.cursor = next * PSX_MEMCARD_FRAMES_IN_BLOCK;
+          stream.limit = stream.cursor + PSX_MEMCARD_FRAMES_IN_BLOCK;
+          stream.hasFollowedLink = true;
+        }
+        address = stream.cursor++;
+        if (!FrameCache::contains(slot, address)) return true;
+      }
+      return false;
+    }
+  }
+
+  /**
+   * @brief Notify the frame transferred to/from host.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @param data Frame data (128 bytes)
+   * @param isRead `true` if the host read the frame, `false` if wrote
+   */
+  void onFrame(int slot, uint16_t address, const uint8_t *data, bool isRead) {
+    if (slot < 0 || slot >= K573_SLOT_COUNTS || address >= K573_MEMCARD_FRAMES) return;
+
+    if (address > 0 && address < K573_DIRECTORY_FRAMES) __parseDirectoryFrame(slot, address, data);
+    else if (address == 0) __directories[slot].loaded |= 1;
+    if (__isPrefetched(slot, address)) {
+      // Written by host before read, the read ahead data is never used
+      if (isRead) __statistics.useful++;
+      else __statistics.wasted++;
+      __setPrefetched(slot, address, false);
+    }
+    if (!isRead) return;
+
+    Stream &stream = __streams[slot];
+    if (address == stream.lastAddress + 1) {
+      // Sequential access: read ahead the rest of the block
+      uint16_t end = (address / PSX_MEMCARD_FRAMES_IN_BLOCK + 1) * PSX_MEMCARD_FRAMES_IN_BLOCK;
+      if (stream.cursor <= address || stream.cursor > end) {
+        stream.cursor = address + 1;
+        stream.limit = end;
+        stream.hasFollowedLink = false;
+      }
+    } else {
+      stream.cursor = 0;
+      stream.limit = 0;
+      stream.hasFollowedLink = true;
+    }
+    stream.lastAddress = address;
+  }
+
+  /**
+   * @brief Notify the frame evicted from `FrameCache`. (pass to `FrameCache::setEvictionListener`)
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  void onEvicted(int slot, uint16_t address) {
+    if (slot < 0 || slot >= K573_SLOT_COUNTS || address >= K573_MEMCARD_FRAMES || !__isPrefetched(slot, address)) return;
+    // Host reads it from the card again, so it is not a useful read ahead
+    __statistics.wasted++;
+    __setPrefetched(slot, address, false);
+  }
+
+  /**
+   * @brief Forget directory and read ahead state. (call when the card is removed or replaced)
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  void invalidate(int slot) {
+    if (slot < 0 || slot >= K573_SLOT_COUNTS) return;
+    for (int i = 0; i < K573_MEMCARD_FRAMES / 32; i++) {
+      __statistics.wasted += __builtin_popcount(__prefetched[slot][i]);
+      __prefetched[slot][i] = 0;
+    }
+    memset(&__directories[slot], 0, sizeof(Directory));
+    __streams[slot] = { -1, 0, 0, false };
+    __generation++;
+  }
+
+  /**
+   * @brief Queue one read ahead frame to PSX core if idle. (call from main loop)
+   * @param isIdle `true` if no transfer is running and JVS link is idle
+   */
+  void service(bool isIdle) {
+    if (!isIdle || __isWaiting) return;
+
+    for (int slot = 0; slot < K573_SLOT_COUNTS; slot++) {
+      uint16_t address;
+      if (!__tryChoose(slot, address)) continue;
+
+      PSXWorker::Job job;
+      job.type = PSXWorker::JobType::ReadMemoryCard;
+      job.slot = slot;
+      job.address = address;
+      job.buffer = __buffer;
+      job.owner = K573::JobOwner::Prefetch;
+      job.tag = __generation;
+      if (!PSXWorker::trySubmit(job)) return;
+      __isWaiting = true;
+      return;
+    }
+  }
+
+  /**
+   * @brief Handle finished prefetch job.
+   * @param completion Job returned from PSX core
+   */
+  void onComplete(const PSXWorker::Completion &completion) {
+    const PSXWorker::Job &job = completion.job;
+    __isWaiting = false;
+    CardPresence::onResult(job.slot, completion.result);
+    if (job.tag != __generation || completion.result != PSX::FrameResult::Success) return;
+
+    __statistics.issued++;
+    // Host has read or written the frame while reading, so the read ahead served nothing
+    if (FrameCache::contains(job.slot, job.address) || !FrameCache::store(job.slot, job.address, job.buffer, false)) {
+      __statistics.wasted++;
+      return;
+    }
+    __setPrefetched(job.slot, job.address, true);
+    if (job.address > 0 && job.address < K573_DIRECTORY_FRAMES) __parseDirectoryFrame(job.slot, job.address, job.buffer);
+    else if (job.address == 0) __directories[job.slot].loaded |= 1;
+  }
+
+  /**
+   * @brief Get the next block of the save.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param block Block number (`1`-`15`)
+   * @return Next block number, `0` if last block or unknown
+   */
+  uint8_t getNextBlock(int slot, uint8_t block) {
+    return block < PSX_MEMCARD_BLOCK_COUNTS ? __directories[slot].next[block] : 0;
+  }
+
+  /**
+   * @brief Get the first block of the save that uses the block.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param block Block number (`1`-`15`)
+   * @return First block number, `0` if free or unknown
+   */
+  uint8_t getFirstBlock(int slot, uint8_t block) {
+    return block < PSX_MEMCARD_BLOCK_COUNTS ? __directories[slot].first[block] : 0;
+  }
+
+  const Statistics &getStatistics() {
+    return __statistics;
+  }
+
+  void resetStatistics() {
+    memset(&__statistics, 0, sizeof(__statistics));
+  }
+}
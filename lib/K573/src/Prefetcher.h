@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <PSXJob.h>
+#include "K573.h"
+
+#ifndef K573_PREFETCH_IDLE_US
+// JVS link is treated as idle after this time without request (microseconds)
+#define K573_PREFETCH_IDLE_US 2000
+#endif
+// Directory frames (frame 0: header, frame 1-15: directory entry for block 1-15)
+#define K573_DIRECTORY_FRAMES PSX_MEMCARD_BLOCK_COUNTS
+
+/**
+ * @brief Reads ahead memory card frames into `FrameCache` while JVS link is idle.
+ * @note Directory (block 0) is parsed to follow the linked blocks of a save,
+ * and sequential access reads ahead the rest of the block, then the next linked block.
+ */
+namespace Prefetcher {
+  /**
+   * @brief Prefetch counters
+   */
+  struct Statistics {
+    // Frames read ahead
+    uint32_t issued;
+    // Read ahead frames that were requested by host later
+    uint32_t useful;
+    // Read ahead frames dropped before used (card was removed, frame was evicted or written by host,
+    // or host had read the frame before the read ahead finished)
+    uint32_t wasted;
+  };
+
+  /**
+   * @brief Notify the frame transferred to/from host.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @param data Frame data (128 bytes)
+   * @param isRead `true` if the host read the frame, `false` if wrote
+   */
+  void onFrame(int slot, uint16_t address, const uint8_t *data, bool isRead);
+
+  /**
+   * @brief Notify the frame evicted from `FrameCache`. (pass to `FrameCache::setEvictionListener`)
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  void onEvicted(int slot, uint16_t address);
+
+  /**
+   * @brief Forget directory and read ahead state. (call when the card is removed or replaced)
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  void invalidate(int slot);
+
+  /**
+   * @brief Queue one read ahead frame to PSX core if idle. (call from main loop)
+   * @param isIdle `true` if no transfer is running and JVS link is idle
+   */
+  void service(bool isIdle);
+
+  /**
+   * @brief Handle finished prefetch job.
+   * @param completion Job returned from PSX core
+   */
+  void onComplete(const PSXWorker::Completion &completion);
+
+  /**
+   * @brief Get the next block of the save.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param block Block number (`1`-`15`)
+   * @return Next block number, `0` if last block or unknown
+   */
+  uint8_t getNextBlock(int slot, uint8_t block);
+
+  /**
+   * @brief Get the first block of the save that uses the block.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param block Block number (`1`-`15`)
+   * @return First block number, `0` if free or unknown
+   */
+  uint8_t getFirstBlock(int slot, uint8_t block);
+
+  const Statistics &getStatistics();
+  void resetStatistics();
+}
@@ -0,0 +1,276 @@
+#include <string.h>
+#include "RamStore.h"
+
+// Region mapped by one page table (64KB)
+#define K573_RAM_REGION_BITS 16
+#define K573_RAM_REGIONS (1 << (K573_RAM_ADDRESS_BITS - K573_RAM_REGION_BITS))
+#define K573_RAM_PAGES_IN_REGION ((1 << K573_RAM_REGION_BITS) / K573_PAGE_SIZE)
+
+namespace RamStore {
+  // private variables & functions
+  namespace {
+    // Region -> page table (`0`: not mapped, otherwise index + 1)
+    uint8_t __directory[K573_RAM_REGIONS];
+    PagePool::Page __tables[K573_RAM_TABLES][K573_RAM_PAGES_IN_REGION];
+    // Region of each page table
+    uint8_t __regions[K573_RAM_TABLES];
+    // Mapped pages of each page table (`0`: the table can be taken over by another region)
+    uint16_t __tablePages[K573_RAM_TABLES];
+    uint16_t __mappedCount = 0;
+
+    const uint8_t __zeroFrame[K573_PAGE_SIZE] = {};
+
+    bool __isInRange(uint32_t address, uint32_t length) {
+      return address <= K573_RAM_SIZE && length <= K573_RAM_SIZE - address;
+    }
+
+    bool __isZero(const uint8_t *data, uint32_t length) {
+      for (uint32_t i = 0; i < length; i++) {
+        if (data[i]) return false;
+      }
+      return true;
+    }
+
+    /**
+     * @brief Count page tables without mapped pages.
+     */
+    uint8_t __countEmptyTables() {
+      uint8_t count = 0;
+      for (int table = 0; table < K573_RAM_TABLES; table++) {
+        if (__tablePages[table] == 0) count++;
+      }
+      return count;
+    }
+
+    /**
+     * @brief Get the page table entry of the address.
+     * @param address RAM address
+     * @param create `true` to assign a page table to the region if needed
+     * @return `nullptr` if the region has no page table
+     */
+    PagePool::Page *__entryOf(uint32_t address, bool create) {
+      uint32_t region = address >> K573_RAM_REGION_BITS;
+      if (!__directory[region]) {
+        if (!create) return nullptr;
+        int table = 0;
+        while (table < K573_RAM_TABLES && __tablePages[table] > 0) table++;
+        if (table >= K573_RAM_TABLES) return nullptr;
+        // Empty table of another region is taken over (its memory reads as zero anyway)
+        if (__directory[__regions[table]] == table + 1) __directory[__regions[table]] = 0;
+        __regions[table] = region;
+        __directory[region] = table + 1;
+      }
+      return &__tables[__directory[region] - 1][(address & ((1 << K573_RAM_REGION_BITS) - 1)) / K573_PAGE_SIZE];
+    }
+
+    /**
+     * @brief Count the page newly mapped at the address.
+     */
+    void __onMapped(uint32_t address) {
+      __mappedCount++;
+      __tablePages[__directory[address >> K573_RAM_REGION_BITS] - 1]++;
+    }
+
+    /**
+     * @brief Unmap the page at the address (reads as zero again).
+     * @param address RAM address
+     * @param entry Page table entry of the address
+     */
+    void __unmap(uint32_t address, PagePool::Page *entry) {
+      PagePool::release(*entry);
+      *entry = 0;
+      __mappedCount--;
+      __tablePages[__directory[address >> K573_RAM_REGION_BITS] - 1]--;
+    }
+
+    /**
+     * @brief Make the page private to RAM (map a new page, or copy the shared page).
+     * @param address RAM address
+     * @param entry Page table entry of the address
+     * @param preserve `false` if the whole page is going to be overwritten
+     * @return Page data, `nullptr` if no page is left
+     */
+    uint8_t *__makePrivate(uint32_t address, PagePool::Page *entry, bool preserve) {
+      if (*entry && !PagePool::isShared(*entry)) return PagePool::data(*entry);
+
+      PagePool::Page page = PagePool::allocate();
+      if (!page) return nullptr;
+      if (!*entry) {
+        if (preserve) memset(PagePool::data(page), 0, K573_PAGE_SIZE);
+        __onMapped(address);
+      } else {
+        if (preserve) memcpy(PagePool::data(page), PagePool::data(*entry), K573_PAGE_SIZE);
+        PagePool::release(*entry);
+      }
+      *entry = page;
+      return PagePool::data(page);
+    }
+  }
+
+  /**
+   * @brief Check if the range can be written (address space and free pages).
+   * @param address RAM address
+   * @param length Byte count
+   */
+  bool canWrite(uint32_t address, uint32_t length) {
+    if (!__isInRange(address, length)) return false;
+    if (length == 0) return true;
+
+    uint32_t newPages = 0;
+    uint32_t newTables = 0;
+    uint32_t lastRegion = K573_RAM_REGIONS;
+    uint32_t last = address + length - 1;
+    for (uint32_t page = address / K573_PAGE_SIZE; page <= last / K573_PAGE_SIZE; page++) {
+      uint32_t pageAddress = page * K573_PAGE_SIZE;
+      uint32_t region = pageAddress >> K573_RAM_REGION_BITS;
+      // Empty table of the region may be taken over by another region of the range first
+      if (region != lastRegion && (!__directory[region] || __tablePages[__directory[region] - 1] == 0)) newTables++;
+      lastRegion = region;
+      PagePool::Page *entry = __entryOf(pageAddress, false);
+      if (entry == nullptr || !*entry) newPages++;
+      if (newPages > (uint32_t)(K573_RAM_PAGES - __mappedCount)) return false;
+    }
+    return newTables <= __countEmptyTables();
+  }
+
+  /**
+   * @brief Read bytes from RAM.
+   * @param address RAM address
+   * @param data Destination
+   * @param length Byte count
+   * @return `false` if the range is out of address space
+   */
+  bool read(uint32_t address, uint8_t *data, uint32_t length) {
+    if (!__isInRange(address, length)) return false;
+    while (length > 0) {
+      uint32_t offset = address % K573_PAGE_SIZE;
+      uint32_t chunk = K573_PAGE_SIZE - offset;
+      if (chunk > length) chunk = length;
+
+      PagePool::Page *entry = __entryOf(address, false);
+      if (entry != nullptr && *entry) memcpy(data, PagePool::data(*entry) + offset, chunk);
+      else memset(data, 0, chunk);
+      address += chunk;
+      data += chunk;
+      length -= chunk;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Write bytes to RAM (pages are mapped if needed).
+   * @param address RAM address
+   * @param data Source
+   * @param length Byte count
+   * @return `false` if the range is out of address space or no page is left (nothing is written)
+   */
+  bool write(uint32_t address, const uint8_t *data, uint32_t length) {
+    if (!canWrite(address, length)) return false;
+    while (length > 0) {
+      uint32_t offset = address % K573_PAGE_SIZE;
+      uint32_t chunk = K573_PAGE_SIZE - offset;
+      if (chunk > length) chunk = length;
+
+      // Zeros are not stored, so a region cleared by host gives its pages and table back
+      bool isZero = __isZero(data, chunk);
+      PagePool::Page *entry = __entryOf(address, !isZero);
+      if (!isZero || (entry != nullptr && *entry)) {
+        if (isZero && chunk == K573_PAGE_SIZE) {
+          __unmap(address, entry);
+        } else {
+          uint8_t *page = __makePrivate(address, entry, chunk < K573_PAGE_SIZE);
+          if (page == nullptr) return false;
+          memcpy(page + offset, data, chunk);
+          if (isZero && __isZero(page, K573_PAGE_SIZE)) __unmap(address, entry);
+        }
+      }
+      address += chunk;
+      data += chunk;
+      length -= chunk;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Get a frame for reading.
+   * @param address RAM address of the frame
+   * @param scratch Buffer used if the frame is not page aligned (128 bytes)
+   * @return Page data or `scratch`
+   */
+  const uint8_t *getFrame(uint32_t address, uint8_t *scratch) {
+    if (address % K573_PAGE_SIZE != 0 || !__isInRange(address, K573_PAGE_SIZE)) {
+      if (!read(address, scratch, K573_PAGE_SIZE)) memset(scratch, 0, K573_PAGE_SIZE);
+      return scratch;
+    }
+    PagePool::Page *entry = __entryOf(address, false);
+    return entry != nullptr && *entry ? PagePool::data(*entry) : __zeroFrame;
+  }
+
+  /**
+   * @brief Get the page for writing the whole page directly (e.g. by DMA).
+   * @param address Page aligned RAM address
+   * @return Page data, `nullptr` if not aligned or no page is left
+   * @note Shared page is copied here, so the pointer stays valid until the page is remapped.
+   */
+  uint8_t *getWritablePage(uint32_t address) {
+    if (address % K573_PAGE_SIZE != 0 || !canWrite(address, K573_PAGE_SIZE)) return nullptr;
+    return __makePrivate(address, __entryOf(address, true), true);
+  }
+
+  /**
+   * @brief Get the page mapped at the address.
+   * @param address Page aligned RAM address
+   * @return Page, `0` if not mapped
+   */
+  PagePool::Page getPage(uint32_t address) {
+    if (!__isInRange(address, K573_PAGE_SIZE)) return 0;
+    PagePool::Page *entry = __entryOf(address, false);
+    return entry != nullptr ? *entry : 0;
+  }
+
+  /**
+   * @brief Map the page at the address without copying (shared with the owner).
+   * @param address Page aligned RAM address
+   * @param page Page to share
+   * @return `false` if not aligned or no page table is left
+   */
+  bool mapPage(uint32_t address, PagePool::Page page) {
+    if (!page || address % K573_PAGE_SIZE != 0 || !canWrite(address, K573_PAGE_SIZE)) return false;
+    PagePool::Page *entry = __entryOf(address, true);
+    if (!*entry) __onMapped(address);
+    PagePool::retain(page);
+    PagePool::release(*entry);
+    *entry = page;
+    return true;
+  }
+
+  /**
+   * @brief Count of mapped pages.
+   */
+  uint16_t countMapped() {
+    return __mappedCount;
+  }
+
+  /**
+   * @brief Count of page tables holding mapped pages.
+   */
+  uint8_t countTables() {
+    return K573_RAM_TABLES - __countEmptyTables();
+  }
+
+  /**
+   * @brief Unmap all memory (reads as zero) and give every page and page table back.
+   * @note No transfer may use RAM pages (e.g. `getWritablePage`) while clearing.
+   */
+  void clear() {
+    for (int table = 0; table < K573_RAM_TABLES; table++) {
+      for (PagePool::Page &page : __tables[table]) {
+        PagePool::release(page);
+        page = 0;
+      }
+      __tablePages[table] = 0;
+    }
+    memset(__directory, 0, sizeof(__directory));
+    __mappedCount = 0;
+  }
+}
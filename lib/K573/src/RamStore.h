@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+#include "PagePool.h"
+
+// RAM address is 3 bytes in commands
+#define K573_RAM_ADDRESS_BITS 24
+#define K573_RAM_SIZE (1UL << K573_RAM_ADDRESS_BITS)
+#ifndef K573_RAM_TABLES
+// Page tables (each maps a 64KB region of RAM address space)
+#define K573_RAM_TABLES 8
+#endif
+
+/**
+ * @brief Sparse emulation of the 16MB RAM buffer addressed by K573 commands.
+ * @note Memory is mapped on demand in `K573_PAGE_SIZE` pages from `PagePool`, unmapped memory reads as zero.
+ * Page aligned frames can be shared with `FrameCache` (copied when either side writes).
+ * At most `K573_RAM_PAGES` pages in `K573_RAM_TABLES` distinct 64KB regions are mapped at a time. Pages overwritten
+ * with zeros are unmapped, and a page table without pages moves to the next region that needs one.
+ */
+namespace RamStore {
+  /**
+   * @brief Check if the range can be written (address space and free pages).
+   * @param address RAM address
+   * @param length Byte count
+   */
+  bool canWrite(uint32_t address, uint32_t length);
+
+  /**
+   * @brief Read bytes from RAM.
+   * @param address RAM address
+   * @param data Destination
+   * @param length Byte count
+   * @return `false` if the range is out of address space
+   */
+  bool read(uint32_t address, uint8_t *data, uint32_t length);
+
+  /**
+   * @brief Write bytes to RAM (pages are mapped if needed).
+   * @param address RAM address
+   * @param data Source
+   * @param length Byte count
+   * @return `false` if the range is out of address space or no page is left (nothing is written)
+   */
+  bool write(uint32_t address, const uint8_t *data, uint32_t length);
+
+  /**
+   * @brief Get a frame for reading.
+   * @param address RAM address of the frame
+   * @param scratch Buffer used if the frame is not page aligned (128 bytes)
+   * @return Page data or `scratch`
+   */
+  const uint8_t *getFrame(uint32_t address, uint8_t *scratch);
+
+  /**
+   * @brief Get the page for writing the whole page directly (e.g. by DMA).
+   * @param address Page aligned RAM address
+   * @return Page data, `nullptr` if not aligned or no page is left
+   * @note Shared page is copied here, so the pointer stays valid until the page is remapped.
+   */
+  uint8_t *getWritablePage(uint32_t address);
+
+  /**
+   * @brief Get the page mapped at the address.
+   * @param address Page aligned RAM address
+   * @return Page, `0` if not mapped
+   */
+  PagePool::Page getPage(uint32_t address);
+
+  /**
+   * @brief Map the page at the address without copying (shared with the owner).
+   * @param address Page aligned RAM address
+   * @param page Page to share
+   * @return `false` if not aligned or no page table is left
+   */
+  bool mapPage(uint32_t address, PagePool::Page page);
+
+  /**
+   * @brief Count of mapped pages.
+   */
+  uint16_t countMapped();
+
+  /**
+   * @brief Count of page tables holding mapped pages.
+   */
+  uint8_t countTables();
+
+  /**
+   * @brief Unmap all memory (reads as zero) and give every page and page table back.
+   * @note No transfer may use RAM pages (e.g. `getWritablePage`) while clearing.
+   */
+  void clear();
+}
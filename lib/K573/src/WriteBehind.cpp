@@ -0,0 +1,194 @@
+#include <string.h>
+#include <PSXWorker.h>
+#include "CardPresence.h"
+#include "MemoryCardEngine.h"
+#include "WriteBehind.h"
+
+namespace WriteBehind {
+  // private variables & functions
+  namespace {
+    // Copy of the frame being written (cached frame can be overwritten by host meanwhile)
+    uint8_t __buffer[PSX_MEMCARD_FRAME_SIZE];
+    bool __isWaiting = false;
+    int __waitingSlot = -1;
+    uint16_t __waitingAddress = 0;
+
+    // Next address to flush (flush goes in address order)
+    uint16_t __cursor[K573_SLOT_COUNTS];
+    bool __isFlushRequested = false;
+    bool __hasFailed[K573_SLOT_COUNTS];
+    // Incremented on `invalidate` to ignore jobs queued before
+    uint16_t __generation = 0;
+
+    Statistics __statistics;
+
+    uint16_t __countDirty() {
+      uint16_t count = 0;
+      for (int slot = 0; slot < K573_SLOT_COUNTS; slot++) {
+        count += FrameCache::countDirty(slot);
+      }
+      return count;
+    }
+
+    /**
+     * @brief Find the next dirty frame from the cursor (wrap around once).
+     * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+     * @param address Found frame address
+     */
+    bool __tryChoose(int slot, uint16_t &address) {
+      if (FrameCache::findDirty(slot, __cursor[slot], address)) return true;
+      return __cursor[slot] > 0 && FrameCache::findDirty(slot, 0, address);
+    }
+  }
+
+  /**
+   * @brief Buffer the frame written by host.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @param data Frame data (128 bytes)
+   * @return `false` if the cache is full of dirty frames (retry after flushing)
+   */
+  bool tryWrite(int slot, uint16_t address, const uint8_t *data) {
+    bool isDirty = FrameCache::isDirty(slot, address);
+    bool isWriting = __isWaiting && __waitingSlot == slot && __waitingAddress == address;
+
+    const uint8_t *cached = FrameCache::peek(slot, address);
+    if (cached != nullptr && memcmp(cached, data, PSX_MEMCARD_FRAME_SIZE) == 0) {
+      __statistics.requested++;
+      if (isDirty) __statistics.coalesced++;
+      else __statistics.skipped++;
+      return true;
+    }
+
+    if (!FrameCache::store(slot, address, data, true)) return false;
+    __statistics.requested++;
+    // Frame being written now must be written again with the new data
+    if (isDirty && !isWriting) __statistics.coalesced++;
+    return true;
+  }
+
+  /**
+   * @brief Request to write all buffered frames as soon as possible (durability barrier).
+   */
+  void flush() {
+    if (__isWaiting || __countDirty() > 0) __isFlushRequested = true;
+  }
+
+  /**
+   * @brief Check if the slot has frames not written to the card yet.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  bool isPending(int slot) {
+    return FrameCache::countDirty(slot) > 0 || (__isWaiting && __waitingSlot == slot);
+  }
+
+  /**
+   * @brief Check if writing to the slot has failed since the last `clearError`.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  bool hasFailed(int slot) {
+    return __hasFailed[slot];
+  }
+
+  /**
+   * @brief Clear the error flag of the slot. (call when host starts a new transfer)
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  void clearError(int slot) {
+    __hasFailed[slot] = false;
+  }
+
+  /**
+   * @brief Drop buffered frames of the slot. (call when the card is removed or replaced)
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @note Dropped frames are counted as `failed` and reported as `Error` status.
+   */
+  void invalidate(int slot) {
+    // Frame being written is still dirty, so it is also counted here
+    uint16_t dropped = FrameCache::countDirty(slot);
+    if (__isWaiting && __waitingSlot == slot) {
+      __generation++;
+      __isWaiting = false;
+    }
+    if (dropped > 0) {
+      __statistics.failed += dropped;
+      __hasFailed[slot] = true;
+    }
+    __cursor[slot] = 0;
+  }
+
+  /**
+   * @brief Queue one dirty frame to PSX core if needed. (call from main loop)
+   * @param isIdle `true` if no transfer is running and JVS link is idle
+   */
+  void service(bool isIdle) {
+    if (__isWaiting) return;
+    bool isUrgent = __isFlushRequested || __countDirty() >= K573_WRITE_BEHIND_HIGH_WATER;
+    if (!isIdle && !isUrgent) return;
+
+    for (int slot = 0; slot < K573_SLOT_COUNTS; slot++) {
+      uint16_t address;
+      if (!__tryChoose(slot, address)) continue;
+
+      memcpy(__buffer, FrameCache::peek(slot, address), PSX_MEMCARD_FRAME_SIZE);
+      PSXWorker::Job job;
+      job.type = PSXWorker::JobType::WriteMemoryCard;
+      job.slot = slot;
+      job.address = address;
+      job.buffer = __buffer;
+      job.owner = K573::JobOwner::Flush;
+      job.tag = __generation;
+      if (!PSXWorker::trySubmit(job)) return;
+
+      __isWaiting = true;
+      __waitingSlot = slot;
+      __waitingAddress = address;
+      __cursor[slot] = address + 1;
+      return;
+    }
+    // Everything is on the card
+    __isFlushRequested = false;
+  }
+
+  /**
+   * @brief Handle finished flush job.
+   * @param completion Job returned from PSX core
+   */
+  void onComplete(const PSXWorker::Completion &completion) {
+    const PSXWorker::Job &job = completion.job;
+    if (job.tag != __generation) return;
+    __isWaiting = false;
+
+    switch (completion.result) {
+      case PSX::FrameResult::Success: {
+        __statistics.physicalWrites++;
+        // Host might have written again while writing
+        const uint8_t *cached = FrameCache::peek(job.slot, job.address);
+        if (cached != nullptr && memcmp(cached, job.buffer, PSX_MEMCARD_FRAME_SIZE) == 0) FrameCache::markClean(job.slot, job.address);
+        break;
+      }
+      case PSX::FrameResult::NoDevice:
+        // Buffered frames (including this one) are counted as failed
+        MemoryCardEngine::onCardRemoved(job.slot);
+        break;
+      default: {
+        // Do not retry forever, report `Error` to host instead
+        __statistics.failed++;
+        __hasFailed[job.slot] = true;
+        // Host might have written again while writing, the new data stays dirty for the next flush
+        const uint8_t *cached = FrameCache::peek(job.slot, job.address);
+        if (cached != nullptr && memcmp(cached, job.buffer, PSX_MEMCARD_FRAME_SIZE) == 0) FrameCache::remove(job.slot, job.address);
+        break;
+      }
+    }
+    CardPresence::onResult(job.slot, completion.result);
+  }
+
+  const Statistics &getStatistics() {
+    return __statistics;
+  }
+
+  void resetStatistics() {
+    memset(&__statistics, 0, sizeof(__statistics));
+  }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <PSXJob.h>
+#include "K573.h"
+#include "FrameCache.h"
+
+#ifndef K573_WRITE_BEHIND_HIGH_WATER
+// Dirty frames that start flushing even if JVS link is busy
+#define K573_WRITE_BEHIND_HIGH_WATER (K573_FRAME_CACHE_FRAMES / 2)
+#endif
+
+/**
+ * @brief Buffers memory card writes in `FrameCache` and writes them back in the background.
+ * @note Repeated writes to the same frame are merged, writes of unchanged data are skipped,
+ * and dirty frames are written in address order.
+ * `flush` is the durability barrier: host sees `Writing` status until all buffered frames are on the card.
+ */
+namespace WriteBehind {
+  /**
+   * @brief Write-behind counters
+   */
+  struct Statistics {
+    // Frames written by host
+    uint32_t requested;
+    // Writes merged into a frame still waiting to be written
+    uint32_t coalesced;
+    // Writes skipped because the card already has the same data
+    uint32_t skipped;
+    // Frames written to the card
+    uint32_t physicalWrites;
+    // Frames failed to write (or dropped because the card was removed)
+    uint32_t failed;
+  };
+
+  /**
+   * @brief Buffer the frame written by host.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @param data Frame data (128 bytes)
+   * @return `false` if the cache is full of dirty frames (retry after flushing)
+   */
+  bool tryWrite(int slot, uint16_t address, const uint8_t *data);
+
+  /**
+   * @brief Request to write all buffered frames as soon as possible (durability barrier).
+   */
+  void flush();
+
+  /**
+   * @brief Check if the slot has frames not written to the card yet.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  bool isPending(int slot);
+
+  /**
+   * @brief Check if writing to the slot has failed since the last `clearError`.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  bool hasFailed(int slot);
+
+  /**
+   * @brief Clear the error flag of the slot. (call when host starts a new transfer)
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  void clearError(int slot);
+
+  /**
+   * @brief Drop buffered frames of the slot. (call when the card is removed or replaced)
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @note Dropped frames are counted as `failed` and reported as `Error` status.
+   */
+  void invalidate(int slot);
+
+  /**
+   * @brief Queue one dirty frame to PSX core if needed. (call from main loop)
+   * @param isIdle `true` if no transfer is running and JVS link is idle
+   */
+  void service(bool isIdle);
+
+  /**
+   * @brief Handle finished flush job.
+   * @param completion Job returned from PSX core
+   */
+  void onComplete(const PSXWorker::Completion &completion);
+
+  const Statistics &getStatistics();
+  void resetStatistics();
+}
@@ -7,13 +7,18 @@
   License: https://github.com/ShendoXT/memcarduino/blob/f506860d0118bcef710503f4069833251da5d685/LICENSE
 */
 #include <SPI.h>
+#include <Gpio.h>
 #include "PSX.h"
+#include "PSXFrame.h"
 
 namespace PSX {
   // Private variables & functions
   namespace {
+    typedef Gpio::Pin<PSX_ATTENTION_PIN_1> __AttentionPin1;
+    typedef Gpio::Pin<PSX_ATTENTION_PIN_2> __AttentionPin2;
+
     volatile int __state = HIGH;
-    bool __isCompatibleMode = false;
+    uint32_t __clock = 0;
 
     /**
      * @brief Acknowledge the PSX device
@@ -24,46 +29,57 @@ namespace PSX {
     }
 
     /**
-     * @brief Activate or deactivate slot.
-     * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+     * @brief Activate or deactivate port (every device behind a multitap shares the line).
+     * @param port Port number (`0`: Port 1, `1`: Port 2)
      * @param status `LOW` to activate, `HIGH` to deactivate
      */
-    void __attention(int slot, int status) {
-      if (slot == 0) {
-        digitalWrite(PSX_ATTENTION_PIN_1, status);
+    void __attention(int port, int status) {
+      if (port == 0) {
+        __AttentionPin1::write(status);
       } else {
-        digitalWrite(PSX_ATTENTION_PIN_2, status);
+        __AttentionPin2::write(status);
       }
     }
 
+    /**
+     * @brief Change the SPI clock if the frame needs another one.
+     * @param clock PSX clock frequency (Hz), `0` for `PSX_SPI_CLOCK`
+     */
+    void __setClock(uint32_t clock) {
+      if (clock == 0) clock = PSX_SPI_CLOCK;
+      if (clock == __clock) return;
+      if (__clock != 0) SPI.endTransaction();
+      SPI.beginTransaction(SPISettings(clock, LSBFIRST, SPI_MODE3));
+      __clock = clock;
+    }
+
     /**
      * @brief Send a command to the PSX port.
      * @param command Command to send
-     * @param timeOut ACK signal timeout in microseconds
      * @param delay Delay in microseconds before sending the command
      * @return Response from the PSX device
      * @note Before sending a command, the attention signal must be set to `LOW`.
      */
-    uint8_t __sendCommand(uint8_t command, int timeOut, int delay) {
-      if (!__isCompatibleMode) timeOut = 3000;
+    uint8_t __sendCommand(uint8_t command, int delay) {
       __state = HIGH;
 
       if (delay > 0) delayMicroseconds(delay);
 
-      uint8_t res = SPI.transfer(command);
+      return SPI.transfer(command);
+    }
 
-      // Wait for the ACK signal from the Memory Card
-      while (__state == HIGH) {
-        timeOut--;
+    /**
+     * @brief Wait for the ACK signal of the command sent last.
+     * @param timeOut ACK signal timeout in microseconds (`0`: device does not send ACK)
+     * @return Microseconds until ACK was received (`timeOut` if timed out)
+     */
+    uint16_t __waitAck(int timeOut) {
+      uint16_t latency = 0;
+      while (latency < timeOut && __state == HIGH) {
+        latency++;
         delayMicroseconds(1);
-        if (timeOut == 0) {
-          // Timeout reached, card doesn't report ACK properly
-          __isCompatibleMode = true;
-          break;
-        }
       }
-
-      return res;
+      return latency;
     }
   }
 }
@@ -72,11 +88,9 @@ namespace PSX {
  * @brief Setup the pins for the PSX port.
  */
 void PSX::setup() {
-  pinMode(PSX_ATTENTION_PIN_1, OUTPUT);
-  pinMode(PSX_ATTENTION_PIN_2, OUTPUT);
+  __AttentionPin1::beginOutput(HIGH);
+  __AttentionPin2::beginOutput(HIGH);
   pinMode(PSX_ACKNOWLEDGE_PIN, INPUT_PULLUP);
-  digitalWrite(PSX_ATTENTION_PIN_1, HIGH);
-  digitalWrite(PSX_ATTENTION_PIN_2, HIGH);
 
 #ifdef ARDUINO_ARCH_RP2040
   SPI.setMISO(PSX_DATA_PIN);
@@ -84,7 +98,7 @@ void PSX::setup() {
   SPI.setSCK(PSX_CLOCK_PIN);
 #endif
   SPI.begin();
-  SPI.beginTransaction(SPISettings(125000, LSBFIRST, SPI_MODE3));
+  __setClock(PSX_SPI_CLOCK);
   pinMode(MISO, OUTPUT);
 
   attachInterrupt(digitalPinToInterrupt(PSX_ACKNOWLEDGE_PIN), __acknowledge, RISING);
@@ -101,76 +115,31 @@ void PSX::setup() {
  * @return `true` if the input was read successfully, `false` otherwise
  */
 bool PSX::tryReadControllerInput(int slot, uint8_t *output) {
-  // Use ACK detection mode by default
-  __isCompatibleMode = false;
-
-  // Activate device
-  __attention(slot, LOW);
-  delayMicroseconds(PSX_TRANSFER_WAIT);
-
-  __sendCommand(Device::Controller, 300, 45);           // Access Controller
-  uint16_t id = __sendCommand('B', 300, 45)             // Read Command (Returns Controller ID LSB)
-                & (__sendCommand(0x00, 300, 45) << 8);  // Returns Controller ID MSB
-
-  bool connected = id == 0x5a41;  // 5a41: Digital Controller
-  if (connected) {
-    *output++ = __sendCommand(0x00, 200, 0);  // Returns Digital switches LSB
-    *output++ = __sendCommand(0x00, 200, 0);  // Returns Digital switches MSB
-  } else {
-    *output++ = 0x00;
-    *output++ = 0x00;
-  }
-
-  //Deactivate device
-  __attention(slot, HIGH);
-
-  return connected;
+  Frame frame;
+  buildControllerFrame(frame, slot);
+  exchange(frame);
+  return parseControllerFrame(frame, output) == FrameResult::Success;
 }
 
 /**
  * @brief Read the data from PS1 memory card.
  * @param slot Slot number (`0`: Port 1, `1`: Port 2)
  * @param address Address of sector (`0x00`-`0x3ff`)
- * @param output Output buffer (128 bytes) if sets `nullptr`, this function only checks memory card availability.
- * @return `true` if the input was read successfully, `false` otherwise
+ * @param output Output buffer (128 bytes), `nullptr` to only check memory card availability (ID bytes, `address` is
+ * not read)
+ * @return `true` if the data was read successfully (or memory card is inserted), `false` otherwise
  */
 bool PSX::tryReadFromMemoryCard(int slot, int address, uint8_t *output) {
-  // Use ACK detection mode by default
-  __isCompatibleMode = false;
-
-  // Activate device
-  __attention(slot, LOW);
-  delayMicroseconds(PSX_TRANSFER_WAIT);
-
-  __sendCommand(Device::MemoryCard, 500, 70);             // Access Memory Card
-  if (__sendCommand('R', 500, 45) == 0xff) return false;  // Send read command
-  uint8_t id = __sendCommand(0x00, 500, 45);              // Receive Memory Card ID1
-  __sendCommand(0x00, 500, 45);                           // Receive Memory Card ID2 (ignore)
+  Frame frame;
+  // Availability needs only the ID bytes, not the whole 140 bytes frame
   if (output == nullptr) {
-    // Only check if the memory card is inserted
-    __attention(slot, HIGH);
-    return id == 0x5a;
+    buildProbeFrame(frame, slot);
+    exchange(frame);
+    return parseProbeFrame(frame) == FrameResult::Success;
   }
-  __sendCommand(highByte(address), 500, 45);                // Address MSB
-  __sendCommand(lowByte(address), 500, 45);                 // Address LSB
-  if (__sendCommand(0x00, 2800, 45) != 0x5c) return false;  // Receive Memory Card ACK1
-  __sendCommand(0x00, 2800, 0);                             // Receive Memory Card ACK2 (ignore)
-
-  uint8_t checksum = __sendCommand(0x00, 2800, 0);  // Receive Confirmed MSB
-  checksum ^= __sendCommand(0x00, 2800, 0);         // Receive Confirmed LSB
-  // Get 128 bytes data from the frame
-  for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE; i++) {
-    uint8_t b = __sendCommand(0x00, 150, 0);
-    *output++ = b;
-    checksum ^= b;
-  }
-  uint8_t receivedSum = __sendCommand(0x00, 500, 0);  // Checksum (MSB xor LSB xor Data)
-  uint8_t status = __sendCommand(0x00, 500, 0);       // Memory Card status byte
-
-  //Deactivate device
-  __attention(slot, HIGH);
-
-  return status == 'G' && checksum == receivedSum;  // 'N': Bad checksum, 0xFF: Bad sector
+  buildReadFrame(frame, slot, address);
+  exchange(frame);
+  return parseReadFrame(frame, output) == FrameResult::Success;
 }
 
 /**
@@ -181,33 +150,44 @@ bool PSX::tryReadFromMemoryCard(int slot, int address, uint8_t *output) {
  * @return `true` if the input was written successfully, `false` otherwise
  */
 bool PSX::tryWriteToMemoryCard(int slot, int address, uint8_t *input) {
-  // Use ACK detection mode by default
-  __isCompatibleMode = false;
+  Frame frame;
+  buildWriteFrame(frame, slot, address, input);
+  exchange(frame);
+  return parseWriteFrame(frame) == FrameResult::Success;
+}
+
+/**
+ * @brief Exchange the whole frame on SPI (blocking).
+ * @param frame Frame to exchange (see `PSXFrame.h`), `transferred` and `ackLatency` are updated
+ * @note Clock, attention delay and ACK timeouts follow `frame.timing`, after an ACK timeout the rest of the frame
+ * is exchanged without ACK if `frame.timing.hasAckFallback`.
+ */
+void PSX::exchange(Frame &frame) {
+  __setClock(frame.timing.clock);
 
   // Activate device
-  __attention(slot, LOW);
-  delayMicroseconds(PSX_TRANSFER_WAIT);
-
-  __sendCommand(Device::MemoryCard, 300, 45);             // Access Memory Card
-  if (__sendCommand('W', 300, 45) == 0xff) return false;  // Send write command
-  __sendCommand(0x00, 300, 45);                           // Memory Card ID1 (ignore)
-  __sendCommand(0x00, 300, 45);                           // Memory Card ID2 (ignore)
-  __sendCommand(highByte(address), 300, 45);              // Address MSB
-  __sendCommand(lowByte(address), 300, 45);               // Address LSB
-
-  uint8_t checksum = highByte(address) ^ lowByte(address);
-  // Write 128 bytes data to the frame
-  for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE; i++) {
-    __sendCommand(input[i], 150, 0);
-    checksum ^= input[i];
+  __attention(portOf(frame.slot), LOW);
+
+  frame.transferred = 0;
+  frame.ackLatency = 0;
+  bool isAckOptional = frame.timing.isAckOptional;
+  for (int i = 0; i < frame.length; i++) {
+    uint16_t timeOut = frame.ackTimeout(i);
+    frame.response[i] = __sendCommand(frame.command[i], frame.delay(i));
+    frame.transferred++;
+    // Nothing is driving the data line, no need to wait for ACK or continue
+    if (i == 1 && frame.response[i] == 0xff) break;
+
+    uint16_t latency = __waitAck(timeOut);
+    if (timeOut > 0 && latency >= timeOut) {
+      // Device stopped responding, the rest of the frame is not exchanged unless ACK is not reliable
+      if (!isAckOptional && !frame.timing.hasAckFallback) break;
+      isAckOptional = true;
+    } else if (!frame.isBusy(i) && latency > frame.ackLatency) {
+      frame.ackLatency = latency;
+    }
   }
-  __sendCommand(checksum, 200, 0);             // Checksum (MSB xor LSB xor Data)
-  __sendCommand(0x00, 200, 0);                 // Memory Card ACK1 (ignore)
-  __sendCommand(0x00, 200, 0);                 // Memory Card ACK2 (ignore)
-  uint8_t status = __sendCommand(0x00, 0, 0);  // Memory Card status byte
 
   // Deactivate device
-  __attention(slot, HIGH);
-
-  return status == 'G';  // 'N': Bad checksum, 0xFF: Bad sector
+  __attention(portOf(frame.slot), HIGH);
 }
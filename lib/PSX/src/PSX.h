@@ -1,3 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
 #pragma region
 #ifndef PSX_DATA_PIN
 // PSX Data(MISO) Pin
@@ -31,25 +35,87 @@
 #define PSX_MEMCARD_FRAMES_IN_BLOCK 64
 // Memory card frame size (128 bytes)
 #define PSX_MEMCARD_FRAME_SIZE 128
+// FLAG bit of a card not written since it was inserted (cleared by a successful write)
+#define PSX_MEMCARD_FLAG_NEW_CARD 0x08
+// Write test frame of the directory block (no save lives there), written to clear the new card FLAG
+#define PSX_MEMCARD_WRITE_TEST_FRAME 0x3f
 #define PSX_TRANSFER_WAIT 20
+#ifndef PSX_SPI_CLOCK
+// PSX clock frequency on SPI when the frame does not choose one (Hz)
+#define PSX_SPI_CLOCK 125000
+#endif
+#ifndef PSX_USE_PIO_TRANSPORT
+// `1`: exchange frames on the PIO transport with DMA (RP2040 only, `pio run -e waveshare_rp2040_zero_pio`),
+// SPI with the ACK interrupt is used if it is `0`, or if the PIO program or DMA channels cannot be claimed
+#define PSX_USE_PIO_TRANSPORT 0
+#endif
+#if PSX_USE_PIO_TRANSPORT && !defined(ARDUINO_ARCH_RP2040)
+#error "PSX_USE_PIO_TRANSPORT needs the RP2040 PIO"
+#endif
+#ifndef PSX_MULTITAP_SLOTS
+// Ports with a PS1 multitap plugged in (bit 0: Port 1, bit 1: Port 2), its batched read is 35 bytes long
+#define PSX_MULTITAP_SLOTS 0
+#endif
+// Ports (attention lines)
+#define PSX_PORT_COUNTS 2
+// Sub-ports of a multitap (A-D)
+#define PSX_MULTITAP_PORTS 4
+// Slots addressed by jobs and snapshots (slot N: Port `N & 1`, multitap sub-port `N >> 1`, so 0-1 are the ports)
+#define PSX_SLOT_COUNTS (PSX_MULTITAP_SLOTS ? PSX_PORT_COUNTS * PSX_MULTITAP_PORTS : PSX_PORT_COUNTS)
 
 namespace PSX {
+  struct Frame;
+
   /**
    * @brief PSX device IDs
    */
   enum Device {
     /**
-     * @brief Standard controller
+     * @brief Standard controller (behind a multitap, `+ 1`-`+ 3` address sub-ports B-D)
      */
     Controller = 0x01,
     // PS2Multitap = 0x21,
     // PS2DVDRemote = 0x61,
     /**
-     * @brief Memory card
+     * @brief Memory card (behind a multitap, `+ 1`-`+ 3` address sub-ports B-D)
      */
     MemoryCard = 0x81,
   };
 
+  /**
+   * @brief Get the port of the slot, the attention line to drive. (`0`: Port 1, `1`: Port 2)
+   * @param slot Slot number (`0`-`PSX_SLOT_COUNTS - 1`)
+   */
+  inline int portOf(int slot) {
+    return slot & 1;
+  }
+
+  /**
+   * @brief Get the multitap sub-port of the slot. (`0`: A or no multitap, `1`-`3`: B-D)
+   * @param slot Slot number (`0`-`PSX_SLOT_COUNTS - 1`)
+   */
+  inline int subPortOf(int slot) {
+    return slot >> 1;
+  }
+
+  /**
+   * @brief Get the slot number of a multitap sub-port.
+   * @param port Port (`0`: Port 1, `1`: Port 2)
+   * @param subPort Sub-port (`0`-`3`: A-D)
+   */
+  inline int slotOf(int port, int subPort) {
+    return port | subPort << 1;
+  }
+
+  /**
+   * @brief Check if the slot can hold a device. (sub-ports B-D only exist on ports of `PSX_MULTITAP_SLOTS`)
+   * @param slot Slot number
+   */
+  inline bool hasSlot(int slot) {
+    if (slot < 0 || slot >= PSX_SLOT_COUNTS) return false;
+    return subPortOf(slot) == 0 || ((PSX_MULTITAP_SLOTS >> portOf(slot)) & 1);
+  }
+
   /**
    * @brief Setup the pins for the PSX port.
    */
@@ -67,8 +133,9 @@ namespace PSX {
    * @brief Read the data from PS1 memory card.
    * @param slot Slot number (`0`: Port 1, `1`: Port 2)
    * @param address Address of sector (0x00-0x3ff)
-   * @param output Output buffer (128 bytes) if sets `nullptr`, this function only checks memory card availability.
-   * @return `true` if the input was read successfully, `false` otherwise
+   * @param output Output buffer (128 bytes), `nullptr` to only check memory card availability (ID bytes, `address` is
+   * not read)
+   * @return `true` if the data was read successfully (or memory card is inserted), `false` otherwise
    */
   bool tryReadFromMemoryCard(int slot, int address, uint8_t* output);
 
@@ -80,4 +147,12 @@ namespace PSX {
    * @return `true` if the input was written successfully, `false` otherwise
    */
   bool tryWriteToMemoryCard(int slot, int address, uint8_t* input);
+
+  /**
+   * @brief Exchange the whole frame on SPI (blocking).
+   * @param frame Frame to exchange (see `PSXFrame.h`), `transferred` and `ackLatency` are updated
+   * @note Clock, attention delay and ACK timeouts follow `frame.timing`, after an ACK timeout the rest of the frame
+   * is exchanged without ACK if `frame.timing.hasAckFallback`.
+   */
+  void exchange(Frame &frame);
 }
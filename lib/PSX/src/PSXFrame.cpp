@@ -0,0 +1,276 @@
+#include <string.h>
+#include "PSXFrame.h"
+
+namespace PSX {
+  const Timing DefaultTiming = {0, PSX_TRANSFER_WAIT, 0xffff, false, true};
+
+  // Private variables & functions
+  namespace {
+    /**
+     * @brief Fill the frame header.
+     * @param frame Frame to build
+     * @param type Frame type
+     * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+     * @param length Frame length
+     */
+    void __initialize(Frame &frame, FrameType type, int slot, uint16_t length) {
+      frame.type = type;
+      frame.slot = slot;
+      frame.length = length;
+      frame.transferred = 0;
+      frame.timing = DefaultTiming;
+      frame.ackLatency = 0;
+      memset(frame.command, 0, length);
+    }
+
+    /**
+     * @brief Check the memory card ID bytes in the response.
+     * @param frame Exchanged frame
+     * @return `true` if memory card responded
+     */
+    bool __isMemoryCard(const Frame &frame) {
+      if (frame.transferred < 3) return false;
+      if (frame.response[1] == 0xff) return false;  // Nothing is driving the data line
+      return frame.response[2] == 0x5a;             // Memory Card ID1
+    }
+
+    /**
+     * @brief Convert the memory card status byte to `FrameResult`.
+     * @param status Memory card status byte
+     */
+    FrameResult __toResult(uint8_t status) {
+      switch (status) {
+        case 'G': return FrameResult::Success;
+        case 'N': return FrameResult::BadChecksum;
+        default: return FrameResult::BadSector;  // 0xFF: Bad sector
+      }
+    }
+  }
+
+  /**
+   * @brief Delay before sending the byte.
+   * @param index Byte index
+   * @return Delay in microseconds
+   */
+  uint16_t Frame::delay(uint16_t index) const {
+    // Device needs some time after attention signal, then it paces the transfer with ACK.
+    return index == 0 ? this->timing.attentionDelay : 0;
+  }
+
+  /**
+   * @brief ACK signal timeout after sending the byte.
+   * @param index Byte index
+   * @return Timeout in microseconds (`0`: device does not send ACK for this byte)
+   */
+  uint16_t Frame::ackTimeout(uint16_t index) const {
+    // Device never sends ACK for the last byte
+    if (index + 1 >= this->length) return 0;
+
+    uint16_t timeout = 0;
+    switch (this->type) {
+      case FrameType::ControllerRead:
+      case FrameType::MultitapControllerRead:
+        timeout = index < 3 ? 300 : 200;
+        break;
+      case FrameType::MemoryCardRead:
+        if (index < 6) timeout = 500;                                 // Command, ID, Address
+        else if (index < 10) timeout = 2800;                          // ACK1, ACK2, Confirmed address
+        else if (index < 10 + PSX_MEMCARD_FRAME_SIZE) timeout = 150;  // Data
+        else timeout = 500;                                           // Checksum
+        break;
+      case FrameType::MemoryCardWrite:
+        if (index < 6) timeout = 300;                                // Command, ID, Address
+        else if (index < 6 + PSX_MEMCARD_FRAME_SIZE) timeout = 150;  // Data
+        else timeout = 200;                                          // Checksum, ACK1, ACK2
+        break;
+      case FrameType::MemoryCardProbe:
+        timeout = 500;  // Command, ID
+        break;
+    }
+    if (this->isBusy(index) || timeout < this->timing.ackLimit) return timeout;
+    return this->timing.ackLimit;
+  }
+
+  /**
+   * @brief Check if the device may hold ACK for a long time after the byte (e.g. memory card reads the flash).
+   * @param index Byte index
+   */
+  bool Frame::isBusy(uint16_t index) const {
+    // Memory card reads the sector between the address and the confirmed address
+    return this->type == FrameType::MemoryCardRead && index >= 6 && index < 10;
+  }
+
+  /**
+   * @brief Build a frame to read the input from PS1 digital controller.
+   * @param frame Frame to build
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  void buildControllerFrame(Frame &frame, int slot) {
+    __initialize(frame, FrameType::ControllerRead, slot, PSX_CONTROLLER_FRAME_LENGTH);
+    frame.command[0] = Device::Controller + subPortOf(slot);  // Access Controller
+    frame.command[1] = 'B';                                   // Read Command
+  }
+
+  /**
+   * @brief Build a frame to read the data from PS1 memory card.
+   * @param frame Frame to build
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Address of sector (`0x00`-`0x3ff`)
+   */
+  void buildReadFrame(Frame &frame, int slot, int address) {
+    __initialize(frame, FrameType::MemoryCardRead, slot, PSX_MEMCARD_READ_FRAME_LENGTH);
+    frame.command[0] = Device::MemoryCard + subPortOf(slot);  // Access Memory Card
+    frame.command[1] = 'R';                                   // Send read command
+    frame.command[4] = (address >> 8) & 0xff;                 // Address MSB
+    frame.command[5] = address & 0xff;                        // Address LSB
+  }
+
+  /**
+   * @brief Build a frame to write the data to PS1 memory card.
+   * @param frame Frame to build
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Address of sector (`0x00`-`0x3ff`)
+   * @param input Input buffer (128 bytes)
+   */
+  void buildWriteFrame(Frame &frame, int slot, int address, const uint8_t *input) {
+    __initialize(frame, FrameType::MemoryCardWrite, slot, PSX_MEMCARD_WRITE_FRAME_LENGTH);
+    frame.command[0] = Device::MemoryCard + subPortOf(slot);  // Access Memory Card
+    frame.command[1] = 'W';                                   // Send write command
+    frame.command[4] = (address >> 8) & 0xff;                 // Address MSB
+    frame.command[5] = address & 0xff;                        // Address LSB
+
+    uint8_t checksum = frame.command[4] ^ frame.command[5];
+    for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE; i++) {
+      frame.command[6 + i] = input[i];
+      checksum ^= input[i];
+    }
+    frame.command[6 + PSX_MEMCARD_FRAME_SIZE] = checksum;  // Checksum (MSB xor LSB xor Data)
+  }
+
+  /**
+   * @brief Build a frame to check if PS1 memory card is inserted (only ID bytes of the read command are exchanged).
+   * @param frame Frame to build
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  void buildProbeFrame(Frame &frame, int slot) {
+    __initialize(frame, FrameType::MemoryCardProbe, slot, PSX_MEMCARD_PROBE_FRAME_LENGTH);
+    frame.command[0] = Device::MemoryCard + subPortOf(slot);  // Access Memory Card
+    frame.command[1] = 'R';                                   // Send read command (card drops it when attention is released)
+  }
+
+  /**
+   * @brief Build a frame to read the controllers of every multitap sub-port in one attention cycle.
+   * @param frame Frame to build
+   * @param port Port of the multitap (`0`: Port 1, `1`: Port 2)
+   * @note Multitap answers `0x80` (instead of the controller ID) only if its previous frame was also batched,
+   * so the first frame after power on reaches the controller on sub-port A directly.
+   */
+  void buildMultitapControllerFrame(Frame &frame, int port) {
+    __initialize(frame, FrameType::MultitapControllerRead, port, PSX_MULTITAP_FRAME_LENGTH);
+    frame.command[0] = Device::Controller;  // Access Controller
+    frame.command[1] = 'B';                 // Read Command
+    frame.command[2] = 0x01;                // Batched read of every sub-port
+    for (int subPort = 0; subPort < PSX_MULTITAP_PORTS; subPort++) {
+      frame.command[3 + subPort * PSX_MULTITAP_PORT_LENGTH] = 'B';  // Read Command, forwarded to the sub-port
+    }
+  }
+
+  /**
+   * @brief Parse the response of controller frame.
+   * @param frame Exchanged frame
+   * @param output Output buffer (2 bytes), filled with `0x00` if failed
+   * @return `FrameResult.Success` if the input was read successfully
+   */
+  FrameResult parseControllerFrame(const Frame &frame, uint8_t *output) {
+    output[0] = 0x00;
+    output[1] = 0x00;
+    // 5a41: Digital Controller
+    if (frame.transferred < 3 || frame.response[1] != 0x41 || frame.response[2] != 0x5a) return FrameResult::NoDevice;
+    if (frame.transferred < frame.length) return FrameResult::Timeout;
+
+    output[0] = frame.response[3];  // Digital switches LSB
+    output[1] = frame.response[4];  // Digital switches MSB
+    return FrameResult::Success;
+  }
+
+  /**
+   * @brief Parse the response of memory card read frame.
+   * @param frame Exchanged frame
+   * @param output Output buffer (128 bytes), `nullptr` to validate only
+   * @return `FrameResult.Success` if the data was read successfully
+   */
+  FrameResult parseReadFrame(const Frame &frame, uint8_t *output) {
+    if (!__isMemoryCard(frame)) return FrameResult::NoDevice;
+    if (frame.transferred < frame.length) return FrameResult::Timeout;
+    if (frame.response[6] != 0x5c) return FrameResult::BadSector;  // Memory Card ACK1
+
+    const uint8_t *data = frame.response + 10;
+    uint8_t checksum = frame.response[8] ^ frame.response[9];  // Confirmed MSB xor LSB
+    for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE; i++) {
+      checksum ^= data[i];
+    }
+    FrameResult result = __toResult(frame.response[11 + PSX_MEMCARD_FRAME_SIZE]);
+    if (result != FrameResult::Success) return result;
+    if (checksum != frame.response[10 + PSX_MEMCARD_FRAME_SIZE]) return FrameResult::BadChecksum;
+
+    if (output != nullptr) memcpy(output, data, PSX_MEMCARD_FRAME_SIZE);
+    return FrameResult::Success;
+  }
+
+  /**
+   * @brief Parse the response of memory card write frame.
+   * @param frame Exchanged frame
+   * @return `FrameResult.Success` if the data was written successfully
+   */
+  FrameResult parseWriteFrame(const Frame &frame) {
+    if (!__isMemoryCard(frame)) return FrameResult::NoDevice;
+    if (frame.transferred < frame.length) return FrameResult::Timeout;
+    return __toResult(frame.response[frame.length - 1]);
+  }
+
+  /**
+   * @brief Parse the response of memory card probe frame.
+   * @param frame Exchanged frame
+   * @param isNewCard Set to `true` if the card reports FLAG bit 3 (not written since inserted), `nullptr` to ignore
+   * @return `FrameResult.Success` if memory card is inserted
+   */
+  FrameResult parseProbeFrame(const Frame &frame, bool *isNewCard) {
+    if (isNewCard != nullptr) *isNewCard = false;
+    if (!__isMemoryCard(frame)) return FrameResult::NoDevice;
+    if (frame.transferred < frame.length) return FrameResult::Timeout;
+    if (frame.response[3] != 0x5d) return FrameResult::NoDevice;  // Memory Card ID2
+    if (isNewCard != nullptr) *isNewCard = (frame.response[1] & PSX_MEMCARD_FLAG_NEW_CARD) != 0;
+    return FrameResult::Success;
+  }
+
+  /**
+   * @brief Parse a sub-port of the batched multitap read.
+   * @param frame Exchanged frame
+   * @param subPort Sub-port (`0`-`3`: A-D)
+   * @param output Output buffer (2 bytes), filled with `0x00` if failed
+   * @return `FrameResult.Success` if the input was read successfully
+   * @note Without the multitap ID, only sub-port A is read (controller answered directly).
+   */
+  FrameResult parseMultitapControllerFrame(const Frame &frame, int subPort, uint8_t *output) {
+    output[0] = 0x00;
+    output[1] = 0x00;
+    if (frame.transferred < 3) return FrameResult::NoDevice;
+    // 5a80: Multitap
+    if (frame.response[1] != 0x80 || frame.response[2] != 0x5a) {
+      // Controller on sub-port A answered alone (multitap was not batched yet, or no multitap), it stops after 5 bytes
+      if (subPort != 0 || frame.response[1] != 0x41 || frame.response[2] != 0x5a) return FrameResult::NoDevice;
+      if (frame.transferred < PSX_CONTROLLER_FRAME_LENGTH) return FrameResult::Timeout;
+      output[0] = frame.response[3];
+      output[1] = frame.response[4];
+      return FrameResult::Success;
+    }
+
+    const uint8_t *response = frame.response + 3 + subPort * PSX_MULTITAP_PORT_LENGTH;
+    if (frame.transferred < (response - frame.response) + 4) return FrameResult::Timeout;
+    // 5a41: Digital Controller (`0xff`: nothing plugged into the sub-port)
+    if (response[0] != 0x41 || response[1] != 0x5a) return FrameResult::NoDevice;
+    output[0] = response[2];  // Digital switches LSB
+    output[1] = response[3];  // Digital switches MSB
+    return FrameResult::Success;
+  }
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <stdint.h>
+#include "PSX.h"
+
+// Controller frame length ({`0x01`, `'B'`, `0x00`, `0x00`, `0x00`})
+#define PSX_CONTROLLER_FRAME_LENGTH 5
+// Memory card read frame length (Command 10 bytes + Data 128 bytes + Checksum + Status)
+#define PSX_MEMCARD_READ_FRAME_LENGTH (10 + PSX_MEMCARD_FRAME_SIZE + 2)
+// Memory card write frame length (Command 6 bytes + Data 128 bytes + Checksum + ACK1 + ACK2 + Status)
+#define PSX_MEMCARD_WRITE_FRAME_LENGTH (6 + PSX_MEMCARD_FRAME_SIZE + 4)
+// Memory card probe frame length (Command, Read command, ID1, ID2, then the read is abandoned)
+#define PSX_MEMCARD_PROBE_FRAME_LENGTH 4
+// Bytes of each sub-port in a batched multitap read (ID, `0x5a`, 6 data bytes)
+#define PSX_MULTITAP_PORT_LENGTH 8
+// Batched multitap read frame length ({`0x01`, `'B'`, `0x01`}, then every sub-port)
+#define PSX_MULTITAP_FRAME_LENGTH (3 + PSX_MULTITAP_PORTS * PSX_MULTITAP_PORT_LENGTH)
+// Longest frame exchanged in one attention cycle
+#define PSX_MAX_FRAME_LENGTH PSX_MEMCARD_READ_FRAME_LENGTH
+
+namespace PSX {
+  /**
+   * @brief Kind of command/response frame
+   */
+  enum FrameType {
+    ControllerRead = 0,
+    MemoryCardRead = 1,
+    MemoryCardWrite = 2,
+    MemoryCardProbe = 3,
+    MultitapControllerRead = 4,
+  };
+
+  /**
+   * @brief Result of a completed frame
+   */
+  enum FrameResult {
+    /**
+     * @brief Frame was exchanged and the response is valid
+     */
+    Success = 0,
+    /**
+     * @brief No device responded (or another device type responded)
+     */
+    NoDevice = 1,
+    /**
+     * @brief Device stopped sending ACK in the middle of the frame
+     */
+    Timeout = 2,
+    /**
+     * @brief Checksum mismatch (`'N'` status or bad received checksum)
+     */
+    BadChecksum = 3,
+    /**
+     * @brief Device reports bad sector (`0xff` status) or unexpected ACK code
+     */
+    BadSector = 4,
+  };
+
+  /**
+   * @brief Bus timing used to exchange a frame
+   */
+  struct Timing {
+    /**
+     * @brief PSX clock frequency (Hz), `0`: default of the transport
+     */
+    uint32_t clock;
+    /**
+     * @brief Delay between attention and the first byte in microseconds
+     */
+    uint16_t attentionDelay;
+    /**
+     * @brief Upper limit of ACK timeout in microseconds (except while the device is busy, see `Frame::isBusy`)
+     */
+    uint16_t ackLimit;
+    /**
+     * @brief `true` to keep exchanging after ACK timeout (for devices that do not report ACK properly)
+     */
+    bool isAckOptional;
+    /**
+     * @brief `true` to go on as `isAckOptional` after the first ACK timeout, unless nothing answers the second byte
+     * @note Used until the slot is calibrated (controllers, first probe), so a device that does not send ACK is
+     * still read. Calibrated timings leave it to `Calibrator::update`.
+     */
+    bool hasAckFallback;
+  };
+
+  /**
+   * @brief Timing that every device should accept (ACK is waited for, with a fallback if it does not come)
+   */
+  extern const Timing DefaultTiming;
+
+  /**
+   * @brief One attention cycle on the PSX bus (command bytes and response bytes)
+   * @note Frame does not depend on the bus implementation, so it can be built and parsed on any host.
+   */
+  struct Frame {
+    FrameType type;
+    /**
+     * @brief Slot number (`0`: Port 1, `1`: Port 2, `2`-`7`: multitap sub-ports B-D, see `PSX_SLOT_COUNTS`)
+     */
+    int slot;
+    /**
+     * @brief Count of bytes in `command` and `response`
+     */
+    uint16_t length;
+    /**
+     * @brief Count of bytes that were exchanged before the transfer stopped (`length` if completed)
+     */
+    uint16_t transferred;
+    /**
+     * @brief Bytes to send (Command)
+     */
+    uint8_t command[PSX_MAX_FRAME_LENGTH];
+    /**
+     * @brief Bytes received (Data)
+     */
+    uint8_t response[PSX_MAX_FRAME_LENGTH];
+    /**
+     * @brief Bus timing (`DefaultTiming` when built)
+     */
+    Timing timing;
+    /**
+     * @brief Longest ACK wait of the exchange in microseconds, excluding busy bytes (`0` if not measured by the bus)
+     */
+    uint16_t ackLatency;
+
+    /**
+     * @brief Delay before sending the byte.
+     * @param index Byte index
+     * @return Delay in microseconds
+     */
+    uint16_t delay(uint16_t index) const;
+
+    /**
+     * @brief ACK signal timeout after sending the byte.
+     * @param index Byte index
+     * @return Timeout in microseconds (`0`: device does not send ACK for this byte)
+     */
+    uint16_t ackTimeout(uint16_t index) const;
+
+    /**
+     * @brief Check if the device may hold ACK for a long time after the byte (e.g. memory card reads the flash).
+     * @param index Byte index
+     */
+    bool isBusy(uint16_t index) const;
+  };
+
+  /**
+   * @brief Build a frame to read the input from PS1 digital controller.
+   * @param frame Frame to build
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  void buildControllerFrame(Frame &frame, int slot);
+
+  /**
+   * @brief Build a frame to read the data from PS1 memory card.
+   * @param frame Frame to build
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Address of sector (`0x00`-`0x3ff`)
+   */
+  void buildReadFrame(Frame &frame, int slot, int address);
+
+  /**
+   * @brief Build a frame to write the data to PS1 memory card.
+   * @param frame Frame to build
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Address of sector (`0x00`-`0x3ff`)
+   * @param input Input buffer (128 bytes)
+   */
+  void buildWriteFrame(Frame &frame, int slot, int address, const uint8_t *input);
+
+  /**
+   * @brief Build a frame to check if PS1 memory card is inserted (only ID bytes of the read command are exchanged).
+   * @param frame Frame to build
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   */
+  void buildProbeFrame(Frame &frame, int slot);
+
+  /**
+   * @brief Build a frame to read the controllers of every multitap sub-port in one attention cycle.
+   * @param frame Frame to build
+   * @param port Port of the multitap (`0`: Port 1, `1`: Port 2)
+   * @note Multitap answers `0x80` (instead of the controller ID) only if its previous frame was also batched,
+   * so the first frame after power on reaches the controller on sub-port A directly.
+   */
+  void buildMultitapControllerFrame(Frame &frame, int port);
+
+  /**
+   * @brief Parse the response of controller frame.
+   * @param frame Exchanged frame
+   * @param output Output buffer (2 bytes), filled with `0x00` if failed
+   * @return `FrameResult.Success` if the input was read successfully
+   */
+  FrameResult parseControllerFrame(const Frame &frame, uint8_t *output);
+
+  /**
+   * @brief Parse the response of memory card read frame.
+   * @param frame Exchanged frame
+   * @param output Output buffer (128 bytes), `nullptr` to validate only
+   * @return `FrameResult.Success` if the data was read successfully
+   */
+  FrameResult parseReadFrame(const Frame &frame, uint8_t *output);
+
+  /**
+   * @brief Parse the response of memory card write frame.
+   * @param frame Exchanged frame
+   * @return `FrameResult.Success` if the data was written successfully
+   */
+  FrameResult parseWriteFrame(const Frame &frame);
+
+  /**
+   * @brief Parse the response of memory card probe frame.
+   * @param frame Exchanged frame
+   * @param isNewCard Set to `true` if the card reports FLAG bit 3 (not written since inserted), `nullptr` to ignore
+   * @return `FrameResult.Success` if memory card is inserted
+   */
+  FrameResult parseProbeFrame(const Frame &frame, bool *isNewCard = nullptr);
+
+  /**
+   * @brief Parse a sub-port of the batched multitap read.
+   * @param frame Exchanged frame
+   * @param subPort Sub-port (`0`-`3`: A-D)
+   * @param output Output buffer (2 bytes), filled with `0x00` if failed
+   * @return `FrameResult.Success` if the input was read successfully
+   * @note Without the multitap ID, only sub-port A is read (controller answered directly).
+   */
+  FrameResult parseMultitapControllerFrame(const Frame &frame, int subPort, uint8_t *output);
+}
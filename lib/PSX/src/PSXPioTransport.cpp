@@ -0,0 +1,325 @@
+#ifdef ARDUINO_ARCH_RP2040
+#include <hardware/clocks.h>
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+#include <hardware/sync.h>
+#include <Gpio.h>
+#include "PSXPioTransport.h"
+
+namespace PSX {
+  // Private variables & functions
+  namespace {
+    // PIO cycles per bit (4 cycles LOW, 4 cycles HIGH)
+    const uint32_t __CYCLES_PER_BIT = 8;
+    // PIO cycles per iteration of delay loop
+    const uint32_t __CYCLES_PER_DELAY = 8;
+    // PIO cycles per iteration of ACK wait loop
+    const uint32_t __CYCLES_PER_ACK_POLL = 2;
+
+    // Program addresses (relative to the loaded offset)
+    enum ProgramLabel {
+      Pull = 0,
+      DelayLoop = 2,
+      BitLoop = 4,
+      AckPoll = 9,
+      AckHigh = 11,
+      AckRelease = 13,
+    };
+
+    uint16_t __instructions[14];
+    const pio_program_t __program = { __instructions, 14, -1 };
+
+    PioTransport *__instance = nullptr;
+
+    /**
+     * @brief Build the PIO program.
+     * @note side-set (1 bit, optional) is CLOCK, OUT is COMMAND, IN is DATA, JMP PIN is ACK.
+     */
+    void __buildProgram() {
+      uint side0 = pio_encode_sideset_opt(1, 0);
+      uint side1 = pio_encode_sideset_opt(1, 1);
+      // Get next byte, wait the requested delay
+      __instructions[0] = pio_encode_pull(false, true) | side1;           // pull block     side 1
+      __instructions[1] = pio_encode_out(pio_y, 8);                        // out y, 8
+      __instructions[2] = pio_encode_jmp_y_dec(DelayLoop) | pio_encode_delay(7);  // jmp y-- delay [7]
+      // Shift 8 bits (LSB first), data is sampled on rising edge
+      __instructions[3] = pio_encode_set(pio_x, 7);                                   // set x, 7
+      __instructions[4] = pio_encode_out(pio_pins, 1) | side0 | pio_encode_delay(3);  // out pins, 1  side 0 [3]
+      __instructions[5] = pio_encode_in(pio_pins, 1) | side1 | pio_encode_delay(2);   // in pins, 1   side 1 [2]
+      __instructions[6] = pio_encode_jmp_x_dec(BitLoop) | side1;                      // jmp x-- bit  side 1
+      // Wait ACK (active LOW) until timeout
+      __instructions[7] = pio_encode_out(pio_y, 16);      // out y, 16
+      __instructions[8] = pio_encode_jmp_not_y(Pull);     // jmp !y pull (no ACK on the last byte)
+      __instructions[9] = pio_encode_jmp_pin(AckHigh);    // jmp pin high
+      __instructions[10] = pio_encode_jmp(AckRelease);    // jmp release
+      __instructions[11] = pio_encode_jmp_y_dec(AckPoll);  // jmp y-- poll
+      __instructions[12] = pio_encode_irq_wait(false, 0);  // irq wait 0 (timeout)
+      __instructions[13] = pio_encode_wait_gpio(true, PSX_ACKNOWLEDGE_PIN);  // wait 1 gpio ACK
+    }
+
+    /**
+     * @brief Activate or deactivate port (every device behind a multitap shares the line).
+     * @param port Port number (`0`: Port 1, `1`: Port 2)
+     * @param status `LOW` to activate, `HIGH` to deactivate
+     */
+    void __attention(int port, int status) {
+      if (port == 0) Gpio::Pin<PSX_ATTENTION_PIN_1>::write(status);
+      else Gpio::Pin<PSX_ATTENTION_PIN_2>::write(status);
+    }
+  }
+
+  /**
+   * @brief Load the PIO program and claim DMA channels.
+   * @param pio PIO instance to use
+   * @param bitrate PSX clock frequency used when `Frame::timing` does not choose one (Hz)
+   * @return `false` if no PIO state machine or DMA channel is available
+   */
+  bool PioTransport::begin(PIO pio, uint32_t bitrate) {
+    if (__instance != nullptr) return false;
+
+    __buildProgram();
+    if (!pio_can_add_program(pio, &__program)) return false;
+    int sm = pio_claim_unused_sm(pio, false);
+    if (sm < 0) return false;
+    __txChannel = dma_claim_unused_channel(false);
+    __rxChannel = dma_claim_unused_channel(false);
+    if (__txChannel < 0 || __rxChannel < 0) return false;
+
+    __pio = pio;
+    __sm = sm;
+    __offset = pio_add_program(pio, &__program);
+    __defaultBitrate = bitrate;
+
+    Gpio::Pin<PSX_ATTENTION_PIN_1>::beginOutput(HIGH);
+    Gpio::Pin<PSX_ATTENTION_PIN_2>::beginOutput(HIGH);
+
+    // Pins
+    pio_gpio_init(pio, PSX_CLOCK_PIN);
+    pio_gpio_init(pio, PSX_COMMAND_PIN);
+    pio_gpio_init(pio, PSX_DATA_PIN);
+    gpio_pull_up(PSX_DATA_PIN);
+    gpio_pull_up(PSX_ACKNOWLEDGE_PIN);
+    pio_sm_set_pins_with_mask(pio, sm, (1u << PSX_CLOCK_PIN) | (1u << PSX_COMMAND_PIN), (1u << PSX_CLOCK_PIN) | (1u << PSX_COMMAND_PIN));
+    pio_sm_set_consecutive_pindirs(pio, sm, PSX_CLOCK_PIN, 1, true);
+    pio_sm_set_consecutive_pindirs(pio, sm, PSX_COMMAND_PIN, 1, true);
+    pio_sm_set_consecutive_pindirs(pio, sm, PSX_DATA_PIN, 1, false);
+
+    // State machine
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, __offset, __offset + __program.length - 1);
+    sm_config_set_sideset(&c, 2, true, false);
+    sm_config_set_sideset_pins(&c, PSX_CLOCK_PIN);
+    sm_config_set_out_pins(&c, PSX_COMMAND_PIN, 1);
+    sm_config_set_in_pins(&c, PSX_DATA_PIN);
+    sm_config_set_jmp_pin(&c, PSX_ACKNOWLEDGE_PIN);
+    sm_config_set_out_shift(&c, true, false, 32);
+    sm_config_set_in_shift(&c, true, true, 8);  // autopush: byte is placed on [31:24]
+    pio_sm_init(pio, sm, __offset, &c);
+    __setBitrate(bitrate);
+
+    // TX: words -> TX FIFO
+    dma_channel_config tx = dma_channel_get_default_config(__txChannel);
+    channel_config_set_transfer_data_size(&tx, DMA_SIZE_32);
+    channel_config_set_read_increment(&tx, true);
+    channel_config_set_write_increment(&tx, false);
+    channel_config_set_dreq(&tx, pio_get_dreq(pio, sm, true));
+    dma_channel_configure(__txChannel, &tx, &pio->txf[sm], __words, 0, false);
+
+    // RX: RX FIFO [31:24] -> frame.response
+    dma_channel_config rx = dma_channel_get_default_config(__rxChannel);
+    channel_config_set_transfer_data_size(&rx, DMA_SIZE_8);
+    channel_config_set_read_increment(&rx, false);
+    channel_config_set_write_increment(&rx, true);
+    channel_config_set_dreq(&rx, pio_get_dreq(pio, sm, false));
+    dma_channel_configure(__rxChannel, &rx, nullptr, (io_rw_8 *)&pio->rxf[sm] + 3, 0, false);
+
+    __instance = this;
+    dma_channel_set_irq1_enabled(__rxChannel, true);
+    irq_add_shared_handler(DMA_IRQ_1, __onDmaComplete, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_1, true);
+
+    uint pioIrq = pio == pio0 ? PIO0_IRQ_0 : PIO1_IRQ_0;
+    pio_set_irq0_source_enabled(pio, pis_interrupt0, true);
+    irq_add_shared_handler(pioIrq, __onTimeout, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(pioIrq, true);
+
+    pio_sm_set_enabled(pio, sm, true);
+    return true;
+  }
+
+  bool PioTransport::tryStart(Frame &frame, CompleteCallback callback, void *context) {
+    if (__busy) return false;
+    __busy = true;
+    __frame = &frame;
+    __callback = callback;
+    __context = context;
+
+    __setBitrate(frame.timing.clock != 0 ? frame.timing.clock : __defaultBitrate);
+    __hasFallback = frame.timing.hasAckFallback && !frame.timing.isAckOptional;
+    __build(0, frame.length, frame.timing.isAckOptional, 0);
+    // PIO does not measure ACK latency
+    frame.ackLatency = 0;
+
+    __attention(portOf(frame.slot), LOW);
+    __run(0, frame.length);
+    return true;
+  }
+
+  bool PioTransport::isBusy() const {
+    return __busy;
+  }
+
+  /**
+   * @brief Stop the frame being exchanged (e.g. the completion did not come in time).
+   * @note `callback` is called with the bytes exchanged so far, nothing happens if no frame is being exchanged.
+   */
+  void PioTransport::abort() {
+    // Completion interrupts run on this core, so the frame can not finish meanwhile
+    uint32_t status = save_and_disable_interrupts();
+    if (__busy) {
+      uint16_t transferred = __received();
+      __restart();
+      __finish(transferred);
+    }
+    restore_interrupts(status);
+  }
+
+  /**
+   * @brief Change the PSX clock (state machine must be waiting for the next frame).
+   * @param bitrate PSX clock frequency (Hz)
+   */
+  void PioTransport::__setBitrate(uint32_t bitrate) {
+    if (bitrate == __bitrate) return;
+    pio_sm_set_clkdiv(__pio, __sm, (float)clock_get_hz(clk_sys) / (bitrate * __CYCLES_PER_BIT));
+    __bitrate = bitrate;
+    __cyclesPerMillisecond = bitrate * __CYCLES_PER_BIT / 1000;
+  }
+
+  /**
+   * @brief Fill the TX words of the bytes.
+   * @param first First byte index
+   * @param end Index after the last byte
+   * @param isAckOptional `true` to spend each ACK timeout as the delay of the next byte instead of waiting for ACK
+   * @param skippedAck Microseconds added to the delay of the first byte
+   */
+  void PioTransport::__build(uint16_t first, uint16_t end, bool isAckOptional, uint32_t skippedAck) {
+    const Frame &frame = *__frame;
+    for (int i = first; i < end; i++) {
+      uint32_t delay = (frame.delay(i) + skippedAck) * __cyclesPerMillisecond / 1000 / __CYCLES_PER_DELAY;
+      uint32_t timeout = frame.ackTimeout(i) * __cyclesPerMillisecond / 1000 / __CYCLES_PER_ACK_POLL;
+      skippedAck = 0;
+      if (isAckOptional) {
+        skippedAck = frame.ackTimeout(i);
+        timeout = 0;
+      }
+      if (delay > 0xff) delay = 0xff;
+      if (timeout > 0xffff) timeout = 0xffff;
+      if (timeout == 0 && frame.ackTimeout(i) > 0 && !isAckOptional) timeout = 1;
+      __words[i] = delay | (frame.command[i] << 8) | (timeout << 16);
+    }
+  }
+
+  /**
+   * @brief Start DMA for the bytes (state machine must be waiting for the next byte).
+   * @param first First byte index
+   * @param end Index after the last byte
+   */
+  void PioTransport::__run(uint16_t first, uint16_t end) {
+    __end = end;
+    dma_channel_set_write_addr(__rxChannel, __frame->response + first, false);
+    dma_channel_set_trans_count(__rxChannel, end - first, true);
+    dma_channel_set_read_addr(__txChannel, __words + first, false);
+    dma_channel_set_trans_count(__txChannel, end - first, true);
+  }
+
+  /**
+   * @brief Exchange the rest of the frame without ACK after the fallback, the second byte alone first.
+   * @param first First byte index
+   * @param skippedAck ACK timeout of the previous byte not waited yet (microseconds)
+   */
+  void PioTransport::__resume(uint16_t first, uint32_t skippedAck) {
+    uint16_t end = first < 2 && __frame->length > 2 ? 2 : __frame->length;
+    __build(first, end, true, skippedAck);
+    __run(first, end);
+  }
+
+  /**
+   * @brief Count of bytes received so far.
+   */
+  uint16_t PioTransport::__received() const {
+    return __end - dma_channel_hw_addr(__rxChannel)->transfer_count;
+  }
+
+  /**
+   * @brief Deactivate the slot and notify the result.
+   * @param transferred Count of received bytes
+   */
+  void PioTransport::__finish(uint16_t transferred) {
+    Frame *frame = __frame;
+    __attention(portOf(frame->slot), HIGH);
+    frame->transferred = transferred;
+    __frame = nullptr;
+    __busy = false;
+    if (__callback != nullptr) __callback(*frame, __context);
+  }
+
+  /**
+   * @brief Stop DMA and reset state machine to the top of the program.
+   */
+  void PioTransport::__restart() {
+    // Disable IRQ before abort (RP2040-E13)
+    dma_channel_set_irq1_enabled(__rxChannel, false);
+    dma_channel_abort(__txChannel);
+    dma_channel_abort(__rxChannel);
+    dma_channel_acknowledge_irq1(__rxChannel);
+    dma_channel_set_irq1_enabled(__rxChannel, true);
+
+    pio_sm_set_enabled(__pio, __sm, false);
+    pio_sm_clear_fifos(__pio, __sm);
+    pio_sm_restart(__pio, __sm);
+    pio_sm_exec(__pio, __sm, pio_encode_jmp(__offset + ProgramLabel::Pull));
+    pio_interrupt_clear(__pio, 0);
+    pio_sm_set_enabled(__pio, __sm, true);
+  }
+
+  /**
+   * @brief DMA_IRQ_1 handler (all response bytes are received)
+   */
+  void PioTransport::__onDmaComplete() {
+    PioTransport *self = __instance;
+    if (!dma_channel_get_irq1_status(self->__rxChannel)) return;
+    dma_channel_acknowledge_irq1(self->__rxChannel);
+    if (!self->__busy) return;
+    uint16_t end = self->__end;
+    if (end < self->__frame->length) {
+      // Second byte after the fallback: nothing is driving the data line on an empty port
+      if (self->__frame->response[1] == 0xff) self->__finish(end);
+      else self->__resume(end, self->__frame->ackTimeout(end - 1));
+      return;
+    }
+    self->__finish(end);
+  }
+
+  /**
+   * @brief PIOx_IRQ_0 handler (ACK signal timeout)
+   */
+  void PioTransport::__onTimeout() {
+    PioTransport *self = __instance;
+    if (!pio_interrupt_get(self->__pio, 0)) return;
+    if (!self->__busy) {
+      self->__restart();
+      return;
+    }
+    uint16_t transferred = self->__received();
+    self->__restart();
+    // Device does not send ACK: the rest goes on without it, unless nothing answered the second byte
+    bool isEmpty = transferred >= 2 && self->__frame->response[1] == 0xff;
+    if (self->__hasFallback && !isEmpty) {
+      self->__hasFallback = false;
+      self->__resume(transferred, 0);
+      return;
+    }
+    self->__finish(transferred);
+  }
+}
+#endif
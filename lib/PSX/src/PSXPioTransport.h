@@ -0,0 +1,73 @@
+#pragma once
+
+#ifdef ARDUINO_ARCH_RP2040
+#include <Arduino.h>
+#include <hardware/pio.h>
+#include "PSXTransport.h"
+
+#ifndef PSX_PIO_BITRATE
+// PSX clock frequency on PIO transport (Hz)
+#define PSX_PIO_BITRATE 250000
+#endif
+
+namespace PSX {
+  /**
+   * @brief PSX bus on RP2040 PIO + DMA.
+   * @note PIO drives clock/command, samples data, waits ACK signal and detects timeout for each byte.
+   * DMA feeds command bytes and stores response bytes, so CPU only handles the completion interrupt.
+   * Only one instance can be started (uses `DMA_IRQ_1` and `PIOx_IRQ_0`).
+   * With `Timing::hasAckFallback`, the timeout interrupt restarts the rest of the frame without ACK, the second
+   * byte alone first so an empty port stops there.
+   * This transport takes over clock and command pins from `SPI`, so do not mix with `PSX::tryReadXxx` functions.
+   */
+  class PioTransport : public Transport {
+  public:
+    /**
+     * @brief Load the PIO program and claim DMA channels.
+     * @param pio PIO instance to use
+     * @param bitrate PSX clock frequency (Hz)
+     * @return `false` if no PIO state machine or DMA channel is available
+     */
+    bool begin(PIO pio = pio0, uint32_t bitrate = PSX_PIO_BITRATE);
+
+    bool tryStart(Frame &frame, CompleteCallback callback, void *context) override;
+    bool isBusy() const override;
+    void abort() override;
+
+  private:
+    PIO __pio;
+    uint __sm;
+    uint __offset;
+    int __txChannel;
+    int __rxChannel;
+    // PSX clock used when the frame does not choose one (Hz)
+    uint32_t __defaultBitrate;
+    // Current PSX clock (Hz)
+    uint32_t __bitrate = 0;
+    // PIO state machine cycles in 1 millisecond
+    uint32_t __cyclesPerMillisecond;
+
+    volatile bool __busy = false;
+    Frame *__frame = nullptr;
+    // Frame may still go on without ACK after a timeout (`Timing::hasAckFallback`)
+    bool __hasFallback = false;
+    // End of the bytes given to DMA (`Frame::length`, or `2` while the second byte is checked after the fallback)
+    uint16_t __end = 0;
+    CompleteCallback __callback = nullptr;
+    void *__context = nullptr;
+    // TX FIFO words ([7:0] delay, [15:8] command, [31:16] ACK timeout)
+    uint32_t __words[PSX_MAX_FRAME_LENGTH];
+
+    void __setBitrate(uint32_t bitrate);
+    void __build(uint16_t first, uint16_t end, bool isAckOptional, uint32_t skippedAck);
+    void __run(uint16_t first, uint16_t end);
+    void __resume(uint16_t first, uint32_t skippedAck);
+    uint16_t __received() const;
+    void __finish(uint16_t transferred);
+    void __restart();
+
+    static void __onDmaComplete();
+    static void __onTimeout();
+  };
+}
+#endif
@@ -0,0 +1,121 @@
+#include "PSXTiming.h"
+
+namespace PSX {
+  /**
+   * @brief Timing of the clock step with default ACK timeouts.
+   * @param step Clock step
+   * @param isAckOptional `true` to ignore missing ACK
+   * @note Missed ACK fails the frame, so calibration and `update` see it and choose the next step.
+   */
+  Timing Calibrator::__timingOf(uint8_t step, bool isAckOptional) {
+    Timing timing = DefaultTiming;
+    timing.clock = (uint32_t)PSX_TIMING_MAX_CLOCK >> step;
+    timing.isAckOptional = isAckOptional;
+    timing.hasAckFallback = false;
+    return timing;
+  }
+
+  Calibrator::Calibrator() {
+    for (int slot = 0; slot < PSX_TIMING_SLOT_COUNTS; slot++) invalidate(slot);
+  }
+
+  /**
+   * @brief Measure the card in the slot and choose its profile.
+   * @param slot Slot number
+   * @param frame Frame used for probing (overwritten)
+   * @param exchange Bus to probe on
+   * @return `false` if no memory card responded at any step (profile stays uncalibrated)
+   */
+  bool Calibrator::calibrate(int slot, Frame &frame, Exchange exchange) {
+    TimingProfile &profile = __profiles[slot];
+    TimingStatistics &statistics = __statistics[slot];
+    statistics.calibrations++;
+
+    // Fastest clock first, the last try ignores missing ACK at the slowest clock
+    for (int i = 0; i <= PSX_TIMING_STEPS; i++) {
+      uint8_t step = i < PSX_TIMING_STEPS ? i : PSX_TIMING_STEPS - 1;
+      Timing timing = __timingOf(step, i == PSX_TIMING_STEPS);
+
+      uint16_t latency = 0;
+      int probe = 0;
+      for (; probe < PSX_TIMING_PROBES; probe++) {
+        // Directory frame is always there and reading it has no side effect
+        buildReadFrame(frame, slot, 0);
+        frame.timing = timing;
+        exchange(frame);
+        if (parseReadFrame(frame, nullptr) != FrameResult::Success) break;
+        if (frame.ackLatency > latency) latency = frame.ackLatency;
+      }
+      if (probe < PSX_TIMING_PROBES) continue;
+
+      if (latency > 0 && !timing.isAckOptional) {
+        uint32_t limit = latency + latency / 2 + PSX_TIMING_ACK_MARGIN;
+        timing.ackLimit = limit < 0xffff ? limit : 0xffff;
+      }
+      profile.timing = timing;
+      profile.step = step;
+      profile.isCalibrated = true;
+      statistics.ackLatency = latency;
+      return true;
+    }
+
+    invalidate(slot);
+    return false;
+  }
+
+  /**
+   * @brief Count the result of a memory card frame, and relax the profile if it failed.
+   * @param slot Slot number
+   * @param result Result of the frame exchanged with `getProfile(slot).timing`
+   */
+  void Calibrator::update(int slot, FrameResult result) {
+    TimingProfile &profile = __profiles[slot];
+    TimingStatistics &statistics = __statistics[slot];
+    statistics.frames++;
+
+    switch (result) {
+      case FrameResult::Timeout:
+        statistics.timeouts++;
+        break;
+      case FrameResult::BadChecksum:
+        statistics.badChecksums++;
+        break;
+      case FrameResult::NoDevice:
+        invalidate(slot);
+        return;
+      default:
+        // Bad sector is reported by the card itself, the bus is fine
+        return;
+    }
+    if (!profile.isCalibrated) return;
+
+    statistics.fallbacks++;
+    if (profile.timing.ackLimit != DefaultTiming.ackLimit) {
+      profile.timing.ackLimit = DefaultTiming.ackLimit;
+    } else if (profile.step + 1 < PSX_TIMING_STEPS) {
+      profile.step++;
+      profile.timing = __timingOf(profile.step, profile.timing.isAckOptional);
+    } else {
+      profile.timing.isAckOptional = true;
+    }
+  }
+
+  /**
+   * @brief Forget the profile (card removed), the next card is calibrated again.
+   * @param slot Slot number
+   */
+  void Calibrator::invalidate(int slot) {
+    TimingProfile &profile = __profiles[slot];
+    profile.timing = DefaultTiming;
+    profile.step = 0;
+    profile.isCalibrated = false;
+  }
+
+  const TimingProfile &Calibrator::getProfile(int slot) const {
+    return __profiles[slot];
+  }
+
+  const TimingStatistics &Calibrator::getStatistics(int slot) const {
+    return __statistics[slot];
+  }
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdint.h>
+#include "PSXFrame.h"
+
+#ifndef PSX_TIMING_SLOT_COUNTS
+// Slots calibrated separately
+#define PSX_TIMING_SLOT_COUNTS PSX_SLOT_COUNTS
+#endif
+#ifndef PSX_TIMING_MAX_CLOCK
+// Fastest PSX clock tried by calibration (Hz), each step halves it
+#define PSX_TIMING_MAX_CLOCK 500000
+#endif
+#ifndef PSX_TIMING_STEPS
+// Clock steps (500kHz, 250kHz, 125kHz, 62.5kHz)
+#define PSX_TIMING_STEPS 4
+#endif
+#ifndef PSX_TIMING_PROBES
+// Clean reads needed to accept a clock step
+#define PSX_TIMING_PROBES 4
+#endif
+#ifndef PSX_TIMING_ACK_MARGIN
+// Margin added to the measured ACK latency (microseconds)
+#define PSX_TIMING_ACK_MARGIN 30
+#endif
+
+namespace PSX {
+  /**
+   * @brief Timing chosen for the memory card of a slot
+   */
+  struct TimingProfile {
+    Timing timing;
+    /**
+     * @brief Clock step (`0`: `PSX_TIMING_MAX_CLOCK`, each step halves the clock)
+     */
+    uint8_t step;
+    /**
+     * @brief `false` until a card passed the calibration (`DefaultTiming` is used meanwhile)
+     */
+    bool isCalibrated;
+  };
+
+  /**
+   * @brief Error counters of a slot (error rate is `(timeouts + badChecksums) / frames`)
+   */
+  struct TimingStatistics {
+    /**
+     * @brief Memory card frames exchanged (excluding calibration)
+     */
+    uint32_t frames;
+    uint32_t timeouts;
+    uint32_t badChecksums;
+    /**
+     * @brief Times the profile was relaxed because of errors
+     */
+    uint16_t fallbacks;
+    /**
+     * @brief Times the calibration ran
+     */
+    uint16_t calibrations;
+    /**
+     * @brief Longest ACK latency measured by the last calibration in microseconds (`0`: not measured)
+     */
+    uint16_t ackLatency;
+  };
+
+  /**
+   * @brief Chooses the fastest timing each memory card can handle.
+   * @note On insertion, frame 0 is read at decreasing clocks until `PSX_TIMING_PROBES` reads are clean,
+   * and ACK timeouts are narrowed to the measured latency. Errors afterwards relax the profile one step at a time:
+   * ACK timeouts back to the defaults, then slower clocks, then ignoring missing ACK.
+   */
+  class Calibrator {
+  public:
+    /**
+     * @brief Exchange a frame on the bus (blocking).
+     */
+    typedef void (*Exchange)(Frame &frame);
+
+    Calibrator();
+
+    /**
+     * @brief Measure the card in the slot and choose its profile.
+     * @param slot Slot number
+     * @param frame Frame used for probing (overwritten)
+     * @param exchange Bus to probe on
+     * @return `false` if no memory card responded at any step (profile stays uncalibrated)
+     */
+    bool calibrate(int slot, Frame &frame, Exchange exchange);
+
+    /**
+     * @brief Count the result of a memory card frame, and relax the profile if it failed.
+     * @param slot Slot number
+     * @param result Result of the frame exchanged with `getProfile(slot).timing`
+     */
+    void update(int slot, FrameResult result);
+
+    /**
+     * @brief Forget the profile (card removed), the next card is calibrated again.
+     * @param slot Slot number
+     */
+    void invalidate(int slot);
+
+    const TimingProfile &getProfile(int slot) const;
+    const TimingStatistics &getStatistics(int slot) const;
+
+  private:
+    TimingProfile __profiles[PSX_TIMING_SLOT_COUNTS];
+    TimingStatistics __statistics[PSX_TIMING_SLOT_COUNTS] = {};
+
+    static Timing __timingOf(uint8_t step, bool isAckOptional);
+  };
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "PSXFrame.h"
+
+namespace PSX {
+  /**
+   * @brief Bus that exchanges a whole `Frame` in the background.
+   * @note Implemented by the PIO engine on RP2040, and can be implemented by a simulated device on the host.
+   */
+  class Transport {
+  public:
+    /**
+     * @brief Called when the frame exchange is finished (completed or timed out).
+     * @param frame Exchanged frame (`transferred` is updated)
+     * @param context User context passed to `tryStart`
+     * @note Might be called from interrupt context.
+     */
+    typedef void (*CompleteCallback)(Frame &frame, void *context);
+
+    virtual ~Transport() {}
+
+    /**
+     * @brief Start exchanging the frame.
+     * @param frame Frame to exchange (must be alive until `callback` is called)
+     * @param callback Completion callback
+     * @param context User context passed to `callback`
+     * @return `false` if another frame is being exchanged
+     */
+    virtual bool tryStart(Frame &frame, CompleteCallback callback, void *context) = 0;
+
+    /**
+     * @brief Check if a frame is being exchanged.
+     */
+    virtual bool isBusy() const = 0;
+
+    /**
+     * @brief Stop the frame being exchanged (e.g. the completion did not come in time).
+     * @note `callback` is called with the bytes exchanged so far, nothing happens if no frame is being exchanged.
+     */
+    virtual void abort() = 0;
+
+    /**
+     * @brief Finish the frame if its time has come. (call while waiting for the completion)
+     * @note Only needed by transports without a completion interrupt (e.g. the simulated bus on the host).
+     */
+    virtual void poll() {}
+  };
+}
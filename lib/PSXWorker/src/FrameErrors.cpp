@@ -0,0 +1,98 @@
+#include "FrameErrors.h"
+
+FrameErrors::FrameErrors() {
+  for (int slot = 0; slot < PSX_FRAME_ERROR_SLOT_COUNTS; slot++) clear(slot);
+}
+
+/**
+ * @brief Check if the frame is marked bad. (any core)
+ * @param slot Slot number
+ * @param address Frame address (`0x00`-`0x3ff`)
+ */
+bool FrameErrors::isBad(int slot, uint16_t address) const {
+  if (slot < 0 || slot >= PSX_FRAME_ERROR_SLOT_COUNTS || address >= PSX_MEMCARD_FRAMES) return false;
+  return __bad[slot][address / 32].load(std::memory_order_relaxed) & (1u << (address % 32));
+}
+
+/**
+ * @brief Check if the read can be failed without touching the bus (counted as `fastFails`).
+ * @param slot Slot number
+ * @param address Frame address (`0x00`-`0x3ff`)
+ */
+bool FrameErrors::tryFailFast(int slot, uint16_t address) {
+  if (!isBad(slot, address)) return false;
+  __counters[slot].fastFails++;
+  return true;
+}
+
+/**
+ * @brief Decide whether the failed attempt should be repeated.
+ * @param slot Slot number
+ * @param result Result of the attempt
+ * @param attempt Attempts done so far (`1`: first attempt)
+ * @param backoff Wait before the next attempt in microseconds
+ * @return `true` to retry
+ */
+bool FrameErrors::shouldRetry(int slot, PSX::FrameResult result, int attempt, uint32_t &backoff) {
+  // Bad sector is reported by the card itself, and a removed card will not come back by retrying
+  if (result != PSX::FrameResult::Timeout && result != PSX::FrameResult::BadChecksum) return false;
+  if (attempt > PSX_RETRY_LIMIT) return false;
+
+  backoff = (uint32_t)PSX_RETRY_BACKOFF_US << (attempt - 1);
+  if (slot >= 0 && slot < PSX_FRAME_ERROR_SLOT_COUNTS) __counters[slot].retries++;
+  return true;
+}
+
+/**
+ * @brief Record the final result of the frame (after retries).
+ * @param slot Slot number
+ * @param address Frame address (`0x00`-`0x3ff`)
+ * @param result Final result
+ * @param attempts Attempts done
+ */
+void FrameErrors::record(int slot, uint16_t address, PSX::FrameResult result, int attempts) {
+  if (slot < 0 || slot >= PSX_FRAME_ERROR_SLOT_COUNTS || address >= PSX_MEMCARD_FRAMES) return;
+  switch (result) {
+    case PSX::FrameResult::Success:
+      if (attempts > 1) __counters[slot].recovered++;
+      __mark(slot, address, false);
+      break;
+    case PSX::FrameResult::NoDevice:
+      clear(slot);
+      break;
+    default:
+      __counters[slot].persistent++;
+      __mark(slot, address, true);
+      break;
+  }
+}
+
+/**
+ * @brief Forget the bad frames of the slot (card removed).
+ * @param slot Slot number
+ */
+void FrameErrors::clear(int slot) {
+  for (int i = 0; i < PSX_MEMCARD_FRAMES / 32; i++) __bad[slot][i].store(0, std::memory_order_relaxed);
+  __counters[slot].badFrames = 0;
+}
+
+const FrameErrors::Counters &FrameErrors::getCounters(int slot) const {
+  return __counters[slot];
+}
+
+/**
+ * @brief Set or clear the mark of the frame.
+ * @param slot Slot number
+ * @param address Frame address (`0x00`-`0x3ff`)
+ * @param isBad `true` to mark
+ */
+void FrameErrors::__mark(int slot, uint16_t address, bool isBad) {
+  if (this->isBad(slot, address) == isBad) return;
+  // Single writer, so plain load/store is enough (RP2040 has no atomic read-modify-write)
+  std::atomic<uint32_t> &word = __bad[slot][address / 32];
+  uint32_t bit = 1u << (address % 32);
+  uint32_t value = word.load(std::memory_order_relaxed);
+  word.store(isBad ? value | bit : value & ~bit, std::memory_order_relaxed);
+  if (isBad) __counters[slot].badFrames++;
+  else __counters[slot].badFrames--;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include "PSX.h"
+#include "PSXFrame.h"
+
+#ifndef PSX_FRAME_ERROR_SLOT_COUNTS
+// Slots tracked by the bad frame map
+#define PSX_FRAME_ERROR_SLOT_COUNTS PSX_SLOT_COUNTS
+#endif
+#ifndef PSX_RETRY_LIMIT
+// Retries of a frame that failed with a transient error (timeout, bad checksum)
+#define PSX_RETRY_LIMIT 3
+#endif
+#ifndef PSX_RETRY_BACKOFF_US
+// Wait before the first retry in microseconds (doubled on each retry)
+#define PSX_RETRY_BACKOFF_US 200
+#endif
+// Frames on one memory card
+#define PSX_MEMCARD_FRAMES (PSX_MEMCARD_BLOCK_COUNTS * PSX_MEMCARD_FRAMES_IN_BLOCK)
+
+/**
+ * @brief Retry policy and bad frame map of memory cards.
+ * @note Timeouts and bad checksums are retried with bounded backoff. A frame that still fails,
+ * or that the card reports as bad, is marked, and later reads of it fail without touching the bus.
+ * The mark is cleared when the frame is written successfully or the card is removed.
+ * Only the PSX core updates the map, the JVS core may read it at any time.
+ */
+class FrameErrors {
+public:
+  /**
+   * @brief Error counters of a slot
+   */
+  struct Counters {
+    // Attempts repeated after a transient error
+    uint32_t retries;
+    // Frames that succeeded after retrying
+    uint32_t recovered;
+    // Frames that failed after retrying (or were reported bad by the card)
+    uint32_t persistent;
+    // Reads failed from the map without touching the bus
+    uint32_t fastFails;
+    // Frames marked bad now
+    uint16_t badFrames;
+  };
+
+  FrameErrors();
+
+  /**
+   * @brief Check if the frame is marked bad. (any core)
+   * @param slot Slot number
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  bool isBad(int slot, uint16_t address) const;
+
+  /**
+   * @brief Check if the read can be failed without touching the bus (counted as `fastFails`).
+   * @param slot Slot number
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  bool tryFailFast(int slot, uint16_t address);
+
+  /**
+   * @brief Decide whether the failed attempt should be repeated.
+   * @param slot Slot number
+   * @param result Result of the attempt
+   * @param attempt Attempts done so far (`1`: first attempt)
+   * @param backoff Wait before the next attempt in microseconds
+   * @return `true` to retry
+   */
+  bool shouldRetry(int slot, PSX::FrameResult result, int attempt, uint32_t &backoff);
+
+  /**
+   * @brief Record the final result of the frame (after retries).
+   * @param slot Slot number
+   * @param address Frame address (`0x00`-`0x3ff`)
+   * @param result Final result
+   * @param attempts Attempts done
+   */
+  void record(int slot, uint16_t address, PSX::FrameResult result, int attempts);
+
+  /**
+   * @brief Forget the bad frames of the slot (card removed).
+   * @param slot Slot number
+   */
+  void clear(int slot);
+
+  const Counters &getCounters(int slot) const;
+
+private:
+  // Bad frames (bit per frame)
+  std::atomic<uint32_t> __bad[PSX_FRAME_ERROR_SLOT_COUNTS][PSX_MEMCARD_FRAMES / 32];
+  Counters __counters[PSX_FRAME_ERROR_SLOT_COUNTS] = {};
+
+  void __mark(int slot, uint16_t address, bool isBad);
+};
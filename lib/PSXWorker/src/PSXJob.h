@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include "PSXFrame.h"
+#include "SpscRing.h"
+
+#ifndef PSX_JOB_QUEUE_SIZE
+// Capacity of request and completion rings (must be power of 2)
+#define PSX_JOB_QUEUE_SIZE 8
+#endif
+
+namespace PSXWorker {
+  /**
+   * @brief Kind of PSX transaction
+   */
+  enum JobType {
+    /**
+     * @brief Read the input from PS1 digital controller. (`buffer`: 2 bytes output)
+     */
+    ReadController = 0,
+    /**
+     * @brief Read a frame from PS1 memory card. (`buffer`: 128 bytes output)
+     */
+    ReadMemoryCard = 1,
+    /**
+     * @brief Write a frame to PS1 memory card. (`buffer`: 128 bytes input)
+     */
+    WriteMemoryCard = 2,
+    /**
+     * @brief Check if PS1 memory card is inserted. (`buffer`: unused)
+     */
+    ProbeMemoryCard = 3,
+  };
+
+  /**
+   * @brief PSX transaction request (JVS core -> PSX core)
+   * @note `buffer` is owned by the PSX core until the job is returned as `Completion`.
+   */
+  struct Job {
+    JobType type;
+    /**
+     * @brief Slot number (`0`: Port 1, `1`: Port 2, `2`-`7`: multitap sub-ports B-D, see `PSX_SLOT_COUNTS`)
+     */
+    uint8_t slot;
+    /**
+     * @brief Address of sector (`0x00`-`0x3ff`), unused for controller
+     */
+    uint16_t address;
+    uint8_t *buffer;
+    /**
+     * @brief Caller defined module ID to route the completion
+     */
+    uint8_t owner;
+    /**
+     * @brief Caller defined value to match the completion
+     */
+    uint32_t tag;
+  };
+
+  /**
+   * @brief PSX transaction result (PSX core -> JVS core)
+   */
+  struct Completion {
+    Job job;
+    PSX::FrameResult result;
+    /**
+     * @brief Probed card reports it was not written since inserted (`ProbeMemoryCard` only)
+     */
+    bool isNewCard;
+  };
+
+  typedef SpscRing<Job, PSX_JOB_QUEUE_SIZE> JobRing;
+  typedef SpscRing<Completion, PSX_JOB_QUEUE_SIZE> CompletionRing;
+}
@@ -0,0 +1,514 @@
+#include <Arduino.h>
+#include <PSX.h>
+#include <Scheduler.h>
+#include <Trace.h>
+#include "FrameErrors.h"
+#include "PSXWorker.h"
+#include "Seqlock.h"
+#if PSX_USE_PIO_TRANSPORT
+#include <PSXPioTransport.h>
+#endif
+#if PSX_VIRTUAL_MEMCARD_SLOTS
+#include <FlashBlockDevice.h>
+#include <FrameStore.h>
+#endif
+
+namespace PSXWorker {
+  // private variables & functions
+  namespace {
+    JobRing __requests;
+    CompletionRing __completions;
+
+    /**
+     * @brief Frame of the job being executed (used only by PSX core)
+     */
+    PSX::Frame __frame;
+    /**
+     * @brief Finished job that could not be pushed because completion queue was full
+     */
+    Completion __pending;
+    bool __hasPending = false;
+    // `__pending.job` is being executed (waiting for retry)
+    bool __isExecuting = false;
+    // Attempts of the memory card job being executed
+    int __attempt = 0;
+    // Frame of `__pending.job` is on the bus, the job is finished on a later step
+    bool __isExchanging = false;
+
+    PSX::Calibrator __calibrator;
+    Seqlock<TimingState> __timingSnapshot;
+    FrameErrors __errors;
+    Seqlock<ErrorState> __errorSnapshot;
+
+    ControllerState __controller;
+    Seqlock<ControllerState> __controllerSnapshot;
+    uint32_t __nextPollTime = 0;
+#if PSX_CONTROLLER_POLL_US > 0
+    // Frame of the controller poller (the job frame may still wait to be parsed)
+    PSX::Frame __pollFrame;
+#endif
+
+    // Transport lost the last frame (it never completed), see `__resultOf`
+    bool __isLost = false;
+
+#if PSX_USE_PIO_TRANSPORT
+    PSX::PioTransport __pio;
+#endif
+    // Transport exchanging frames in the background (`nullptr`: SPI, `PSX::exchange`)
+    PSX::Transport *__transport = nullptr;
+    volatile bool __exchanged;
+    // Frame started on the bus and not finished yet (both ports share clock, command and data)
+    PSX::Frame *__busFrame = nullptr;
+    uint32_t __busStart = 0;
+    uint32_t __busLimit = 0;
+
+    void __onExchanged(PSX::Frame &, void *) {
+      __exchanged = true;
+    }
+
+    /**
+     * @brief Longest time the frame can take: every bit at the clock, every delay and ACK timeout spent.
+     * @param frame Frame to exchange
+     * @return Microseconds (with a margin for the completion interrupt)
+     * @note Frames without a clock of their own are counted at `PSX_SPI_CLOCK`, no transport is slower by default.
+     */
+    uint32_t __limitOf(const PSX::Frame &frame) {
+      uint32_t clock = frame.timing.clock != 0 ? frame.timing.clock : PSX_SPI_CLOCK;
+      uint32_t limit = (uint64_t)frame.length * 8 * 1000000 / clock;
+      for (int i = 0; i < frame.length; i++) {
+        limit += frame.delay(i) + frame.ackTimeout(i);
+      }
+      return limit + 1000;
+    }
+
+    /**
+     * @brief Start exchanging the frame, finish it with `__tryFinishExchange`. (SPI exchanges it at once)
+     * @param frame Frame to exchange (the bus must be free)
+     */
+    void __startExchange(PSX::Frame &frame) {
+      TRACE_POINT(Trace::Point::FrameStart, frame.type | frame.slot << 4);
+      __busFrame = &frame;
+      if (__transport == nullptr) {
+        PSX::exchange(frame);
+        __exchanged = true;
+        __isLost = false;
+        return;
+      }
+      __exchanged = false;
+      __isLost = !__transport->tryStart(frame, __onExchanged, nullptr);
+      __busStart = micros();
+      __busLimit = __limitOf(frame);
+    }
+
+    /**
+     * @brief Check if the frame on the bus has completed, or should have by now.
+     */
+    bool __isExchanged() {
+      if (__busFrame == nullptr || __exchanged || __isLost) return true;
+      __transport->poll();
+      return __exchanged || micros() - __busStart >= __busLimit;
+    }
+
+    /**
+     * @brief Finish the frame started by `__startExchange` if it is done.
+     * @return `false` if it is still on the bus
+     * @note A completion that never comes must not stop PSX core: the frame is aborted after its longest time.
+     */
+    bool __tryFinishExchange() {
+      if (__busFrame == nullptr) return true;
+      if (!__isExchanged()) return false;
+      if (!__exchanged && !__isLost) {
+        __transport->abort();
+        __isLost = true;
+      }
+      PSX::Frame &frame = *__busFrame;
+      if (__isLost) frame.transferred = 0;
+      __busFrame = nullptr;
+      TRACE_POINT(Trace::Point::FrameEnd, frame.type | frame.slot << 4);
+      return true;
+    }
+
+    /**
+     * @brief Exchange the frame and wait for it (calibration and controller polls).
+     * @param frame Frame to exchange (the bus must be free)
+     */
+    void __exchange(PSX::Frame &frame) {
+      __startExchange(frame);
+      while (!__tryFinishExchange()) {
+      }
+    }
+
+    /**
+     * @brief Result of the exchanged frame, `Timeout` if the transport lost it.
+     * @param result Result parsed from the response
+     */
+    PSX::FrameResult __resultOf(PSX::FrameResult result) {
+      return __isLost ? PSX::FrameResult::Timeout : result;
+    }
+
+#if PSX_VIRTUAL_MEMCARD_SLOTS
+    FlashBlockDevice __flash;
+    FrameStore __store;
+    bool __isMounted = false;
+
+    /**
+     * @brief Execute a memory card job on the flash.
+     * @param job Job to execute
+     * @param result Result of the job
+     * @return `false` if the slot is not virtual
+     */
+    bool __tryExecuteVirtual(const Job &job, PSX::FrameResult &result) {
+      if (job.type == JobType::ReadController || !((PSX_VIRTUAL_MEMCARD_SLOTS >> job.slot) & 1)) return false;
+      if (!__isMounted) {
+        result = PSX::FrameResult::NoDevice;
+      } else if (job.type == JobType::ProbeMemoryCard) {
+        result = PSX::FrameResult::Success;
+      } else if (job.type == JobType::ReadMemoryCard) {
+        result = __store.read(job.slot, job.address, job.buffer) ? PSX::FrameResult::Success : PSX::FrameResult::BadSector;
+      } else {
+        result = __store.write(job.slot, job.address, job.buffer) ? PSX::FrameResult::Success : PSX::FrameResult::BadSector;
+      }
+      return true;
+    }
+#endif
+
+    void __publishStatistics() {
+      TimingState timing;
+      for (int slot = 0; slot < PSX_TIMING_SLOT_COUNTS; slot++) {
+        timing.profile[slot] = __calibrator.getProfile(slot);
+        timing.statistics[slot] = __calibrator.getStatistics(slot);
+      }
+      __timingSnapshot.write(timing);
+
+      ErrorState errors;
+      for (int slot = 0; slot < PSX_FRAME_ERROR_SLOT_COUNTS; slot++) {
+        errors.counters[slot] = __errors.getCounters(slot);
+      }
+      __errorSnapshot.write(errors);
+    }
+
+    /**
+     * @brief Start one attempt of a memory card frame with the timing of the slot (new card is calibrated first).
+     * @param job Memory card job
+     * @param result Result of the job if no frame is started
+     * @return `false` if the job is finished without a frame (known bad frame)
+     */
+    bool __startMemoryCard(const Job &job, PSX::FrameResult &result) {
+      bool isRead = job.type == JobType::ReadMemoryCard;
+      if (__attempt == 0) {
+        // Known bad frame is reported at once (writing may repair it, so writes always go to the card)
+        if (isRead && __errors.tryFailFast(job.slot, job.address)) {
+          result = PSX::FrameResult::BadSector;
+          return false;
+        }
+        if (!__calibrator.getProfile(job.slot).isCalibrated) __calibrator.calibrate(job.slot, __frame, __exchange);
+      }
+
+      __attempt++;
+      if (isRead) PSX::buildReadFrame(__frame, job.slot, job.address);
+      else PSX::buildWriteFrame(__frame, job.slot, job.address, job.buffer);
+      // Profile might have been relaxed by the previous attempt
+      __frame.timing = __calibrator.getProfile(job.slot).timing;
+      __startExchange(__frame);
+      return true;
+    }
+
+    /**
+     * @brief Finish the attempt started by `__startMemoryCard`.
+     * @param job Memory card job
+     * @param result Result of the frame
+     * @param backoff Wait before the next attempt in microseconds
+     * @return `true` if the frame should be tried again after `backoff`
+     */
+    bool __finishMemoryCard(const Job &job, PSX::FrameResult &result, uint32_t &backoff) {
+      bool isRead = job.type == JobType::ReadMemoryCard;
+      result = __resultOf(isRead ? PSX::parseReadFrame(__frame, job.buffer) : PSX::parseWriteFrame(__frame));
+      __calibrator.update(job.slot, result);
+      if (__errors.shouldRetry(job.slot, result, __attempt, backoff)) return true;
+
+      __errors.record(job.slot, job.address, result, __attempt);
+      __attempt = 0;
+      __publishStatistics();
+      return false;
+    }
+
+    /**
+     * @brief Check if memory card is inserted (with the default timing), and calibrate a new card.
+     * @param job Probe job (its frame is exchanged)
+     * @param isNewCard Set to `true` if the card reports the new card FLAG
+     * @return Result of the frame
+     */
+    PSX::FrameResult __finishProbe(const Job &job, bool &isNewCard) {
+      PSX::FrameResult result = __resultOf(PSX::parseProbeFrame(__frame, &isNewCard));
+      if (result == PSX::FrameResult::NoDevice) {
+        __calibrator.invalidate(job.slot);
+        __errors.clear(job.slot);
+      } else if (result == PSX::FrameResult::Success && !__calibrator.getProfile(job.slot).isCalibrated) {
+        __calibrator.calibrate(job.slot, __frame, __exchange);
+      }
+      __publishStatistics();
+      return result;
+    }
+
+    /**
+     * @brief Start one attempt of a job on the PSX bus.
+     * @param job Job to execute
+     * @param result Result of the job if no frame is started
+     * @return `true` if its frame is on the bus (finish the job with `__finish` once it is exchanged)
+     */
+    bool __start(const Job &job, PSX::FrameResult &result) {
+#if PSX_VIRTUAL_MEMCARD_SLOTS
+      if (__tryExecuteVirtual(job, result)) return false;
+#endif
+      switch (job.type) {
+        case JobType::ReadController:
+          PSX::buildControllerFrame(__frame, job.slot);
+          __startExchange(__frame);
+          return true;
+        case JobType::ReadMemoryCard:
+        case JobType::WriteMemoryCard:
+          return __startMemoryCard(job, result);
+        case JobType::ProbeMemoryCard:
+          PSX::buildProbeFrame(__frame, job.slot);
+          __startExchange(__frame);
+          return true;
+      }
+      result = PSX::FrameResult::NoDevice;
+      return false;
+    }
+
+    /**
+     * @brief Finish the attempt started by `__start`.
+     * @param job Job to execute
+     * @param result Result of the frame
+     * @param isNewCard Set to `true` if a probed card reports the new card FLAG
+     * @param backoff Wait before the next attempt in microseconds
+     * @return `true` if the job should be tried again after `backoff`
+     */
+    bool __finish(const Job &job, PSX::FrameResult &result, bool &isNewCard, uint32_t &backoff) {
+      switch (job.type) {
+        case JobType::ReadController:
+          result = __resultOf(PSX::parseControllerFrame(__frame, job.buffer));
+          return false;
+        case JobType::ReadMemoryCard:
+        case JobType::WriteMemoryCard:
+          return __finishMemoryCard(job, result, backoff);
+        case JobType::ProbeMemoryCard:
+          result = __finishProbe(job, isNewCard);
+          return false;
+      }
+      return false;
+    }
+
+#if PSX_CONTROLLER_POLL_US > 0
+    /**
+     * @brief Read every sub-port of the multitap in one attention cycle.
+     * @param port Port of the multitap (`0`: Port 1, `1`: Port 2)
+     */
+    void __pollMultitap(int port) {
+      PSX::buildMultitapControllerFrame(__pollFrame, port);
+      __exchange(__pollFrame);
+      uint32_t time = micros();
+      for (int subPort = 0; subPort < PSX_MULTITAP_PORTS; subPort++) {
+        int slot = PSX::slotOf(port, subPort);
+        __controller.result[slot] = __resultOf(PSX::parseMultitapControllerFrame(__pollFrame, subPort, __controller.input[slot]));
+        __controller.time[slot] = time;
+      }
+    }
+
+    /**
+     * @brief Task: read the controllers of both ports and publish the inputs.
+     * @return Microseconds until the next poll
+     */
+    uint32_t __pollControllers(void *) {
+      // Keep the grid, count the polls that should have happened meanwhile
+      uint32_t now = micros();
+      uint32_t missed = (int32_t)(now - __nextPollTime) > 0 ? (now - __nextPollTime) / PSX_CONTROLLER_POLL_US : 0;
+      __controller.dropped += missed;
+      __nextPollTime += (missed + 1) * PSX_CONTROLLER_POLL_US;
+
+      for (int port = 0; port < PSX_PORT_COUNTS; port++) {
+        if ((PSX_MULTITAP_SLOTS >> port) & 1) {
+          __pollMultitap(port);
+          continue;
+        }
+        PSX::buildControllerFrame(__pollFrame, port);
+        __exchange(__pollFrame);
+        __controller.result[port] = __resultOf(PSX::parseControllerFrame(__pollFrame, __controller.input[port]));
+        __controller.time[port] = micros();
+      }
+      __controller.samples++;
+      __controllerSnapshot.write(__controller);
+
+      int32_t wait = __nextPollTime - micros();
+      if (wait > 0) return wait;
+      // Polling took longer than the interval: wait for the next grid point anyway, so queued jobs get a turn
+      return PSX_CONTROLLER_POLL_US - (uint32_t)-wait % PSX_CONTROLLER_POLL_US;
+    }
+
+    /**
+     * @brief Poll waits while a job frame is on the bus, or exchanged and not finished yet.
+     */
+    bool __isBusFree(void *) {
+      return __busFrame == nullptr;
+    }
+#endif
+
+    bool __hasJob(void *) {
+      // Nothing to do until the job frame is exchanged
+      if (__isExchanging) return __isExchanged();
+      return __hasPending || __isExecuting || !__requests.isEmpty();
+    }
+
+    /**
+     * @brief Task: start one attempt of the queued job, finish it on a later step once its frame is exchanged,
+     * and return the finished job to JVS core.
+     * @return Microseconds until the next attempt (backoff of a retry)
+     */
+    uint32_t __runJobs(void *) {
+      // Completion queue is full, wait for JVS core
+      if (__hasPending) {
+        if (!__completions.tryPush(__pending)) return 0;
+        __hasPending = false;
+      }
+      if (!__isExecuting) {
+        if (!__requests.tryPop(__pending.job)) return 0;
+        __pending.isNewCard = false;
+        __isExecuting = true;
+      }
+
+      if (!__isExchanging) {
+        // Step ends while the frame is on the bus, PSX core is not held by a 140 bytes frame
+        __isExchanging = __start(__pending.job, __pending.result);
+        if (__isExchanging) return 0;
+      } else {
+        if (!__tryFinishExchange()) return 0;
+        __isExchanging = false;
+        uint32_t backoff;
+        // Controllers are polled while waiting for the retry
+        if (__finish(__pending.job, __pending.result, __pending.isNewCard, backoff)) return backoff;
+      }
+      __isExecuting = false;
+      __hasPending = !__completions.tryPush(__pending);
+      return 0;
+    }
+
+#if PSX_VIRTUAL_MEMCARD_SLOTS
+    bool __isIdle(void *) {
+      return __isMounted && !__isExecuting && __requests.isEmpty();
+    }
+
+    /**
+     * @brief Task: prepare erased sectors for the next writes while no job is queued.
+     */
+    uint32_t __serviceStore(void *) {
+      __store.service();
+      return 0;
+    }
+#endif
+
+    uint32_t __now() {
+      return micros();
+    }
+
+    Scheduler __scheduler(__now);
+  }
+
+  /**
+   * @brief Setup the PSX bus. (call from `setup1()`)
+   * @param transport Started transport to exchange frames on (`nullptr`: PIO with `PSX_USE_PIO_TRANSPORT`, or SPI)
+   * @note GPIO interrupt is handled by the calling core, so ACK interrupt is also moved to PSX core.
+   */
+  void setup(PSX::Transport *transport) {
+#if PSX_USE_PIO_TRANSPORT
+    // PIO takes over the pins only if it could claim everything, SPI drives them otherwise
+    if (transport == nullptr && __pio.begin()) transport = &__pio;
+#endif
+    __transport = transport;
+    if (__transport == nullptr) PSX::setup();
+#if PSX_VIRTUAL_MEMCARD_SLOTS
+    __flash.begin();
+    __isMounted = __store.begin(__flash);
+#endif
+    __nextPollTime = micros();
+    // Sub-ports without a multitap are never polled
+    for (int slot = 0; slot < PSX_CONTROLLER_SLOT_COUNTS; slot++) __controller.result[slot] = PSX::FrameResult::NoDevice;
+    __publishStatistics();
+
+#if PSX_CONTROLLER_POLL_US > 0
+    __scheduler.add(__pollControllers, nullptr, Scheduler::Priority::High, __isBusFree);
+#endif
+    __scheduler.add(__runJobs, nullptr, Scheduler::Priority::Normal, __hasJob);
+#if PSX_VIRTUAL_MEMCARD_SLOTS
+    __scheduler.add(__serviceStore, nullptr, Scheduler::Priority::Low, __isIdle);
+#endif
+  }
+
+  /**
+   * @brief Run one step of the PSX core tasks. (call from `loop1()`)
+   * @note Controller polling runs first, then queued jobs, and flash of virtual memory cards is compacted
+   * while no job is queued. Retry backoff of a memory card frame yields to the controller polling.
+   * A job frame on a transport ends the step and is finished on a later one (the poll waits for the shared bus).
+   */
+  void service() {
+    __scheduler.runOnce();
+  }
+
+  /**
+   * @brief Queue a job. (JVS core only)
+   * @param job Job to queue
+   * @return `false` if request queue is full
+   */
+  bool trySubmit(const Job &job) {
+    return __requests.tryPush(job);
+  }
+
+  /**
+   * @brief Take a finished job. (JVS core only)
+   * @param completion Finished job
+   * @return `false` if no job has finished
+   */
+  bool tryGetCompletion(Completion &completion) {
+    return __completions.tryPop(completion);
+  }
+
+  /**
+   * @brief Check if a finished job is waiting. (JVS core only)
+   */
+  bool hasCompletion() {
+    return !__completions.isEmpty();
+  }
+
+  /**
+   * @brief Copy the latest controller inputs. (JVS core only, never blocks the PSX core)
+   * @param state Latest inputs
+   */
+  void readController(ControllerState &state) {
+    __controllerSnapshot.read(state);
+  }
+
+  /**
+   * @brief Copy the latest memory card timings. (JVS core only, never blocks the PSX core)
+   * @param state Timing profiles and error counters
+   */
+  void readTiming(TimingState &state) {
+    __timingSnapshot.read(state);
+  }
+
+  /**
+   * @brief Copy the latest memory card error counters. (JVS core only, never blocks the PSX core)
+   * @param state Error counters
+   */
+  void readErrors(ErrorState &state) {
+    __errorSnapshot.read(state);
+  }
+
+  /**
+   * @brief Check if the frame is known to be unreadable. (JVS core only)
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  bool isBadFrame(int slot, uint16_t address) {
+    return __errors.isBad(slot, address);
+  }
+}
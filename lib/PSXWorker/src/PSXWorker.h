@@ -0,0 +1,127 @@
+#pragma once
+
+#include <PSXTransport.h>
+#include "FrameErrors.h"
+#include "PSXJob.h"
+#include "PSXTiming.h"
+
+#ifndef PSX_VIRTUAL_MEMCARD_SLOTS
+// Slots whose memory card is served from flash instead of the PSX bus (bit 0: Port 1, bit 1: Port 2)
+#define PSX_VIRTUAL_MEMCARD_SLOTS 0
+#endif
+#ifndef PSX_CONTROLLER_POLL_US
+// Interval of background controller polling in microseconds (1000: 1kHz, 0: disabled)
+#define PSX_CONTROLLER_POLL_US 1000
+#endif
+// Slots polled by the background poller (every sub-port of a multitap is read in one frame)
+#define PSX_CONTROLLER_SLOT_COUNTS PSX_SLOT_COUNTS
+
+/**
+ * @brief Runs PSX transactions on the second core.
+ * @note JVS core (core 0) calls `trySubmit` and `tryGetCompletion`, PSX core (core 1) calls `setup` and `service`.
+ * Controllers are polled every `PSX_CONTROLLER_POLL_US` between jobs, every sub-port of a multitap in one frame.
+ * Each memory card is calibrated on insertion and exchanged with its own timing (see `PSX::Calibrator`).
+ * Failed frames are retried and remembered by `FrameErrors`.
+ * Memory card jobs of `PSX_VIRTUAL_MEMCARD_SLOTS` are served by `FrameStore` on the flash.
+ */
+namespace PSXWorker {
+  /**
+   * @brief Latest controller inputs published by the poller (indexed by slot, see `PSX_SLOT_COUNTS`)
+   */
+  struct ControllerState {
+    /**
+     * @brief Digital switches (LSB, MSB), `0x00` if not connected
+     */
+    uint8_t input[PSX_CONTROLLER_SLOT_COUNTS][2];
+    /**
+     * @brief Result of the last poll (`PSX::FrameResult`)
+     */
+    uint8_t result[PSX_CONTROLLER_SLOT_COUNTS];
+    /**
+     * @brief `micros()` when the input was read (age is `micros() - time`)
+     */
+    uint32_t time[PSX_CONTROLLER_SLOT_COUNTS];
+    /**
+     * @brief Polls done
+     */
+    uint32_t samples;
+    /**
+     * @brief Polls skipped because the bus was busy (memory card frame, flash erase)
+     */
+    uint32_t dropped;
+  };
+
+  /**
+   * @brief Timing profiles and error counters of memory cards published after each frame
+   */
+  struct TimingState {
+    PSX::TimingProfile profile[PSX_TIMING_SLOT_COUNTS];
+    PSX::TimingStatistics statistics[PSX_TIMING_SLOT_COUNTS];
+  };
+
+  /**
+   * @brief Memory card error counters published after each frame
+   */
+  struct ErrorState {
+    FrameErrors::Counters counters[PSX_FRAME_ERROR_SLOT_COUNTS];
+  };
+
+  /**
+   * @brief Setup the PSX bus. (call from `setup1()`)
+   * @param transport Started transport to exchange frames on (`nullptr`: PIO with `PSX_USE_PIO_TRANSPORT`, or SPI)
+   * @note GPIO interrupt is handled by the calling core, so ACK interrupt is also moved to PSX core.
+   */
+  void setup(PSX::Transport *transport = nullptr);
+
+  /**
+   * @brief Run one step of the PSX core tasks. (call from `loop1()`)
+   * @note Controller polling runs first, then queued jobs, and flash of virtual memory cards is compacted
+   * while no job is queued. Retry backoff of a memory card frame yields to the controller polling.
+   * A job frame on a transport ends the step and is finished on a later one (the poll waits for the shared bus).
+   */
+  void service();
+
+  /**
+   * @brief Queue a job. (JVS core only)
+   * @param job Job to queue
+   * @return `false` if request queue is full
+   */
+  bool trySubmit(const Job &job);
+
+  /**
+   * @brief Take a finished job. (JVS core only)
+   * @param completion Finished job
+   * @return `false` if no job has finished
+   */
+  bool tryGetCompletion(Completion &completion);
+
+  /**
+   * @brief Check if a finished job is waiting. (JVS core only)
+   */
+  bool hasCompletion();
+
+  /**
+   * @brief Copy the latest controller inputs. (JVS core only, never blocks the PSX core)
+   * @param state Latest inputs
+   */
+  void readController(ControllerState &state);
+
+  /**
+   * @brief Copy the latest memory card timings. (JVS core only, never blocks the PSX core)
+   * @param state Timing profiles and error counters
+   */
+  void readTiming(TimingState &state);
+
+  /**
+   * @brief Copy the latest memory card error counters. (JVS core only, never blocks the PSX core)
+   * @param state Error counters
+   */
+  void readErrors(ErrorState &state);
+
+  /**
+   * @brief Check if the frame is known to be unreadable. (JVS core only)
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param address Frame address (`0x00`-`0x3ff`)
+   */
+  bool isBadFrame(int slot, uint16_t address);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+/**
+ * @brief Single-writer sequence lock for a small snapshot.
+ * @tparam T Snapshot type (trivially copyable)
+ * @note Writer never waits, reader retries while the snapshot is being written.
+ * Sequence is odd while writing, so a reader that saw the same even value before and after copying got a consistent copy.
+ */
+template <typename T>
+class Seqlock {
+public:
+  /**
+   * @brief Publish a new snapshot (writer only).
+   * @param value Snapshot
+   */
+  void write(const T &value) {
+    uint32_t sequence = __sequence.load(std::memory_order_relaxed);
+    __sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy((void *)&__value, &value, sizeof(T));
+    __sequence.store(sequence + 2, std::memory_order_release);
+  }
+
+  /**
+   * @brief Copy the latest snapshot.
+   * @param value Copied snapshot
+   */
+  void read(T &value) const {
+    while (true) {
+      uint32_t before = __sequence.load(std::memory_order_acquire);
+      if (before & 1) continue;
+      memcpy(&value, (const void *)&__value, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (__sequence.load(std::memory_order_relaxed) == before) return;
+    }
+  }
+
+private:
+  std::atomic<uint32_t> __sequence{0};
+  volatile T __value;
+};
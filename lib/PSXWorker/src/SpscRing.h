@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * @brief Lock-free single-producer/single-consumer ring buffer.
+ * @tparam T Item type (copied in and out)
+ * @tparam N Capacity (must be power of 2)
+ * @note Only one thread (core) may call `tryPush`, and only one other thread (core) may call `tryPop`.
+ * Indexes are free-running 32-bit counters, so only word-sized loads/stores are used (Cortex-M0+ has no LDREX/STREX).
+ */
+template <typename T, uint32_t N>
+class SpscRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "Capacity must be power of 2");
+
+public:
+  /**
+   * @brief Add an item to the tail (producer only).
+   * @param item Item to add
+   * @return `false` if the ring is full
+   */
+  bool tryPush(const T &item) {
+    uint32_t head = __head.load(std::memory_order_relaxed);
+    uint32_t tail = __tail.load(std::memory_order_acquire);
+    if (head - tail >= N) return false;
+    __items[head & (N - 1)] = item;
+    __head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Take an item from the head (consumer only).
+   * @param item Taken item
+   * @return `false` if the ring is empty
+   */
+  bool tryPop(T &item) {
+    uint32_t tail = __tail.load(std::memory_order_relaxed);
+    uint32_t head = __head.load(std::memory_order_acquire);
+    if (head == tail) return false;
+    item = __items[tail & (N - 1)];
+    __tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Count of items in the ring (approximate if called from neither side).
+   */
+  uint32_t size() const {
+    return __head.load(std::memory_order_acquire) - __tail.load(std::memory_order_acquire);
+  }
+
+  bool isEmpty() const {
+    return size() == 0;
+  }
+
+  bool isFull() const {
+    return size() >= N;
+  }
+
+private:
+  // Written by producer
+  std::atomic<uint32_t> __head{ 0 };
+  // Written by consumer
+  std::atomic<uint32_t> __tail{ 0 };
+  T __items[N];
+};
@@ -0,0 +1,75 @@
+#include <string.h>
+#include "Scheduler.h"
+
+Scheduler::Scheduler(Clock clock) : __clock(clock) {}
+
+/**
+ * @brief Register a task.
+ * @param step Step function
+ * @param context User context passed to `step` and `ready`
+ * @param priority Priority
+ * @param ready Readiness predicate (`nullptr`: ready whenever the sleep has elapsed)
+ * @return Task ID, `-1` if too many tasks
+ */
+int Scheduler::add(Step step, void *context, Priority priority, Ready ready) {
+  if (__count >= SCHEDULER_MAX_TASKS) return -1;
+  Task &task = __tasks[__count];
+  task.step = step;
+  task.ready = ready;
+  task.context = context;
+  task.wakeTime = __clock();
+  task.priority = priority;
+  memset(&task.statistics, 0, sizeof(Statistics));
+  return __count++;
+}
+
+/**
+ * @brief Cancel the sleep of the task.
+ * @param task Task ID
+ */
+void Scheduler::wake(int task) {
+  if (task < 0 || task >= __count) return;
+  __tasks[task].wakeTime = __clock();
+}
+
+/**
+ * @brief Run one step of the highest priority ready task.
+ * @return `false` if no task was ready
+ */
+bool Scheduler::runOnce() {
+  uint32_t now = __clock();
+  for (int priority = Priority::High; priority <= Priority::Low; priority++) {
+    for (int i = 0; i < __count; i++) {
+      int index = (__cursors[priority] + i) % __count;
+      Task &task = __tasks[index];
+      if (task.priority != priority || !__isReady(task, now)) continue;
+
+      uint32_t late = now - task.wakeTime;
+      uint32_t sleep = task.step(task.context);
+      uint32_t end = __clock();
+
+      Statistics &statistics = task.statistics;
+      statistics.runs++;
+      if (end - now > statistics.maxRunUs) statistics.maxRunUs = end - now;
+      // Event driven task is not late while it has nothing to do
+      if (task.ready == nullptr && late > statistics.maxLateUs) statistics.maxLateUs = late;
+      task.wakeTime = end + sleep;
+      __cursors[priority] = index + 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+const Scheduler::Statistics &Scheduler::getStatistics(int task) const {
+  return __tasks[task].statistics;
+}
+
+void Scheduler::resetStatistics() {
+  for (int i = 0; i < __count; i++) memset(&__tasks[i].statistics, 0, sizeof(Statistics));
+}
+
+bool Scheduler::__isReady(Task &task, uint32_t now) {
+  if ((int32_t)(now - task.wakeTime) < 0) return false;
+  return task.ready == nullptr || task.ready(task.context);
+}
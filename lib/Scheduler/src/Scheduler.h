@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifndef SCHEDULER_MAX_TASKS
+// Tasks registered to one scheduler
+#define SCHEDULER_MAX_TASKS 8
+#endif
+
+/**
+ * @brief Cooperative scheduler of stackless tasks.
+ * @note A task is a step function that does a bounded amount of work and returns instead of waiting.
+ * The highest priority task that is ready runs first, tasks of the same priority take turns.
+ * A task is ready when its sleep has elapsed and its `Ready` predicate (if any) is true, so an event driven
+ * task does not starve lower priorities while it has nothing to do.
+ * Time comes from the `Clock` given to the constructor, so the scheduler runs on the host with a fake clock.
+ */
+class Scheduler {
+public:
+  enum Priority : uint8_t {
+    High = 0,
+    Normal = 1,
+    Low = 2,
+  };
+
+  /**
+   * @brief Monotonic clock in microseconds (wraps around)
+   */
+  typedef uint32_t (*Clock)();
+
+  /**
+   * @brief One step of a task.
+   * @param context User context passed to `add`
+   * @return Microseconds to sleep before the next step (`0`: as soon as possible)
+   */
+  typedef uint32_t (*Step)(void *context);
+
+  /**
+   * @brief Check if an event driven task has something to do.
+   * @param context User context passed to `add`
+   */
+  typedef bool (*Ready)(void *context);
+
+  /**
+   * @brief Task counters
+   */
+  struct Statistics {
+    // Steps executed
+    uint32_t runs;
+    // Longest step in microseconds
+    uint32_t maxRunUs;
+    // Longest delay between the end of sleep and the start of the step in microseconds
+    uint32_t maxLateUs;
+  };
+
+  explicit Scheduler(Clock clock);
+
+  /**
+   * @brief Register a task.
+   * @param step Step function
+   * @param context User context passed to `step` and `ready`
+   * @param priority Priority
+   * @param ready Readiness predicate (`nullptr`: ready whenever the sleep has elapsed)
+   * @return Task ID, `-1` if too many tasks
+   */
+  int add(Step step, void *context, Priority priority, Ready ready = nullptr);
+
+  /**
+   * @brief Cancel the sleep of the task.
+   * @param task Task ID
+   */
+  void wake(int task);
+
+  /**
+   * @brief Run one step of the highest priority ready task.
+   * @return `false` if no task was ready
+   */
+  bool runOnce();
+
+  const Statistics &getStatistics(int task) const;
+  void resetStatistics();
+
+private:
+  struct Task {
+    Step step;
+    Ready ready;
+    void *context;
+    uint32_t wakeTime;
+    Priority priority;
+    Statistics statistics;
+  };
+
+  Clock __clock;
+  Task __tasks[SCHEDULER_MAX_TASKS];
+  uint8_t __count = 0;
+  // Task to try first in each priority (round robin)
+  uint8_t __cursors[Priority::Low + 1] = {};
+
+  bool __isReady(Task &task, uint32_t now);
+};
@@ -0,0 +1,359 @@
+#include <string.h>
+#include "Trace.h"
+
+#if TRACE_ENABLED
+#include <atomic>
+#if defined(ARDUINO_ARCH_RP2040)
+#include <hardware/timer.h>
+#include <pico/platform.h>
+#elif defined(ARDUINO)
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+#endif
+
+namespace Trace {
+#if TRACE_ENABLED
+  // private variables & functions
+  namespace {
+    // Core 0, core 0 interrupts, core 1
+    const int __SourceCount = 3;
+    // Events merged by one `service` call
+    const int __EventsPerService = 64;
+    // Record header (magic, type, length)
+    const size_t __HeaderSize = 4;
+
+    /**
+     * @brief Single-producer/single-consumer ring of one source.
+     * @note Only word-sized loads/stores are used (Cortex-M0+ has no LDREX/STREX).
+     */
+    struct Ring {
+      // Written by producer
+      std::atomic<uint32_t> head{ 0 };
+      // Written by consumer
+      std::atomic<uint32_t> tail{ 0 };
+      // Events lost because the ring was full (written by producer)
+      volatile uint32_t dropped = 0;
+      Event events[TRACE_RING_SIZE];
+    };
+
+    struct Histogram {
+      // `0xffff`: unused
+      uint16_t key;
+      uint32_t counts[TRACE_BUCKETS];
+    };
+
+    Ring __rings[__SourceCount];
+    Histogram __histograms[TRACE_KEYS];
+
+    // Pairing state (consumer only)
+    bool __hasSync = false;
+    uint32_t __syncTime = 0;
+    int __command = -1;
+    bool __hasFrame = false;
+    uint32_t __frameTime = 0;
+    uint16_t __frameArg = 0;
+
+    uint32_t __processed = 0;
+    uint32_t __notStreamed = 0;
+    bool __isStreaming = false;
+    bool __isCapturing = false;
+    // Captured bytes were dropped since the last capture record
+    bool __hasCaptureGap = false;
+    // Next histogram to dump (`-1`: no dump requested, `TRACE_KEYS`: summary)
+    int __dumpIndex = -1;
+
+    uint8_t __out[TRACE_OUT_SIZE];
+    size_t __outLength = 0;
+    // Offset of the open `Events` record in `__out` (`-1`: none)
+    int __eventsRecord = -1;
+
+#ifndef ARDUINO
+    Clock __clock = nullptr;
+#endif
+
+    uint32_t __now() {
+#if defined(ARDUINO_ARCH_RP2040)
+      return time_us_32();
+#elif defined(ARDUINO)
+      return micros();
+#else
+      if (__clock != nullptr) return __clock();
+      auto elapsed = std::chrono::steady_clock::now().time_since_epoch();
+      return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+#endif
+    }
+
+    uint8_t __source() {
+#if defined(ARDUINO_ARCH_RP2040)
+      if (get_core_num() != 0) return 2;
+      return __get_current_exception() != 0 ? 1 : 0;
+#else
+      return 0;
+#endif
+    }
+
+    void __clearHistograms() {
+      for (int i = 0; i < TRACE_KEYS; i++) {
+        __histograms[i].key = 0xffff;
+        memset(__histograms[i].counts, 0, sizeof(__histograms[i].counts));
+      }
+    }
+
+    void __add(uint16_t key, uint32_t us) {
+      for (int i = 0; i < TRACE_KEYS; i++) {
+        Histogram &histogram = __histograms[i];
+        if (histogram.key == 0xffff) histogram.key = key;
+        if (histogram.key != key) continue;
+        histogram.counts[bucketOf(us)]++;
+        return;
+      }
+      // Table is full, key is not kept
+    }
+
+    /**
+     * @brief Pair the event with the previous ones and add the latency to the histogram.
+     */
+    void __process(const Event &event) {
+      switch (event.point) {
+        case Point::Sync:
+          __hasSync = true;
+          __syncTime = event.time;
+          __command = -1;
+          break;
+        case Point::Dispatch:
+          if (__hasSync) __command = event.arg;
+          break;
+        case Point::Release:
+          // Sync to the end of the response, per command
+          if (__hasSync && __command >= 0) __add(__command, event.time - __syncTime);
+          __hasSync = false;
+          break;
+        case Point::FrameStart:
+          __hasFrame = true;
+          __frameTime = event.time;
+          __frameArg = event.arg;
+          break;
+        case Point::FrameEnd:
+          if (__hasFrame && __frameArg == event.arg) __add(TRACE_KEY_FRAME | (event.arg & 0x0f), event.time - __frameTime);
+          __hasFrame = false;
+          break;
+      }
+    }
+
+    /**
+     * @brief Open a record in `__out`.
+     * @return Offset of the payload (`-1`: no room)
+     */
+    int __openRecord(RecordType type, size_t payloadLength) {
+      if (__outLength + __HeaderSize + payloadLength > TRACE_OUT_SIZE) return -1;
+      uint8_t *header = &__out[__outLength];
+      header[0] = TRACE_RECORD_MAGIC;
+      header[1] = type;
+      header[2] = payloadLength & 0xff;
+      header[3] = payloadLength >> 8;
+      __outLength += __HeaderSize + payloadLength;
+      __eventsRecord = -1;
+      return __outLength - payloadLength;
+    }
+
+    void __put16(uint8_t *buffer, uint16_t value) {
+      buffer[0] = value & 0xff;
+      buffer[1] = value >> 8;
+    }
+
+    void __put32(uint8_t *buffer, uint32_t value) {
+      for (int i = 0; i < 4; i++) buffer[i] = value >> (i * 8);
+    }
+
+    void __stream(const Event &event) {
+      // Append to the open record (it is closed when another record is opened)
+      if (__eventsRecord >= 0 && __outLength + sizeof(Event) <= TRACE_OUT_SIZE) {
+        uint8_t *header = &__out[__eventsRecord];
+        uint16_t length = header[2] | header[3] << 8;
+        __put16(&header[2], length + sizeof(Event));
+        memcpy(&__out[__outLength], &event, sizeof(Event));
+        __outLength += sizeof(Event);
+        return;
+      }
+      int offset = __openRecord(RecordType::Events, sizeof(Event));
+      if (offset < 0) {
+        __notStreamed++;
+        return;
+      }
+      memcpy(&__out[offset], &event, sizeof(Event));
+      __eventsRecord = offset - __HeaderSize;
+    }
+
+    void __dump() {
+      while (__dumpIndex >= 0 && __dumpIndex < TRACE_KEYS) {
+        Histogram &histogram = __histograms[__dumpIndex];
+        if (histogram.key == 0xffff) {
+          __dumpIndex = TRACE_KEYS;
+          break;
+        }
+        int offset = __openRecord(RecordType::Histogram, 4 + TRACE_BUCKETS * 4);
+        if (offset < 0) return;
+        __put16(&__out[offset], histogram.key);
+        __put16(&__out[offset + 2], TRACE_BUCKETS);
+        for (int i = 0; i < TRACE_BUCKETS; i++) __put32(&__out[offset + 4 + i * 4], histogram.counts[i]);
+        __dumpIndex++;
+      }
+      if (__dumpIndex != TRACE_KEYS) return;
+
+      int offset = __openRecord(RecordType::Summary, 12);
+      if (offset < 0) return;
+      uint32_t dropped = 0;
+      for (int i = 0; i < __SourceCount; i++) dropped += __rings[i].dropped;
+      __put32(&__out[offset], __processed);
+      __put32(&__out[offset + 4], dropped);
+      __put32(&__out[offset + 8], __notStreamed);
+      __dumpIndex = -1;
+    }
+
+    void __flush(Output output) {
+      if (__outLength == 0) return;
+      size_t sent = output(__out, __outLength);
+      if (sent == 0) return;
+      memmove(__out, &__out[sent], __outLength - sent);
+      __outLength -= sent;
+      // Open record might be partially sent, the next event starts a new one
+      __eventsRecord = -1;
+    }
+
+    /**
+     * @brief Take the oldest event of all rings.
+     * @return `false` if every ring is empty
+     */
+    bool __tryPopOldest(Event &event) {
+      int oldest = -1;
+      for (int i = 0; i < __SourceCount; i++) {
+        Ring &ring = __rings[i];
+        uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+        if (ring.head.load(std::memory_order_acquire) == tail) continue;
+        const Event &candidate = ring.events[tail & (TRACE_RING_SIZE - 1)];
+        // Wrap-around safe comparison
+        if (oldest < 0 || (int32_t)(candidate.time - event.time) < 0) {
+          event = candidate;
+          oldest = i;
+        }
+      }
+      if (oldest < 0) return false;
+      Ring &ring = __rings[oldest];
+      ring.tail.store(ring.tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+      return true;
+    }
+
+    struct Initializer {
+      Initializer() {
+        __clearHistograms();
+      }
+    } __initializer;
+  }
+
+  /**
+   * @brief Record a trace point. (any core, also from interrupt)
+   * @param point Trace point
+   * @param arg Argument of the point
+   * @note Use `TRACE_POINT`, so the call disappears when tracing is compiled out.
+   */
+  void record(Point point, uint16_t arg) {
+    uint8_t source = __source();
+    Ring &ring = __rings[source];
+    uint32_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= TRACE_RING_SIZE) {
+      ring.dropped = ring.dropped + 1;
+      return;
+    }
+    Event &event = ring.events[head & (TRACE_RING_SIZE - 1)];
+    event.time = __now();
+    event.point = point;
+    event.source = source;
+    event.arg = arg;
+    ring.head.store(head + 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief Handle a control byte from the host.
+   * @param command `'s'`: start streaming events, `'c'`: start capturing JVS bytes, `'q'`: stop streaming and capturing,
+   * `'d'`: dump histograms and summary, `'r'`: reset histograms
+   */
+  void control(uint8_t command) {
+    switch (command) {
+      case 's': __isStreaming = true; break;
+      case 'c': __isCapturing = true; break;
+      case 'q':
+        __isStreaming = false;
+        __isCapturing = false;
+        break;
+      case 'd': __dumpIndex = 0; break;
+      case 'r': __clearHistograms(); break;
+    }
+  }
+
+  /**
+   * @brief Capture raw JVS bytes while capture mode is on. (core 0 only, not from interrupt)
+   * @param direction `Direction`
+   * @param data Bytes
+   * @param length Count of `data`
+   * @note Use `TRACE_CAPTURE`, so the call disappears when tracing is compiled out.
+   */
+  void capture(Direction direction, const uint8_t *data, size_t length) {
+    if (!__isCapturing || length == 0) return;
+    int offset = __openRecord(RecordType::Capture, 5 + length);
+    if (offset < 0) {
+      __hasCaptureGap = true;
+      return;
+    }
+    __put32(&__out[offset], __now());
+    __out[offset + 4] = direction | (__hasCaptureGap ? TRACE_CAPTURE_GAP : 0);
+    memcpy(&__out[offset + 5], data, length);
+    __hasCaptureGap = false;
+  }
+
+  /**
+   * @brief Merge the recorded events into the histograms and send pending records. (core 0 only)
+   * @param output Output to send records to
+   */
+  void service(Output output) {
+    __flush(output);
+    Event event;
+    for (int i = 0; i < __EventsPerService && __tryPopOldest(event); i++) {
+      __processed++;
+      __process(event);
+      if (__isStreaming) __stream(event);
+    }
+    __dump();
+    __flush(output);
+  }
+
+  /**
+   * @brief Check if records are waiting to be sent (another producer on the same stream must wait).
+   */
+  bool isSending() {
+    return __outLength > 0;
+  }
+
+#ifndef ARDUINO
+  /**
+   * @brief Replace the clock of the events (e.g. by a simulated clock).
+   * @param clock Clock, `nullptr` for the monotonic clock of the host
+   */
+  void setClock(Clock clock) {
+    __clock = clock;
+  }
+#endif
+#endif
+
+  /**
+   * @brief Bucket of a latency.
+   * @param us Latency in microseconds
+   */
+  uint8_t bucketOf(uint32_t us) {
+    if (us < 16) return us;
+    int msb = 31 - __builtin_clz(us);
+    int bucket = (msb - 2) * 8 + ((us >> (msb - 3)) & 7);
+    return bucket < TRACE_BUCKETS ? bucket : TRACE_BUCKETS - 1;
+  }
+}
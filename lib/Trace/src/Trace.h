@@ -0,0 +1,182 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TRACE_ENABLED
+// `1` to record trace points (`0`: every `TRACE_POINT` compiles to nothing)
+#define TRACE_ENABLED 0
+#endif
+#ifndef TRACE_RING_BITS
+// Events buffered per source in bits (8: 256 events)
+#define TRACE_RING_BITS 8
+#endif
+#define TRACE_RING_SIZE (1 << TRACE_RING_BITS)
+#ifndef TRACE_KEYS
+// Histograms kept (commands and frame types, first come first served)
+#define TRACE_KEYS 12
+#endif
+#ifndef TRACE_OUT_SIZE
+// Bytes staged for the output (a captured JVS packet must fit)
+#define TRACE_OUT_SIZE 2048
+#endif
+// Histogram buckets (exact below 16us, then 8 buckets per power of 2 up to 16s)
+#define TRACE_BUCKETS 176
+// First byte of every record
+#define TRACE_RECORD_MAGIC 0xa5
+// Histogram key of a PSX frame (`TRACE_KEY_FRAME | FrameType`), commands use the command code
+#define TRACE_KEY_FRAME 0x100
+
+// Direction flag of a capture record: bytes were lost before this record
+#define TRACE_CAPTURE_GAP 0x80
+
+#if TRACE_ENABLED
+#define TRACE_POINT(point, arg) Trace::record((point), (arg))
+#define TRACE_CAPTURE(direction, data, length) Trace::capture((direction), (data), (length))
+#else
+#define TRACE_POINT(point, arg) ((void)0)
+#define TRACE_CAPTURE(direction, data, length) ((void)0)
+#endif
+
+/**
+ * @brief Timestamps at fixed points, and latency histograms built from them.
+ * @note Each source (core 0, core 0 interrupts, core 1) has its own lock-free ring, so recording is a few stores.
+ * `service` merges the rings in time order on core 0, updates the histograms and streams the records.
+ * In capture mode, raw JVS bytes are streamed too, so a cabinet session can be replayed on the host.
+ * Records on the output are {`TRACE_RECORD_MAGIC`, `RecordType`, <Payload length (2 bytes, LE)>, <Payload>}.
+ */
+namespace Trace {
+  /**
+   * @brief Trace points
+   */
+  enum Point {
+    /**
+     * @brief [SYNC] received (arg: `0`)
+     */
+    Sync = 0,
+    /**
+     * @brief Request handed to the dispatcher (arg: first command code)
+     */
+    Dispatch = 1,
+    /**
+     * @brief PSX frame started (arg: `FrameType | slot << 4`)
+     */
+    FrameStart = 2,
+    /**
+     * @brief PSX frame ended (arg: same as `FrameStart`)
+     */
+    FrameEnd = 3,
+    /**
+     * @brief RS485 line released after the response (arg: late in microseconds)
+     */
+    Release = 4,
+  };
+
+  /**
+   * @brief Output record types
+   */
+  enum RecordType {
+    /**
+     * @brief Events: <`Event` (8 bytes each)>
+     */
+    Events = 1,
+    /**
+     * @brief Histogram: <Key (2 bytes)>, <Bucket count (2 bytes)>, <Counts (4 bytes each)>
+     */
+    Histogram = 2,
+    /**
+     * @brief Summary: <Recorded events (4 bytes)>, <Dropped events (4 bytes)>, <Events not streamed (4 bytes)>
+     */
+    Summary = 3,
+    /**
+     * @brief Captured JVS bytes: <Time (4 bytes)>, <`Direction` (1 byte, `TRACE_CAPTURE_GAP` flag)>, <Bytes>
+     */
+    Capture = 4,
+  };
+
+  /**
+   * @brief Direction of captured JVS bytes
+   */
+  enum Direction {
+    /**
+     * @brief Request bytes as parsed (timestamp is when they were taken from the RX ring)
+     */
+    Received = 0,
+    /**
+     * @brief Response on the wire (timestamp is when TX started)
+     */
+    Sent = 1,
+  };
+
+  /**
+   * @brief Recorded event (little endian on the output)
+   */
+  struct Event {
+    // Microseconds (wraps around)
+    uint32_t time;
+    uint8_t point;
+    // `0`: core 0, `1`: core 0 interrupt, `2`: core 1
+    uint8_t source;
+    uint16_t arg;
+  };
+  static_assert(sizeof(Event) == 8, "Event is sent as is");
+
+  /**
+   * @brief Send staged bytes. (must not block)
+   * @param data Bytes to send
+   * @param length Count of `data`
+   * @return Count of bytes accepted
+   */
+  typedef size_t (*Output)(const uint8_t *data, size_t length);
+
+  /**
+   * @brief Record a trace point. (any core, also from interrupt)
+   * @param point Trace point
+   * @param arg Argument of the point
+   * @note Use `TRACE_POINT`, so the call disappears when tracing is compiled out.
+   */
+  void record(Point point, uint16_t arg);
+
+  /**
+   * @brief Handle a control byte from the host.
+   * @param command `'s'`: start streaming events, `'c'`: start capturing JVS bytes, `'q'`: stop streaming and capturing,
+   * `'d'`: dump histograms and summary, `'r'`: reset histograms
+   */
+  void control(uint8_t command);
+
+  /**
+   * @brief Capture raw JVS bytes while capture mode is on. (core 0 only, not from interrupt)
+   * @param direction `Direction`
+   * @param data Bytes
+   * @param length Count of `data`
+   * @note Use `TRACE_CAPTURE`, so the call disappears when tracing is compiled out.
+   */
+  void capture(Direction direction, const uint8_t *data, size_t length);
+
+  /**
+   * @brief Merge the recorded events into the histograms and send pending records. (core 0 only)
+   * @param output Output to send records to
+   */
+  void service(Output output);
+
+  /**
+   * @brief Check if records are waiting to be sent (another producer on the same stream must wait).
+   */
+  bool isSending();
+
+  /**
+   * @brief Bucket of a latency.
+   * @param us Latency in microseconds
+   */
+  uint8_t bucketOf(uint32_t us);
+
+#ifndef ARDUINO
+  typedef uint32_t (*Clock)();
+
+  /**
+   * @brief Replace the clock of the events (e.g. by a simulated clock).
+   * @param clock Clock, `nullptr` for the monotonic clock of the host
+   */
+  void setClock(Clock clock);
+#endif
+}
@@ -1,38 +1,418 @@
 #include <Arduino.h>
 #include <PSX.h>
 #include <JVS.h>
+#include <JVSDispatcher.h>
+#include <JVSPacketPool.h>
+#include <PSXWorker.h>
+#include <K573.h>
+#include <CardPresence.h>
+#include <CardService.h>
+#include <FrameCache.h>
+#include <MemoryCardEngine.h>
+#include <Prefetcher.h>
+#include <RamStore.h>
+#include <Scheduler.h>
+#include <Trace.h>
+#include <WriteBehind.h>
 
-#define BUFFER_SIZE 1024
-
-enum MemoryCardStatus {
-  // Default value, also used after writing?
-  Uninitialized = 0x0000,
-  Error = 0x0002,
-  // Card is not inserted
-  Unavailable = 0x0008,
-  // Read request is executing
-  Reading = 0x0200,
-  // Write request is executing
-  Writing = 0x0400,
-  // Can be combined with MEMCARD_READING and MEMCARD_WRITING for busy state
-  Available = 0x8000
-};
 static const char *__ioId = "KONAMI CO.,LTD.;White I/O;Ver1.0;White I/O PCB";
 
 // private variables
 namespace {
-  JVS::Packet __requestPacket;
-  JVS::Packet __acknowledgePacket;
+  // Request under construction (kept between calls, bytes arrive in pieces)
+  JVS::PacketHandle __requestPacket;
+
+  // Set by `K573BufferSetAddress`, used by `K573Execute`
+  uint32_t __executeAddress = 0;
+  // Time of the last request (used to detect idle JVS link)
+  unsigned long __lastRequestTime = 0;
+
+  /**
+   * @brief Add memory card command report.
+   * @param result Result of `MemoryCardEngine::startXxx`
+   * @param ack Acknowledge packet
+   */
+  void __reportMemoryCard(MemoryCardEngine::StartResult result, JVS::Packet &ack) {
+    switch (result) {
+      case MemoryCardEngine::StartResult::Started:
+        ack.add(JVS::AckReport::OK);
+        ack.add(0x01);
+        break;
+      case MemoryCardEngine::StartResult::Busy:
+        ack.add(JVS::AckReport::Busy);
+        break;
+      case MemoryCardEngine::StartResult::BadFrame:
+        ack.add(JVS::AckReport::ParamErrorIgnored);
+        break;
+      default:
+        ack.add(JVS::AckReport::ParamErrorNoResult);
+        break;
+    }
+  }
+
+  /**
+   * @brief Get memory card slot from the port word. (`0`: Port 1, `1`: Port 2, `2`-`7`: multitap sub-ports B-D)
+   * @note Sub-port bits are a local extension, only decoded with `PSX_MULTITAP_SLOTS`.
+   */
+  int __slotOf(uint16_t port) {
+#if PSX_MULTITAP_SLOTS
+    return PSX::slotOf((port & K573_MEMCARD_PORT_BIT) ? 1 : 0, (port & K573_MEMCARD_SUBPORT_MASK) >> K573_MEMCARD_SUBPORT_SHIFT);
+#else
+    return (port & K573_MEMCARD_PORT_BIT) ? 1 : 0;
+#endif
+  }
+
+  // {0xf1, <Node No.>}
+  void __setAddress(const uint8_t *command, JVS::Packet &ack) {
+    ack.add(JVS::AckReport::OK);
+    JVS::setAddress(command[1]);
+  }
+
+  // {0x10}
+  void __ioIdentify(const uint8_t *, JVS::Packet &ack) {
+    ack.add(JVS::AckReport::OK);
+    ack.add((uint8_t *)__ioId, strlen(__ioId) + 1);
+  }
+
+  // {0x11}
+  void __commandRevision(const uint8_t *, JVS::Packet &ack) {
+    ack.add(JVS::AckReport::OK);
+    ack.add(0x13);  // Rev 1.3
+  }
+
+  // {0x12}
+  void __jvsRevision(const uint8_t *, JVS::Packet &ack) {
+    ack.add(JVS::AckReport::OK);
+    ack.add(0x30);  // Rev 3.0
+  }
+
+  // {0x13}
+  void __protocolVersion(const uint8_t *, JVS::Packet &ack) {
+    ack.add(JVS::AckReport::OK);
+    ack.add(0x10);  // Ver 1.0
+  }
+
+  // {0x14}
+  void __functionCheck(const uint8_t *, JVS::Packet &ack) {
+    ack.add(JVS::AckReport::OK);
+    ack.add(0x00);  // No general purpose I/O
+  }
+
+  // {0xd2}
+  void __commSupported(const uint8_t *, JVS::Packet &ack) {
+    ack.add(JVS::AckReport::OK);
+    ack.add(JVS_COMM_METHODS);
+  }
+
+  // {0x70, 0x00, <RAM Address (3 bytes)>, <Length>}
+  void __k573BufferRead(const uint8_t *command, JVS::Packet &ack) {
+    uint8_t length = command[5];
+    // Frames still coming from the card (host may read the first frames of a running transfer)
+    if (!MemoryCardEngine::isReady(K573::readAddress(command + 2), length)) {
+      ack.add(JVS::AckReport::Busy);
+      return;
+    }
+    // Report + data must fit in the acknowledge packet
+    uint8_t data[JVS_MAX_DATA_SIZE];
+    if (ack.length + 1 + length > JVS_MAX_DATA_SIZE || !RamStore::read(K573::readAddress(command + 2), data, length)) {
+      ack.add(JVS::AckReport::ParamErrorNoResult);
+      return;
+    }
+    ack.add(JVS::AckReport::OK);
+    ack.add(data, length);
+  }
+
+  // {0x70, 0x01, <RAM Address (3 bytes)>, <Length>, <Data>}
+  void __k573BufferWrite(const uint8_t *command, JVS::Packet &ack) {
+    // Frames still coming from the card are written straight into their pages
+    if (!MemoryCardEngine::isReady(K573::readAddress(command + 2), command[5])) {
+      ack.add(JVS::AckReport::Busy);
+      return;
+    }
+    if (!RamStore::write(K573::readAddress(command + 2), command + 6, command[5])) {
+      ack.add(JVS::AckReport::ParamErrorIgnored);
+      return;
+    }
+    ack.add(JVS::AckReport::OK);
+  }
+
+  // {0x70, 0x02, <RAM Address (3 bytes)>}
+  void __k573BufferSetAddress(const uint8_t *command, JVS::Packet &ack) {
+    __executeAddress = K573::readAddress(command + 2);
+    ack.add(JVS::AckReport::OK);
+  }
+
+  // {0x71}
+  void __k573Status(const uint8_t *, JVS::Packet &ack) {
+    // Host waits until `Writing` is cleared, so write back buffered frames now
+    WriteBehind::flush();
+    ack.add(JVS::AckReport::OK);
+    for (int slot = 0; slot < PSX_PORT_COUNTS; slot++) {
+      uint16_t status = MemoryCardEngine::getStatus(slot);
+      ack.add(status >> 8);
+      ack.add(status & 0xff);
+    }
+  }
+
+  // {0x77}
+  void __k573Controller(const uint8_t *, JVS::Packet &ack) {
+    // Polled in the background, only the latest inputs are copied here
+    PSXWorker::ControllerState state;
+    PSXWorker::readController(state);
+    ack.add(JVS::AckReport::OK);
+    for (int slot = 0; slot < PSX_PORT_COUNTS; slot++) {
+      ack.add(state.input[slot][0]);
+      ack.add(state.input[slot][1]);
+    }
+  }
+
+#if PSX_MULTITAP_SLOTS
+  // {0x78, 0x71}, sub-ports B-D in slot order (same length with or without multitap)
+  void __k573MultitapStatus(const uint8_t *, JVS::Packet &ack) {
+    // As `K573Status`, write back buffered frames first
+    WriteBehind::flush();
+    ack.add(JVS::AckReport::OK);
+    for (int slot = PSX_PORT_COUNTS; slot < PSX_PORT_COUNTS * PSX_MULTITAP_PORTS; slot++) {
+      uint16_t status = PSX::hasSlot(slot) ? MemoryCardEngine::getStatus(slot) : (uint16_t)MemoryCardStatus::Unavailable;
+      ack.add(status >> 8);
+      ack.add(status & 0xff);
+    }
+  }
+
+  // {0x78, 0x77}, sub-ports B-D in slot order (same length with or without multitap)
+  void __k573MultitapController(const uint8_t *, JVS::Packet &ack) {
+    PSXWorker::ControllerState state;
+    PSXWorker::readController(state);
+    ack.add(JVS::AckReport::OK);
+    for (int slot = PSX_PORT_COUNTS; slot < PSX_PORT_COUNTS * PSX_MULTITAP_PORTS; slot++) {
+      bool hasSlot = PSX::hasSlot(slot);
+      ack.add(hasSlot ? state.input[slot][0] : 0x00);
+      ack.add(hasSlot ? state.input[slot][1] : 0x00);
+    }
+  }
+#endif
+
+  // {0x76, 0x74, <Port xor Address (2 bytes)>, <RAM Address (3 bytes)>, <Frame Count (2 bytes)>}
+  void __k573MemoryCardRead(const uint8_t *command, JVS::Packet &ack) {
+    uint16_t port = K573::readUInt16(command + 2);
+    __reportMemoryCard(MemoryCardEngine::startRead(__slotOf(port),
+                                                   port & K573_MEMCARD_ADDRESS_MASK,
+                                                   K573::readAddress(command + 4),
+                                                   K573::readUInt16(command + 7)),
+                       ack);
+  }
 
-  int __status = MemoryCardStatus::Uninitialized;
+  // {0x76, 0x75, <RAM Address (3 bytes)>, <Port xor Address (2 bytes)>, <Frame Count (2 bytes)>}
+  void __k573MemoryCardWrite(const uint8_t *command, JVS::Packet &ack) {
+    uint16_t port = K573::readUInt16(command + 5);
+    __reportMemoryCard(MemoryCardEngine::startWrite(__slotOf(port),
+                                                    port & K573_MEMCARD_ADDRESS_MASK,
+                                                    K573::readAddress(command + 2),
+                                                    K573::readUInt16(command + 7)),
+                       ack);
+  }
+
+  /**
+   * @brief Command table (command byte, length, handler)
+   */
+  typedef JVS::Dispatcher<
+      JVS::On<JVS::Command::SetAddress, 2, __setAddress>,
+      JVS::On<JVS::Command::IOId, 1, __ioIdentify>,
+      JVS::On<JVS::Command::CommandRev, 1, __commandRevision>,
+      JVS::On<JVS::Command::JvRev, 1, __jvsRevision>,
+      JVS::On<JVS::Command::ProtocolVer, 1, __protocolVersion>,
+      JVS::On<JVS::Command::FunctionCheck, 1, __functionCheck>,
+      JVS::On<JVS::Command::CommSupported, 1, __commSupported>,
+      JVS::OnSub<JVS::Command::K573Buffer, JVS::Command::K573BufferRead, 6, __k573BufferRead>,
+      JVS::OnSub<JVS::Command::K573Buffer, JVS::Command::K573BufferWrite, 6, __k573BufferWrite, 5>,
+      JVS::OnSub<JVS::Command::K573Buffer, JVS::Command::K573BufferSetAddress, 5, __k573BufferSetAddress>,
+      JVS::On<JVS::Command::K573Status, 1, __k573Status>,
+      JVS::OnSub<JVS::Command::K573MemoryCard, JVS::Command::K573MemoryCardRead, 9, __k573MemoryCardRead>,
+      JVS::OnSub<JVS::Command::K573MemoryCard, JVS::Command::K573MemoryCardWrite, 9, __k573MemoryCardWrite>,
+      JVS::On<JVS::Command::K573Controller, 1, __k573Controller>
+#if PSX_MULTITAP_SLOTS
+      // Local extension, a stock System 573 never sends it
+      ,
+      JVS::OnSub<JVS::Command::K573Multitap, JVS::Command::K573MultitapStatus, 2, __k573MultitapStatus>,
+      JVS::OnSub<JVS::Command::K573Multitap, JVS::Command::K573MultitapController, 2, __k573MultitapController>
+#endif
+      >
+      CommandDispatcher;
+
+  /**
+   * @brief Process all commands in the request packet.
+   * @param request Request packet
+   * @param ack Acknowledge packet
+   * @return `true` if acknowledge packet should be sent (`Retry` is resent here)
+   */
+  bool __processRequest(JVS::Packet &request, JVS::Packet &ack) {
+    if (request.length == 0) return false;
+    TRACE_POINT(Trace::Point::Dispatch, request.data[0]);
+    // Reset: {0xf0, 0xd9}, no response
+    if (request.data[0] == JVS::Command::Reset) {
+      if (request.length >= 2 && request.data[1] == 0xd9) {
+        JVS::reset();
+        // Host starts over and reloads RAM, pages of a running transfer are kept (given back on the next reset)
+        if (!MemoryCardEngine::isBusy()) RamStore::clear();
+      }
+      return false;
+    }
+    // Change communication method: {0xf2, <Method>}, no response, next packet comes at the new speed
+    if (request.data[0] == JVS::Command::CommMethodChange) {
+      if (request.length >= 2) JVS::trySetCommMethod(request.data[1]);
+      return false;
+    }
+    // Send the previous packet again (already encoded)
+    if (request.data[0] == JVS::Command::Retry) {
+      JVS::resend();
+      return false;
+    }
+
+    // All commands are processed in one pass, reports are added to one packet
+    CommandDispatcher::process(request, ack);
+    return true;
+  }
+
+  bool __hasRequest(void *) {
+    return JVS::hasReceived();
+  }
+
+  /**
+   * @brief Task: parse received bytes and answer the request.
+   */
+  uint32_t __serveJvs(void *) {
+    if (JVS::tryGetRequest(*__requestPacket)) {
+      __lastRequestTime = micros();
+      JVS::PacketHandle ack = JVS::PacketPool::acquire();
+      if (ack && __processRequest(*__requestPacket, *ack)) JVS::sendPacket(*ack);
+    }
+    return 0;
+  }
+
+  bool __hasTransfer(void *) {
+    return PSXWorker::hasCompletion() || MemoryCardEngine::isBusy();
+  }
+
+  /**
+   * @brief Task: route finished PSX jobs and queue the next frames of the transfer.
+   */
+  uint32_t __serveTransfer(void *) {
+    PSXWorker::Completion completion;
+    while (PSXWorker::tryGetCompletion(completion)) {
+      switch (completion.job.owner) {
+        case K573::JobOwner::Transfer: MemoryCardEngine::onComplete(completion); break;
+        case K573::JobOwner::Prefetch: Prefetcher::onComplete(completion); break;
+        case K573::JobOwner::Flush: WriteBehind::onComplete(completion); break;
+        case K573::JobOwner::Presence: CardPresence::onComplete(completion); break;
+        case K573::JobOwner::Service: CardService::onComplete(completion); break;
+      }
+    }
+    MemoryCardEngine::service();
+    return 0;
+  }
+
+  /**
+   * @brief Task: presence probes, write-behind flush and prefetch.
+   */
+  uint32_t __serveMaintenance(void *) {
+    CardPresence::service();
+
+    // Card service keeps the bus to itself
+    bool isIdle = !MemoryCardEngine::isBusy() && !CardService::isBusy()
+                  && micros() - __lastRequestTime >= K573_PREFETCH_IDLE_US;
+    WriteBehind::service(isIdle);
+    bool isFlushing = false;
+    for (int slot = 0; slot < K573_SLOT_COUNTS; slot++) {
+      isFlushing |= WriteBehind::isPending(slot);
+    }
+    Prefetcher::service(isIdle && !isFlushing);
+    return 0;
+  }
+
+#if TRACE_ENABLED || K573_CARD_SERVICE
+  /**
+   * @brief Send records to USB CDC without blocking.
+   */
+  size_t __writeUsb(const uint8_t *data, size_t length) {
+    size_t room = Serial.availableForWrite();
+    return Serial.write(data, length < room ? length : room);
+  }
+
+#if K573_CARD_SERVICE
+  size_t __writeService(const uint8_t *data, size_t length) {
+#if TRACE_ENABLED
+    // Records are never interleaved: a new service record waits until trace records are out
+    if (!CardService::isSending() && Trace::isSending()) return 0;
+#endif
+    return __writeUsb(data, length);
+  }
+#endif
+
+#if TRACE_ENABLED
+  size_t __writeTrace(const uint8_t *data, size_t length) {
+#if K573_CARD_SERVICE
+    if (CardService::isSending()) return 0;
+#endif
+    return __writeUsb(data, length);
+  }
+#endif
+
+  /**
+   * @brief Task: take requests from the host, and stream card service and trace records.
+   */
+  uint32_t __serveUsb(void *) {
+    while (Serial.available() > 0) {
+      uint8_t data = Serial.read();
+#if K573_CARD_SERVICE
+      if (CardService::receive(data)) continue;
+#endif
+#if TRACE_ENABLED
+      Trace::control(data);
+#endif
+    }
+#if K573_CARD_SERVICE
+    CardService::service(__writeService);
+#endif
+#if TRACE_ENABLED
+    Trace::service(__writeTrace);
+#endif
+    return 0;
+  }
+#endif
+
+  uint32_t __now() {
+    return micros();
+  }
+
+  // JVS is never delayed by memory card work more than one step
+  Scheduler __scheduler(__now);
 };
 
 
+// Core 0: JVS
 void setup() {
-  PSX::setup();
   JVS::setup();
+  __requestPacket = JVS::PacketPool::acquire();
+  FrameCache::setEvictionListener(Prefetcher::onEvicted);
+  __scheduler.add(__serveJvs, nullptr, Scheduler::Priority::High, __hasRequest);
+  __scheduler.add(__serveTransfer, nullptr, Scheduler::Priority::Normal, __hasTransfer);
+  __scheduler.add(__serveMaintenance, nullptr, Scheduler::Priority::Low);
+#if TRACE_ENABLED || K573_CARD_SERVICE
+  // USB CDC, separate from the JVS UART
+  Serial.begin(115200);
+  __scheduler.add(__serveUsb, nullptr, Scheduler::Priority::Low);
+#endif
 }
 
 void loop() {
-  // put your main code here, to run repeatedly:
+  __scheduler.runOnce();
+}
+
+// Core 1: PSX (controller & memory card)
+void setup1() {
+  PSXWorker::setup();
+}
+
+void loop1() {
+  PSXWorker::service();
 }
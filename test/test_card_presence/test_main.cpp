@@ -0,0 +1,152 @@
+/*
+  Card presence on simulated cards: the new card FLAG cleared by a write of the write test frame, and a card
+  swapped between two probes caught by its FLAG (everything cached for the old card is dropped).
+
+    pio test -e native -f test_card_presence -v
+*/
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <unity.h>
+#include <Arduino.h>
+#include <CardPresence.h>
+#include <FrameCache.h>
+#include <MemoryCardEngine.h>
+#include <Prefetcher.h>
+#include <PSXSim.h>
+#include <PSXWorker.h>
+#include <RamStore.h>
+#include <WriteBehind.h>
+
+namespace {
+  const uint32_t __timeoutUs = 5000000;
+  const uint32_t __ramAddress = 0x040000;
+
+  PSXSim::MemoryCard __cardA;
+  PSXSim::MemoryCard __cardB;
+  std::atomic<bool> __isRunning{ true };
+  std::atomic<bool> __isReady{ false };
+  std::thread __core1;
+
+  void __fill(PSXSim::MemoryCard &card, uint8_t seed) {
+    for (uint16_t address = 0; address < K573_MEMCARD_FRAMES; address++) {
+      for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE; i++) card.frame(address)[i] = (uint8_t)(seed + address * 3 + i);
+    }
+  }
+
+  /**
+   * @brief One pass of core 0 (no read ahead, the bus only sees the host and the presence jobs).
+   */
+  void __step() {
+    PSXWorker::Completion completion;
+    while (PSXWorker::tryGetCompletion(completion)) {
+      switch (completion.job.owner) {
+        case K573::JobOwner::Transfer: MemoryCardEngine::onComplete(completion); break;
+        case K573::JobOwner::Flush: WriteBehind::onComplete(completion); break;
+        case K573::JobOwner::Presence: CardPresence::onComplete(completion); break;
+      }
+    }
+    MemoryCardEngine::service();
+    CardPresence::service();
+    WriteBehind::flush();
+    WriteBehind::service(!MemoryCardEngine::isBusy());
+    std::this_thread::yield();
+  }
+
+  /**
+   * @brief Run core 0 until the card was written (FLAG cleared).
+   * @return `false` if it was not written in time
+   */
+  bool __stepUntilWritten(PSXSim::MemoryCard &card, uint32_t writes) {
+    uint32_t start = micros();
+    while (card.writes < writes) {
+      if (micros() - start > __timeoutUs) return false;
+      __step();
+    }
+    return true;
+  }
+
+  void __stepFor(uint32_t us) {
+    uint32_t start = micros();
+    while (micros() - start < us) __step();
+  }
+
+  /**
+   * @brief Host reads the directory into RAM.
+   * @return `false` if it did not finish in time
+   */
+  bool __readDirectory() {
+    if (MemoryCardEngine::startRead(0, 0, __ramAddress, K573_DIRECTORY_FRAMES) != MemoryCardEngine::StartResult::Started) return false;
+    uint32_t start = micros();
+    while (MemoryCardEngine::isBusy()) {
+      if (micros() - start > __timeoutUs) return false;
+      __step();
+    }
+    return true;
+  }
+
+  void testFlagClearedOnInsert() {
+    uint8_t testFrame[PSX_MEMCARD_FRAME_SIZE];
+    memcpy(testFrame, __cardA.frame(PSX_MEMCARD_WRITE_TEST_FRAME), sizeof(testFrame));
+    TEST_ASSERT_TRUE(__stepUntilWritten(__cardA, 1));
+    TEST_ASSERT_EQUAL_UINT16(MemoryCardStatus::Available, CardPresence::getStatus(0));
+    // Written back as it was
+    TEST_ASSERT_EQUAL_MEMORY(testFrame, __cardA.frame(PSX_MEMCARD_WRITE_TEST_FRAME), sizeof(testFrame));
+
+    // Next probes find the FLAG cleared and write nothing
+    __stepFor(3 * K573_PRESENCE_PROBE_US);
+    TEST_ASSERT_EQUAL_UINT32(1, __cardA.writes);
+  }
+
+  void testSwapBetweenProbes() {
+    TEST_ASSERT_TRUE(__readDirectory());
+    TEST_ASSERT_TRUE(FrameCache::contains(0, 0));
+
+    // Card B plugged in before the next probe saw the slot empty
+    PSXSim::detach(0, &__cardA);
+    PSXSim::attach(0, &__cardB);
+    TEST_ASSERT_TRUE(__stepUntilWritten(__cardB, 1));
+    TEST_ASSERT_FALSE(FrameCache::contains(0, 0));
+    TEST_ASSERT_EQUAL_UINT16(MemoryCardStatus::Available, CardPresence::getStatus(0));
+
+    // Host gets the data of card B, not the cached data of card A
+    uint32_t reads = __cardB.reads;
+    TEST_ASSERT_TRUE(__readDirectory());
+    TEST_ASSERT_EQUAL_UINT32(reads + K573_DIRECTORY_FRAMES, __cardB.reads);
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    TEST_ASSERT_TRUE(RamStore::read(__ramAddress + PSX_MEMCARD_FRAME_SIZE, data, sizeof(data)));
+    TEST_ASSERT_EQUAL_MEMORY(__cardB.frame(1), data, sizeof(data));
+
+    __stepFor(3 * K573_PRESENCE_PROBE_US);
+    TEST_ASSERT_EQUAL_UINT32(1, __cardB.writes);
+    TEST_ASSERT_TRUE(FrameCache::contains(0, 0));
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  __fill(__cardA, 0x11);
+  __fill(__cardB, 0x77);
+  PSXSim::begin();
+  PSXSim::attach(0, &__cardA);
+  __core1 = std::thread([] {
+    PSXWorker::setup();
+    __isReady.store(true);
+    while (__isRunning.load(std::memory_order_relaxed)) {
+      PSXWorker::service();
+      std::this_thread::yield();
+    }
+  });
+  while (!__isReady.load()) std::this_thread::yield();
+
+  UNITY_BEGIN();
+  RUN_TEST(testFlagClearedOnInsert);
+  RUN_TEST(testSwapBetweenProbes);
+  int failures = UNITY_END();
+  __isRunning.store(false);
+  __core1.join();
+  return failures;
+}
@@ -0,0 +1,137 @@
+/*
+  Background controller polling on a stopped clock (moved only by the simulated bus and the test): polls on the
+  `PSX_CONTROLLER_POLL_US` grid even when served late, grid points passed during a long memory card frame counted as
+  `dropped`, and the age of a published sample from `ControllerState.time`.
+
+    pio test -e native -f test_controller_poller -v
+*/
+#include <unity.h>
+#include <Arduino.h>
+#include <PSXSim.h>
+#include <PSXWorker.h>
+
+namespace {
+  // First grid point (`micros` when the worker was set up)
+  const uint32_t __start = 1000000;
+
+  PSXSim::DigitalPad __pad;
+  PSXSim::MemoryCard __card;
+  // Microseconds from the start of a poll to the end of the Port 1 exchange (fixed on a stopped clock)
+  uint32_t __exchangeUs = 0;
+
+  PSXWorker::ControllerState __read() {
+    PSXWorker::ControllerState state;
+    PSXWorker::readController(state);
+    return state;
+  }
+
+  /**
+   * @brief Step the PSX core at the time.
+   * @return Polls done meanwhile
+   */
+  uint32_t __serviceAt(uint32_t time) {
+    uint32_t samples = __read().samples;
+    hostSetClock(time);
+    for (int i = 0; i < 4; i++) PSXWorker::service();
+    return __read().samples - samples;
+  }
+
+  void testGrid() {
+    // First poll as soon as the worker is set up
+    TEST_ASSERT_EQUAL_UINT32(1, __serviceAt(__start));
+    PSXWorker::ControllerState state = __read();
+    __exchangeUs = state.time[0] - __start;
+    TEST_ASSERT_TRUE(__exchangeUs > 0 && __exchangeUs < PSX_CONTROLLER_POLL_US / 2);
+
+    for (uint32_t poll = 1; poll <= 3; poll++) {
+      uint32_t point = __start + poll * PSX_CONTROLLER_POLL_US;
+      TEST_ASSERT_EQUAL_UINT32(0, __serviceAt(point - 1));
+      // Served late: polled now, the next poll stays on the grid
+      uint32_t late = poll * 37;
+      TEST_ASSERT_EQUAL_UINT32(1, __serviceAt(point + late));
+      TEST_ASSERT_EQUAL_UINT32(point + late + __exchangeUs, __read().time[0]);
+    }
+    state = __read();
+    TEST_ASSERT_EQUAL_UINT32(4, state.samples);
+    TEST_ASSERT_EQUAL_UINT32(0, state.dropped);
+  }
+
+  void testDroppedAfterLongJob() {
+    uint32_t point = __start + 4 * PSX_CONTROLLER_POLL_US;
+    TEST_ASSERT_EQUAL_UINT32(1, __serviceAt(point));
+
+    // Write frame of 138 bytes holds the shared bus for several grid points
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE; i++) data[i] = i;
+    PSXWorker::Job job;
+    job.type = PSXWorker::JobType::WriteMemoryCard;
+    job.slot = 1;
+    job.address = 0x100;
+    job.buffer = data;
+    TEST_ASSERT_TRUE(PSXWorker::trySubmit(job));
+    PSXWorker::Completion completion;
+    for (int i = 0; i < 1000 && !PSXWorker::tryGetCompletion(completion); i++) PSXWorker::service();
+    TEST_ASSERT_EQUAL(PSX::FrameResult::Success, completion.result);
+    TEST_ASSERT_EQUAL_MEMORY(data, __card.frame(0x100), sizeof(data));
+
+    // Polled once the bus is free, every grid point passed without a poll is dropped
+    __serviceAt(micros());
+    PSXWorker::ControllerState state = __read();
+    uint32_t pollStart = state.time[0] - __exchangeUs;
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(4, state.dropped);
+    TEST_ASSERT_EQUAL_UINT32((pollStart - __start) / PSX_CONTROLLER_POLL_US + 1, state.samples + state.dropped);
+
+    // Still on the grid (a late poll might run past a grid point, that one is dropped too)
+    uint32_t next = micros() - (micros() - __start) % PSX_CONTROLLER_POLL_US + PSX_CONTROLLER_POLL_US;
+    TEST_ASSERT_EQUAL_UINT32(0, __serviceAt(next - 1));
+    TEST_ASSERT_EQUAL_UINT32(1, __serviceAt(next));
+    state = __read();
+    TEST_ASSERT_EQUAL_UINT32(next + __exchangeUs, state.time[0]);
+    TEST_ASSERT_EQUAL_UINT32((next - __start) / PSX_CONTROLLER_POLL_US + 1, state.samples + state.dropped);
+  }
+
+  void testSampleAge() {
+    uint32_t point = micros() - (micros() - __start) % PSX_CONTROLLER_POLL_US + PSX_CONTROLLER_POLL_US;
+    __pad.buttons = 0xfe7f;
+    TEST_ASSERT_EQUAL_UINT32(1, __serviceAt(point));
+    PSXWorker::ControllerState state = __read();
+    TEST_ASSERT_EQUAL(PSX::FrameResult::Success, state.result[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x7f, state.input[0][0]);
+    TEST_ASSERT_EQUAL_HEX8(0xfe, state.input[0][1]);
+    TEST_ASSERT_EQUAL_UINT32(point + __exchangeUs, state.time[0]);
+    // Port 2 (a memory card, no controller) is read in the same poll
+    TEST_ASSERT_EQUAL(PSX::FrameResult::NoDevice, state.result[1]);
+    TEST_ASSERT_TRUE(state.time[1] >= state.time[0] && state.time[1] <= micros());
+
+    // Switches change between polls: the sample gets older until the next grid point
+    __pad.buttons = 0xffff;
+    TEST_ASSERT_EQUAL_UINT32(0, __serviceAt(point + 900));
+    state = __read();
+    TEST_ASSERT_EQUAL_HEX8(0x7f, state.input[0][0]);
+    TEST_ASSERT_EQUAL_UINT32(900 - __exchangeUs, micros() - state.time[0]);
+
+    TEST_ASSERT_EQUAL_UINT32(1, __serviceAt(point + PSX_CONTROLLER_POLL_US));
+    state = __read();
+    TEST_ASSERT_EQUAL_HEX8(0xff, state.input[0][0]);
+    TEST_ASSERT_EQUAL_HEX8(0xff, state.input[0][1]);
+    TEST_ASSERT_EQUAL_UINT32(point + PSX_CONTROLLER_POLL_US + __exchangeUs, state.time[0]);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  // PSX core runs on this thread, time moves only on the bus and in `__serviceAt`
+  hostSetClock(__start);
+  PSXSim::begin();
+  PSXSim::attach(0, &__pad);
+  PSXSim::attach(1, &__card);
+  PSXWorker::setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(testGrid);
+  RUN_TEST(testDroppedAfterLongJob);
+  RUN_TEST(testSampleAge);
+  return UNITY_END();
+}
@@ -0,0 +1,225 @@
+/*
+  Frame cache: LRU order, dirty frames, invalidation and page sharing, then a benchmark over the access patterns
+  of a game session (directory scans, save block loads and saves).
+
+    pio test -e native -f test_frame_cache -v
+*/
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+#include <unity.h>
+#include <FrameCache.h>
+#include <PagePool.h>
+
+namespace {
+  struct Access {
+    uint8_t slot;
+    uint16_t address;
+    bool isWrite;
+  };
+
+  void __fill(uint8_t *data, int seed) {
+    for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE; i++) data[i] = (uint8_t)(seed * 13 + i);
+  }
+
+  bool __isFilled(const uint8_t *data, int seed) {
+    for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE; i++) {
+      if (data[i] != (uint8_t)(seed * 13 + i)) return false;
+    }
+    return true;
+  }
+
+  void testHitAndMiss() {
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    __fill(data, 1);
+    TEST_ASSERT_EQUAL(0, FrameCache::findPage(0, 5));
+    TEST_ASSERT_TRUE(FrameCache::store(0, 5, data, false));
+    PagePool::Page page = FrameCache::findPage(0, 5);
+    TEST_ASSERT_NOT_EQUAL(0, page);
+    TEST_ASSERT_TRUE(__isFilled(PagePool::data(page), 1));
+    // Same address on the other slot is another frame
+    TEST_ASSERT_FALSE(FrameCache::contains(1, 5));
+    // Out of range is a miss, never an entry
+    TEST_ASSERT_FALSE(FrameCache::store(K573_SLOT_COUNTS, 0, data, false));
+    TEST_ASSERT_FALSE(FrameCache::store(0, K573_MEMCARD_FRAMES, data, false));
+
+    const FrameCache::Statistics &statistics = FrameCache::getStatistics();
+    TEST_ASSERT_EQUAL_UINT32(1, statistics.hits);
+    TEST_ASSERT_EQUAL_UINT32(1, statistics.misses);
+  }
+
+  void testLeastRecentlyUsedIsEvicted() {
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    for (int i = 0; i < K573_FRAME_CACHE_FRAMES; i++) {
+      __fill(data, i);
+      TEST_ASSERT_TRUE(FrameCache::store(0, i, data, false));
+    }
+    // Frame 0 becomes the newest, so frame 1 is the oldest
+    TEST_ASSERT_NOT_EQUAL(0, FrameCache::findPage(0, 0));
+    TEST_ASSERT_TRUE(FrameCache::store(0, K573_FRAME_CACHE_FRAMES, data, false));
+    TEST_ASSERT_TRUE(FrameCache::contains(0, 0));
+    TEST_ASSERT_FALSE(FrameCache::contains(0, 1));
+    TEST_ASSERT_TRUE(FrameCache::contains(0, 2));
+    TEST_ASSERT_EQUAL_UINT32(1, FrameCache::getStatistics().evictions);
+    // `contains` and `peek` do not refresh the frame
+    TEST_ASSERT_NOT_NULL(FrameCache::peek(0, 2));
+    TEST_ASSERT_TRUE(FrameCache::store(0, K573_FRAME_CACHE_FRAMES + 1, data, false));
+    TEST_ASSERT_FALSE(FrameCache::contains(0, 2));
+  }
+
+  void testDirtyFramesStay() {
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    __fill(data, 7);
+    for (int i = 0; i < K573_FRAME_CACHE_FRAMES; i++) TEST_ASSERT_TRUE(FrameCache::store(1, i, data, true));
+    TEST_ASSERT_EQUAL_UINT16(K573_FRAME_CACHE_FRAMES, FrameCache::countDirty(1));
+    // Nothing can be evicted
+    TEST_ASSERT_FALSE(FrameCache::store(0, 0, data, false));
+    TEST_ASSERT_EQUAL_UINT32(0, FrameCache::getStatistics().evictions);
+
+    // Written back in address order
+    uint16_t address;
+    TEST_ASSERT_TRUE(FrameCache::findDirty(1, 10, address));
+    TEST_ASSERT_EQUAL_UINT16(10, address);
+    FrameCache::markClean(1, 10);
+    TEST_ASSERT_FALSE(FrameCache::isDirty(1, 10));
+    TEST_ASSERT_TRUE(FrameCache::findDirty(1, 10, address));
+    TEST_ASSERT_EQUAL_UINT16(11, address);
+    // The clean frame makes room
+    TEST_ASSERT_TRUE(FrameCache::store(0, 0, data, false));
+    TEST_ASSERT_FALSE(FrameCache::contains(1, 10));
+    TEST_ASSERT_EQUAL_UINT16(K573_FRAME_CACHE_FRAMES - 1, FrameCache::countDirty(1));
+  }
+
+  void testInvalidateDropsOneSlot() {
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    __fill(data, 3);
+    uint16_t freePages = PagePool::countFree();
+    for (int i = 0; i < 4; i++) {
+      FrameCache::store(0, i, data, i < 2);
+      FrameCache::store(1, i, data, false);
+    }
+    FrameCache::invalidate(0);
+    for (int i = 0; i < 4; i++) {
+      TEST_ASSERT_FALSE(FrameCache::contains(0, i));
+      TEST_ASSERT_TRUE(FrameCache::contains(1, i));
+    }
+    TEST_ASSERT_EQUAL_UINT16(0, FrameCache::countDirty(0));
+    TEST_ASSERT_EQUAL_UINT32(2, FrameCache::getStatistics().droppedDirty);
+    FrameCache::invalidate(1);
+    TEST_ASSERT_EQUAL_UINT16(freePages, PagePool::countFree());
+  }
+
+  void testSharedPageIsCopiedOnWrite() {
+    PagePool::Page page = PagePool::allocate();
+    __fill(PagePool::data(page), 4);
+    TEST_ASSERT_TRUE(FrameCache::storePage(0, 9, page, false));
+    TEST_ASSERT_TRUE(PagePool::isShared(page));
+    TEST_ASSERT_EQUAL(page, FrameCache::findPage(0, 9));
+
+    // Writer of the cached frame gets its own page, the other owner keeps the old data
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    __fill(data, 5);
+    TEST_ASSERT_TRUE(FrameCache::store(0, 9, data, true));
+    TEST_ASSERT_NOT_EQUAL(page, FrameCache::findPage(0, 9));
+    TEST_ASSERT_TRUE(__isFilled(PagePool::data(page), 4));
+    TEST_ASSERT_TRUE(__isFilled(FrameCache::peek(0, 9), 5));
+    TEST_ASSERT_FALSE(PagePool::isShared(page));
+    PagePool::release(page);
+  }
+
+  /**
+   * @brief Session of a game: directory scan, load of two saves, save of one of them, directory scan again.
+   */
+  std::vector<Access> __session(int slot) {
+    std::vector<Access> accesses;
+    auto scan = [&](uint16_t first, uint16_t count, bool isWrite) {
+      for (uint16_t i = 0; i < count; i++) accesses.push_back({ (uint8_t)slot, (uint16_t)(first + i), isWrite });
+    };
+    for (int round = 0; round < 4; round++) {
+      scan(0, 16, false);
+      scan(PSX_MEMCARD_FRAMES_IN_BLOCK * 3, PSX_MEMCARD_FRAMES_IN_BLOCK, false);
+      scan(PSX_MEMCARD_FRAMES_IN_BLOCK * 7, PSX_MEMCARD_FRAMES_IN_BLOCK / 2, false);
+      scan(0, 16, false);
+      scan(PSX_MEMCARD_FRAMES_IN_BLOCK * 3, PSX_MEMCARD_FRAMES_IN_BLOCK, true);
+      scan(1, 1, true);
+    }
+    return accesses;
+  }
+
+  /**
+   * @brief Every block read once in order (card dump), nothing is read twice.
+   */
+  std::vector<Access> __dump(int slot) {
+    std::vector<Access> accesses;
+    for (uint16_t address = 0; address < K573_MEMCARD_FRAMES; address++) accesses.push_back({ (uint8_t)slot, address, false });
+    return accesses;
+  }
+
+  /**
+   * @brief Replay the accesses like `MemoryCardEngine` and `WriteBehind` do (miss: frame read from the card).
+   */
+  void __replay(const char *name, const std::vector<Access> &accesses, int rounds) {
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    __fill(data, 9);
+    FrameCache::resetStatistics();
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t cardReads = 0;
+    for (int round = 0; round < rounds; round++) {
+      for (const Access &access : accesses) {
+        if (access.isWrite) {
+          FrameCache::store(access.slot, access.address, data, true);
+          // Written back at once
+          FrameCache::markClean(access.slot, access.address);
+          continue;
+        }
+        if (FrameCache::findPage(access.slot, access.address)) continue;
+        cardReads++;
+        FrameCache::store(access.slot, access.address, data, false);
+      }
+      FrameCache::invalidate(0);
+      FrameCache::invalidate(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsedNs = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    const FrameCache::Statistics &statistics = FrameCache::getStatistics();
+    uint32_t lookups = statistics.hits + statistics.misses;
+    printf("%-8s %6zu accesses: hit rate %5.1f%%, %u card reads, %u evictions, %.0f ns per access (%d frames cached)\n",
+           name, accesses.size(), 100.0 * statistics.hits / lookups, cardReads / rounds, statistics.evictions / rounds,
+           elapsedNs / (accesses.size() * rounds), K573_FRAME_CACHE_FRAMES);
+  }
+
+  void testBenchmark() {
+    std::vector<Access> session = __session(0);
+    std::vector<Access> both = __session(0);
+    std::vector<Access> other = __session(1);
+    // Two players saving at the same time
+    for (size_t i = 0; i < other.size(); i++) both.insert(both.begin() + i * 2 + 1, other[i]);
+    __replay("session", session, 200);
+    __replay("2 cards", both, 200);
+    __replay("dump", __dump(0), 200);
+
+    // Directory and save of the session are served from RAM after the first round
+    __replay("session", session, 1);
+    TEST_ASSERT_GREATER_THAN_UINT32(FrameCache::getStatistics().misses * 3, FrameCache::getStatistics().hits);
+  }
+}
+
+void setUp() {
+  FrameCache::invalidate(0);
+  FrameCache::invalidate(1);
+  FrameCache::resetStatistics();
+}
+
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testHitAndMiss);
+  RUN_TEST(testLeastRecentlyUsedIsEvicted);
+  RUN_TEST(testDirtyFramesStay);
+  RUN_TEST(testInvalidateDropsOneSlot);
+  RUN_TEST(testSharedPageIsCopiedOnWrite);
+  RUN_TEST(testBenchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,183 @@
+/*
+  Retry policy and bad frame map: the backoff of each attempt, then faults injected into a simulated card
+  (transient bad checksums and timeouts recovered by retrying, persistent ones and bad sectors marked, marks cleared
+  by a write or by removing the card).
+
+    pio test -e native -f test_frame_errors -v
+*/
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <unity.h>
+#include <Arduino.h>
+#include <CardPresence.h>
+#include <FrameErrors.h>
+#include <MemoryCardEngine.h>
+#include <PSXSim.h>
+#include <PSXWorker.h>
+#include <RamStore.h>
+#include <WriteBehind.h>
+
+namespace {
+  const uint32_t __timeoutUs = 5000000;
+  const uint32_t __ramAddress = 0x040000;
+  const uint16_t __frame = 0x120;
+
+  PSXSim::MemoryCard __card;
+  std::atomic<bool> __isRunning{ true };
+  std::atomic<bool> __isReady{ false };
+  std::thread __core1;
+
+  void __step() {
+    PSXWorker::Completion completion;
+    while (PSXWorker::tryGetCompletion(completion)) {
+      switch (completion.job.owner) {
+        case K573::JobOwner::Transfer: MemoryCardEngine::onComplete(completion); break;
+        case K573::JobOwner::Flush: WriteBehind::onComplete(completion); break;
+        case K573::JobOwner::Presence: CardPresence::onComplete(completion); break;
+      }
+    }
+    MemoryCardEngine::service();
+    CardPresence::service();
+    WriteBehind::flush();
+    WriteBehind::service(!MemoryCardEngine::isBusy());
+    std::this_thread::yield();
+  }
+
+  /**
+   * @brief Host transfer of one frame.
+   * @return Start result (the transfer is done when `Started` is returned)
+   */
+  MemoryCardEngine::StartResult __transfer(bool isRead, uint16_t address) {
+    MemoryCardEngine::StartResult result = isRead ? MemoryCardEngine::startRead(0, address, __ramAddress, 1)
+                                                  : MemoryCardEngine::startWrite(0, address, __ramAddress, 1);
+    if (result != MemoryCardEngine::StartResult::Started) return result;
+    uint32_t start = micros();
+    while (MemoryCardEngine::isBusy() || WriteBehind::isPending(0)) {
+      if (micros() - start > __timeoutUs) return MemoryCardEngine::StartResult::Busy;
+      __step();
+    }
+    return result;
+  }
+
+  FrameErrors::Counters __counters() {
+    PSXWorker::ErrorState state;
+    PSXWorker::readErrors(state);
+    return state.counters[0];
+  }
+
+  void testBackoff() {
+    static FrameErrors errors;
+    uint32_t backoff = 0;
+    for (int attempt = 1; attempt <= PSX_RETRY_LIMIT; attempt++) {
+      TEST_ASSERT_TRUE(errors.shouldRetry(0, PSX::FrameResult::BadChecksum, attempt, backoff));
+      TEST_ASSERT_EQUAL_UINT32(PSX_RETRY_BACKOFF_US << (attempt - 1), backoff);
+    }
+    // Bounded, and nothing but transient errors is retried
+    TEST_ASSERT_FALSE(errors.shouldRetry(0, PSX::FrameResult::Timeout, PSX_RETRY_LIMIT + 1, backoff));
+    TEST_ASSERT_FALSE(errors.shouldRetry(0, PSX::FrameResult::BadSector, 1, backoff));
+    TEST_ASSERT_FALSE(errors.shouldRetry(0, PSX::FrameResult::NoDevice, 1, backoff));
+    TEST_ASSERT_EQUAL_UINT32(PSX_RETRY_LIMIT, errors.getCounters(0).retries);
+
+    errors.record(0, __frame, PSX::FrameResult::BadChecksum, PSX_RETRY_LIMIT + 1);
+    TEST_ASSERT_TRUE(errors.isBad(0, __frame));
+    TEST_ASSERT_FALSE(errors.isBad(0, __frame + 1));
+    TEST_ASSERT_FALSE(errors.isBad(1, __frame));
+    errors.record(0, __frame, PSX::FrameResult::Success, 1);
+    TEST_ASSERT_FALSE(errors.isBad(0, __frame));
+    TEST_ASSERT_EQUAL_UINT16(0, errors.getCounters(0).badFrames);
+  }
+
+  void testTransientRecovered() {
+    FrameErrors::Counters before = __counters();
+    __card.faults.badChecksums = 2;
+    TEST_ASSERT_EQUAL(MemoryCardEngine::StartResult::Started, __transfer(true, __frame));
+    __card.faults.timeouts = 1;
+    TEST_ASSERT_EQUAL(MemoryCardEngine::StartResult::Started, __transfer(true, __frame + 1));
+
+    FrameErrors::Counters after = __counters();
+    TEST_ASSERT_EQUAL_UINT32(3, after.retries - before.retries);
+    TEST_ASSERT_EQUAL_UINT32(2, after.recovered - before.recovered);
+    TEST_ASSERT_EQUAL_UINT32(0, after.persistent - before.persistent);
+    TEST_ASSERT_EQUAL_UINT16(0, after.badFrames);
+    TEST_ASSERT_NOT_EQUAL(MemoryCardStatus::Error, MemoryCardEngine::getStatus(0));
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    TEST_ASSERT_TRUE(RamStore::read(__ramAddress, data, sizeof(data)));
+    TEST_ASSERT_EQUAL_MEMORY(__card.frame(__frame + 1), data, sizeof(data));
+  }
+
+  void testPersistentMarked() {
+    // Frames not read before, so nothing comes from the cache
+    FrameErrors::Counters before = __counters();
+    __card.faults.badChecksums = PSX_RETRY_LIMIT + 1;
+    TEST_ASSERT_EQUAL(MemoryCardEngine::StartResult::Started, __transfer(true, __frame + 8));
+    FrameErrors::Counters after = __counters();
+    TEST_ASSERT_EQUAL_UINT32(PSX_RETRY_LIMIT, after.retries - before.retries);
+    TEST_ASSERT_EQUAL_UINT32(1, after.persistent - before.persistent);
+    TEST_ASSERT_EQUAL_UINT16(1, after.badFrames);
+    TEST_ASSERT_EQUAL_UINT16(MemoryCardStatus::Error, MemoryCardEngine::getStatus(0));
+    TEST_ASSERT_TRUE(PSXWorker::isBadFrame(0, __frame + 8));
+
+    // Refused when the command arrives, the card is not touched again
+    uint32_t reads = __card.reads;
+    TEST_ASSERT_EQUAL(MemoryCardEngine::StartResult::BadFrame, __transfer(true, __frame + 8));
+    TEST_ASSERT_EQUAL_UINT32(reads, __card.reads);
+
+    // Writing the frame clears the mark
+    TEST_ASSERT_EQUAL(MemoryCardEngine::StartResult::Started, __transfer(false, __frame + 8));
+    TEST_ASSERT_FALSE(PSXWorker::isBadFrame(0, __frame + 8));
+    TEST_ASSERT_EQUAL_UINT16(0, __counters().badFrames);
+    TEST_ASSERT_EQUAL(MemoryCardEngine::StartResult::Started, __transfer(true, __frame + 8));
+  }
+
+  void testBadSectorNotRetried() {
+    FrameErrors::Counters before = __counters();
+    __card.faults.badFrame = __frame + 16;
+    TEST_ASSERT_EQUAL(MemoryCardEngine::StartResult::Started, __transfer(true, __frame + 16));
+    FrameErrors::Counters after = __counters();
+    TEST_ASSERT_EQUAL_UINT32(0, after.retries - before.retries);
+    TEST_ASSERT_EQUAL_UINT32(1, after.persistent - before.persistent);
+    TEST_ASSERT_TRUE(PSXWorker::isBadFrame(0, __frame + 16));
+
+    // Card removed and inserted again: the map starts over
+    PSXSim::detach(0, &__card);
+    uint32_t start = micros();
+    while (CardPresence::getStatus(0) != MemoryCardStatus::Unavailable && micros() - start < __timeoutUs) __step();
+    TEST_ASSERT_FALSE(PSXWorker::isBadFrame(0, __frame + 16));
+    PSXSim::attach(0, &__card);
+    start = micros();
+    while (CardPresence::getStatus(0) != MemoryCardStatus::Available && micros() - start < __timeoutUs) __step();
+    TEST_ASSERT_EQUAL_UINT16(MemoryCardStatus::Available, CardPresence::getStatus(0));
+    TEST_ASSERT_EQUAL_UINT16(0, __counters().badFrames);
+    __card.faults.badFrame = -1;
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  PSXSim::begin();
+  PSXSim::attach(0, &__card);
+  __core1 = std::thread([] {
+    PSXWorker::setup();
+    __isReady.store(true);
+    while (__isRunning.load(std::memory_order_relaxed)) {
+      PSXWorker::service();
+      std::this_thread::yield();
+    }
+  });
+  while (!__isReady.load()) std::this_thread::yield();
+  // New card FLAG cleared before faults are injected
+  while (__card.writes == 0) __step();
+
+  UNITY_BEGIN();
+  RUN_TEST(testBackoff);
+  RUN_TEST(testTransientRecovered);
+  RUN_TEST(testPersistentMarked);
+  RUN_TEST(testBadSectorNotRetried);
+  int failures = UNITY_END();
+  __isRunning.store(false);
+  __core1.join();
+  return failures;
+}
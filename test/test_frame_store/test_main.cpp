@@ -0,0 +1,212 @@
+/*
+  Log-structured frame store on a file-backed flash image: round trip and remount, then the write amplification
+  and wear spread of the write patterns games make.
+
+    pio test -e native -f test_frame_store -v
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <unity.h>
+#include <FileBlockDevice.h>
+#include <FrameStore.h>
+
+namespace {
+  // 512KB of flash, twice the two card images
+  const uint32_t __sectorCounts = 128;
+  const uint16_t __framesInBlock = 64;
+
+  /**
+   * @brief Counts the erases of each sector of the file device.
+   */
+  class WearDevice : public BlockDevice {
+  public:
+    FileBlockDevice file;
+    uint32_t erases[__sectorCounts] = {};
+
+    uint32_t getSectorSize() const override {
+      return file.getSectorSize();
+    }
+
+    uint32_t getSectorCount() const override {
+      return file.getSectorCount();
+    }
+
+    bool read(uint32_t offset, uint8_t *data, uint32_t length) override {
+      return file.read(offset, data, length);
+    }
+
+    bool program(uint32_t offset, const uint8_t *data, uint32_t length) override {
+      return file.program(offset, data, length);
+    }
+
+    bool erase(uint32_t sector) override {
+      if (sector < __sectorCounts) erases[sector]++;
+      return file.erase(sector);
+    }
+  };
+
+  char __path[64];
+  WearDevice __device;
+  FrameStore __store;
+  uint32_t __random = 0x2468ace1;
+
+  uint32_t __next() {
+    __random ^= __random << 13;
+    __random ^= __random >> 17;
+    __random ^= __random << 5;
+    return __random;
+  }
+
+  void __fill(uint8_t *data, int slot, uint16_t address, uint32_t version) {
+    for (int i = 0; i < FRAME_STORE_FRAME_SIZE; i++) data[i] = (uint8_t)(slot * 97 + address * 13 + version * 7 + i);
+  }
+
+  /**
+   * @brief Fresh flash image and store.
+   */
+  void __open() {
+    __device.file.close();
+    if (__path[0]) unlink(__path);
+    strcpy(__path, "/tmp/test_frame_store_XXXXXX");
+    int file = mkstemp(__path);
+    TEST_ASSERT_GREATER_OR_EQUAL(0, file);
+    close(file);
+    memset(__device.erases, 0, sizeof(__device.erases));
+    TEST_ASSERT_TRUE(__device.file.open(__path, __sectorCounts));
+    __store = FrameStore();
+    TEST_ASSERT_TRUE(__store.begin(__device));
+  }
+
+  /**
+   * @brief Write the frame, then let the store work as the idle loop does.
+   */
+  void __write(int slot, uint16_t address, uint32_t version) {
+    uint8_t data[FRAME_STORE_FRAME_SIZE];
+    __fill(data, slot, address, version);
+    TEST_ASSERT_TRUE(__store.write(slot, address, data));
+    __store.service();
+  }
+
+  void testFormattedCard() {
+    __open();
+    uint8_t data[FRAME_STORE_FRAME_SIZE];
+    TEST_ASSERT_TRUE(__store.read(0, 0, data));
+    TEST_ASSERT_EQUAL_UINT8('M', data[0]);
+    TEST_ASSERT_EQUAL_UINT8('C', data[1]);
+    TEST_ASSERT_TRUE(__store.read(1, 1, data));
+    TEST_ASSERT_EQUAL_HEX8(0xa0, data[0]);
+    TEST_ASSERT_FALSE(__store.read(FRAME_STORE_SLOT_COUNTS, 0, data));
+    TEST_ASSERT_FALSE(__store.read(0, FRAME_STORE_FRAMES, data));
+  }
+
+  void testRoundTripAndRemount() {
+    __open();
+    for (uint16_t address = 0; address < FRAME_STORE_FRAMES; address += 3) __write(address % 2, address, 1);
+    // Rewritten frames keep only the latest copy
+    for (uint16_t address = 0; address < 300; address += 3) __write(address % 2, address, 2);
+
+    FrameStore mounted;
+    TEST_ASSERT_TRUE(mounted.begin(__device));
+    uint8_t expected[FRAME_STORE_FRAME_SIZE];
+    uint8_t data[FRAME_STORE_FRAME_SIZE];
+    for (uint16_t address = 0; address < FRAME_STORE_FRAMES; address += 3) {
+      __fill(expected, address % 2, address, address < 300 ? 2 : 1);
+      TEST_ASSERT_TRUE(mounted.read(address % 2, address, data));
+      TEST_ASSERT_EQUAL_MEMORY(expected, data, FRAME_STORE_FRAME_SIZE);
+    }
+  }
+
+  void testUnchangedWriteIsSkipped() {
+    __open();
+    __write(0, 70, 1);
+    __write(0, 70, 1);
+    const FrameStore::Statistics &statistics = __store.getStatistics();
+    TEST_ASSERT_EQUAL_UINT32(2, statistics.hostWrites);
+    TEST_ASSERT_EQUAL_UINT32(1, statistics.skipped);
+    TEST_ASSERT_EQUAL_UINT32(1, statistics.deviceWrites);
+  }
+
+  /**
+   * @brief Run a write pattern on two full cards and report what it cost the flash.
+   * @return Write amplification (device writes per changed frame)
+   */
+  double __measure(const char *name, uint32_t writes, uint16_t (*pattern)(uint32_t index, int &slot)) {
+    __open();
+    // Both cards full of saves
+    for (int slot = 0; slot < FRAME_STORE_SLOT_COUNTS; slot++) {
+      for (uint16_t address = 0; address < FRAME_STORE_FRAMES; address++) __write(slot, address, 0);
+    }
+    FrameStore::Statistics before = __store.getStatistics();
+    uint32_t erasesBefore[__sectorCounts];
+    memcpy(erasesBefore, __device.erases, sizeof(erasesBefore));
+
+    for (uint32_t i = 0; i < writes; i++) {
+      int slot = 0;
+      uint16_t address = pattern(i, slot);
+      __write(slot, address, i + 1);
+    }
+
+    const FrameStore::Statistics &after = __store.getStatistics();
+    uint32_t changed = (after.hostWrites - before.hostWrites) - (after.skipped - before.skipped);
+    uint32_t deviceWrites = after.deviceWrites - before.deviceWrites;
+    uint32_t least = UINT32_MAX;
+    uint32_t most = 0;
+    for (uint32_t sector = 0; sector < __sectorCounts; sector++) {
+      uint32_t erases = __device.erases[sector] - erasesBefore[sector];
+      if (erases < least) least = erases;
+      if (erases > most) most = erases;
+    }
+    double amplification = (double)deviceWrites / changed;
+    printf("%-16s %6u frames: write amplification %.2f, %.3f erases per frame, erases per sector %u-%u\n", name,
+           changed, amplification, (double)(after.erases - before.erases) / changed, least, most);
+    // Static wear levelling keeps the sectors within the delta
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(least + FRAME_STORE_WEAR_DELTA + 2, most);
+    return amplification;
+  }
+
+  uint16_t __saveSlot(uint32_t index, int &slot) {
+    // One save block and its directory frame, over and over (the game saves after every play)
+    slot = 0;
+    uint32_t frame = index % (__framesInBlock + 1);
+    return frame == __framesInBlock ? 1 : 3 * __framesInBlock + frame;
+  }
+
+  uint16_t __twoPlayers(uint32_t index, int &slot) {
+    slot = (index / (__framesInBlock + 1)) % 2;
+    uint32_t frame = index % (__framesInBlock + 1);
+    return frame == __framesInBlock ? 2 : (slot ? 9 : 4) * __framesInBlock + frame;
+  }
+
+  uint16_t __randomFrames(uint32_t, int &slot) {
+    slot = __next() % FRAME_STORE_SLOT_COUNTS;
+    return __next() % FRAME_STORE_FRAMES;
+  }
+
+  void testWriteAmplification() {
+    double save = __measure("save block", 100000, __saveSlot);
+    double players = __measure("two players", 100000, __twoPlayers);
+    double random = __measure("random frames", 50000, __randomFrames);
+    // Rewriting a few hot blocks on a full card stays cheap, cold saves are moved rarely
+    TEST_ASSERT_LESS_THAN(1.5, save);
+    TEST_ASSERT_LESS_THAN(1.5, players);
+    TEST_ASSERT_LESS_THAN(4.0, random);
+  }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testFormattedCard);
+  RUN_TEST(testRoundTripAndRemount);
+  RUN_TEST(testUnchangedWriteIsSkipped);
+  RUN_TEST(testWriteAmplification);
+  int failures = UNITY_END();
+  __device.file.close();
+  unlink(__path);
+  return failures;
+}
@@ -0,0 +1,140 @@
+/*
+  Host GPIO backend: transitions recorded with the trace clock, inputs driven from the outside, the trace ring,
+  then the attention line of a memory card read timed against the PSX clock.
+
+    pio test -e native -f test_gpio_trace -v
+*/
+#include <stdio.h>
+#include <unity.h>
+#include <Gpio.h>
+#include <PSX.h>
+#include <PSXFrame.h>
+#include <PSXSim.h>
+
+namespace {
+  // Pins the firmware does not use
+  typedef Gpio::Pin<20> OutputPin;
+  typedef Gpio::Pin<21> InputPin;
+
+  uint32_t __time = 0;
+
+  uint32_t __fakeClock() {
+    return __time;
+  }
+
+  void __assertTransition(size_t index, uint32_t time, uint8_t pin, bool level) {
+    const Gpio::Transition &transition = Gpio::getTransition(index);
+    TEST_ASSERT_EQUAL_UINT32(time, transition.time);
+    TEST_ASSERT_EQUAL_UINT8(pin, transition.pin);
+    TEST_ASSERT_EQUAL(level, transition.level);
+  }
+
+  /**
+   * @brief Find the next transition of the pin.
+   * @return Index, `countTransitions()` if none
+   */
+  size_t __find(size_t from, uint8_t pin, bool level) {
+    size_t counts = Gpio::countTransitions();
+    for (size_t i = from; i < counts; i++) {
+      if (Gpio::getTransition(i).pin == pin && Gpio::getTransition(i).level == level) return i;
+    }
+    return counts;
+  }
+
+  void testOutputTimestamps() {
+    __time = 100;
+    OutputPin::beginOutput(true);
+    Gpio::clearTrace();
+    __time = 110;
+    OutputPin::low();
+    // Same level again is not a transition
+    __time = 115;
+    OutputPin::low();
+    __time = 125;
+    OutputPin::high();
+    // Released with the latch HIGH, nothing drives the pin (input level LOW)
+    __time = 130;
+    OutputPin::input();
+
+    TEST_ASSERT_EQUAL_UINT32(3, Gpio::countTransitions());
+    __assertTransition(0, 110, 20, false);
+    __assertTransition(1, 125, 20, true);
+    __assertTransition(2, 130, 20, false);
+  }
+
+  void testInputDrivenFromOutside() {
+    InputPin::beginInput(true);
+    Gpio::clearTrace();
+    __time = 200;
+    Gpio::setInput(21, true);
+    TEST_ASSERT_TRUE(InputPin::read());
+    // Latch was cleared by `beginInput`, so driving the pin pulls it LOW (open drain style)
+    __time = 210;
+    InputPin::output();
+    TEST_ASSERT_FALSE(InputPin::read());
+    __time = 220;
+    InputPin::input();
+    TEST_ASSERT_TRUE(InputPin::read());
+
+    TEST_ASSERT_EQUAL_UINT32(3, Gpio::countTransitions());
+    __assertTransition(0, 200, 21, true);
+    __assertTransition(1, 210, 21, false);
+    __assertTransition(2, 220, 21, true);
+  }
+
+  void testRingKeepsNewest() {
+    OutputPin::beginOutput(false);
+    Gpio::clearTrace();
+    const uint32_t extra = 10;
+    for (uint32_t i = 0; i < GPIO_TRACE_SIZE + extra; i++) {
+      __time = i;
+      OutputPin::write(i % 2 == 0);
+    }
+    TEST_ASSERT_EQUAL_UINT32(GPIO_TRACE_SIZE, Gpio::countTransitions());
+    __assertTransition(0, extra, 20, true);
+    __assertTransition(GPIO_TRACE_SIZE - 1, GPIO_TRACE_SIZE + extra - 1, 20, false);
+  }
+
+  void testAttentionTiming() {
+    Gpio::setClock(nullptr);
+    PSXSim::MemoryCard card;
+    PSXSim::begin();
+    PSXSim::attach(0, &card);
+    PSX::setup();
+
+    Gpio::clearTrace();
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    TEST_ASSERT_TRUE(PSX::tryReadFromMemoryCard(0, 0, data));
+    PSXSim::detach(0, &card);
+
+    size_t start = __find(0, PSX_ATTENTION_PIN_1, false);
+    size_t end = __find(start, PSX_ATTENTION_PIN_1, true);
+    TEST_ASSERT_LESS_THAN_UINT32(Gpio::countTransitions(), end);
+    // Only the port of the slot is selected
+    TEST_ASSERT_EQUAL_UINT32(Gpio::countTransitions(), __find(0, PSX_ATTENTION_PIN_2, false));
+
+    // Attention stays LOW for the whole frame: every byte at the bus clock, plus the ACK delays of the card
+    uint32_t selectedUs = Gpio::getTransition(end).time - Gpio::getTransition(start).time;
+    uint32_t bytesUs = (uint64_t)PSX_MEMCARD_READ_FRAME_LENGTH * 8 * 1000000 / PSX_SPI_CLOCK;
+    uint32_t ackUs = (PSX_MEMCARD_READ_FRAME_LENGTH - 2) * card.timing.ackDelay + card.timing.readDelay;
+    printf("read frame: attention LOW for %u us (%u us of bytes, %u us of ACK delays)\n", selectedUs, bytesUs, ackUs);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(bytesUs + ackUs, selectedUs);
+  }
+}
+
+void setUp() {
+  Gpio::setClock(__fakeClock);
+}
+
+void tearDown() {
+  Gpio::setClock(nullptr);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testOutputTimestamps);
+  RUN_TEST(testInputDrivenFromOutside);
+  RUN_TEST(testRingKeepsNewest);
+  RUN_TEST(testAttentionTiming);
+  return UNITY_END();
+}
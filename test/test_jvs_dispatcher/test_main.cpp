@@ -0,0 +1,204 @@
+/*
+  JVS command dispatcher: one acknowledge packet for a batch of commands, unknown and truncated commands,
+  reports that do not fit in one packet, then the dispatch cost per command.
+
+    pio test -e native -f test_jvs_dispatcher -v
+*/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unity.h>
+#include <JVSDispatcher.h>
+
+namespace {
+  // Same length as the firmware's I/O ID, six of them do not fit in one acknowledge packet
+  const char *__ioId = "KONAMI CO.,LTD.;White I/O;Ver1.0;White I/O PCB";
+
+  uint32_t __calls = 0;
+  uint8_t __written[JVS_MAX_DATA_SIZE];
+  uint8_t __writtenLength = 0;
+
+  void __ioIdentify(const uint8_t *, JVS::Packet &ack) {
+    __calls++;
+    ack.add(JVS::AckReport::OK);
+    ack.add((const uint8_t *)__ioId, strlen(__ioId) + 1);
+  }
+
+  void __commandRevision(const uint8_t *, JVS::Packet &ack) {
+    __calls++;
+    ack.add(JVS::AckReport::OK);
+    ack.add(0x13);
+  }
+
+  // {0x70, 0x01, <Address (3 bytes)>, <Length>, <Data>}
+  void __bufferWrite(const uint8_t *command, JVS::Packet &ack) {
+    __calls++;
+    __writtenLength = command[5];
+    memcpy(__written, command + 6, __writtenLength);
+    ack.add(JVS::AckReport::OK);
+  }
+
+  // {0x70, 0x02, <Address (3 bytes)>}
+  void __bufferSetAddress(const uint8_t *, JVS::Packet &ack) {
+    __calls++;
+    ack.add(JVS::AckReport::OK);
+  }
+
+  void __status(const uint8_t *, JVS::Packet &ack) {
+    __calls++;
+    ack.add(JVS::AckReport::OK);
+    for (int i = 0; i < 4; i++) ack.add(0x00);
+  }
+
+  typedef JVS::Dispatcher<
+      JVS::On<JVS::Command::IOId, 1, __ioIdentify>,
+      JVS::On<JVS::Command::CommandRev, 1, __commandRevision>,
+      JVS::OnSub<JVS::Command::K573Buffer, JVS::Command::K573BufferWrite, 6, __bufferWrite, 5>,
+      JVS::OnSub<JVS::Command::K573Buffer, JVS::Command::K573BufferSetAddress, 5, __bufferSetAddress>,
+      JVS::On<JVS::Command::K573Status, 1, __status>,
+      JVS::On<JVS::Command::K573Controller, 1, __status>>
+      TestDispatcher;
+
+  JVS::Packet __request;
+  JVS::Packet __ack;
+
+  void __setRequest(const uint8_t *data, uint8_t length) {
+    __request.reset(0x01);
+    __request.add(data, length);
+  }
+
+  void testPacketRefusesOverflow() {
+    JVS::Packet packet(0x00);
+    uint8_t data[JVS_MAX_DATA_SIZE];
+    for (int i = 0; i < JVS_MAX_DATA_SIZE; i++) data[i] = i;
+    TEST_ASSERT_TRUE(packet.add(data, JVS_MAX_DATA_SIZE - 1));
+    TEST_ASSERT_TRUE(packet.add(0xaa));
+    TEST_ASSERT_FALSE(packet.isOverflowed);
+
+    // Nothing is added past the end, and the checksum still matches the data
+    TEST_ASSERT_FALSE(packet.add(0xbb));
+    TEST_ASSERT_FALSE(packet.add(data, 1));
+    TEST_ASSERT_EQUAL_UINT8(JVS_MAX_DATA_SIZE, packet.length);
+    TEST_ASSERT_TRUE(packet.isOverflowed);
+    TEST_ASSERT_TRUE(packet.validate());
+
+    // A block that does not fit is refused as a whole
+    packet.reset(0x00);
+    TEST_ASSERT_TRUE(packet.add(data, 200));
+    TEST_ASSERT_FALSE(packet.add(data, 100));
+    TEST_ASSERT_EQUAL_UINT8(200, packet.length);
+    TEST_ASSERT_TRUE(packet.validate());
+    packet.reset(0x00);
+    TEST_ASSERT_FALSE(packet.isOverflowed);
+  }
+
+  void testBatchInOneAck() {
+    const uint8_t request[] = {
+      JVS::Command::CommandRev,
+      JVS::Command::K573Buffer, JVS::Command::K573BufferWrite, 0x01, 0x00, 0x00, 3, 0xe0, 0xd0, 0x01,
+      JVS::Command::K573Buffer, JVS::Command::K573BufferSetAddress, 0x01, 0x00, 0x00,
+      JVS::Command::K573Status,
+    };
+    __setRequest(request, sizeof(request));
+    __calls = 0;
+    TestDispatcher::process(__request, __ack);
+
+    const uint8_t expected[] = {
+      JVS::AckStatus::StatusOK,
+      JVS::AckReport::OK, 0x13,
+      JVS::AckReport::OK,
+      JVS::AckReport::OK,
+      JVS::AckReport::OK, 0x00, 0x00, 0x00, 0x00,
+    };
+    TEST_ASSERT_EQUAL_UINT32(4, __calls);
+    TEST_ASSERT_EQUAL_UINT8(sizeof(expected), __ack.length);
+    TEST_ASSERT_EQUAL_MEMORY(expected, __ack.data, sizeof(expected));
+    TEST_ASSERT_TRUE(__ack.validate());
+    // Data length of the write comes from the command itself
+    TEST_ASSERT_EQUAL_UINT8(3, __writtenLength);
+    TEST_ASSERT_EQUAL_MEMORY(request + 7, __written, 3);
+  }
+
+  void testUnknownAndTruncated() {
+    // Unknown command byte, unknown sub-command, missing write data
+    const uint8_t unknown[] = { JVS::Command::CommandRev, 0x55 };
+    const uint8_t unknownSub[] = { JVS::Command::K573Buffer, 0x7f, 0x00, 0x00, 0x00 };
+    const uint8_t truncated[] = { JVS::Command::K573Buffer, JVS::Command::K573BufferWrite, 0x01, 0x00, 0x00, 4, 0x00 };
+    const uint8_t *requests[] = { unknown, unknownSub, truncated };
+    const uint8_t lengths[] = { sizeof(unknown), sizeof(unknownSub), sizeof(truncated) };
+    for (int i = 0; i < 3; i++) {
+      __setRequest(requests[i], lengths[i]);
+      TestDispatcher::process(__request, __ack);
+      TEST_ASSERT_EQUAL_UINT8(1, __ack.length);
+      TEST_ASSERT_EQUAL_HEX8(JVS::AckStatus::CommandUnknown, __ack.data[0]);
+    }
+  }
+
+  void testReportsTooLargeForAck() {
+    uint8_t request[6];
+    memset(request, JVS::Command::IOId, sizeof(request));
+    // Four I/O IDs fit
+    __setRequest(request, 4);
+    TestDispatcher::process(__request, __ack);
+    TEST_ASSERT_EQUAL_HEX8(JVS::AckStatus::StatusOK, __ack.data[0]);
+    TEST_ASSERT_EQUAL_UINT8(1 + 4 * (2 + strlen(__ioId)), __ack.length);
+
+    // Six do not: the batch stops at the report that does not fit
+    __calls = 0;
+    __setRequest(request, sizeof(request));
+    TestDispatcher::process(__request, __ack);
+    TEST_ASSERT_EQUAL_UINT8(1, __ack.length);
+    TEST_ASSERT_EQUAL_HEX8(JVS::AckStatus::Overflow, __ack.data[0]);
+    TEST_ASSERT_TRUE(__ack.validate());
+    TEST_ASSERT_FALSE(__ack.isOverflowed);
+    TEST_ASSERT_EQUAL_UINT32(6, __calls);
+
+    // The next request on the same packet is answered normally
+    __setRequest(request, 1);
+    TestDispatcher::process(__request, __ack);
+    TEST_ASSERT_EQUAL_HEX8(JVS::AckStatus::StatusOK, __ack.data[0]);
+  }
+
+  void testBenchmark() {
+    // Polling request of a game: status, controller, and a frame written to RAM
+    uint8_t request[3 + 6 + 128];
+    uint8_t length = 0;
+    request[length++] = JVS::Command::K573Status;
+    request[length++] = JVS::Command::K573Controller;
+    request[length++] = JVS::Command::K573Buffer;
+    request[length++] = JVS::Command::K573BufferWrite;
+    for (int i = 0; i < 3; i++) request[length++] = 0x00;
+    request[length++] = 128;
+    for (int i = 0; i < 128; i++) request[length++] = i;
+    request[length++] = JVS::Command::CommandRev;
+    __setRequest(request, length);
+
+    const uint32_t rounds = 1000000;
+    const uint32_t commands = 4;
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t round = 0; round < rounds; round++) {
+      TestDispatcher::process(__request, __ack);
+      // Keep the compiler from folding the rounds
+      __asm__ volatile("" : : "r"(__ack.data) : "memory");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsedNs = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("dispatch: %.1f ns per request, %.1f ns per command (handlers included)\n", elapsedNs / rounds,
+           elapsedNs / (rounds * commands));
+    TEST_ASSERT_EQUAL_HEX8(JVS::AckStatus::StatusOK, __ack.data[0]);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testPacketRefusesOverflow);
+  RUN_TEST(testBatchInOneAck);
+  RUN_TEST(testUnknownAndTruncated);
+  RUN_TEST(testReportsTooLargeForAck);
+  RUN_TEST(testBenchmark);
+  return UNITY_END();
+}
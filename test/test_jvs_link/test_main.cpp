@@ -0,0 +1,384 @@
+/*
+  JVS link over a pseudo terminal: the master writes requests to one end, the other end is wired to the host UART.
+  Communication method negotiation, `Retry` answered with the same bytes, the response encoded once into the wire
+  buffer and handed to UART in one write, `resend` sending that buffer again without encoding the packet, the response
+  and release times in `JVS::Timing`, then the response throughput at each line speed the build supports.
+
+    pio test -e native -f test_jvs_link -v
+*/
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <unity.h>
+#include <Arduino.h>
+#include <JVS.h>
+#include <JVSUart.h>
+
+namespace {
+  const uint8_t __nodeNo = 0x01;
+  const int __timeoutMs = 2000;
+  const uint32_t __baudRates[] = { JVS_BAUD_RATE, 1000000, 3000000 };
+
+  // Master end, and the end wired to the host UART
+  int __master = -1;
+  int __slave = -1;
+  // Bytes handed to UART, and the count of writes
+  std::vector<uint8_t> __sent;
+  int __writes = 0;
+
+  /**
+   * @brief Open a pseudo terminal in raw mode (both ends non blocking).
+   * @return `false` if failed
+   */
+  bool __openTerminal() {
+    __master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (__master < 0 || grantpt(__master) != 0 || unlockpt(__master) != 0) return false;
+    __slave = open(ptsname(__master), O_RDWR | O_NOCTTY);
+    if (__slave < 0) return false;
+    termios attributes;
+    tcgetattr(__slave, &attributes);
+    cfmakeraw(&attributes);
+    tcsetattr(__slave, TCSANOW, &attributes);
+    fcntl(__master, F_SETFL, fcntl(__master, F_GETFL) | O_NONBLOCK);
+    fcntl(__slave, F_SETFL, fcntl(__slave, F_GETFL) | O_NONBLOCK);
+    return true;
+  }
+
+  void __writeAll(int file, const uint8_t *data, size_t length) {
+    while (length > 0) {
+      ssize_t written = write(file, data, length);
+      if (written < 0) {
+        pollfd entry = { file, POLLOUT, 0 };
+        poll(&entry, 1, __timeoutMs);
+        continue;
+      }
+      data += written;
+      length -= written;
+    }
+  }
+
+  void __onSent(const uint8_t *data, size_t length, void *) {
+    __sent.insert(__sent.end(), data, data + length);
+    __writes++;
+    __writeAll(__slave, data, length);
+  }
+
+  /**
+   * @brief Drop the responses not read by the master.
+   */
+  void __discard() {
+    uint8_t buffer[256];
+    JVS::Uart::flush();
+    while (read(__master, buffer, sizeof(buffer)) > 0) {}
+  }
+
+  /**
+   * @brief One pass of the device: line to UART, then the request handled as `main.cpp` does for these commands.
+   */
+  void __serve() {
+    uint8_t buffer[256];
+    ssize_t length;
+    while ((length = read(__slave, buffer, sizeof(buffer))) > 0) JVS::Uart::hostReceive(buffer, length);
+    JVS::Uart::hostPoll();
+
+    static JVS::Packet request;
+    if (!JVS::tryGetRequest(request) || request.length == 0) return;
+    switch (request.data[0]) {
+      case JVS::Command::CommMethodChange:
+        if (request.length >= 2) JVS::trySetCommMethod(request.data[1]);
+        return;
+      case JVS::Command::Retry:
+        JVS::resend();
+        return;
+    }
+    static JVS::Packet ack;
+    ack.reset(0x00);
+    ack.add(JVS::AckStatus::StatusOK);
+    ack.add(JVS::AckReport::OK);
+    if (request.data[0] == JVS::Command::CommSupported) ack.add(JVS_COMM_METHODS);
+    // Anything else is echoed back
+    else ack.add(request.data, request.length);
+    JVS::sendPacket(ack);
+  }
+
+  void __put(std::vector<uint8_t> &wire, uint8_t b) {
+    if (b == JVS::SpecialChar::Sync || b == JVS::SpecialChar::Escape) {
+      wire.push_back(JVS::SpecialChar::Escape);
+      b--;
+    }
+    wire.push_back(b);
+  }
+
+  void __send(uint8_t nodeNo, const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> wire = { JVS::SpecialChar::Sync };
+    uint8_t sum = nodeNo + data.size() + 1;
+    __put(wire, nodeNo);
+    __put(wire, data.size() + 1);
+    for (uint8_t b : data) {
+      __put(wire, b);
+      sum += b;
+    }
+    __put(wire, sum);
+    __writeAll(__master, wire.data(), wire.size());
+  }
+
+  /**
+   * @brief Serve the device until a whole response arrives at the master end.
+   * @param wire Bytes on the wire
+   * @param data Unescaped [Data]
+   * @return `false` if nothing (or a broken packet) arrived in time
+   */
+  bool __receive(std::vector<uint8_t> &wire, std::vector<uint8_t> &data) {
+    wire.clear();
+    data.clear();
+    std::vector<uint8_t> body;
+    bool isEscaped = false;
+    timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (true) {
+      __serve();
+      uint8_t b;
+      if (read(__master, &b, 1) != 1) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 > __timeoutMs) return false;
+        continue;
+      }
+      wire.push_back(b);
+      if (b == JVS::SpecialChar::Sync) {
+        body.clear();
+        continue;
+      }
+      if (b == JVS::SpecialChar::Escape) {
+        isEscaped = true;
+        continue;
+      }
+      body.push_back(isEscaped ? b + 1 : b);
+      isEscaped = false;
+      // [Node No.] [Byte Count] [Data] [SUM]
+      if (body.size() < 2 || body.size() < 2 + (size_t)body[1]) continue;
+      uint8_t sum = 0;
+      for (size_t i = 0; i + 1 < body.size(); i++) sum += body[i];
+      data.assign(body.begin() + 2, body.end() - 1);
+      return body[0] == 0x00 && sum == body.back();
+    }
+  }
+
+  /**
+   * @brief Send the request and wait for the response.
+   * @return Unescaped [Data] of the response, empty if none
+   */
+  std::vector<uint8_t> __transact(const std::vector<uint8_t> &request) {
+    std::vector<uint8_t> wire, data;
+    __send(__nodeNo, request);
+    if (!__receive(wire, data)) data.clear();
+    return data;
+  }
+
+  /**
+   * @brief Broadcast the method change, and let the device switch before the next request.
+   */
+  void __changeMethod(uint8_t method) {
+    __send(JVS_ADDRESS_BROADCAST, { JVS::Command::CommMethodChange, method });
+    for (int i = 0; i < 100; i++) __serve();
+  }
+
+  void testCommSupported() {
+    std::vector<uint8_t> ack = __transact({ JVS::Command::CommSupported });
+    TEST_ASSERT_EQUAL_UINT32(3, ack.size());
+    TEST_ASSERT_EQUAL_HEX8(JVS_COMM_METHODS, ack[2]);
+    // Method 0 is always there
+    TEST_ASSERT_TRUE(ack[2] & 0x01);
+  }
+
+  void testMethodChange() {
+    for (uint8_t method = 0; method <= JVS::CommMethod::Baud3M + 1; method++) {
+      bool isSupported = method <= JVS::CommMethod::Baud3M && (JVS_COMM_METHODS & (1 << method));
+      __changeMethod(method);
+      // Unsupported method keeps the speed
+      TEST_ASSERT_EQUAL_UINT32(isSupported ? __baudRates[method] : JVS_BAUD_RATE, JVS::getBaudRate());
+      std::vector<uint8_t> ack = __transact({ 0x11, JVS::SpecialChar::Sync, method });
+      TEST_ASSERT_EQUAL_UINT32(5, ack.size());
+      TEST_ASSERT_EQUAL_HEX8(JVS::SpecialChar::Sync, ack[3]);
+
+      // Reset goes back to method 0
+      JVS::reset();
+      JVS::setAddress(__nodeNo);
+      TEST_ASSERT_EQUAL_UINT32(JVS_BAUD_RATE, JVS::getBaudRate());
+    }
+  }
+
+  void testRetryResendsSameBytes() {
+    for (uint8_t method = 0; method <= JVS::CommMethod::Baud3M; method++) {
+      if (!(JVS_COMM_METHODS & (1 << method))) continue;
+      __changeMethod(method);
+      std::vector<uint8_t> wire, retried, data;
+      // Escaped bytes in the response
+      __send(__nodeNo, { 0x22, JVS::SpecialChar::Escape, JVS::SpecialChar::Sync, method });
+      TEST_ASSERT_TRUE(__receive(wire, data));
+      __send(__nodeNo, { JVS::Command::Retry });
+      TEST_ASSERT_TRUE(__receive(retried, data));
+      TEST_ASSERT_EQUAL_UINT32(wire.size(), retried.size());
+      TEST_ASSERT_EQUAL_MEMORY(wire.data(), retried.data(), wire.size());
+      JVS::reset();
+      JVS::setAddress(__nodeNo);
+    }
+  }
+
+  /**
+   * @brief Response with the special characters, as expected on the wire.
+   */
+  std::vector<uint8_t> __buildResponse(JVS::Packet &packet) {
+    const std::vector<uint8_t> data = { JVS::AckStatus::StatusOK, JVS::AckReport::OK, JVS::SpecialChar::Sync,
+                                        JVS::SpecialChar::Escape, 0x42 };
+    packet.reset(0x00);
+    packet.add(data.data(), data.size());
+    std::vector<uint8_t> wire = { JVS::SpecialChar::Sync };
+    uint8_t sum = data.size() + 1;
+    __put(wire, 0x00);
+    __put(wire, data.size() + 1);
+    for (uint8_t b : data) {
+      __put(wire, b);
+      sum += b;
+    }
+    __put(wire, sum);
+    return wire;
+  }
+
+  void testWireBuffer() {
+    JVS::Packet packet;
+    std::vector<uint8_t> expected = __buildResponse(packet);
+    JVS::Uart::flush();
+    __sent.clear();
+    __writes = 0;
+    JVS::sendPacket(packet);
+    // Whole packet encoded before the write, one DMA transfer on the target
+    TEST_ASSERT_EQUAL_INT(1, __writes);
+    TEST_ASSERT_EQUAL_UINT32(expected.size(), __sent.size());
+    TEST_ASSERT_EQUAL_MEMORY(expected.data(), __sent.data(), expected.size());
+    __discard();
+  }
+
+  void testResendWithoutEncoding() {
+    JVS::Packet packet;
+    std::vector<uint8_t> expected = __buildResponse(packet);
+    JVS::sendPacket(packet);
+    // Packet is reused for something else before `Retry` arrives
+    packet.reset(0x00);
+    packet.add(JVS::AckStatus::SumError);
+    JVS::Uart::flush();
+    __sent.clear();
+    __writes = 0;
+    JVS::resend();
+    TEST_ASSERT_EQUAL_INT(1, __writes);
+    TEST_ASSERT_EQUAL_UINT32(expected.size(), __sent.size());
+    TEST_ASSERT_EQUAL_MEMORY(expected.data(), __sent.data(), expected.size());
+    __discard();
+  }
+
+  void testTiming() {
+    JVS::Uart::flush();
+    JVS::resetTiming();
+    uint32_t sent = micros();
+    __send(__nodeNo, { 0x44 });
+    JVS::Packet request;
+    bool isReceived = false;
+    for (int i = 0; i < 100000 && !isReceived; i++) {
+      uint8_t buffer[256];
+      ssize_t length;
+      while ((length = read(__slave, buffer, sizeof(buffer))) > 0) JVS::Uart::hostReceive(buffer, length);
+      isReceived = JVS::tryGetRequest(request) && request.length > 0;
+    }
+    TEST_ASSERT_TRUE(isReceived);
+
+    // Answered late, then the line released late
+    const uint32_t responseUs = 300;
+    delayMicroseconds(responseUs);
+    JVS::Packet ack;
+    ack.reset(0x00);
+    ack.add(JVS::AckStatus::StatusOK);
+    __sent.clear();
+    JVS::sendPacket(ack);
+    uint32_t elapsed = micros() - sent;
+    const JVS::Timing &timing = JVS::getTiming();
+    TEST_ASSERT_EQUAL_UINT32(1, timing.count);
+    TEST_ASSERT_TRUE(timing.lastResponseUs >= responseUs && timing.lastResponseUs <= elapsed);
+    TEST_ASSERT_EQUAL_UINT32(timing.lastResponseUs, timing.maxResponseUs);
+    // Still on the line
+    TEST_ASSERT_EQUAL_UINT32(0, timing.lastReleaseUs);
+
+    const uint32_t releaseUs = 1000;
+    usleep(__sent.size() * 10 * 1000000 / JVS_BAUD_RATE + releaseUs);
+    JVS::Uart::hostPoll();
+    TEST_ASSERT_TRUE(timing.lastReleaseUs >= releaseUs);
+    TEST_ASSERT_EQUAL_UINT32(timing.lastReleaseUs, timing.maxReleaseUs);
+    __discard();
+  }
+
+  void testThroughputPerRate() {
+    // Buffer read of a memory card frame: 128 bytes of data and the headers
+    std::vector<uint8_t> request(1 + 135);
+    request[0] = 0x33;
+    for (size_t i = 1; i < request.size(); i++) request[i] = (uint8_t)(i * 37);
+    const int rounds = 100;
+    double previous = 0;
+    for (uint8_t method = 0; method <= JVS::CommMethod::Baud3M; method++) {
+      if (!(JVS_COMM_METHODS & (1 << method))) continue;
+      __changeMethod(method);
+      std::vector<uint8_t> wire, data;
+      size_t bytes = 0;
+      timespec start, end;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (int i = 0; i < rounds; i++) {
+        __send(__nodeNo, request);
+        TEST_ASSERT_TRUE(__receive(wire, data));
+        bytes += wire.size();
+      }
+      // Last response off the line
+      JVS::Uart::flush();
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+      double bytesPerSecond = bytes / seconds;
+      double lineBytesPerSecond = __baudRates[method] / 10.0;
+      printf("method %u (%7u baud): %6.1f kB/s of responses, %3.0f%% of the line, %.0f us per round trip\n", method,
+             __baudRates[method], bytesPerSecond / 1000, bytesPerSecond * 100 / lineBytesPerSecond, seconds * 1e6 / rounds);
+      // UART never sends faster than the line
+      TEST_ASSERT_TRUE(bytesPerSecond <= lineBytesPerSecond * 1.05);
+      TEST_ASSERT_TRUE(bytesPerSecond > previous);
+      previous = bytesPerSecond;
+      JVS::reset();
+      JVS::setAddress(__nodeNo);
+    }
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  if (!__openTerminal()) {
+    perror("pseudo terminal");
+    return 1;
+  }
+  JVS::Uart::hostSetSink(__onSent, nullptr);
+  JVS::setup();
+  JVS::setAddress(__nodeNo);
+
+  UNITY_BEGIN();
+  RUN_TEST(testCommSupported);
+  RUN_TEST(testMethodChange);
+  RUN_TEST(testRetryResendsSameBytes);
+  RUN_TEST(testWireBuffer);
+  RUN_TEST(testResendWithoutEncoding);
+  RUN_TEST(testTiming);
+  RUN_TEST(testThroughputPerRate);
+  int failures = UNITY_END();
+  close(__slave);
+  close(__master);
+  return failures;
+}
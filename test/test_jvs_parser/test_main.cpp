@@ -0,0 +1,239 @@
+/*
+  JVS request parser: fuzzing with random and mutated streams, round trip of escaped packets split into random
+  spans, and the parser throughput against the fastest line speed.
+
+    pio test -e native -f test_jvs_parser -v
+
+  The fuzz target also builds for libFuzzer (the suite's `main` is left out):
+
+    clang++ -std=gnu++17 -g -O1 -fsanitize=fuzzer,address -DJVS_PARSER_FUZZER -I lib/JVS/src -I lib/Trace/src \
+      lib/JVS/src/JVSParser.cpp lib/JVS/src/JVSProtocol.cpp test/test_jvs_parser/test_main.cpp -o fuzz_jvs_parser
+*/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#ifndef JVS_PARSER_FUZZER
+#include <unity.h>
+#endif
+#include <JVSParser.h>
+
+namespace {
+  // Spans the receiver hands to the parser at most (DMA ring chunk)
+  const size_t __spanSize = 64;
+
+  /**
+   * @brief Feed the stream in spans of the given sizes and check what the parser must always hold.
+   * @param sizes Span sizes (`0` is taken as 1), repeated over the stream
+   * @param counts Packets by result
+   * @return `false` if an invariant is broken
+   */
+  bool __feed(JVS::Parser &parser, const uint8_t *data, size_t length, const uint8_t *sizes, size_t sizeCounts,
+              uint32_t counts[3]) {
+    static JVS::Packet packet;
+    size_t offset = 0;
+    for (size_t span = 0; offset < length; span++) {
+      size_t size = sizeCounts > 0 ? sizes[span % sizeCounts] : __spanSize;
+      if (size == 0) size = 1;
+      if (size > length - offset) size = length - offset;
+      while (size > 0) {
+        size_t consumed = SIZE_MAX;
+        JVS::Parser::Result result = parser.parse(data + offset, size, packet, consumed);
+        if (consumed > size) return false;
+        if (result == JVS::Parser::Result::Incomplete && consumed != size) return false;
+        if (result != JVS::Parser::Result::Incomplete && consumed == 0) return false;
+        if (result != JVS::Parser::Result::Incomplete) {
+          // Running checksum agrees with the checksum of the stored data
+          if (packet.length > JVS_MAX_DATA_SIZE) return false;
+          if (packet.validate() != (result == JVS::Parser::Result::Completed)) return false;
+          counts[result]++;
+        }
+        offset += consumed;
+        size -= consumed;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @brief One fuzz input: [Node No.], 7 span sizes, then the stream.
+   * @return `false` if an invariant is broken
+   */
+  bool __fuzzOne(const uint8_t *data, size_t length) {
+    if (length < 8) return true;
+    JVS::Parser parser;
+    parser.setNodeNo(data[0]);
+    uint32_t counts[3] = {};
+    return __feed(parser, data + 8, length - 8, data + 1, 7, counts);
+  }
+}
+
+#ifdef JVS_PARSER_FUZZER
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if (!__fuzzOne(data, size)) __builtin_trap();
+  return 0;
+}
+#else
+namespace {
+  // Line speed of `CommMethod::Baud3M` in bytes per second (10 bits per byte)
+  const double __lineBytesPerSecond = 3000000 / 10.0;
+
+  uint32_t __random = 0x12345678;
+
+  uint32_t __next() {
+    // xorshift32, the same sequence on every run
+    __random ^= __random << 13;
+    __random ^= __random >> 17;
+    __random ^= __random << 5;
+    return __random;
+  }
+
+  /**
+   * @brief Bytes that steer the parser into every branch (sync, escape, addresses).
+   */
+  uint8_t __nextByte() {
+    static const uint8_t specials[] = { JVS::SpecialChar::Sync, JVS::SpecialChar::Escape, JVS_ADDRESS_BROADCAST, 0x01, 0x00, 0xdf };
+    uint32_t value = __next();
+    return (value & 0x300) == 0 ? specials[(value >> 10) % sizeof(specials)] : (uint8_t)value;
+  }
+
+  void __put(std::vector<uint8_t> &stream, uint8_t b) {
+    if (b == JVS::SpecialChar::Sync || b == JVS::SpecialChar::Escape) {
+      stream.push_back(JVS::SpecialChar::Escape);
+      b--;
+    }
+    stream.push_back(b);
+  }
+
+  /**
+   * @brief Encode a packet as the host sends it (escaped, with [SUM]).
+   */
+  void __encode(std::vector<uint8_t> &stream, uint8_t nodeNo, const uint8_t *data, uint8_t length, bool isCorrupted = false) {
+    stream.push_back(JVS::SpecialChar::Sync);
+    uint8_t sum = nodeNo + length + 1;
+    __put(stream, nodeNo);
+    __put(stream, length + 1);
+    for (int i = 0; i < length; i++) {
+      __put(stream, data[i]);
+      sum += data[i];
+    }
+    __put(stream, isCorrupted ? sum + 1 : sum);
+  }
+
+  void testFuzzRandomStreams() {
+    std::vector<uint8_t> input;
+    uint32_t failures = 0;
+    for (int run = 0; run < 20000; run++) {
+      input.resize(8 + __next() % 600);
+      for (uint8_t &b : input) b = __nextByte();
+      if (!__fuzzOne(input.data(), input.size())) failures++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, failures);
+  }
+
+  void testFuzzMutatedPackets() {
+    uint32_t failures = 0;
+    uint32_t counts[3] = {};
+    uint8_t data[JVS_MAX_DATA_SIZE];
+    for (int run = 0; run < 20000; run++) {
+      std::vector<uint8_t> stream;
+      for (int i = 0; i < 4; i++) {
+        uint8_t length = __next() % (JVS_MAX_DATA_SIZE + 1);
+        for (int j = 0; j < length; j++) data[j] = __nextByte();
+        __encode(stream, __next() % 2 ? 0x01 : JVS_ADDRESS_BROADCAST, data, length);
+      }
+      // Flip, drop or insert a few bytes
+      for (int i = __next() % 4; i > 0; i--) {
+        size_t at = __next() % stream.size();
+        switch (__next() % 3) {
+          case 0: stream[at] ^= 1 << (__next() % 8); break;
+          case 1: stream.erase(stream.begin() + at); break;
+          default: stream.insert(stream.begin() + at, __nextByte()); break;
+        }
+      }
+      uint8_t sizes[7];
+      for (uint8_t &size : sizes) size = __next() % 32;
+      JVS::Parser parser;
+      parser.setNodeNo(0x01);
+      if (!__feed(parser, stream.data(), stream.size(), sizes, sizeof(sizes), counts)) failures++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, failures);
+    // Most packets survive the mutations, some are caught by the checksum
+    TEST_ASSERT_GREATER_THAN_UINT32(40000, counts[JVS::Parser::Result::Completed]);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, counts[JVS::Parser::Result::ChecksumError]);
+  }
+
+  void testRoundTripInRandomSpans() {
+    JVS::Parser parser;
+    parser.setNodeNo(0x01);
+    static JVS::Packet packet;
+    uint8_t data[JVS_MAX_DATA_SIZE];
+    for (int run = 0; run < 2000; run++) {
+      uint8_t length = __next() % (JVS_MAX_DATA_SIZE + 1);
+      for (int i = 0; i < length; i++) data[i] = __nextByte();
+      std::vector<uint8_t> stream;
+      // Noise before the packet and a packet for another node are skipped
+      for (int i = __next() % 8; i > 0; i--) stream.push_back(__nextByte() & 0x7f);
+      __encode(stream, 0x02, data, length);
+      bool isCorrupted = run % 10 == 0;
+      __encode(stream, run % 2 ? 0x01 : JVS_ADDRESS_BROADCAST, data, length, isCorrupted);
+
+      JVS::Parser::Result result = JVS::Parser::Result::Incomplete;
+      size_t offset = 0;
+      while (offset < stream.size() && result == JVS::Parser::Result::Incomplete) {
+        size_t size = 1 + __next() % __spanSize;
+        if (size > stream.size() - offset) size = stream.size() - offset;
+        size_t consumed;
+        result = parser.parse(stream.data() + offset, size, packet, consumed);
+        offset += consumed;
+      }
+      TEST_ASSERT_EQUAL_UINT32(stream.size(), offset);
+      TEST_ASSERT_EQUAL(isCorrupted ? JVS::Parser::Result::ChecksumError : JVS::Parser::Result::Completed, result);
+      TEST_ASSERT_EQUAL_UINT8(length, packet.length);
+      if (length > 0) TEST_ASSERT_EQUAL_MEMORY(data, packet.data, length);
+    }
+  }
+
+  void testBenchmark() {
+    // Traffic of a session: status and controller polls, and buffer writes of memory card frames (128 bytes)
+    std::vector<uint8_t> stream;
+    uint8_t data[JVS_MAX_DATA_SIZE];
+    uint32_t packets = 0;
+    while (stream.size() < 1 << 20) {
+      uint8_t length = __next() % 8 == 0 ? 7 + 128 : 1 + __next() % 8;
+      for (int i = 0; i < length; i++) data[i] = __next();
+      __encode(stream, 0x01, data, length);
+      packets++;
+    }
+
+    const int rounds = 50;
+    JVS::Parser parser;
+    parser.setNodeNo(0x01);
+    uint32_t counts[3] = {};
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < rounds; round++) {
+      TEST_ASSERT_TRUE(__feed(parser, stream.data(), stream.size(), nullptr, 0, counts));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double bytesPerSecond = stream.size() * rounds / seconds;
+    printf("parser: %.1f MB/s, %.2f ns per byte, %.0f packets/s (%.0fx the 3 Mbps line)\n", bytesPerSecond / 1e6,
+           1e9 / bytesPerSecond, packets * rounds / seconds, bytesPerSecond / __lineBytesPerSecond);
+    TEST_ASSERT_EQUAL_UINT32(packets * rounds, counts[JVS::Parser::Result::Completed]);
+    TEST_ASSERT_GREATER_THAN(__lineBytesPerSecond, bytesPerSecond);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testFuzzRandomStreams);
+  RUN_TEST(testFuzzMutatedPackets);
+  RUN_TEST(testRoundTripInRandomSpans);
+  RUN_TEST(testBenchmark);
+  return UNITY_END();
+}
+#endif
@@ -0,0 +1,199 @@
+/*
+  Long memory card transfers against the simulated card, with core 1 in its own thread.
+
+    pio test -e native -f test_memory_card_engine -v
+
+  Core 0 does what the JVS loop does between requests: routes finished jobs, queues the next frames and answers
+  `K573Status` from memory. The CPU time of each step is what a JVS request waits behind a transfer at most,
+  so it must stay far below the time of one frame on the bus.
+*/
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unity.h>
+#include <Arduino.h>
+#include <CardPresence.h>
+#include <MemoryCardEngine.h>
+#include <PSXSim.h>
+#include <PSXWorker.h>
+#include <RamStore.h>
+#include <WriteBehind.h>
+
+namespace {
+  // Longest step of core 0 (CPU time, 99.9th percentile: the host may charge a pass for a page fault or a tick),
+  // a memory card frame takes milliseconds on the bus
+  const uint32_t __stepLimitUs = 500;
+  const uint32_t __transferTimeoutUs = 20000000;
+
+  PSXSim::MemoryCard __card;
+  std::atomic<bool> __isRunning{ true };
+  std::atomic<bool> __isReady{ false };
+  std::thread __core1;
+
+  struct Steps {
+    std::vector<uint32_t> times;
+    // Status polls that saw the transfer running
+    uint32_t busyPolls = 0;
+  };
+
+  uint8_t __pattern(int seed, int index) {
+    return (uint8_t)(seed * 31 + index * 7 + (index >> 7));
+  }
+
+  uint32_t __threadTimeUs() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1000000 + now.tv_nsec / 1000;
+  }
+
+  /**
+   * @brief One pass of core 0 (see `__serveTransfer` and `__serveMaintenance` of the firmware).
+   * @return CPU time of the pass in microseconds
+   */
+  uint32_t __step(Steps &steps) {
+    uint32_t start = __threadTimeUs();
+    PSXWorker::Completion completion;
+    while (PSXWorker::tryGetCompletion(completion)) {
+      switch (completion.job.owner) {
+        case K573::JobOwner::Transfer: MemoryCardEngine::onComplete(completion); break;
+        case K573::JobOwner::Flush: WriteBehind::onComplete(completion); break;
+        case K573::JobOwner::Presence: CardPresence::onComplete(completion); break;
+      }
+    }
+    MemoryCardEngine::service();
+    CardPresence::service();
+    // `K573Status` is the durability barrier of buffered writes
+    WriteBehind::flush();
+    WriteBehind::service(!MemoryCardEngine::isBusy());
+    uint16_t status = MemoryCardEngine::getStatus(0);
+    if (status & (MemoryCardStatus::Reading | MemoryCardStatus::Writing)) steps.busyPolls++;
+    uint32_t elapsed = __threadTimeUs() - start;
+    steps.times.push_back(elapsed);
+    std::this_thread::yield();
+    return elapsed;
+  }
+
+  /**
+   * @brief Step until the transfer and buffered writes of slot 0 are done.
+   * @return `false` if it did not finish in time
+   */
+  bool __run(Steps &steps) {
+    uint32_t start = micros();
+    while (MemoryCardEngine::isBusy() || WriteBehind::isPending(0)) {
+      if (micros() - start > __transferTimeoutUs) return false;
+      __step(steps);
+    }
+    return true;
+  }
+
+  uint32_t __percentile(std::vector<uint32_t> values, double ratio) {
+    size_t index = (size_t)(ratio * (values.size() - 1) + 0.5);
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+  }
+
+  void __print(const char *name, const Steps &steps, uint16_t frames, uint32_t elapsedUs) {
+    printf("%s: %u frames in %.1f ms, %zu steps (%u saw it running), step CPU p50 %u us p99 %u us max %u us\n", name,
+           frames, elapsedUs / 1000.0, steps.times.size(), steps.busyPolls, __percentile(steps.times, 0.5),
+           __percentile(steps.times, 0.99), __percentile(steps.times, 1.0));
+  }
+
+  void testLongRead() {
+    const uint16_t first = 0x100;
+    const uint16_t count = 128;
+    const uint32_t ramAddress = 0x010000;
+    for (int frame = 0; frame < count; frame++) {
+      uint8_t *data = __card.frame(first + frame);
+      for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE; i++) data[i] = __pattern(1, frame * PSX_MEMCARD_FRAME_SIZE + i);
+    }
+
+    uint32_t start = micros();
+    TEST_ASSERT_EQUAL(MemoryCardEngine::StartResult::Started, MemoryCardEngine::startRead(0, first, ramAddress, count));
+    // Acknowledged at once, the transfer runs behind
+    TEST_ASSERT_TRUE(MemoryCardEngine::isBusy());
+    TEST_ASSERT_EQUAL(MemoryCardEngine::StartResult::Busy, MemoryCardEngine::startRead(0, 0, 0x020000, 1));
+    TEST_ASSERT_EQUAL(MemoryCardEngine::StartResult::Busy, MemoryCardEngine::startWrite(0, 0, 0x020000, 1));
+    TEST_ASSERT_EQUAL_HEX16(MemoryCardStatus::Available | MemoryCardStatus::Reading, MemoryCardEngine::getStatus(0));
+
+    Steps steps;
+    TEST_ASSERT_TRUE_MESSAGE(__run(steps), "read did not finish");
+    __print("read", steps, count, micros() - start);
+    TEST_ASSERT_EQUAL_HEX16(MemoryCardStatus::Available, MemoryCardEngine::getStatus(0));
+    TEST_ASSERT_GREATER_THAN_UINT32(count, steps.busyPolls);
+    TEST_ASSERT_LESS_THAN_UINT32(__stepLimitUs, __percentile(steps.times, 0.999));
+
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    for (int frame = 0; frame < count; frame++) {
+      TEST_ASSERT_TRUE(RamStore::read(ramAddress + frame * PSX_MEMCARD_FRAME_SIZE, data, PSX_MEMCARD_FRAME_SIZE));
+      TEST_ASSERT_EQUAL_MEMORY(__card.frame(first + frame), data, PSX_MEMCARD_FRAME_SIZE);
+    }
+  }
+
+  void testLongWrite() {
+    const uint16_t first = 0x200;
+    const uint16_t count = 128;
+    const uint32_t ramAddress = 0x030000;
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    for (int frame = 0; frame < count; frame++) {
+      for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE; i++) data[i] = __pattern(2, frame * PSX_MEMCARD_FRAME_SIZE + i);
+      TEST_ASSERT_TRUE(RamStore::write(ramAddress + frame * PSX_MEMCARD_FRAME_SIZE, data, PSX_MEMCARD_FRAME_SIZE));
+    }
+    uint32_t writes = __card.writes;
+
+    uint32_t start = micros();
+    TEST_ASSERT_EQUAL(MemoryCardEngine::StartResult::Started, MemoryCardEngine::startWrite(0, first, ramAddress, count));
+    Steps steps;
+    TEST_ASSERT_TRUE_MESSAGE(__run(steps), "write did not finish");
+    __print("write", steps, count, micros() - start);
+    TEST_ASSERT_EQUAL_HEX16(MemoryCardStatus::Available, MemoryCardEngine::getStatus(0));
+    // Host sees `Writing` until every frame is on the card
+    TEST_ASSERT_GREATER_THAN_UINT32(count, steps.busyPolls);
+    TEST_ASSERT_LESS_THAN_UINT32(__stepLimitUs, __percentile(steps.times, 0.999));
+
+    TEST_ASSERT_EQUAL_UINT32(writes + count, __card.writes);
+    for (int frame = 0; frame < count; frame++) {
+      RamStore::read(ramAddress + frame * PSX_MEMCARD_FRAME_SIZE, data, PSX_MEMCARD_FRAME_SIZE);
+      TEST_ASSERT_EQUAL_MEMORY(data, __card.frame(first + frame), PSX_MEMCARD_FRAME_SIZE);
+    }
+  }
+
+  void testOutOfRange() {
+    // Past the last frame of the card, past the end of the RAM address space, and a slot that does not exist
+    TEST_ASSERT_EQUAL(MemoryCardEngine::StartResult::InvalidParameter, MemoryCardEngine::startRead(0, 0x3ff, 0, 2));
+    TEST_ASSERT_EQUAL(MemoryCardEngine::StartResult::InvalidParameter,
+                      MemoryCardEngine::startRead(0, 0, K573_RAM_SIZE - PSX_MEMCARD_FRAME_SIZE, 2));
+    TEST_ASSERT_EQUAL(MemoryCardEngine::StartResult::InvalidParameter, MemoryCardEngine::startRead(K573_SLOT_COUNTS, 0, 0, 1));
+    TEST_ASSERT_FALSE(MemoryCardEngine::isBusy());
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  PSXSim::begin();
+  PSXSim::attach(0, &__card);
+  __core1 = std::thread([] {
+    PSXWorker::setup();
+    __isReady.store(true);
+    while (__isRunning.load(std::memory_order_relaxed)) {
+      PSXWorker::service();
+      std::this_thread::yield();
+    }
+  });
+  while (!__isReady.load()) std::this_thread::yield();
+  // Wait for the first presence probe (and the calibration of the new card)
+  Steps steps;
+  while (CardPresence::getStatus(0) != MemoryCardStatus::Available) __step(steps);
+
+  UNITY_BEGIN();
+  RUN_TEST(testLongRead);
+  RUN_TEST(testLongWrite);
+  RUN_TEST(testOutOfRange);
+  int failures = UNITY_END();
+  __isRunning.store(false);
+  __core1.join();
+  return failures;
+}
@@ -0,0 +1,136 @@
+/*
+  JVS packet pool: exhaustion and the counters, handles moved and released, only the header reset when a buffer is
+  taken, then the cost of taking a buffer against clearing and copying a packet.
+
+    pio test -e native -f test_packet_pool -v
+*/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <utility>
+#include <unity.h>
+#include <JVSPacketPool.h>
+
+namespace {
+  double __elapsedNs(const timespec &start, const timespec &end) {
+    return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+  }
+
+  void testExhaustion() {
+    JVS::PacketHandle handles[JVS_PACKET_POOL_SIZE];
+    for (JVS::PacketHandle &handle : handles) {
+      handle = JVS::PacketPool::acquire(0x01);
+      TEST_ASSERT_TRUE((bool)handle);
+    }
+    TEST_ASSERT_EQUAL_UINT8(0, JVS::PacketPool::available());
+
+    // Every buffer in use: an empty handle, nothing is shared
+    JVS::PacketHandle none = JVS::PacketPool::acquire();
+    TEST_ASSERT_FALSE((bool)none);
+    const JVS::PacketPool::Statistics &statistics = JVS::PacketPool::getStatistics();
+    TEST_ASSERT_EQUAL_UINT32(JVS_PACKET_POOL_SIZE, statistics.acquired);
+    TEST_ASSERT_EQUAL_UINT32(1, statistics.exhausted);
+    TEST_ASSERT_EQUAL_UINT8(JVS_PACKET_POOL_SIZE, statistics.peakInUse);
+    for (int i = 1; i < JVS_PACKET_POOL_SIZE; i++) TEST_ASSERT_TRUE(&*handles[0] != &*handles[i]);
+
+    // One released, one more can be taken
+    handles[0].release();
+    TEST_ASSERT_FALSE((bool)handles[0]);
+    TEST_ASSERT_EQUAL_UINT8(1, JVS::PacketPool::available());
+    JVS::PacketHandle again = JVS::PacketPool::acquire();
+    TEST_ASSERT_TRUE((bool)again);
+    TEST_ASSERT_EQUAL_UINT32(1, statistics.exhausted);
+  }
+
+  void testMoveAndScope() {
+    {
+      JVS::PacketHandle first = JVS::PacketPool::acquire();
+      JVS::Packet *packet = &*first;
+      // Moved: the buffer has one owner
+      JVS::PacketHandle second = std::move(first);
+      TEST_ASSERT_FALSE((bool)first);
+      TEST_ASSERT_EQUAL_PTR(packet, &*second);
+      TEST_ASSERT_EQUAL_UINT8(JVS_PACKET_POOL_SIZE - 1, JVS::PacketPool::available());
+
+      // Assigned over a handle that owns a buffer: that buffer goes back
+      JVS::PacketHandle third = JVS::PacketPool::acquire();
+      third = std::move(second);
+      TEST_ASSERT_EQUAL_PTR(packet, &*third);
+      TEST_ASSERT_EQUAL_UINT8(JVS_PACKET_POOL_SIZE - 1, JVS::PacketPool::available());
+    }
+    // Destroyed handles return their buffers
+    TEST_ASSERT_EQUAL_UINT8(JVS_PACKET_POOL_SIZE, JVS::PacketPool::available());
+  }
+
+  void testHeaderResetOnly() {
+    JVS::PacketHandle handle = JVS::PacketPool::acquire(0x02);
+    JVS::Packet *packet = &*handle;
+    uint8_t data[JVS_MAX_DATA_SIZE];
+    memset(data, 0x5a, sizeof(data));
+    handle->add(data, sizeof(data));
+    handle->add(0x01);
+    TEST_ASSERT_TRUE(handle->isOverflowed);
+    handle.release();
+
+    // Same buffer comes back first, with a clean header and a checksum of the new address
+    handle = JVS::PacketPool::acquire(0x03);
+    TEST_ASSERT_EQUAL_PTR(packet, &*handle);
+    TEST_ASSERT_EQUAL_HEX8(0x03, handle->nodeNo);
+    TEST_ASSERT_EQUAL_UINT8(0, handle->length);
+    TEST_ASSERT_FALSE(handle->isOverflowed);
+    TEST_ASSERT_TRUE(handle->validate());
+    handle->add(0x10);
+    TEST_ASSERT_EQUAL_UINT8(1, handle->length);
+    TEST_ASSERT_TRUE(handle->validate());
+  }
+
+  void testBenchmark() {
+    // Status response of a poll: taken from the pool, built in place and released
+    const uint32_t rounds = 10000000;
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t round = 0; round < rounds; round++) {
+      JVS::PacketHandle ack = JVS::PacketPool::acquire();
+      ack->add(JVS::AckStatus::StatusOK);
+      ack->add(JVS::AckReport::OK);
+      ack->add((uint8_t)round);
+      __asm__ volatile("" : : "r"(&*ack) : "memory");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double pooledNs = __elapsedNs(start, end) / rounds;
+
+    // Before the pool: a temporary with its data cleared, copied over the response
+    static uint8_t temporary[sizeof(JVS::Packet)], response[sizeof(JVS::Packet)];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t round = 0; round < rounds; round++) {
+      memset(temporary, 0, sizeof(temporary));
+      temporary[0] = JVS::AckStatus::StatusOK;
+      temporary[1] = JVS::AckReport::OK;
+      temporary[2] = (uint8_t)round;
+      memcpy(response, temporary, sizeof(response));
+      __asm__ volatile("" : : "r"(response), "r"(temporary) : "memory");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double copiedNs = __elapsedNs(start, end) / rounds;
+
+    printf("packet: %.1f ns to take, build and release, %.1f ns to clear and copy %zu bytes\n", pooledNs, copiedNs,
+           sizeof(JVS::Packet));
+    TEST_ASSERT_EQUAL_UINT8(JVS_PACKET_POOL_SIZE, JVS::PacketPool::available());
+    TEST_ASSERT_EQUAL_UINT32(0, JVS::PacketPool::getStatistics().exhausted);
+  }
+}
+
+void setUp() {
+  JVS::PacketPool::resetStatistics();
+}
+
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testExhaustion);
+  RUN_TEST(testMoveAndScope);
+  RUN_TEST(testHeaderResetOnly);
+  RUN_TEST(testBenchmark);
+  return UNITY_END();
+}
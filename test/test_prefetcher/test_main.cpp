@@ -0,0 +1,223 @@
+/*
+  Read ahead against a card image file: directory index, sequential reads of a linked save, and the accuracy
+  counters when read ahead frames are evicted or overwritten before the host reads them.
+
+    pio test -e native -f test_prefetcher -v
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <unity.h>
+#include <Arduino.h>
+#include <CardPresence.h>
+#include <FrameCache.h>
+#include <MemoryCardEngine.h>
+#include <Prefetcher.h>
+#include <PSXSim.h>
+#include <PSXWorker.h>
+#include <WriteBehind.h>
+
+namespace {
+  const uint32_t __timeoutUs = 20000000;
+  const uint32_t __ramAddress = 0x040000;
+  // Save on the image: block 1 (first) linked to block 2 (last)
+  const uint16_t __saveFrame = PSX_MEMCARD_FRAMES_IN_BLOCK;
+  const uint16_t __saveFrames = PSX_MEMCARD_FRAMES_IN_BLOCK * 2;
+
+  PSXSim::MemoryCard __card;
+  std::atomic<bool> __isRunning{ true };
+  std::atomic<bool> __isReady{ false };
+  std::thread __core1;
+
+  /**
+   * @brief Directory frame with the XOR checksum in the last byte.
+   */
+  void __setDirectoryFrame(uint8_t *data, uint8_t state, uint16_t next) {
+    memset(data, 0, PSX_MEMCARD_FRAME_SIZE);
+    data[0x00] = state;
+    data[0x08] = next & 0xff;
+    data[0x09] = next >> 8;
+    uint8_t checksum = 0;
+    for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE - 1; i++) checksum ^= data[i];
+    data[PSX_MEMCARD_FRAME_SIZE - 1] = checksum;
+  }
+
+  /**
+   * @brief Write the card image the tests run against, like a dump taken with `tools/card_backup.py`.
+   * @return `false` if the file can not be written or read back
+   */
+  bool __loadImage() {
+    PSXSim::MemoryCard source;
+    uint8_t *header = source.frame(0);
+    memset(header, 0, PSX_MEMCARD_FRAME_SIZE);
+    header[0] = 'M';
+    header[1] = 'C';
+    header[PSX_MEMCARD_FRAME_SIZE - 1] = 'M' ^ 'C';
+    // Next block is stored as the block index - 1
+    __setDirectoryFrame(source.frame(1), 0x51, 1);
+    __setDirectoryFrame(source.frame(2), 0x53, 0xffff);
+    for (int block = 3; block < PSX_MEMCARD_BLOCK_COUNTS; block++) __setDirectoryFrame(source.frame(block), 0xa0, 0xffff);
+    for (uint16_t address = PSX_MEMCARD_FRAMES_IN_BLOCK; address < K573_MEMCARD_FRAMES; address++) {
+      for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE; i++) source.frame(address)[i] = (uint8_t)(address * 3 + i);
+    }
+
+    char path[] = "/tmp/test_prefetcher_XXXXXX";
+    int file = mkstemp(path);
+    if (file < 0) return false;
+    close(file);
+    bool isLoaded = source.save(path) && __card.load(path);
+    unlink(path);
+    return isLoaded;
+  }
+
+  /**
+   * @brief One pass of core 0, read ahead only while `isIdle` (JVS link idle).
+   */
+  void __step(bool isIdle) {
+    PSXWorker::Completion completion;
+    while (PSXWorker::tryGetCompletion(completion)) {
+      switch (completion.job.owner) {
+        case K573::JobOwner::Transfer: MemoryCardEngine::onComplete(completion); break;
+        case K573::JobOwner::Prefetch: Prefetcher::onComplete(completion); break;
+        case K573::JobOwner::Flush: WriteBehind::onComplete(completion); break;
+        case K573::JobOwner::Presence: CardPresence::onComplete(completion); break;
+      }
+    }
+    MemoryCardEngine::service();
+    CardPresence::service();
+    WriteBehind::flush();
+    bool isBusy = MemoryCardEngine::isBusy();
+    WriteBehind::service(!isBusy);
+    Prefetcher::service(isIdle && !isBusy && !WriteBehind::isPending(0));
+    std::this_thread::yield();
+  }
+
+  /**
+   * @brief Host transfer, the link is busy until it is done.
+   * @return `false` if it did not finish in time
+   */
+  bool __transfer(bool isRead, uint16_t address, uint16_t count) {
+    MemoryCardEngine::StartResult result = isRead ? MemoryCardEngine::startRead(0, address, __ramAddress, count)
+                                                  : MemoryCardEngine::startWrite(0, address, __ramAddress, count);
+    // Read ahead job still on the bus
+    while (result == MemoryCardEngine::StartResult::Busy) {
+      __step(false);
+      result = isRead ? MemoryCardEngine::startRead(0, address, __ramAddress, count)
+                      : MemoryCardEngine::startWrite(0, address, __ramAddress, count);
+    }
+    if (result != MemoryCardEngine::StartResult::Started) return false;
+    uint32_t start = micros();
+    while (MemoryCardEngine::isBusy() || WriteBehind::isPending(0)) {
+      if (micros() - start > __timeoutUs) return false;
+      __step(false);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Leave the link idle until the frames are read ahead.
+   * @return `false` if they were not read in time
+   */
+  bool __idleUntilCached(uint16_t first, uint16_t count) {
+    uint32_t start = micros();
+    for (uint16_t address = first; address < first + count; address++) {
+      while (!FrameCache::contains(0, address)) {
+        if (micros() - start > __timeoutUs) return false;
+        __step(true);
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @brief Game loading the save: directory, then the first frames of the save one at a time.
+   */
+  void __startSave() {
+    MemoryCardEngine::onCardRemoved(0);
+    Prefetcher::resetStatistics();
+    TEST_ASSERT_TRUE(__transfer(true, 0, K573_DIRECTORY_FRAMES));
+    TEST_ASSERT_TRUE(__transfer(true, __saveFrame, 1));
+    TEST_ASSERT_TRUE(__transfer(true, __saveFrame + 1, 1));
+  }
+
+  void testDirectoryIndex() {
+    __startSave();
+    TEST_ASSERT_EQUAL_UINT8(2, Prefetcher::getNextBlock(0, 1));
+    TEST_ASSERT_EQUAL_UINT8(0, Prefetcher::getNextBlock(0, 2));
+    TEST_ASSERT_EQUAL_UINT8(1, Prefetcher::getFirstBlock(0, 1));
+    TEST_ASSERT_EQUAL_UINT8(1, Prefetcher::getFirstBlock(0, 2));
+    TEST_ASSERT_EQUAL_UINT8(0, Prefetcher::getFirstBlock(0, 3));
+  }
+
+  void testSaveServedFromCache() {
+    __startSave();
+    // Rest of block 1, then the linked block 2
+    TEST_ASSERT_TRUE(__idleUntilCached(__saveFrame + 2, __saveFrames - 2));
+    uint32_t reads = __card.reads;
+    TEST_ASSERT_TRUE(__transfer(true, __saveFrame + 2, __saveFrames - 2));
+    TEST_ASSERT_EQUAL_UINT32(reads, __card.reads);
+
+    const Prefetcher::Statistics &statistics = Prefetcher::getStatistics();
+    printf("save: %u issued, %u useful, %u wasted\n", statistics.issued, statistics.useful, statistics.wasted);
+    TEST_ASSERT_EQUAL_UINT32(__saveFrames - 2, statistics.issued);
+    TEST_ASSERT_EQUAL_UINT32(__saveFrames - 2, statistics.useful);
+    TEST_ASSERT_EQUAL_UINT32(0, statistics.wasted);
+  }
+
+  void testEvictedAndOverwrittenAreWasted() {
+    __startSave();
+    TEST_ASSERT_TRUE(__idleUntilCached(__saveFrame + 2, __saveFrames - 2));
+    const Prefetcher::Statistics &statistics = Prefetcher::getStatistics();
+    TEST_ASSERT_EQUAL_UINT32(__saveFrames - 2, statistics.issued);
+
+    // Host writes the last frame of the save before reading it
+    TEST_ASSERT_TRUE(__transfer(false, __saveFrame + __saveFrames - 1, 1));
+    TEST_ASSERT_EQUAL_UINT32(1, statistics.wasted);
+
+    // Another save pushes the oldest read ahead frames out of the cache
+    const uint16_t others = 96;
+    TEST_ASSERT_TRUE(__transfer(true, PSX_MEMCARD_FRAMES_IN_BLOCK * 10, others));
+    // Frames read by host were the oldest, so two fewer read ahead frames are evicted
+    TEST_ASSERT_EQUAL_UINT32(1 + others - 2, statistics.wasted);
+
+    // Host reads them from the card again (pushing out the rest), nothing was served by the read ahead
+    uint32_t reads = __card.reads;
+    TEST_ASSERT_TRUE(__transfer(true, __saveFrame + 2, others - 2));
+    TEST_ASSERT_EQUAL_UINT32(reads + others - 2, __card.reads);
+    printf("evicted: %u issued, %u useful, %u wasted\n", statistics.issued, statistics.useful, statistics.wasted);
+    TEST_ASSERT_EQUAL_UINT32(0, statistics.useful);
+    TEST_ASSERT_EQUAL_UINT32(statistics.issued, statistics.wasted);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  if (!__loadImage()) return 1;
+  FrameCache::setEvictionListener(Prefetcher::onEvicted);
+  PSXSim::begin();
+  PSXSim::attach(0, &__card);
+  __core1 = std::thread([] {
+    PSXWorker::setup();
+    __isReady.store(true);
+    while (__isRunning.load(std::memory_order_relaxed)) {
+      PSXWorker::service();
+      std::this_thread::yield();
+    }
+  });
+  while (!__isReady.load()) std::this_thread::yield();
+  while (CardPresence::getStatus(0) != MemoryCardStatus::Available) __step(false);
+
+  UNITY_BEGIN();
+  RUN_TEST(testDirectoryIndex);
+  RUN_TEST(testSaveServedFromCache);
+  RUN_TEST(testEvictedAndOverwrittenAreWasted);
+  int failures = UNITY_END();
+  __isRunning.store(false);
+  __core1.join();
+  return failures;
+}
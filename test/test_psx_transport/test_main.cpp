@@ -0,0 +1,216 @@
+/*
+  PSX transport path: whole frames started on the simulated transport and finished by its completion (busy while a
+  frame is on the bus, stopped by an ACK timeout of a calibrated timing unless ACK is optional, a lost frame finished only by `abort`), then
+  memory card jobs of the worker on it (PSX core steps end while a job frame is on the bus), a lost frame taken as a
+  timeout and retried.
+
+    pio test -e native -f test_psx_transport -v
+*/
+#include <atomic>
+#include <thread>
+#include <unity.h>
+#include <Arduino.h>
+#include <PSXFrame.h>
+#include <PSXSim.h>
+#include <PSXWorker.h>
+
+namespace {
+  const uint32_t __timeoutUs = 5000000;
+  const uint16_t __address = 0x040;
+
+  PSXSim::Transport __transport;
+  PSXSim::MemoryCard __card;
+  PSXSim::DigitalPad __pad;
+  std::atomic<bool> __isRunning{ false };
+  std::atomic<bool> __isReady{ false };
+  // PSX core steps that returned while a frame was still on the bus
+  std::atomic<uint32_t> __busySteps{ 0 };
+  std::thread __core1;
+
+  int __completions = 0;
+  PSX::Frame *__completed = nullptr;
+
+  void __onComplete(PSX::Frame &frame, void *context) {
+    __completions++;
+    __completed = &frame;
+    TEST_ASSERT_EQUAL_PTR(&__completions, context);
+  }
+
+  /**
+   * @brief Poll the transport until the frame completes.
+   * @return Microseconds from the start, `__timeoutUs` if it never completed
+   */
+  uint32_t __wait(uint32_t start) {
+    while (__transport.isBusy() && micros() - start < __timeoutUs) {
+      __transport.poll();
+      std::this_thread::yield();
+    }
+    return __transport.isBusy() ? __timeoutUs : micros() - start;
+  }
+
+  void testControllerFrame() {
+    PSX::Frame frame;
+    PSX::buildControllerFrame(frame, 1);
+    __pad.buttons = 0xfe7f;
+    __completions = 0;
+    uint32_t start = micros();
+    TEST_ASSERT_TRUE(__transport.tryStart(frame, __onComplete, &__completions));
+    TEST_ASSERT_TRUE(__transport.isBusy());
+    // One frame at a time
+    PSX::Frame other;
+    PSX::buildControllerFrame(other, 0);
+    TEST_ASSERT_FALSE(__transport.tryStart(other, __onComplete, &__completions));
+    TEST_ASSERT_EQUAL_INT(0, __completions);
+
+    // 5 bytes at 250 kHz, the attention delay and 4 ACK delays
+    uint32_t elapsed = __wait(start);
+    TEST_ASSERT_EQUAL_INT(1, __completions);
+    TEST_ASSERT_EQUAL_PTR(&frame, __completed);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(5 * 32 + PSX_TRANSFER_WAIT + 4 * __pad.ackDelay, elapsed);
+    TEST_ASSERT_EQUAL_UINT16(frame.length, frame.transferred);
+    TEST_ASSERT_EQUAL_UINT16(__pad.ackDelay, frame.ackLatency);
+    uint8_t input[2];
+    TEST_ASSERT_EQUAL(PSX::FrameResult::Success, PSX::parseControllerFrame(frame, input));
+    TEST_ASSERT_EQUAL_HEX8(0x7f, input[0]);
+    TEST_ASSERT_EQUAL_HEX8(0xfe, input[1]);
+
+    // No controller on Port 1, the card there does not answer it (nor the second byte after the fallback)
+    TEST_ASSERT_TRUE(__transport.tryStart(other, __onComplete, &__completions));
+    __wait(micros());
+    TEST_ASSERT_EQUAL_UINT16(2, other.transferred);
+    TEST_ASSERT_EQUAL(PSX::FrameResult::NoDevice, PSX::parseControllerFrame(other, input));
+  }
+
+  void testAckTimeout() {
+    // Sector fetched slower than the ACK timeout of the byte (calibrated timing, no fallback)
+    __card.timing.readDelay = 3000;
+    PSX::Frame frame;
+    PSX::buildReadFrame(frame, 0, __address);
+    frame.timing.hasAckFallback = false;
+    TEST_ASSERT_TRUE(__transport.tryStart(frame, __onComplete, &__completions));
+    __wait(micros());
+    TEST_ASSERT_EQUAL_UINT16(7, frame.transferred);
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    TEST_ASSERT_EQUAL(PSX::FrameResult::Timeout, PSX::parseReadFrame(frame, data));
+
+    // Without reliable ACK the timeout is waited and the frame goes on
+    PSX::buildReadFrame(frame, 0, __address);
+    frame.timing.hasAckFallback = false;
+    frame.timing.isAckOptional = true;
+    TEST_ASSERT_TRUE(__transport.tryStart(frame, __onComplete, &__completions));
+    __wait(micros());
+    __card.timing.readDelay = 100;
+    TEST_ASSERT_EQUAL_UINT16(frame.length, frame.transferred);
+    TEST_ASSERT_EQUAL(PSX::FrameResult::Success, PSX::parseReadFrame(frame, data));
+    TEST_ASSERT_EQUAL_MEMORY(__card.frame(__address), data, sizeof(data));
+  }
+
+  void testLostFrame() {
+    PSX::Frame frame;
+    PSX::buildControllerFrame(frame, 1);
+    __transport.lostFrames = 1;
+    __completions = 0;
+    TEST_ASSERT_TRUE(__transport.tryStart(frame, __onComplete, &__completions));
+    // Never completes by itself
+    uint32_t start = micros();
+    while (micros() - start < 20000) __transport.poll();
+    TEST_ASSERT_TRUE(__transport.isBusy());
+    TEST_ASSERT_EQUAL_INT(0, __completions);
+
+    __transport.abort();
+    TEST_ASSERT_FALSE(__transport.isBusy());
+    TEST_ASSERT_EQUAL_INT(1, __completions);
+    TEST_ASSERT_EQUAL_UINT16(0, frame.transferred);
+    // Nothing left to abort
+    __transport.abort();
+    TEST_ASSERT_EQUAL_INT(1, __completions);
+  }
+
+  /**
+   * @brief Run a memory card job on the worker.
+   */
+  PSX::FrameResult __run(PSXWorker::JobType type, uint16_t address, uint8_t *buffer) {
+    PSXWorker::Job job;
+    job.type = type;
+    job.slot = 0;
+    job.address = address;
+    job.buffer = buffer;
+    TEST_ASSERT_TRUE(PSXWorker::trySubmit(job));
+    PSXWorker::Completion completion;
+    uint32_t start = micros();
+    while (!PSXWorker::tryGetCompletion(completion)) {
+      TEST_ASSERT_TRUE(micros() - start < __timeoutUs);
+      std::this_thread::yield();
+    }
+    TEST_ASSERT_EQUAL_UINT16(address, completion.job.address);
+    return completion.result;
+  }
+
+  FrameErrors::Counters __counters() {
+    PSXWorker::ErrorState state;
+    PSXWorker::readErrors(state);
+    return state.counters[0];
+  }
+
+  void testWorkerJobs() {
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE; i++) data[i] = i * 3;
+    uint32_t frames = __transport.frames;
+    __busySteps = 0;
+    TEST_ASSERT_EQUAL(PSX::FrameResult::Success, __run(PSXWorker::JobType::WriteMemoryCard, __address + 1, data));
+    TEST_ASSERT_EQUAL_MEMORY(data, __card.frame(__address + 1), sizeof(data));
+    uint8_t read[PSX_MEMCARD_FRAME_SIZE];
+    TEST_ASSERT_EQUAL(PSX::FrameResult::Success, __run(PSXWorker::JobType::ReadMemoryCard, __address + 1, read));
+    TEST_ASSERT_EQUAL_MEMORY(data, read, sizeof(read));
+    // Every frame went through the transport (the first job calibrated the card too)
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(2, __transport.frames - frames);
+    // Job frames do not hold the step, only the polls wait for their frames
+    TEST_ASSERT_TRUE(__busySteps.load() > 0);
+
+    // Completion never comes: aborted after the longest time of the frame, retried as a timeout
+    FrameErrors::Counters before = __counters();
+    // Controller polls keep going on the same bus
+    __transport.lostTypes = 1 << PSX::FrameType::MemoryCardRead;
+    __transport.lostFrames = 1;
+    TEST_ASSERT_EQUAL(PSX::FrameResult::Success, __run(PSXWorker::JobType::ReadMemoryCard, __address, read));
+    TEST_ASSERT_EQUAL_MEMORY(__card.frame(__address), read, sizeof(read));
+    FrameErrors::Counters after = __counters();
+    TEST_ASSERT_EQUAL_UINT32(0, __transport.lostFrames.load());
+    TEST_ASSERT_EQUAL_UINT32(1, after.retries - before.retries);
+    TEST_ASSERT_EQUAL_UINT32(1, after.recovered - before.recovered);
+    TEST_ASSERT_FALSE(PSXWorker::isBadFrame(0, __address));
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  PSXSim::begin();
+  __transport.begin();
+  PSXSim::attach(0, &__card);
+  PSXSim::attach(1, &__pad);
+
+  UNITY_BEGIN();
+  RUN_TEST(testControllerFrame);
+  RUN_TEST(testAckTimeout);
+  RUN_TEST(testLostFrame);
+
+  // The transport now belongs to the PSX core
+  __isRunning.store(true);
+  __core1 = std::thread([] {
+    PSXWorker::setup(&__transport);
+    __isReady.store(true);
+    while (__isRunning.load(std::memory_order_relaxed)) {
+      PSXWorker::service();
+      if (__transport.isBusy()) __busySteps++;
+      std::this_thread::yield();
+    }
+  });
+  while (!__isReady.load()) std::this_thread::yield();
+  RUN_TEST(testWorkerJobs);
+  int failures = UNITY_END();
+  __isRunning.store(false);
+  __core1.join();
+  return failures;
+}
@@ -0,0 +1,151 @@
+/*
+  Sparse RAM buffer: worst-case page and table footprint of the transfers games make, and pages and page tables
+  given back when memory is cleared by host or on reset.
+
+    pio test -e native -f test_ram_store -v
+*/
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+#include <FrameCache.h>
+#include <PagePool.h>
+#include <RamStore.h>
+
+namespace {
+  // RAM region mapped by one page table
+  const uint32_t __regionSize = 0x10000;
+  const uint32_t __frameSize = PSX_MEMCARD_FRAME_SIZE;
+  const uint32_t __blockSize = PSX_MEMCARD_FRAMES_IN_BLOCK * PSX_MEMCARD_FRAME_SIZE;
+
+  uint8_t __data[__blockSize * 2];
+  uint8_t __zero[__blockSize * 2];
+
+  /**
+   * @brief Transfer of frames into RAM, as `MemoryCardEngine` and `K573BufferWrite` do it.
+   */
+  bool __transfer(uint32_t address, uint32_t length) {
+    for (uint32_t offset = 0; offset < length; offset += __frameSize) {
+      if (!RamStore::write(address + offset, __data + offset % sizeof(__data), __frameSize)) return false;
+    }
+    return true;
+  }
+
+  void __print(const char *name) {
+    printf("%-28s %4u pages (%5u bytes), %u tables\n", name, RamStore::countMapped(),
+           RamStore::countMapped() * K573_PAGE_SIZE, RamStore::countTables());
+  }
+
+  void testDirectoryAndBlockFootprint() {
+    // Directory (16 frames) and one save block (64 frames) of each slot, page aligned
+    TEST_ASSERT_TRUE(__transfer(0x010000, 16 * __frameSize));
+    TEST_ASSERT_TRUE(__transfer(0x012000, __blockSize));
+    TEST_ASSERT_TRUE(__transfer(0x020000, 16 * __frameSize));
+    TEST_ASSERT_TRUE(__transfer(0x022000, __blockSize));
+    __print("2 directories + 2 blocks");
+    TEST_ASSERT_EQUAL_UINT16(2 * (16 + 64), RamStore::countMapped());
+    TEST_ASSERT_EQUAL_UINT8(2, RamStore::countTables());
+  }
+
+  void testUnalignedBlockAcrossRegions() {
+    // Not page aligned: one more page, and across a 64KB boundary: one more table
+    uint32_t address = 0x030000 - __blockSize / 2 + 0x40;
+    TEST_ASSERT_TRUE(RamStore::write(address, __data, __blockSize));
+    __print("unaligned block across 64KB");
+    TEST_ASSERT_EQUAL_UINT16(64 + 1, RamStore::countMapped());
+    TEST_ASSERT_EQUAL_UINT8(2, RamStore::countTables());
+
+    uint8_t data[__blockSize];
+    TEST_ASSERT_TRUE(RamStore::read(address, data, __blockSize));
+    TEST_ASSERT_EQUAL_MEMORY(__data, data, __blockSize);
+  }
+
+  void testWholeBudget() {
+    // Every page of the budget in one run, then nothing more fits (and nothing is written)
+    TEST_ASSERT_TRUE(__transfer(0, K573_RAM_PAGES * K573_PAGE_SIZE));
+    __print("whole budget");
+    TEST_ASSERT_EQUAL_UINT16(K573_RAM_PAGES, RamStore::countMapped());
+    TEST_ASSERT_FALSE(RamStore::canWrite(K573_RAM_PAGES * K573_PAGE_SIZE, 1));
+    TEST_ASSERT_FALSE(RamStore::write(K573_RAM_PAGES * K573_PAGE_SIZE - 1, __data, 2));
+    uint8_t data[2];
+    RamStore::read(K573_RAM_PAGES * K573_PAGE_SIZE - 1, data, 2);
+    TEST_ASSERT_EQUAL_HEX8(__data[(K573_RAM_PAGES * K573_PAGE_SIZE - 1) % sizeof(__data)], data[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x00, data[1]);
+  }
+
+  void testZerosAreNotStored() {
+    // Zeros into unmapped memory map nothing
+    TEST_ASSERT_TRUE(RamStore::write(0x050000, __zero, __blockSize));
+    TEST_ASSERT_EQUAL_UINT16(0, RamStore::countMapped());
+    TEST_ASSERT_EQUAL_UINT8(0, RamStore::countTables());
+
+    // Host clearing a buffer gives the pages and the table back
+    TEST_ASSERT_TRUE(__transfer(0x050000, __blockSize));
+    TEST_ASSERT_EQUAL_UINT16(64, RamStore::countMapped());
+    TEST_ASSERT_TRUE(RamStore::write(0x050000, __zero, __blockSize));
+    TEST_ASSERT_EQUAL_UINT16(0, RamStore::countMapped());
+    TEST_ASSERT_EQUAL_UINT8(0, RamStore::countTables());
+
+    // Partly cleared page stays until its last byte is zero
+    TEST_ASSERT_TRUE(RamStore::write(0x050000, __data, K573_PAGE_SIZE));
+    TEST_ASSERT_TRUE(RamStore::write(0x050000, __zero, K573_PAGE_SIZE / 2));
+    TEST_ASSERT_EQUAL_UINT16(1, RamStore::countMapped());
+    TEST_ASSERT_TRUE(RamStore::write(0x050000 + K573_PAGE_SIZE / 2, __zero, K573_PAGE_SIZE / 2));
+    TEST_ASSERT_EQUAL_UINT16(0, RamStore::countMapped());
+  }
+
+  void testTablesMoveToNewRegions() {
+    // Every table in use, one more region does not fit
+    for (uint32_t region = 0; region < K573_RAM_TABLES; region++) TEST_ASSERT_TRUE(__transfer(region * __regionSize, __frameSize));
+    TEST_ASSERT_FALSE(RamStore::write(K573_RAM_TABLES * __regionSize, __data, 1));
+
+    // Once a region is cleared, its table serves another one, over and over (the whole 24-bit address space)
+    for (uint32_t region = K573_RAM_TABLES; region < K573_RAM_SIZE / __regionSize; region++) {
+      uint32_t oldest = (region - K573_RAM_TABLES) * __regionSize;
+      TEST_ASSERT_TRUE(RamStore::write(oldest, __zero, __frameSize));
+      TEST_ASSERT_TRUE(__transfer(region * __regionSize, __frameSize));
+      TEST_ASSERT_EQUAL_UINT8(K573_RAM_TABLES, RamStore::countTables());
+    }
+    uint8_t data[__frameSize];
+    TEST_ASSERT_TRUE(RamStore::read(K573_RAM_SIZE - __regionSize, data, __frameSize));
+    TEST_ASSERT_EQUAL_MEMORY(__data, data, __frameSize);
+    // Taken over regions read as zero
+    TEST_ASSERT_TRUE(RamStore::read(0, data, __frameSize));
+    TEST_ASSERT_EQUAL_MEMORY(__zero, data, __frameSize);
+  }
+
+  void testClearGivesEverythingBack() {
+    uint16_t freePages = PagePool::countFree();
+    for (uint32_t region = 0; region < K573_RAM_TABLES; region++) TEST_ASSERT_TRUE(__transfer(region * __regionSize, __blockSize));
+    // A page shared with the frame cache stays with the cache
+    FrameCache::storePage(0, 0, RamStore::getPage(0), false);
+
+    RamStore::clear();
+    TEST_ASSERT_EQUAL_UINT16(0, RamStore::countMapped());
+    TEST_ASSERT_EQUAL_UINT8(0, RamStore::countTables());
+    TEST_ASSERT_EQUAL_UINT16(freePages - 1, PagePool::countFree());
+    TEST_ASSERT_EQUAL_MEMORY(__data, FrameCache::peek(0, 0), __frameSize);
+    FrameCache::invalidate(0);
+    TEST_ASSERT_EQUAL_UINT16(freePages, PagePool::countFree());
+
+    // Next session can use other regions
+    TEST_ASSERT_TRUE(__transfer(0x800000, __blockSize));
+  }
+}
+
+void setUp() {
+  RamStore::clear();
+  for (uint32_t i = 0; i < sizeof(__data); i++) __data[i] = (uint8_t)(i * 7 + 1) | 1;
+}
+
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testDirectoryAndBlockFootprint);
+  RUN_TEST(testUnalignedBlockAcrossRegions);
+  RUN_TEST(testWholeBudget);
+  RUN_TEST(testZerosAreNotStored);
+  RUN_TEST(testTablesMoveToNewRegions);
+  RUN_TEST(testClearGivesEverythingBack);
+  return UNITY_END();
+}
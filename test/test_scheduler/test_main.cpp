@@ -0,0 +1,186 @@
+/*
+  Cooperative scheduler on a fake clock: priorities, round robin, sleeps across the clock wrap, event driven tasks,
+  the run/late counters, then the cost of picking a task.
+
+    pio test -e native -f test_scheduler -v
+*/
+#include <stdio.h>
+#include <time.h>
+#include <unity.h>
+#include <Scheduler.h>
+
+namespace {
+  uint32_t __time = 0;
+  // Task IDs in the order they ran
+  int __order[64];
+  int __runs = 0;
+
+  uint32_t __fakeClock() {
+    return __time;
+  }
+
+  /**
+   * @brief Task context: what the step does when it runs
+   */
+  struct Work {
+    int id;
+    // Fake time the step takes
+    uint32_t runUs;
+    uint32_t sleepUs;
+    bool hasEvent;
+  };
+
+  uint32_t __step(void *context) {
+    Work &work = *(Work *)context;
+    if (__runs < 64) __order[__runs] = work.id;
+    __runs++;
+    __time += work.runUs;
+    work.hasEvent = false;
+    return work.sleepUs;
+  }
+
+  bool __hasEvent(void *context) {
+    return ((Work *)context)->hasEvent;
+  }
+
+  void testPriorityFirst() {
+    Scheduler scheduler(__fakeClock);
+    Work low = { 0, 0, 0, false };
+    Work high = { 1, 0, 100, false };
+    scheduler.add(__step, &low, Scheduler::Priority::Low);
+    scheduler.add(__step, &high, Scheduler::Priority::High);
+
+    // High runs, then sleeps and leaves the core to low
+    for (int i = 0; i < 3; i++) TEST_ASSERT_TRUE(scheduler.runOnce());
+    TEST_ASSERT_EQUAL_INT(1, __order[0]);
+    TEST_ASSERT_EQUAL_INT(0, __order[1]);
+    TEST_ASSERT_EQUAL_INT(0, __order[2]);
+    __time += 100;
+    TEST_ASSERT_TRUE(scheduler.runOnce());
+    TEST_ASSERT_EQUAL_INT(1, __order[3]);
+  }
+
+  void testRoundRobin() {
+    Scheduler scheduler(__fakeClock);
+    Work works[3] = { { 0, 0, 0, false }, { 1, 0, 0, false }, { 2, 0, 0, false } };
+    for (Work &work : works) scheduler.add(__step, &work, Scheduler::Priority::Normal);
+    for (int i = 0; i < 9; i++) TEST_ASSERT_TRUE(scheduler.runOnce());
+    for (int i = 0; i < 9; i++) TEST_ASSERT_EQUAL_INT(i % 3, __order[i]);
+  }
+
+  void testSleepAcrossWrap() {
+    // 50us before the clock wraps
+    __time = UINT32_MAX - 49;
+    Scheduler scheduler(__fakeClock);
+    Work work = { 0, 0, 200, false };
+    int task = scheduler.add(__step, &work, Scheduler::Priority::Normal);
+    TEST_ASSERT_TRUE(scheduler.runOnce());
+
+    __time += 199;
+    TEST_ASSERT_FALSE(scheduler.runOnce());
+    __time += 1;
+    TEST_ASSERT_TRUE(scheduler.runOnce());
+    TEST_ASSERT_EQUAL_UINT32(150, __time);
+
+    // Woken before the sleep has elapsed
+    TEST_ASSERT_FALSE(scheduler.runOnce());
+    scheduler.wake(task);
+    TEST_ASSERT_TRUE(scheduler.runOnce());
+    TEST_ASSERT_EQUAL_INT(3, __runs);
+  }
+
+  void testEventDrivenDoesNotStarve() {
+    Scheduler scheduler(__fakeClock);
+    Work event = { 0, 0, 0, false };
+    Work background = { 1, 0, 0, false };
+    scheduler.add(__step, &event, Scheduler::Priority::High, __hasEvent);
+    scheduler.add(__step, &background, Scheduler::Priority::Low);
+
+    TEST_ASSERT_TRUE(scheduler.runOnce());
+    TEST_ASSERT_EQUAL_INT(1, __order[0]);
+    event.hasEvent = true;
+    TEST_ASSERT_TRUE(scheduler.runOnce());
+    TEST_ASSERT_EQUAL_INT(0, __order[1]);
+    TEST_ASSERT_TRUE(scheduler.runOnce());
+    TEST_ASSERT_EQUAL_INT(1, __order[2]);
+  }
+
+  void testStatistics() {
+    Scheduler scheduler(__fakeClock);
+    Work slow = { 0, 300, 1000, false };
+    Work event = { 1, 20, 0, false };
+    int slowTask = scheduler.add(__step, &slow, Scheduler::Priority::Normal);
+    int eventTask = scheduler.add(__step, &event, Scheduler::Priority::High, __hasEvent);
+
+    TEST_ASSERT_TRUE(scheduler.runOnce());
+    // Slow task is due 1000us after its step ended, an event comes 250us after that and runs first
+    __time += 1250;
+    event.hasEvent = true;
+    TEST_ASSERT_TRUE(scheduler.runOnce());
+    TEST_ASSERT_TRUE(scheduler.runOnce());
+
+    const Scheduler::Statistics &slowStatistics = scheduler.getStatistics(slowTask);
+    TEST_ASSERT_EQUAL_UINT32(2, slowStatistics.runs);
+    TEST_ASSERT_EQUAL_UINT32(300, slowStatistics.maxRunUs);
+    TEST_ASSERT_EQUAL_UINT32(250 + 20, slowStatistics.maxLateUs);
+    // Waiting for an event is not being late
+    const Scheduler::Statistics &eventStatistics = scheduler.getStatistics(eventTask);
+    TEST_ASSERT_EQUAL_UINT32(1, eventStatistics.runs);
+    TEST_ASSERT_EQUAL_UINT32(20, eventStatistics.maxRunUs);
+    TEST_ASSERT_EQUAL_UINT32(0, eventStatistics.maxLateUs);
+
+    scheduler.resetStatistics();
+    TEST_ASSERT_EQUAL_UINT32(0, slowStatistics.runs);
+  }
+
+  void testTooManyTasks() {
+    Scheduler scheduler(__fakeClock);
+    Work work = { 0, 0, 0, false };
+    for (int i = 0; i < SCHEDULER_MAX_TASKS; i++) TEST_ASSERT_EQUAL_INT(i, scheduler.add(__step, &work, Scheduler::Priority::Low));
+    TEST_ASSERT_EQUAL_INT(-1, scheduler.add(__step, &work, Scheduler::Priority::Low));
+  }
+
+  uint32_t __emptyStep(void *) {
+    return 0;
+  }
+
+  bool __never(void *) {
+    return false;
+  }
+
+  void testBenchmark() {
+    // PSX core: a polling task, event driven tasks with nothing to do, and the job runner
+    Scheduler scheduler(__fakeClock);
+    for (int i = 0; i < SCHEDULER_MAX_TASKS - 1; i++) scheduler.add(__emptyStep, nullptr, Scheduler::Priority::High, __never);
+    int runner = scheduler.add(__emptyStep, nullptr, Scheduler::Priority::Low);
+
+    const uint32_t rounds = 10000000;
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t round = 0; round < rounds; round++) scheduler.runOnce();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsedNs = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("scheduler: %.1f ns per step (%d tasks, %d of them waiting for an event)\n", elapsedNs / rounds,
+           SCHEDULER_MAX_TASKS, SCHEDULER_MAX_TASKS - 1);
+    TEST_ASSERT_EQUAL_UINT32(rounds, scheduler.getStatistics(runner).runs);
+  }
+}
+
+void setUp() {
+  __time = 1000;
+  __runs = 0;
+}
+
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testPriorityFirst);
+  RUN_TEST(testRoundRobin);
+  RUN_TEST(testSleepAcrossWrap);
+  RUN_TEST(testEventDrivenDoesNotStarve);
+  RUN_TEST(testStatistics);
+  RUN_TEST(testTooManyTasks);
+  RUN_TEST(testBenchmark);
+  return UNITY_END();
+}
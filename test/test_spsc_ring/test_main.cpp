@@ -0,0 +1,197 @@
+/*
+  Lock-free rings and seqlock between threads (stand-ins for the two cores). Waiting sides yield, so the test
+  also interleaves on a single CPU.
+
+    pio test -e native -f test_spsc_ring
+*/
+#include <atomic>
+#include <thread>
+#include <unity.h>
+#include <PSXJob.h>
+#include <Seqlock.h>
+#include <SpscRing.h>
+
+namespace {
+  // Items pushed through the ring by the stress test
+  const uint32_t __itemCounts = 1000000;
+  // Snapshots published by the seqlock stress test
+  const uint32_t __snapshotCounts = 200000;
+
+  /**
+   * @brief Item larger than a word, so a torn copy shows as a mismatch
+   */
+  struct Item {
+    uint32_t sequence;
+    uint32_t check[7];
+  };
+
+  struct Snapshot {
+    uint32_t values[32];
+  };
+
+  void __fill(Item &item, uint32_t sequence) {
+    item.sequence = sequence;
+    for (int i = 0; i < 7; i++) item.check[i] = sequence * (i + 3) + i;
+  }
+
+  bool __isIntact(const Item &item) {
+    for (int i = 0; i < 7; i++) {
+      if (item.check[i] != item.sequence * (i + 3) + i) return false;
+    }
+    return true;
+  }
+
+  void testRingCapacity() {
+    SpscRing<uint32_t, 4> ring;
+    uint32_t value;
+    TEST_ASSERT_TRUE(ring.isEmpty());
+    TEST_ASSERT_FALSE(ring.tryPop(value));
+    for (uint32_t i = 0; i < 4; i++) TEST_ASSERT_TRUE(ring.tryPush(i));
+    TEST_ASSERT_TRUE(ring.isFull());
+    TEST_ASSERT_FALSE(ring.tryPush(4));
+    TEST_ASSERT_EQUAL_UINT32(4, ring.size());
+
+    // Indexes keep running past the capacity
+    for (uint32_t i = 0; i < 100; i++) {
+      TEST_ASSERT_TRUE(ring.tryPop(value));
+      TEST_ASSERT_EQUAL_UINT32(i, value);
+      TEST_ASSERT_TRUE(ring.tryPush(i + 4));
+    }
+    TEST_ASSERT_EQUAL_UINT32(4, ring.size());
+  }
+
+  void testRingStress() {
+    static SpscRing<Item, 8> ring;
+    std::atomic<uint32_t> fullCounts{ 0 };
+    std::thread producer([&] {
+      Item item;
+      for (uint32_t sequence = 0; sequence < __itemCounts; sequence++) {
+        __fill(item, sequence);
+        while (!ring.tryPush(item)) {
+          fullCounts.fetch_add(1, std::memory_order_relaxed);
+          std::this_thread::yield();
+        }
+      }
+    });
+
+    uint32_t expected = 0;
+    uint32_t torn = 0;
+    uint32_t outOfOrder = 0;
+    Item item;
+    while (expected < __itemCounts) {
+      if (!ring.tryPop(item)) {
+        std::this_thread::yield();
+        continue;
+      }
+      if (!__isIntact(item)) torn++;
+      if (item.sequence != expected) outOfOrder++;
+      expected = item.sequence + 1;
+    }
+    producer.join();
+
+    TEST_ASSERT_EQUAL_UINT32(0, torn);
+    TEST_ASSERT_EQUAL_UINT32(0, outOfOrder);
+    TEST_ASSERT_TRUE(ring.isEmpty());
+    // Both sides waited on each other at some point, so the full and empty edges were crossed
+    TEST_ASSERT_GREATER_THAN_UINT32(0, fullCounts.load());
+  }
+
+  void testJobRingRoundTrip() {
+    // Request ring to core 1 and completion ring back, as `PSXWorker` uses them
+    static PSXWorker::JobRing requests;
+    static PSXWorker::CompletionRing completions;
+    const uint32_t counts = 200000;
+    std::atomic<bool> isRunning{ true };
+    std::thread worker([&] {
+      PSXWorker::Completion completion;
+      while (isRunning.load(std::memory_order_relaxed)) {
+        if (!requests.tryPop(completion.job)) {
+          std::this_thread::yield();
+          continue;
+        }
+        completion.result = (PSX::FrameResult)(completion.job.tag % 5);
+        while (!completions.tryPush(completion)) std::this_thread::yield();
+      }
+    });
+
+    uint32_t submitted = 0;
+    uint32_t completed = 0;
+    uint32_t mismatches = 0;
+    while (completed < counts) {
+      PSXWorker::Job job = { PSXWorker::JobType::ReadMemoryCard, (uint8_t)(submitted & 1),
+                             (uint16_t)(submitted & 0x3ff), nullptr, 1, submitted };
+      if (submitted < counts && requests.tryPush(job)) submitted++;
+      PSXWorker::Completion completion;
+      if (completions.isEmpty()) std::this_thread::yield();
+      while (completions.tryPop(completion)) {
+        if (completion.job.tag != completed || completion.job.address != (completed & 0x3ff)
+            || completion.result != (PSX::FrameResult)(completed % 5)) {
+          mismatches++;
+        }
+        completed++;
+      }
+    }
+    isRunning.store(false);
+    worker.join();
+    TEST_ASSERT_EQUAL_UINT32(0, mismatches);
+  }
+
+  void testSeqlockStress() {
+    static Seqlock<Snapshot> lock;
+    Snapshot initial = {};
+    lock.write(initial);
+    std::atomic<bool> isWriting{ true };
+    std::thread writer([&] {
+      Snapshot snapshot;
+      for (uint32_t counter = 1; counter <= __snapshotCounts; counter++) {
+        for (uint32_t &value : snapshot.values) value = counter;
+        lock.write(snapshot);
+        // Readers get in between (and in the middle of) writes on a single CPU too
+        if (counter % 64 == 0) std::this_thread::yield();
+      }
+      isWriting.store(false);
+    });
+
+    // Two readers, like the JVS handlers reading the controller snapshot
+    std::atomic<uint32_t> torn{ 0 };
+    std::atomic<uint32_t> backwards{ 0 };
+    auto read = [&] {
+      uint32_t last = 0;
+      Snapshot snapshot;
+      while (isWriting.load(std::memory_order_relaxed)) {
+        lock.read(snapshot);
+        for (uint32_t value : snapshot.values) {
+          if (value != snapshot.values[0]) {
+            torn.fetch_add(1);
+            break;
+          }
+        }
+        if (snapshot.values[0] < last) backwards.fetch_add(1);
+        last = snapshot.values[0];
+        std::this_thread::yield();
+      }
+    };
+    std::thread reader(read);
+    read();
+    reader.join();
+    writer.join();
+
+    Snapshot last;
+    lock.read(last);
+    TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+    TEST_ASSERT_EQUAL_UINT32(0, backwards.load());
+    TEST_ASSERT_EQUAL_UINT32(__snapshotCounts, last.values[31]);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testRingCapacity);
+  RUN_TEST(testRingStress);
+  RUN_TEST(testJobRingRoundTrip);
+  RUN_TEST(testSeqlockStress);
+  return UNITY_END();
+}
@@ -0,0 +1,192 @@
+/*
+  PSX bus timing: calibration of a card that only keeps up with slower clocks and of a card that never sends ACK,
+  the fallback steps of a calibrated profile (ACK limit, then clock, then ACK optional), and frames sent before
+  calibration going on without ACK after a timeout (on SPI and on a transport) while an empty port still stops early.
+
+    pio test -e native -f test_timing -v
+*/
+#include <thread>
+#include <unity.h>
+#include <Arduino.h>
+#include <PSX.h>
+#include <PSXFrame.h>
+#include <PSXSim.h>
+#include <PSXTiming.h>
+
+namespace {
+  const uint32_t __timeoutUs = 5000000;
+
+  PSXSim::MemoryCard __card;
+  PSXSim::DigitalPad __pad;
+  PSXSim::Transport __transport;
+  // Fastest clock the card keeps up with (Hz)
+  uint32_t __maxClock = PSX_TIMING_MAX_CLOCK;
+
+  /**
+   * @brief Exchange on SPI with a card that loses the frame above `__maxClock`.
+   */
+  void __exchange(PSX::Frame &frame) {
+    PSX::exchange(frame);
+    uint32_t clock = frame.timing.clock != 0 ? frame.timing.clock : PSX_SPI_CLOCK;
+    // Out of sync halfway through the data, nothing after it is answered
+    if (clock > __maxClock && frame.transferred > 64) frame.transferred = 64;
+  }
+
+  void __onComplete(PSX::Frame &, void *) {}
+
+  /**
+   * @brief Exchange on the simulated transport (blocking).
+   */
+  void __exchangeOnTransport(PSX::Frame &frame) {
+    TEST_ASSERT_TRUE(__transport.tryStart(frame, __onComplete, nullptr));
+    uint32_t start = micros();
+    while (__transport.isBusy() && micros() - start < __timeoutUs) {
+      __transport.poll();
+      std::this_thread::yield();
+    }
+    TEST_ASSERT_FALSE(__transport.isBusy());
+  }
+
+  void testCalibrateSlowCard() {
+    PSX::Calibrator calibrator;
+    PSX::Frame frame;
+    __maxClock = PSX_TIMING_MAX_CLOCK >> 2;
+    TEST_ASSERT_TRUE(calibrator.calibrate(0, frame, __exchange));
+    __maxClock = PSX_TIMING_MAX_CLOCK;
+
+    const PSX::TimingProfile &profile = calibrator.getProfile(0);
+    TEST_ASSERT_TRUE(profile.isCalibrated);
+    TEST_ASSERT_EQUAL_UINT8(2, profile.step);
+    TEST_ASSERT_EQUAL_UINT32(PSX_TIMING_MAX_CLOCK >> 2, profile.timing.clock);
+    TEST_ASSERT_FALSE(profile.timing.isAckOptional);
+    TEST_ASSERT_FALSE(profile.timing.hasAckFallback);
+    // ACK timeouts narrowed to the measured latency
+    const PSX::TimingStatistics &statistics = calibrator.getStatistics(0);
+    TEST_ASSERT_EQUAL_UINT16(1, statistics.calibrations);
+    TEST_ASSERT_TRUE(statistics.ackLatency >= __card.timing.ackDelay);
+    TEST_ASSERT_EQUAL_UINT16(statistics.ackLatency + statistics.ackLatency / 2 + PSX_TIMING_ACK_MARGIN,
+                             profile.timing.ackLimit);
+  }
+
+  void testFallbackSteps() {
+    PSX::Calibrator calibrator;
+    PSX::Frame frame;
+    TEST_ASSERT_TRUE(calibrator.calibrate(0, frame, __exchange));
+    const PSX::TimingProfile &profile = calibrator.getProfile(0);
+    const PSX::TimingStatistics &statistics = calibrator.getStatistics(0);
+    TEST_ASSERT_EQUAL_UINT8(0, profile.step);
+    TEST_ASSERT_NOT_EQUAL(PSX::DefaultTiming.ackLimit, profile.timing.ackLimit);
+
+    // Results the bus is not to blame for change nothing
+    calibrator.update(0, PSX::FrameResult::Success);
+    calibrator.update(0, PSX::FrameResult::BadSector);
+    TEST_ASSERT_EQUAL_UINT16(0, statistics.fallbacks);
+
+    // ACK timeouts first
+    calibrator.update(0, PSX::FrameResult::Timeout);
+    TEST_ASSERT_EQUAL_UINT16(PSX::DefaultTiming.ackLimit, profile.timing.ackLimit);
+    TEST_ASSERT_EQUAL_UINT8(0, profile.step);
+    // Then each slower clock
+    for (int step = 1; step < PSX_TIMING_STEPS; step++) {
+      calibrator.update(0, step & 1 ? PSX::FrameResult::BadChecksum : PSX::FrameResult::Timeout);
+      TEST_ASSERT_EQUAL_UINT8(step, profile.step);
+      TEST_ASSERT_EQUAL_UINT32(PSX_TIMING_MAX_CLOCK >> step, profile.timing.clock);
+      TEST_ASSERT_FALSE(profile.timing.isAckOptional);
+    }
+    // Then missing ACK is ignored at the slowest clock, and it stays there
+    calibrator.update(0, PSX::FrameResult::Timeout);
+    TEST_ASSERT_TRUE(profile.timing.isAckOptional);
+    calibrator.update(0, PSX::FrameResult::Timeout);
+    TEST_ASSERT_TRUE(profile.timing.isAckOptional);
+    TEST_ASSERT_EQUAL_UINT8(PSX_TIMING_STEPS - 1, profile.step);
+    TEST_ASSERT_EQUAL_UINT16(PSX_TIMING_STEPS + 2, statistics.fallbacks);
+    TEST_ASSERT_EQUAL_UINT32(PSX_TIMING_STEPS + 2, statistics.timeouts + statistics.badChecksums);
+
+    // Card removed: the next one starts over with the default timing
+    calibrator.update(0, PSX::FrameResult::NoDevice);
+    TEST_ASSERT_FALSE(profile.isCalibrated);
+    TEST_ASSERT_EQUAL_UINT32(0, profile.timing.clock);
+    TEST_ASSERT_FALSE(profile.timing.isAckOptional);
+    TEST_ASSERT_TRUE(profile.timing.hasAckFallback);
+  }
+
+  void testCalibrateCardWithoutAck() {
+    // No ACK in time for any byte, even while the sector is read
+    __card.timing.ackDelay = 1000;
+    __card.timing.readDelay = 3000;
+    PSX::Calibrator calibrator;
+    PSX::Frame frame;
+    bool isCalibrated = calibrator.calibrate(0, frame, __exchange);
+    __card.timing = PSXSim::MemoryCard::Timing();
+
+    // Every clock failed with ACK, the last try ignores it at the slowest clock
+    TEST_ASSERT_TRUE(isCalibrated);
+    const PSX::TimingProfile &profile = calibrator.getProfile(0);
+    TEST_ASSERT_TRUE(profile.timing.isAckOptional);
+    TEST_ASSERT_EQUAL_UINT8(PSX_TIMING_STEPS - 1, profile.step);
+    TEST_ASSERT_EQUAL_UINT16(PSX::DefaultTiming.ackLimit, profile.timing.ackLimit);
+
+    // Nothing in the slot at all
+    PSXSim::detach(0, &__card);
+    TEST_ASSERT_FALSE(calibrator.calibrate(0, frame, __exchange));
+    PSXSim::attach(0, &__card);
+    TEST_ASSERT_FALSE(calibrator.getProfile(0).isCalibrated);
+  }
+
+  /**
+   * @brief Read the pad without ACK: the default timing falls back, a strict one stops after the first byte.
+   */
+  void __checkAckFallback(void (*exchange)(PSX::Frame &frame)) {
+    __pad.ackDelay = 1000;
+    __pad.buttons = 0xbfff;
+    PSX::Frame frame;
+    uint8_t input[2];
+    PSX::buildControllerFrame(frame, 1);
+    TEST_ASSERT_TRUE(frame.timing.hasAckFallback);
+    exchange(frame);
+    TEST_ASSERT_EQUAL_UINT16(frame.length, frame.transferred);
+    TEST_ASSERT_EQUAL(PSX::FrameResult::Success, PSX::parseControllerFrame(frame, input));
+    TEST_ASSERT_EQUAL_HEX8(0xff, input[0]);
+    TEST_ASSERT_EQUAL_HEX8(0xbf, input[1]);
+
+    PSX::buildControllerFrame(frame, 1);
+    frame.timing.hasAckFallback = false;
+    exchange(frame);
+    TEST_ASSERT_EQUAL_UINT16(1, frame.transferred);
+    TEST_ASSERT_NOT_EQUAL(PSX::FrameResult::Success, PSX::parseControllerFrame(frame, input));
+    __pad.ackDelay = 10;
+
+    // Empty port: nothing answers the second byte, the frame stops there
+    PSX::buildControllerFrame(frame, 0);
+    exchange(frame);
+    TEST_ASSERT_EQUAL_UINT16(2, frame.transferred);
+    TEST_ASSERT_EQUAL(PSX::FrameResult::NoDevice, PSX::parseControllerFrame(frame, input));
+  }
+
+  void testAckFallbackOnSpi() {
+    __checkAckFallback(PSX::exchange);
+  }
+
+  void testAckFallbackOnTransport() {
+    __checkAckFallback(__exchangeOnTransport);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  PSXSim::begin();
+  PSX::setup();
+  __transport.begin();
+  PSXSim::attach(0, &__card);
+  PSXSim::attach(1, &__pad);
+
+  UNITY_BEGIN();
+  RUN_TEST(testCalibrateSlowCard);
+  RUN_TEST(testFallbackSteps);
+  RUN_TEST(testCalibrateCardWithoutAck);
+  RUN_TEST(testAckFallbackOnSpi);
+  RUN_TEST(testAckFallbackOnTransport);
+  return UNITY_END();
+}
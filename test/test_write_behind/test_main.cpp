@@ -0,0 +1,190 @@
+/*
+  Write-behind against a simulated card: repeated writes merged into one card write (also while it is on the bus),
+  writes of unchanged data skipped, dirty frames written in address order from the cursor, and `flush` as the barrier
+  that writes while the link is busy until nothing is left.
+
+    pio test -e native -f test_write_behind -v
+*/
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unity.h>
+#include <Arduino.h>
+#include <FrameCache.h>
+#include <PSXSim.h>
+#include <PSXWorker.h>
+#include <WriteBehind.h>
+
+namespace {
+  const uint32_t __timeoutUs = 5000000;
+
+  PSXSim::MemoryCard __card;
+  std::atomic<bool> __isRunning{ true };
+  std::atomic<bool> __isReady{ false };
+  std::thread __core1;
+  // Addresses of the finished flush jobs in completion order
+  std::vector<uint16_t> __written;
+
+  void __fill(uint8_t *data, uint8_t seed) {
+    for (int i = 0; i < PSX_MEMCARD_FRAME_SIZE; i++) data[i] = seed + i * 7;
+  }
+
+  /**
+   * @brief One pass of core 0, flush jobs are queued while `isIdle` (JVS link idle) or urgent.
+   */
+  void __step(bool isIdle) {
+    PSXWorker::Completion completion;
+    while (PSXWorker::tryGetCompletion(completion)) {
+      if (completion.job.owner != K573::JobOwner::Flush) continue;
+      __written.push_back(completion.job.address);
+      WriteBehind::onComplete(completion);
+    }
+    WriteBehind::service(isIdle);
+    std::this_thread::yield();
+  }
+
+  /**
+   * @brief Step until nothing is pending on Port 1.
+   * @return `false` if frames are still pending after the timeout
+   */
+  bool __drain(bool isIdle) {
+    uint32_t start = micros();
+    while (WriteBehind::isPending(0)) {
+      if (micros() - start > __timeoutUs) return false;
+      __step(isIdle);
+    }
+    return true;
+  }
+
+  void testCoalescing() {
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    const uint16_t address = 0x010;
+    for (uint8_t seed = 1; seed <= 3; seed++) {
+      __fill(data, seed);
+      TEST_ASSERT_TRUE(WriteBehind::tryWrite(0, address, data));
+    }
+    TEST_ASSERT_TRUE(WriteBehind::isPending(0));
+    uint32_t writes = __card.writes;
+    TEST_ASSERT_TRUE(__drain(true));
+
+    // Last data only, written once
+    const WriteBehind::Statistics &statistics = WriteBehind::getStatistics();
+    TEST_ASSERT_EQUAL_UINT32(3, statistics.requested);
+    TEST_ASSERT_EQUAL_UINT32(2, statistics.coalesced);
+    TEST_ASSERT_EQUAL_UINT32(1, statistics.physicalWrites);
+    TEST_ASSERT_EQUAL_UINT32(writes + 1, __card.writes);
+    TEST_ASSERT_EQUAL_MEMORY(data, __card.frame(address), sizeof(data));
+
+    // Written again while its copy is on the bus: not merged, the new data goes to the card after it
+    __fill(data, 4);
+    TEST_ASSERT_TRUE(WriteBehind::tryWrite(0, address, data));
+    __step(true);
+    __fill(data, 5);
+    TEST_ASSERT_TRUE(WriteBehind::tryWrite(0, address, data));
+    TEST_ASSERT_EQUAL_UINT32(2, statistics.coalesced);
+    TEST_ASSERT_TRUE(__drain(true));
+    TEST_ASSERT_EQUAL_UINT32(3, statistics.physicalWrites);
+    TEST_ASSERT_EQUAL_MEMORY(data, __card.frame(address), sizeof(data));
+    TEST_ASSERT_EQUAL_UINT32(0, statistics.failed);
+  }
+
+  void testSkipIdentical() {
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    const uint16_t address = 0x020;
+    __fill(data, 6);
+    TEST_ASSERT_TRUE(WriteBehind::tryWrite(0, address, data));
+    TEST_ASSERT_TRUE(__drain(true));
+
+    // Same data as the card: nothing to write
+    uint32_t writes = __card.writes;
+    TEST_ASSERT_TRUE(WriteBehind::tryWrite(0, address, data));
+    TEST_ASSERT_FALSE(WriteBehind::isPending(0));
+    for (int i = 0; i < 10; i++) __step(true);
+    const WriteBehind::Statistics &statistics = WriteBehind::getStatistics();
+    TEST_ASSERT_EQUAL_UINT32(2, statistics.requested);
+    TEST_ASSERT_EQUAL_UINT32(1, statistics.skipped);
+    TEST_ASSERT_EQUAL_UINT32(0, statistics.coalesced);
+    TEST_ASSERT_EQUAL_UINT32(1, statistics.physicalWrites);
+    TEST_ASSERT_EQUAL_UINT32(writes, __card.writes);
+  }
+
+  void testAddressOrder() {
+    // Cursor is behind 0x020 now: frames after it first, then the ones before it
+    const uint16_t addresses[] = { 0x035, 0x008, 0x031, 0x012, 0x033 };
+    const uint16_t expected[] = { 0x031, 0x033, 0x035, 0x008, 0x012 };
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    for (uint16_t address : addresses) {
+      __fill(data, address);
+      TEST_ASSERT_TRUE(WriteBehind::tryWrite(0, address, data));
+    }
+    __written.clear();
+    TEST_ASSERT_TRUE(__drain(true));
+    TEST_ASSERT_EQUAL_UINT32(5, __written.size());
+    for (int i = 0; i < 5; i++) TEST_ASSERT_EQUAL_UINT16(expected[i], __written[i]);
+    for (uint16_t address : addresses) {
+      __fill(data, address);
+      TEST_ASSERT_EQUAL_MEMORY(data, __card.frame(address), sizeof(data));
+    }
+  }
+
+  void testFlushBarrier() {
+    uint8_t data[PSX_MEMCARD_FRAME_SIZE];
+    for (uint16_t address = 0x040; address < 0x044; address++) {
+      __fill(data, address);
+      TEST_ASSERT_TRUE(WriteBehind::tryWrite(0, address, data));
+    }
+    // Link busy and below the high water: frames wait in the cache
+    for (int i = 0; i < 10; i++) __step(false);
+    TEST_ASSERT_EQUAL_UINT16(4, FrameCache::countDirty(0));
+    TEST_ASSERT_EQUAL_UINT32(0, WriteBehind::getStatistics().physicalWrites);
+
+    // Barrier: written even though the link stays busy
+    WriteBehind::flush();
+    TEST_ASSERT_TRUE(__drain(false));
+    TEST_ASSERT_EQUAL_UINT32(4, WriteBehind::getStatistics().physicalWrites);
+    for (uint16_t address = 0x040; address < 0x044; address++) {
+      __fill(data, address);
+      TEST_ASSERT_EQUAL_MEMORY(data, __card.frame(address), sizeof(data));
+    }
+
+    // The barrier ends once everything is on the card, later writes wait again
+    __step(false);
+    __fill(data, 0x50);
+    TEST_ASSERT_TRUE(WriteBehind::tryWrite(0, 0x050, data));
+    for (int i = 0; i < 10; i++) __step(false);
+    TEST_ASSERT_TRUE(WriteBehind::isPending(0));
+    TEST_ASSERT_EQUAL_UINT32(4, WriteBehind::getStatistics().physicalWrites);
+    TEST_ASSERT_TRUE(__drain(true));
+  }
+}
+
+void setUp() {
+  WriteBehind::resetStatistics();
+}
+
+void tearDown() {}
+
+int main() {
+  PSXSim::begin();
+  PSXSim::attach(0, &__card);
+  __core1 = std::thread([] {
+    PSXWorker::setup();
+    __isReady.store(true);
+    while (__isRunning.load(std::memory_order_relaxed)) {
+      PSXWorker::service();
+      std::this_thread::yield();
+    }
+  });
+  while (!__isReady.load()) std::this_thread::yield();
+
+  UNITY_BEGIN();
+  RUN_TEST(testCoalescing);
+  RUN_TEST(testSkipIdentical);
+  RUN_TEST(testAddressOrder);
+  RUN_TEST(testFlushBarrier);
+  int failures = UNITY_END();
+  __isRunning.store(false);
+  __core1.join();
+  return failures;
+}
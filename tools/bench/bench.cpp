@@ -0,0 +1,520 @@
+/*
+  End-to-end bench on the host: a simulated System 573 JVS master against the firmware, with a simulated
+  PS1 memory card and digital pad on the PSX bus.
+
+    pio run -e bench
+    .pio/build/bench/program [--frames N] [--slot SLOT] [--method METHOD] [--polls N] [--status-interval US] [--stream]
+
+  The master boots the node (reset, `SetAddress`, `IOId`), polls `K573Controller` while the pad switches change,
+  saves frames with `K573BufferWrite` + `K573MemoryCardWrite`, loads other frames with `K573MemoryCardRead` +
+  `K573BufferRead`, and waits on `K573Status` like the game does. Every request and response goes through the
+  host UART at the line speed, and the card answers byte by byte with ACK delays, checksum and 'G'/'N' status.
+  With `--stream` the master pulls the loaded frames while the card is still reading the next ones.
+  `--method` switches the line speed after boot, the bench envs build with every method in `JVS_COMM_METHODS`.
+
+  Built with `PSX_MULTITAP_SLOTS` (`pio run -e bench_multitap`), the ports get simulated multitaps, `--slot` takes
+  sub-ports too (`2`-`7`), and every other slot holds a pad with its own switches, so each batched read is checked
+  for all of them. Sub-ports B-D are read with the `K573Multitap` sub-commands (a local extension, only built with
+  `PSX_MULTITAP_SLOTS`), `K573Status` and `K573Controller` must keep their 2 slot length in every build.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <thread>
+#include <vector>
+#include <Arduino.h>
+#include <JVS.h>
+#include <JVSPacketPool.h>
+#include <JVSUart.h>
+#include <K573.h>
+#include <PSXSim.h>
+#include <PSXWorker.h>
+#include <WriteBehind.h>
+
+void setup();
+void loop();
+void setup1();
+void loop1();
+
+namespace {
+  const uint8_t __nodeNo = 0x01;
+  // RAM addresses used by the master
+  const uint32_t __saveRam = 0x010000;
+  const uint32_t __loadRam = 0x020000;
+  // Bytes of `K573BufferWrite` / `K573BufferRead` per request
+  const uint8_t __chunkSize = 128;
+  // Every slot holds a pad (multitap builds check the batched read of all of them)
+  const bool __isFull = PSX_MULTITAP_SLOTS != 0;
+
+  struct Options {
+    int frames = 128;
+    int slot = 0;
+    // `CommMethodChange` after boot (`-1`: stay at 115200 bps)
+    int method = -1;
+    int polls = 200;
+    // Read the RAM while `K573MemoryCardRead` is running
+    bool isStreaming = false;
+    // Interval of `K573Status` while a transfer runs
+    uint32_t statusIntervalUs = 1000;
+    // Longest wait for a response
+    uint32_t timeoutUs = 100000;
+  };
+
+  struct Response {
+    bool isReceived = false;
+    // Time the first byte left the node
+    uint32_t time = 0;
+    uint8_t status = 0;
+    std::vector<uint8_t> data;
+  };
+
+  std::atomic<bool> __isRunning{ true };
+  uint32_t __baudRate = JVS_BAUD_RATE;
+  Response __response;
+  // Turnaround (end of request to start of response) per command
+  std::map<int, std::vector<uint32_t>> __latencies;
+  int __timeouts = 0;
+  int __failures = 0;
+
+  void __fail(const char *message) {
+    fprintf(stderr, "FAIL: %s\n", message);
+    __failures++;
+  }
+
+  void __step() {
+    loop();
+    JVS::Uart::hostPoll();
+    std::this_thread::yield();
+  }
+
+  void __wait(uint32_t us) {
+    uint32_t start = micros();
+    while (micros() - start < us) __step();
+  }
+
+  uint32_t __wireTime(size_t length) {
+    // 10 bits per byte (start + 8 data + stop)
+    return (uint32_t)((uint64_t)length * 10 * 1000000 / __baudRate);
+  }
+
+  void __escape(uint8_t b, std::vector<uint8_t> &wire) {
+    if (b == JVS::SpecialChar::Sync || b == JVS::SpecialChar::Escape) {
+      wire.push_back(JVS::SpecialChar::Escape);
+      b--;
+    }
+    wire.push_back(b);
+  }
+
+  std::vector<uint8_t> __encode(uint8_t nodeNo, const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> wire = { JVS::SpecialChar::Sync, nodeNo };
+    uint8_t sum = nodeNo + data.size() + 1;
+    __escape(data.size() + 1, wire);
+    for (uint8_t b : data) {
+      __escape(b, wire);
+      sum += b;
+    }
+    __escape(sum, wire);
+    return wire;
+  }
+
+  /**
+   * @brief Take the response of the node (addressed to the master, node `0x00`).
+   */
+  void __onSent(const uint8_t *data, size_t length, void *) {
+    std::vector<uint8_t> bytes;
+    bool isEscaped = false;
+    for (size_t i = 1; i < length; i++) {
+      if (data[i] == JVS::SpecialChar::Escape) {
+        isEscaped = true;
+        continue;
+      }
+      bytes.push_back(isEscaped ? data[i] + 1 : data[i]);
+      isEscaped = false;
+    }
+    // [Node No.] [Byte Count] [Status] ... [SUM]
+    if (length == 0 || data[0] != JVS::SpecialChar::Sync || bytes.size() < 4 || bytes[0] != 0x00
+        || bytes[1] != bytes.size() - 2) {
+      __fail("malformed response");
+      return;
+    }
+    uint8_t sum = 0;
+    for (size_t i = 0; i + 1 < bytes.size(); i++) sum += bytes[i];
+    if (sum != bytes.back()) __fail("response checksum");
+
+    __response.isReceived = true;
+    __response.time = micros();
+    __response.status = bytes[2];
+    __response.data.assign(bytes.begin() + 3, bytes.end() - 1);
+  }
+
+  /**
+   * @brief Send a request and wait for the response.
+   * @param nodeNo Destination
+   * @param data Request data (one command)
+   * @param isAnswered Node answers the request
+   * @return Report and data of the command (empty if not answered)
+   */
+  std::vector<uint8_t> __transact(uint8_t nodeNo, const std::vector<uint8_t> &data, const Options &options,
+                                  bool isAnswered = true) {
+    // Master sends after the previous response is on the wire
+    while (JVS::Uart::isWriting()) __step();
+    std::vector<uint8_t> wire = __encode(nodeNo, data);
+    __response = Response();
+    __wait(__wireTime(wire.size()));
+    uint32_t end = micros();
+    JVS::Uart::hostReceive(wire.data(), wire.size());
+
+    if (!isAnswered) {
+      while (JVS::hasReceived()) __step();
+      return {};
+    }
+    while (!__response.isReceived && micros() - end < options.timeoutUs) __step();
+    if (!__response.isReceived) {
+      __timeouts++;
+      return {};
+    }
+    __latencies[data[0]].push_back(__response.time - end);
+    if (__response.status != 0x01) __fail("status of the response");
+    return __response.data;
+  }
+
+  void __pushUInt16(std::vector<uint8_t> &data, uint16_t value) {
+    data.push_back(value >> 8);
+    data.push_back(value & 0xff);
+  }
+
+  void __pushAddress(std::vector<uint8_t> &data, uint32_t address) {
+    data.push_back(address >> 16);
+    data.push_back((address >> 8) & 0xff);
+    data.push_back(address & 0xff);
+  }
+
+  uint32_t __percentile(std::vector<uint32_t> &values, double ratio) {
+    size_t index = (size_t)(ratio * (values.size() - 1) + 0.5);
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+  }
+
+  /**
+   * @brief Read the 2 bytes of every slot: `K573Status` / `K573Controller` for the ports, then the `K573Multitap`
+   * sub-command of the same code for sub-ports B-D.
+   * @param command `K573Status` or `K573Controller`
+   * @param hasSubPorts Read sub-ports B-D too
+   * @param data 2 bytes per slot in slot order, as on the wire
+   * @return `false` if a response is missing or not of the fixed length
+   */
+  bool __readSlots(uint8_t command, bool hasSubPorts, std::vector<uint8_t> &data, const Options &options) {
+    std::vector<uint8_t> ack = __transact(__nodeNo, { command }, options);
+    // Report, then 2 bytes per slot, whatever `PSX_MULTITAP_SLOTS` is
+    if (ack.size() != 1 + 2 * PSX_PORT_COUNTS || ack[0] != JVS::AckReport::OK) return false;
+    data.assign(ack.begin() + 1, ack.end());
+    if (!hasSubPorts) return true;
+    ack = __transact(__nodeNo, { JVS::Command::K573Multitap, command }, options);
+    if (ack.size() != 1 + 2 * PSX_PORT_COUNTS * (PSX_MULTITAP_PORTS - 1) || ack[0] != JVS::AckReport::OK) return false;
+    data.insert(data.end(), ack.begin() + 1, ack.end());
+    return true;
+  }
+
+  uint16_t __readStatus(const Options &options) {
+    std::vector<uint8_t> data;
+    if (!__readSlots(JVS::Command::K573Status, options.slot >= PSX_PORT_COUNTS, data, options)) {
+      return MemoryCardStatus::Error;
+    }
+    return K573::readUInt16(&data[2 * options.slot]);
+  }
+
+  /**
+   * @brief Poll `K573Status` until the transfer of the slot is finished.
+   * @return `false` if the card reported an error or never finished
+   */
+  bool __waitTransfer(const Options &options) {
+    uint32_t start = micros();
+    while (micros() - start < 10000000) {
+      uint16_t status = __readStatus(options);
+      if (status & MemoryCardStatus::Error) return false;
+      if (!(status & (MemoryCardStatus::Reading | MemoryCardStatus::Writing))) return true;
+      __wait(options.statusIntervalUs);
+    }
+    return false;
+  }
+
+  uint16_t __port(const Options &options, uint16_t address) {
+    uint16_t subPort = PSX::subPortOf(options.slot) << K573_MEMCARD_SUBPORT_SHIFT;
+    return (PSX::portOf(options.slot) ? K573_MEMCARD_PORT_BIT : 0) | subPort | address;
+  }
+
+  /**
+   * @brief Switches held by the pad of a slot not under test.
+   */
+  uint16_t __idleButtons(int slot) {
+    return ~(0x0101 << slot);
+  }
+
+#if PSX_MULTITAP_SLOTS
+  PSXSim::Multitap __taps[PSX_SIM_SLOT_COUNTS];
+#endif
+
+  /**
+   * @brief Plug a device into the slot, into the sub-port of the multitap if the port has one.
+   */
+  void __plug(int slot, PSXSim::Device *device) {
+#if PSX_MULTITAP_SLOTS
+    if ((PSX_MULTITAP_SLOTS >> PSX::portOf(slot)) & 1) {
+      __taps[PSX::portOf(slot)].attach(PSX::subPortOf(slot), device);
+      return;
+    }
+#endif
+    PSXSim::attach(slot, device);
+  }
+
+  uint8_t __pattern(int seed, int index) {
+    return (uint8_t)(seed * 31 + index * 7 + (index >> 7));
+  }
+
+  void __boot(const Options &options) {
+    for (int i = 0; i < 2; i++) __transact(JVS_ADDRESS_BROADCAST, { JVS::Command::Reset, 0xd9 }, options, false);
+    __transact(JVS_ADDRESS_BROADCAST, { JVS::Command::SetAddress, __nodeNo }, options);
+    std::vector<uint8_t> id = __transact(__nodeNo, { JVS::Command::IOId }, options);
+    if (id.size() < 2) __fail("IOId");
+    else printf("IOId: %.*s\n", (int)id.size() - 1, (const char *)&id[1]);
+
+    if (options.method < 0) return;
+    std::vector<uint8_t> supported = __transact(__nodeNo, { JVS::Command::CommSupported }, options);
+    if (supported.size() < 2 || !(supported[1] & (1 << options.method))) {
+      __fail("communication method is not supported");
+      return;
+    }
+    __transact(JVS_ADDRESS_BROADCAST, { JVS::Command::CommMethodChange, (uint8_t)options.method }, options, false);
+    static const uint32_t baudRates[] = { JVS_BAUD_RATE, 1000000, 3000000 };
+    __baudRate = baudRates[options.method];
+  }
+
+  void __pollController(PSXSim::DigitalPad *pads, const Options &options) {
+    PSXSim::DigitalPad &pad = pads[options.slot];
+    std::vector<uint32_t> lags;
+    int mismatches = 0;
+    for (int i = 0; i < options.polls; i++) {
+      uint16_t buttons = ~(1 << (i % 16));
+      PSXWorker::ControllerState state;
+      PSXWorker::readController(state);
+      uint32_t samples = state.samples;
+      uint32_t changed = micros();
+      pad.buttons = buttons;
+      // Poll running at the change may have read the old switches, wait for the next one
+      while (state.samples - samples < 2 && micros() - changed < options.timeoutUs) {
+        __step();
+        PSXWorker::readController(state);
+      }
+      lags.push_back(micros() - changed);
+
+      // Sub-ports of a port without multitap stay `0x0000`
+      std::vector<uint8_t> inputs;
+      if (!__readSlots(JVS::Command::K573Controller, PSX_MULTITAP_SLOTS != 0, inputs, options)) {
+        mismatches++;
+        continue;
+      }
+      for (int slot = 0; slot < (int)inputs.size() / 2; slot++) {
+        // Empty slot reads `0x0000`
+        uint16_t expected = slot == options.slot ? buttons : 0;
+        if (slot != options.slot && __isFull && PSX::hasSlot(slot)) expected = pads[slot].buttons.load();
+        if (inputs[2 * slot] != (expected & 0xff) || inputs[2 * slot + 1] != expected >> 8) mismatches++;
+      }
+    }
+    printf("controller: %d polls, %d mismatches, input lag p50 %u us max %u us\n", options.polls, mismatches,
+           __percentile(lags, 0.5), __percentile(lags, 1.0));
+#if PSX_MULTITAP_SLOTS
+    PSXWorker::ControllerState state;
+    PSXWorker::readController(state);
+    for (int port = 0; port < PSX_SIM_SLOT_COUNTS; port++) {
+      if (!((PSX_MULTITAP_SLOTS >> port) & 1)) continue;
+      printf("multitap %d: %u batched reads for %u polls of %d slots\n", port + 1, __taps[port].batches, state.samples,
+             PSX_MULTITAP_PORTS);
+    }
+#endif
+    if (mismatches > 0) __fail("controller inputs");
+  }
+
+  bool __waitCard(const Options &options) {
+    uint32_t start = micros();
+    while (micros() - start < 2000000) {
+      if (__readStatus(options) & MemoryCardStatus::Available) return true;
+      __wait(options.statusIntervalUs);
+    }
+    return false;
+  }
+
+  void __save(PSXSim::MemoryCard &card, const Options &options) {
+    size_t length = (size_t)options.frames * PSX_SIM_MEMCARD_FRAME_SIZE;
+    for (size_t offset = 0; offset < length; offset += __chunkSize) {
+      std::vector<uint8_t> data = { JVS::Command::K573Buffer, JVS::Command::K573BufferWrite };
+      __pushAddress(data, __saveRam + offset);
+      data.push_back(__chunkSize);
+      for (int i = 0; i < __chunkSize; i++) data.push_back(__pattern(1, offset + i));
+      __transact(__nodeNo, data, options);
+    }
+
+    std::vector<uint8_t> data = { JVS::Command::K573MemoryCard, JVS::Command::K573MemoryCardWrite };
+    __pushAddress(data, __saveRam);
+    __pushUInt16(data, __port(options, 0));
+    __pushUInt16(data, options.frames);
+    uint32_t start = micros();
+    std::vector<uint8_t> ack = __transact(__nodeNo, data, options);
+    if (ack.empty() || ack[0] != JVS::AckReport::OK) __fail("K573MemoryCardWrite");
+    else if (!__waitTransfer(options)) __fail("save did not finish");
+    uint32_t elapsed = micros() - start;
+
+    int errors = 0;
+    for (int frame = 0; frame < options.frames; frame++) {
+      const uint8_t *saved = card.frame(frame);
+      for (int i = 0; i < PSX_SIM_MEMCARD_FRAME_SIZE; i++) {
+        if (saved[i] != __pattern(1, frame * PSX_SIM_MEMCARD_FRAME_SIZE + i)) {
+          errors++;
+          break;
+        }
+      }
+    }
+    printf("save: %d frames in %.1f ms (%.1f frames/s), %d frames differ on the card\n", options.frames,
+           elapsed / 1000.0, options.frames * 1e6 / elapsed, errors);
+    if (errors > 0) __fail("saved frames");
+  }
+
+  void __load(PSXSim::MemoryCard &card, const Options &options) {
+    // Frames behind the saved ones, never seen by the firmware (nothing cached)
+    uint16_t first = options.frames;
+    for (int frame = 0; frame < options.frames; frame++) {
+      uint8_t *data = card.frame(first + frame);
+      for (int i = 0; i < PSX_SIM_MEMCARD_FRAME_SIZE; i++) data[i] = __pattern(2, frame * PSX_SIM_MEMCARD_FRAME_SIZE + i);
+    }
+
+    std::vector<uint8_t> data = { JVS::Command::K573MemoryCard, JVS::Command::K573MemoryCardRead };
+    __pushUInt16(data, __port(options, first));
+    __pushAddress(data, __loadRam);
+    __pushUInt16(data, options.frames);
+    uint32_t start = micros();
+    std::vector<uint8_t> ack = __transact(__nodeNo, data, options);
+    bool isStarted = !ack.empty() && ack[0] == JVS::AckReport::OK;
+    if (!isStarted) __fail("K573MemoryCardRead");
+    // Streaming: pull the frames while the card reads the next ones, otherwise wait for the whole transfer first
+    else if (!options.isStreaming && !__waitTransfer(options)) __fail("load did not finish");
+    uint32_t cardElapsed = micros() - start;
+
+    size_t length = (size_t)options.frames * PSX_SIM_MEMCARD_FRAME_SIZE;
+    int errors = 0;
+    int busy = 0;
+    for (size_t offset = 0; offset < length; offset += __chunkSize) {
+      std::vector<uint8_t> request = { JVS::Command::K573Buffer, JVS::Command::K573BufferRead };
+      __pushAddress(request, __loadRam + offset);
+      request.push_back(__chunkSize);
+      std::vector<uint8_t> chunk = __transact(__nodeNo, request, options);
+      // Frame is still on its way from the card
+      while (isStarted && chunk.size() == 1 && chunk[0] == JVS::AckReport::Busy && busy++ < 100000) {
+        chunk = __transact(__nodeNo, request, options);
+      }
+      bool isSame = chunk.size() == 1u + __chunkSize && chunk[0] == JVS::AckReport::OK;
+      for (int i = 0; isSame && i < __chunkSize; i++) isSame = chunk[1 + i] == __pattern(2, offset + i);
+      if (!isSame) errors++;
+    }
+    if (isStarted && options.isStreaming) {
+      if (!__waitTransfer(options)) __fail("load did not finish");
+      cardElapsed = micros() - start;
+    }
+    uint32_t elapsed = micros() - start;
+    printf("load: %d frames in %.1f ms (%s, card %.1f ms, %.1f frames/s), %d busy replies, %d chunks differ\n",
+           options.frames, elapsed / 1000.0, options.isStreaming ? "streamed" : "after the transfer", cardElapsed / 1000.0,
+           options.frames * 1e6 / elapsed, busy, errors);
+    if (errors > 0) __fail("loaded frames");
+  }
+
+  void __report(const PSXSim::MemoryCard &card, uint32_t elapsedUs) {
+    printf("%-8s %8s %8s %8s %8s %8s  (turnaround in us)\n", "command", "count", "p50", "p90", "p99", "max");
+    for (auto &entry : __latencies) {
+      std::vector<uint32_t> &values = entry.second;
+      printf("0x%02x     %8zu %8u %8u %8u %8u\n", entry.first & 0xff, values.size(), __percentile(values, 0.5),
+             __percentile(values, 0.9), __percentile(values, 0.99), __percentile(values, 1.0));
+    }
+    printf("card: frames %u (read %u, write %u, rejected %u), busy %llu ms of %u ms\n", card.frames, card.reads,
+           card.writes, card.badChecksums, (unsigned long long)(card.busyUs / 1000), elapsedUs / 1000);
+    const JVS::PacketPool::Statistics &pool = JVS::PacketPool::getStatistics();
+    printf("packets: %u acquired, peak %u of %d in use, %u exhausted\n", pool.acquired, pool.peakInUse,
+           JVS_PACKET_POOL_SIZE, pool.exhausted);
+    const WriteBehind::Statistics &writes = WriteBehind::getStatistics();
+    printf("write-behind: %u requested, %u coalesced, %u skipped, %u written, %u failed\n", writes.requested,
+           writes.coalesced, writes.skipped, writes.physicalWrites, writes.failed);
+    printf("timeouts %d, failures %d\n", __timeouts, __failures);
+  }
+
+  bool __parseOptions(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; i++) {
+      const char *arg = argv[i];
+      if (strcmp(arg, "--stream") == 0) {
+        options.isStreaming = true;
+        continue;
+      }
+      if (i + 1 >= argc) return false;
+      const char *value = argv[++i];
+      if (strcmp(arg, "--frames") == 0) options.frames = atoi(value);
+      else if (strcmp(arg, "--slot") == 0) options.slot = atoi(value);
+      else if (strcmp(arg, "--method") == 0) options.method = atoi(value);
+      else if (strcmp(arg, "--polls") == 0) options.polls = atoi(value);
+      else if (strcmp(arg, "--status-interval") == 0) options.statusIntervalUs = strtoul(value, nullptr, 0);
+      else return false;
+    }
+    // Saved and loaded frames must fit on the card
+    return options.frames > 0 && options.frames * 2 <= PSX_SIM_MEMCARD_FRAMES && options.method < 3 && PSX::hasSlot(options.slot);
+  }
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!__parseOptions(argc, argv, options)) {
+    fprintf(stderr, "usage: %s [--frames N] [--slot SLOT] [--method METHOD] [--polls N] [--status-interval US] [--stream]\n",
+            argv[0]);
+    return 2;
+  }
+
+  static PSXSim::MemoryCard card;
+  static PSXSim::DigitalPad pads[K573_SLOT_COUNTS];
+  PSXSim::begin();
+#if PSX_MULTITAP_SLOTS
+  for (int port = 0; port < PSX_SIM_SLOT_COUNTS; port++) {
+    if ((PSX_MULTITAP_SLOTS >> port) & 1) PSXSim::attach(port, &__taps[port]);
+  }
+#endif
+  for (int slot = 0; slot < K573_SLOT_COUNTS; slot++) {
+    if (slot != options.slot && (!__isFull || !PSX::hasSlot(slot))) continue;
+    pads[slot].buttons = __idleButtons(slot);
+    __plug(slot, &pads[slot]);
+  }
+  __plug(options.slot, &card);
+
+  // Core 1
+  std::thread core1([] {
+    setup1();
+    while (__isRunning.load(std::memory_order_relaxed)) {
+      loop1();
+      std::this_thread::yield();
+    }
+  });
+  // Core 0
+  setup();
+  JVS::Uart::hostSetSink(__onSent, nullptr);
+
+  uint32_t start = micros();
+  __boot(options);
+  __pollController(pads, options);
+  if (!__waitCard(options)) {
+    __fail("memory card is not detected");
+  } else {
+    __save(card, options);
+    __load(card, options);
+  }
+  uint32_t elapsed = micros() - start;
+
+  __isRunning.store(false, std::memory_order_relaxed);
+  core1.join();
+  __report(card, elapsed);
+  return __failures > 0 || __timeouts > 0 ? 1 : 0;
+}
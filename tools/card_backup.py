@@ -0,0 +1,265 @@
+#!/usr/bin/env python3
+"""Back up and restore whole PS1 memory cards over USB CDC (card service of the firmware).
+
+  card_backup.py dump /dev/ttyACM0 card.mcr [--slot 1]     read all 16 blocks into a raw image
+  card_backup.py restore /dev/ttyACM0 card.mcr [--slot 1]  write a raw image, only the frames that differ
+
+An interrupted dump is kept in card.mcr.part and resumed by running the same command again.
+Restore is naturally resumable: blocks already on the card are only read back, never written.
+Works against the simulated card too (see tools/cardsim/cardsim.cpp).
+"""
+import argparse
+import os
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+import zlib
+
+RECORD_MAGIC = 0xA5
+DUMP_REQUEST, DUMP_BLOCK, DUMP_END, RESTORE_BLOCK, RESTORE_RESULT = 0x10, 0x11, 0x12, 0x13, 0x14
+OK, BUSY, BAD_REQUEST, BAD_CRC, CARD_ERROR = range(5)
+STATUS_NAMES = ["ok", "busy", "bad request", "bad crc", "card error"]
+
+BLOCKS = 16
+FRAMES_IN_BLOCK = 64
+FRAME_SIZE = 128
+BLOCK_SIZE = FRAMES_IN_BLOCK * FRAME_SIZE
+CARD_SIZE = BLOCKS * BLOCK_SIZE
+# Longest silence of the device before the transfer is taken as interrupted
+TIMEOUT = 5.0
+RETRIES = 3
+
+
+def rle_encode(data):
+    """Control N < 0x80: N + 1 literal bytes follow, N >= 0x80: one byte repeated N - 0x7d times."""
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        run = 1
+        while i + run < len(data) and run < 130 and data[i + run] == data[i]:
+            run += 1
+        if run >= 3:
+            out += bytes([0x80 + run - 3, data[i]])
+            i += run
+            continue
+        start = i
+        while i < len(data) and i - start < 128:
+            if i + 2 < len(data) and data[i] == data[i + 1] == data[i + 2]:
+                break
+            i += 1
+        out.append(i - start - 1)
+        out += data[start:i]
+    return bytes(out)
+
+
+def rle_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        control = data[i]
+        if control < 0x80:
+            out += data[i + 1:i + 2 + control]
+            i += 2 + control
+        else:
+            out += bytes([data[i + 1]]) * (control - 0x7D)
+            i += 2
+    return bytes(out)
+
+
+def open_port(path):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)
+    attributes = termios.tcgetattr(fd)
+    attributes[6][termios.VMIN] = 0
+    attributes[6][termios.VTIME] = 0
+    termios.tcsetattr(fd, termios.TCSANOW, attributes)
+    return fd
+
+
+class Link:
+    """Records on the USB CDC stream (trace records of a tracing build are skipped)."""
+
+    def __init__(self, fd):
+        self.fd = fd
+        self.buffer = bytearray()
+        self.received = 0
+
+    def send(self, kind, payload):
+        data = struct.pack("<BBH", RECORD_MAGIC, kind, len(payload)) + payload
+        while data:
+            _, ready, _ = select.select([], [self.fd], [], TIMEOUT)
+            if not ready:
+                raise TimeoutError("device does not accept data")
+            data = data[os.write(self.fd, data):]
+
+    def receive(self, kinds):
+        deadline = time.monotonic() + TIMEOUT
+        while True:
+            record = self._parse(kinds)
+            if record:
+                return record
+            remaining = deadline - time.monotonic()
+            ready, _, _ = select.select([self.fd], [], [], max(remaining, 0))
+            if not ready:
+                raise TimeoutError("no response from the device")
+            data = os.read(self.fd, 65536)
+            self.received += len(data)
+            self.buffer += data
+
+    def _parse(self, kinds):
+        while True:
+            start = self.buffer.find(bytes([RECORD_MAGIC]))
+            if start < 0:
+                self.buffer.clear()
+                return None
+            del self.buffer[:start]
+            if len(self.buffer) < 4:
+                return None
+            kind = self.buffer[1]
+            (length,) = struct.unpack_from("<H", self.buffer, 2)
+            if len(self.buffer) < 4 + length:
+                return None
+            payload = bytes(self.buffer[4:4 + length])
+            del self.buffer[:4 + length]
+            if kind in kinds:
+                return kind, payload
+
+
+class Partial:
+    """Image being dumped, with the blocks already verified (bit N: block N) stored after it."""
+
+    def __init__(self, path):
+        self.path = path + ".part"
+        self.image = bytearray(CARD_SIZE)
+        self.done = 0
+        if os.path.exists(self.path):
+            with open(self.path, "rb") as file:
+                data = file.read()
+            if len(data) == CARD_SIZE + 2:
+                self.image[:] = data[:CARD_SIZE]
+                (self.done,) = struct.unpack_from("<H", data, CARD_SIZE)
+
+    def store(self, block, data):
+        self.image[block * BLOCK_SIZE:(block + 1) * BLOCK_SIZE] = data
+        self.done |= 1 << block
+        with open(self.path, "wb") as file:
+            file.write(self.image + struct.pack("<H", self.done))
+
+    def missing(self):
+        return [block for block in range(BLOCKS) if not self.done & (1 << block)]
+
+
+def runs(blocks):
+    """Contiguous ranges (first, count) of the block list."""
+    result = []
+    for block in blocks:
+        if result and result[-1][0] + result[-1][1] == block:
+            result[-1][1] += 1
+        else:
+            result.append([block, 1])
+    return result
+
+
+def dump(link, args):
+    partial = Partial(args.image)
+    if partial.done:
+        print("resuming, %d blocks already dumped" % bin(partial.done).count("1"))
+    start = time.monotonic()
+    wire = link.received
+    dumped = 0
+    for attempt in range(RETRIES + 1):
+        missing = partial.missing()
+        if not missing:
+            break
+        for first, count in runs(missing):
+            link.send(DUMP_REQUEST, bytes([args.slot, first, count]))
+            while True:
+                kind, payload = link.receive((DUMP_BLOCK, DUMP_END))
+                if kind == DUMP_END:
+                    status = payload[1]
+                    if status == BUSY:
+                        time.sleep(0.2)
+                    elif status != OK:
+                        print("dump stopped: %s" % STATUS_NAMES[status], file=sys.stderr)
+                    break
+                block, status = payload[1], payload[2]
+                (crc,) = struct.unpack_from("<I", payload, 3)
+                if status != OK:
+                    print("block %d: %s" % (block, STATUS_NAMES[status]), file=sys.stderr)
+                    continue
+                data = rle_decode(payload[7:])
+                if len(data) != BLOCK_SIZE or zlib.crc32(data) != crc:
+                    print("block %d: corrupted on the way, retrying" % block, file=sys.stderr)
+                    continue
+                partial.store(block, data)
+                dumped += 1
+    elapsed = time.monotonic() - start
+    missing = partial.missing()
+    if missing:
+        sys.exit("blocks %s failed, run again to resume" % missing)
+    os.replace(partial.path, args.image)
+    os.truncate(args.image, CARD_SIZE)
+    received = link.received - wire
+    if dumped:
+        print("dumped %d blocks in %.2f s: %.1f frames/s, %.1f KiB/s of card data, %d bytes on USB (%.1f:1)" % (
+            dumped, elapsed, dumped * FRAMES_IN_BLOCK / elapsed, dumped * BLOCK_SIZE / 1024 / elapsed, received,
+            dumped * BLOCK_SIZE / max(received, 1)))
+
+
+def restore(link, args):
+    with open(args.image, "rb") as file:
+        image = file.read()
+    if len(image) != CARD_SIZE:
+        sys.exit("%s is not a raw card image (%d bytes)" % (args.image, CARD_SIZE))
+    start = time.monotonic()
+    written = 0
+    sent = 0
+    for block in range(BLOCKS):
+        data = image[block * BLOCK_SIZE:(block + 1) * BLOCK_SIZE]
+        payload = bytes([args.slot, block]) + struct.pack("<I", zlib.crc32(data)) + rle_encode(data)
+        for attempt in range(RETRIES * 10):
+            link.send(RESTORE_BLOCK, payload)
+            sent += len(payload) + 4
+            _, result = link.receive((RESTORE_RESULT,))
+            status = result[2]
+            if status == OK:
+                written += result[3]
+                break
+            if status == CARD_ERROR or status == BAD_REQUEST:
+                sys.exit("block %d: %s (frames written so far: %d)" % (block, STATUS_NAMES[status], written))
+            # Busy or damaged on the way
+            time.sleep(0.2 if status == BUSY else 0)
+        else:
+            sys.exit("block %d: device stays busy" % block)
+    elapsed = time.monotonic() - start
+    print("restored %d blocks in %.2f s: %d frames written, %.1f frames/s compared, %d bytes on USB (%.1f:1)" % (
+        BLOCKS, elapsed, written, BLOCKS * FRAMES_IN_BLOCK / elapsed, sent, CARD_SIZE / sent))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("command", choices=["dump", "restore"])
+    parser.add_argument("port", help="USB CDC device (or the terminal of the simulator)")
+    parser.add_argument("image", help="raw card image (128 KiB, .mcr)")
+    parser.add_argument("--slot", type=int, choices=range(8), default=0,
+                        help="0: Port 1, 1: Port 2, 2-7: multitap sub-ports B-D (Port 1 B, Port 2 B, ...)")
+    args = parser.parse_args()
+
+    fd = open_port(args.port)
+    try:
+        link = Link(fd)
+        if args.command == "dump":
+            dump(link, args)
+        else:
+            restore(link, args)
+    except TimeoutError as error:
+        sys.exit("%s%s" % (error, ", run again to resume" if args.command == "dump" else ""))
+    finally:
+        os.close(fd)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,140 @@
+/*
+  Run the firmware on the host with simulated memory cards, its USB CDC on a pseudo terminal.
+
+    pio run -e cardsim
+    .pio/build/cardsim/program [--card0 PATH] [--card1 PATH] [--empty SLOT] [--save] [--link PATH]
+
+  The terminal path is printed (and linked at `--link`), so the USB CDC tools run against it as against the real
+  device, e.g. `tools/card_backup.py dump /tmp/k573 backup.mcr`. Cards start formatted, or from raw images (`.mcr`),
+  and are written back to the images on exit (Ctrl+C) with `--save`.
+*/
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <Arduino.h>
+#include <PSXSim.h>
+
+void setup();
+void loop();
+void setup1();
+void loop1();
+
+namespace {
+  struct Options {
+    const char *cardPaths[PSX_SIM_SLOT_COUNTS] = {};
+    bool isSlotEmpty[PSX_SIM_SLOT_COUNTS] = {};
+    bool isSaving = false;
+    const char *linkPath = nullptr;
+  };
+
+  std::atomic<bool> __isRunning{ true };
+
+  void __onSignal(int) {
+    __isRunning.store(false);
+  }
+
+  /**
+   * @brief Open a pseudo terminal in raw mode.
+   * @param slave Opened slave (kept open, so the master does not hang up between clients)
+   * @return Master, `-1` if failed
+   */
+  int __openTerminal(int &slave) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) return -1;
+    slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (slave < 0) return -1;
+    termios attributes;
+    tcgetattr(slave, &attributes);
+    cfmakeraw(&attributes);
+    tcsetattr(slave, TCSANOW, &attributes);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    return master;
+  }
+
+  bool __parseOptions(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; i++) {
+      const char *arg = argv[i];
+      bool hasValue = i + 1 < argc;
+      if (strcmp(arg, "--save") == 0) options.isSaving = true;
+      else if (strcmp(arg, "--card0") == 0 && hasValue) options.cardPaths[0] = argv[++i];
+      else if (strcmp(arg, "--card1") == 0 && hasValue) options.cardPaths[1] = argv[++i];
+      else if (strcmp(arg, "--empty") == 0 && hasValue) options.isSlotEmpty[atoi(argv[++i]) & 1] = true;
+      else if (strcmp(arg, "--link") == 0 && hasValue) options.linkPath = argv[++i];
+      else return false;
+    }
+    return true;
+  }
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!__parseOptions(argc, argv, options)) {
+    fprintf(stderr, "usage: %s [--card0 PATH] [--card1 PATH] [--empty SLOT] [--save] [--link PATH]\n", argv[0]);
+    return 2;
+  }
+
+  static PSXSim::MemoryCard cards[PSX_SIM_SLOT_COUNTS];
+  PSXSim::begin();
+  for (int slot = 0; slot < PSX_SIM_SLOT_COUNTS; slot++) {
+    if (options.isSlotEmpty[slot]) continue;
+    const char *path = options.cardPaths[slot];
+    // Missing image is created on save
+    if (path != nullptr && access(path, F_OK) == 0 && !cards[slot].load(path)) {
+      fprintf(stderr, "can not read %s\n", path);
+      return 1;
+    }
+    PSXSim::attach(slot, &cards[slot]);
+  }
+
+  int slave;
+  int master = __openTerminal(slave);
+  if (master < 0) {
+    perror("pseudo terminal");
+    return 1;
+  }
+  if (options.linkPath != nullptr) {
+    unlink(options.linkPath);
+    if (symlink(ptsname(master), options.linkPath) != 0) perror(options.linkPath);
+  }
+  printf("USB CDC: %s\n", ptsname(master));
+  fflush(stdout);
+  signal(SIGINT, __onSignal);
+  signal(SIGTERM, __onSignal);
+
+  // Core 1
+  std::thread core1([] {
+    setup1();
+    while (__isRunning.load(std::memory_order_relaxed)) {
+      loop1();
+      std::this_thread::yield();
+    }
+  });
+  // Core 0
+  setup();
+  Serial.hostOpen(master);
+  while (__isRunning.load(std::memory_order_relaxed)) {
+    loop();
+    std::this_thread::yield();
+  }
+  core1.join();
+
+  for (int slot = 0; slot < PSX_SIM_SLOT_COUNTS; slot++) {
+    if (options.isSlotEmpty[slot]) continue;
+    const PSXSim::MemoryCard &card = cards[slot];
+    printf("card %d: frames %u (read %u, write %u, rejected %u)\n", slot, card.frames, card.reads, card.writes,
+           card.badChecksums);
+    if (options.isSaving && options.cardPaths[slot] != nullptr && !card.save(options.cardPaths[slot])) {
+      fprintf(stderr, "can not write %s\n", options.cardPaths[slot]);
+    }
+  }
+  if (options.linkPath != nullptr) unlink(options.linkPath);
+  close(master);
+  close(slave);
+  return 0;
+}
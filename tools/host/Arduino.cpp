@@ -0,0 +1,101 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+#include "Arduino.h"
+#include "SPI.h"
+
+HostSerial Serial;
+SPIClass SPI;
+
+namespace {
+  struct Interrupt {
+    void (*handler)() = nullptr;
+    std::atomic<bool> isPending{ false };
+    std::atomic<uint32_t> time{ 0 };
+  };
+
+  Interrupt __interrupts[32];
+  // Set by `hostSetClock`
+  std::atomic<bool> __isClockStopped{ false };
+  std::atomic<uint32_t> __stoppedTime{ 0 };
+
+  void __runDueInterrupts() {
+    uint32_t now = micros();
+    for (Interrupt &interrupt : __interrupts) {
+      if (!interrupt.isPending.load(std::memory_order_acquire)) continue;
+      if ((int32_t)(now - interrupt.time.load(std::memory_order_relaxed)) < 0) continue;
+      interrupt.isPending.store(false, std::memory_order_relaxed);
+      if (interrupt.handler != nullptr) interrupt.handler();
+    }
+  }
+}
+
+uint32_t micros() {
+  if (__isClockStopped.load(std::memory_order_acquire)) return __stoppedTime.load(std::memory_order_relaxed);
+  auto elapsed = std::chrono::steady_clock::now().time_since_epoch();
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+uint32_t millis() {
+  return micros() / 1000;
+}
+
+void delay(uint32_t ms) {
+  delayMicroseconds(ms * 1000);
+}
+
+void hostSetClock(uint32_t time) {
+  __stoppedTime.store(time, std::memory_order_relaxed);
+  __isClockStopped.store(true, std::memory_order_release);
+  __runDueInterrupts();
+}
+
+void delayMicroseconds(uint32_t us) {
+  if (__isClockStopped.load(std::memory_order_acquire)) {
+    __stoppedTime.fetch_add(us, std::memory_order_relaxed);
+    __runDueInterrupts();
+    return;
+  }
+  uint32_t start = micros();
+  do {
+    __runDueInterrupts();
+    // Let the other simulated core run when the host has fewer CPUs than threads
+    std::this_thread::yield();
+  } while (micros() - start < us);
+}
+
+void attachInterrupt(int pin, void (*handler)(), int) {
+  __interrupts[pin & 31].handler = handler;
+}
+
+void hostScheduleInterrupt(uint8_t pin, uint32_t time) {
+  Interrupt &interrupt = __interrupts[pin & 31];
+  interrupt.time.store(time, std::memory_order_relaxed);
+  interrupt.isPending.store(true, std::memory_order_release);
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+  // 8 clocks on the wire, then the device sees the whole byte (and may schedule its ACK)
+  delayMicroseconds((8 * 1000000 + __clock - 1) / __clock);
+  return __device != nullptr ? __device(data) : 0xff;
+}
+
+int HostSerial::available() {
+  if (__offset == __length && __fd >= 0) {
+    ssize_t length = ::read(__fd, __buffer, sizeof(__buffer));
+    __length = length > 0 ? length : 0;
+    __offset = 0;
+  }
+  return __length - __offset;
+}
+
+int HostSerial::read() {
+  return available() > 0 ? __buffer[__offset++] : -1;
+}
+
+size_t HostSerial::write(const uint8_t *data, size_t length) {
+  if (__fd < 0) return length;
+  ssize_t written = ::write(__fd, data, length);
+  return written > 0 ? written : 0;
+}
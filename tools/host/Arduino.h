@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+  Arduino API for running the firmware on the host (tools only).
+  `ARDUINO` is not defined, so libraries pick their host backends (Gpio trace, JVS UART in memory, ...).
+  Time is the monotonic clock of the host, delays are busy waits so simulated bus timing holds
+  (or a stopped clock moved by the delays, see `hostSetClock`).
+*/
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define tight_loop_contents() \
+  do {                        \
+  } while (0)
+
+uint32_t micros();
+uint32_t millis();
+void delay(uint32_t ms);
+
+/**
+ * @brief Stop the clock at the time (tests only): from now on it moves by `delayMicroseconds` and by further calls.
+ * @param time Time in `micros`
+ * @note Waits of the simulated bus end at once, so a test on one thread steps through time deterministically.
+ */
+void hostSetClock(uint32_t time);
+
+/**
+ * @brief Busy wait, and run the interrupts scheduled by `hostScheduleInterrupt` when they are due.
+ * @param us Microseconds
+ */
+void delayMicroseconds(uint32_t us);
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) {
+  return HIGH;
+}
+
+inline int digitalPinToInterrupt(uint8_t pin) {
+  return pin;
+}
+
+/**
+ * @brief Register the handler run by `hostScheduleInterrupt`.
+ * @param pin GPIO number
+ * @param handler Interrupt handler
+ * @param mode Ignored (the simulated device decides when the edge happens)
+ */
+void attachInterrupt(int pin, void (*handler)(), int mode);
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+/**
+ * @brief Raise the interrupt of the pin once the time has come (e.g. ACK from a simulated device).
+ * @param pin GPIO number
+ * @param time Time in `micros`
+ * @note One interrupt is kept per pin, the handler runs in the thread that waits in `delayMicroseconds`.
+ */
+void hostScheduleInterrupt(uint8_t pin, uint32_t time);
+
+/**
+ * @brief USB CDC of the host: accepts everything and never receives, until `hostOpen` connects it to a file
+ * descriptor (e.g. a pseudo terminal, so the tools talk to the simulated device as to the real one).
+ */
+class HostSerial {
+public:
+  void begin(uint32_t) {}
+  int available();
+  int read();
+  int availableForWrite() {
+    return 4096;
+  }
+  size_t write(uint8_t data) {
+    return write(&data, 1);
+  }
+  size_t write(const uint8_t *data, size_t length);
+  operator bool() {
+    return true;
+  }
+
+  /**
+   * @brief Connect the port to a non-blocking file descriptor.
+   * @param fd File descriptor (`-1`: disconnect)
+   */
+  void hostOpen(int fd) {
+    __fd = fd;
+  }
+
+private:
+  int __fd = -1;
+  uint8_t __buffer[256];
+  size_t __length = 0;
+  size_t __offset = 0;
+};
+
+extern HostSerial Serial;
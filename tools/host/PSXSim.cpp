@@ -0,0 +1,560 @@
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <Arduino.h>
+#include <SPI.h>
+#include <Gpio.h>
+#include <PSX.h>
+#include "PSXSim.h"
+
+namespace PSXSim {
+  // private variables & functions
+  namespace {
+    struct Slot {
+      Device *devices[PSX_SIM_DEVICES_PER_SLOT] = {};
+      bool isSelected = false;
+      uint16_t index = 0;
+      // Device answering the current frame (`nullptr`: not decided yet or nobody)
+      Device *active = nullptr;
+      // Every device declined the current frame
+      bool isSilent = false;
+      uint32_t selectTime = 0;
+    };
+
+    // Batched multitap read: {0x01, 'B', 0x01}, then every sub-port
+    const uint16_t __BatchLength = 3 + PSX_SIM_MULTITAP_PORTS * PSX_SIM_MULTITAP_PORT_LENGTH;
+
+    // Devices are plugged from the tool thread, bytes come from the PSX core thread
+    std::mutex __mutex;
+    Slot __slots[PSX_SIM_SLOT_COUNTS];
+
+    /**
+     * @brief Take one of the injected faults.
+     * @return `false` if none is left
+     */
+    bool __take(std::atomic<uint32_t> &faults) {
+      uint32_t count = faults.load();
+      while (count > 0 && !faults.compare_exchange_weak(count, count - 1)) {
+      }
+      return count > 0;
+    }
+
+    int __slotOf(uint8_t pin) {
+      if (pin == PSX_ATTENTION_PIN_1) return 0;
+      if (pin == PSX_ATTENTION_PIN_2) return 1;
+      return -1;
+    }
+
+    void __onLevel(uint8_t pin, bool level) {
+      int number = __slotOf(pin);
+      if (number < 0) return;
+
+      std::lock_guard<std::mutex> lock(__mutex);
+      Slot &slot = __slots[number];
+      if (level == LOW && !slot.isSelected) {
+        slot.isSelected = true;
+        slot.index = 0;
+        slot.active = nullptr;
+        slot.isSilent = false;
+        slot.selectTime = micros();
+        for (Device *device : slot.devices) {
+          if (device != nullptr) device->select();
+        }
+      } else if (level == HIGH && slot.isSelected) {
+        slot.isSelected = false;
+        if (slot.active != nullptr) {
+          slot.active->frames++;
+          slot.active->busyUs += micros() - slot.selectTime;
+        }
+        for (Device *device : slot.devices) {
+          if (device != nullptr) device->deselect();
+        }
+      }
+    }
+
+    /**
+     * @brief Exchange a byte with the device of the selected slot.
+     * @param ackDelay Microseconds from the end of the byte to ACK (`NoAck`: no ACK)
+     */
+    uint8_t __exchange(uint8_t command, uint16_t &ackDelay) {
+      std::lock_guard<std::mutex> lock(__mutex);
+      ackDelay = NoAck;
+      Slot *slot = nullptr;
+      for (Slot &candidate : __slots) {
+        if (candidate.isSelected) slot = &candidate;
+      }
+      if (slot == nullptr || slot->isSilent) return 0xff;
+
+      uint16_t index = slot->index++;
+      uint8_t response = 0xff;
+      if (slot->active == nullptr) {
+        // First byte addresses one of the devices sharing the line
+        for (Device *device : slot->devices) {
+          if (device != nullptr && device->exchange(index, command, response, ackDelay)) {
+            slot->active = device;
+            break;
+          }
+        }
+        if (slot->active == nullptr) {
+          slot->isSilent = true;
+          ackDelay = NoAck;
+          return 0xff;
+        }
+      } else if (!slot->active->exchange(index, command, response, ackDelay)) {
+        slot->isSilent = true;
+        ackDelay = NoAck;
+        return 0xff;
+      }
+      return response;
+    }
+
+    uint8_t __transfer(uint8_t command) {
+      uint16_t ackDelay;
+      uint8_t response = __exchange(command, ackDelay);
+      if (ackDelay != NoAck) hostScheduleInterrupt(PSX_ACKNOWLEDGE_PIN, micros() + ackDelay);
+      return response;
+    }
+
+    /**
+     * @brief Activate or deactivate port (every device behind a multitap shares the line).
+     * @param port Port number (`0`: Port 1, `1`: Port 2)
+     * @param status `LOW` to activate, `HIGH` to deactivate
+     */
+    void __attention(int port, int status) {
+      if (port == 0) Gpio::Pin<PSX_ATTENTION_PIN_1>::write(status);
+      else Gpio::Pin<PSX_ATTENTION_PIN_2>::write(status);
+    }
+  }
+
+  MemoryCard::MemoryCard() {
+    // Formatted card: empty directory, every block free
+    memset(__data, 0, sizeof(__data));
+    __data[0][0] = 'M';
+    __data[0][1] = 'C';
+    __data[0][127] = 'M' ^ 'C';
+    for (int block = 1; block < 16; block++) {
+      uint8_t *entry = __data[block];
+      entry[0] = 0xa0;  // Free
+      entry[8] = 0xff;  // No next block
+      entry[9] = 0xff;
+      uint8_t checksum = 0;
+      for (int i = 0; i < 127; i++) checksum ^= entry[i];
+      entry[127] = checksum;
+    }
+  }
+
+  /**
+   * @brief Load a raw card image (128 KiB, `.mcr`).
+   * @return `false` if the file can not be read
+   */
+  bool MemoryCard::load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) return false;
+    bool isRead = fread(__data, 1, sizeof(__data), file) == sizeof(__data);
+    fclose(file);
+    return isRead;
+  }
+
+  /**
+   * @brief Save the card as a raw image.
+   * @return `false` if the file can not be written
+   */
+  bool MemoryCard::save(const char *path) const {
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) return false;
+    bool isWritten = fwrite(__data, 1, sizeof(__data), file) == sizeof(__data);
+    fclose(file);
+    return isWritten;
+  }
+
+  /**
+   * @brief Frame data (128 bytes).
+   * @param address Frame address (`0x000`-`0x3ff`)
+   */
+  uint8_t *MemoryCard::frame(uint16_t address) {
+    return __data[address & (PSX_SIM_MEMCARD_FRAMES - 1)];
+  }
+
+  void MemoryCard::select() {
+    __command = 0;
+  }
+
+  bool MemoryCard::exchange(uint16_t index, uint8_t command, uint8_t &response, uint16_t &ackDelay) {
+    ackDelay = timing.ackDelay;
+    switch (index) {
+      case 0:
+        response = 0xff;  // Line is not driven yet
+        return command == PSX::Device::MemoryCard;
+      case 1:
+        if (command != 'R' && command != 'W') return false;
+        __command = command;
+        response = __flag;
+        return true;
+      case 2:
+        response = 0x5a;  // ID1
+        return true;
+      case 3:
+        response = 0x5d;  // ID2
+        return true;
+      case 4:
+        __address = command << 8;
+        __checksum = command;
+        response = 0x00;
+        return true;
+      case 5:
+        __address |= command;
+        __checksum ^= command;
+        response = 0x00;
+        return true;
+    }
+    return __command == 'R' ? __read(index, command, response, ackDelay) : __write(index, command, response, ackDelay);
+  }
+
+  bool MemoryCard::__read(uint16_t index, uint8_t, uint8_t &response, uint16_t &ackDelay) {
+    bool isValid = __address < PSX_SIM_MEMCARD_FRAMES;
+    const uint16_t dataStart = 10;
+    const uint16_t dataEnd = dataStart + PSX_SIM_MEMCARD_FRAME_SIZE;
+    if (index == 6) {
+      isValid = isValid && faults.badFrame.load() != __address;
+      __isCorrupted = isValid && __take(faults.badChecksums);
+      __isStalled = isValid && !__isCorrupted && __take(faults.timeouts);
+      // Sector is fetched before the confirmed address
+      response = isValid ? 0x5c : 0xff;  // ACK1
+      ackDelay = timing.readDelay;
+      return isValid;
+    }
+    // Card stops answering halfway through the data
+    if (__isStalled && index == dataStart + PSX_SIM_MEMCARD_FRAME_SIZE / 2) return false;
+    if (index == 7) response = 0x5d;  // ACK2
+    else if (index == 8) response = __address >> 8;
+    else if (index == 9) response = __address & 0xff;
+    else if (index < dataEnd) {
+      response = __data[__address][index - dataStart];
+      __checksum ^= response;
+    } else if (index == dataEnd) {
+      response = __isCorrupted ? __checksum ^ 0x01 : __checksum;
+    } else if (index == dataEnd + 1) {
+      response = 'G';
+      ackDelay = NoAck;
+      reads++;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  bool MemoryCard::__write(uint16_t index, uint8_t command, uint8_t &response, uint16_t &ackDelay) {
+    const uint16_t dataStart = 6;
+    const uint16_t dataEnd = dataStart + PSX_SIM_MEMCARD_FRAME_SIZE;
+    response = 0x00;
+    if (index < dataEnd) {
+      __buffer[index - dataStart] = command;
+      __checksum ^= command;
+    } else if (index == dataEnd) {
+      // Checksum sent by the firmware is compared at the end
+      __checksum ^= command;
+    } else if (index == dataEnd + 1) {
+      response = 0x5c;  // ACK1
+    } else if (index == dataEnd + 2) {
+      response = 0x5d;  // ACK2
+    } else if (index == dataEnd + 3) {
+      ackDelay = NoAck;
+      if (__address >= PSX_SIM_MEMCARD_FRAMES) {
+        response = 0xff;  // Bad sector
+      } else if (__checksum != 0) {
+        response = 'N';
+        badChecksums++;
+      } else {
+        memcpy(__data[__address], __buffer, PSX_SIM_MEMCARD_FRAME_SIZE);
+        // Writing repairs the bad frame
+        int32_t badFrame = __address;
+        faults.badFrame.compare_exchange_strong(badFrame, -1);
+        __flag = 0x00;
+        response = 'G';
+        writes++;
+      }
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  bool DigitalPad::exchange(uint16_t index, uint8_t command, uint8_t &response, uint16_t &ackDelay) {
+    ackDelay = this->ackDelay;
+    switch (index) {
+      case 0:
+        response = 0xff;
+        return command == PSX::Device::Controller;
+      case 1:
+        response = 0x41;  // ID LSB (Digital Controller)
+        return command == 'B';
+      case 2:
+        response = 0x5a;  // ID MSB
+        return true;
+      case 3:
+        response = buttons.load() & 0xff;
+        return true;
+      case 4:
+        response = buttons.load() >> 8;
+        ackDelay = NoAck;
+        return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Plug a device into a sub-port.
+   * @param subPort Sub-port (`0`-`3`: A-D)
+   * @param device Device (must be alive while attached)
+   * @return `false` if the sub-port is full
+   */
+  bool Multitap::attach(int subPort, Device *device) {
+    std::lock_guard<std::mutex> lock(__mutex);
+    for (Device *&entry : __devices[subPort]) {
+      if (entry != nullptr) continue;
+      entry = device;
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Unplug a device from a sub-port.
+   */
+  void Multitap::detach(int subPort, Device *device) {
+    std::lock_guard<std::mutex> lock(__mutex);
+    for (Device *&entry : __devices[subPort]) {
+      if (entry == device) entry = nullptr;
+    }
+    if (__target == device) __target = nullptr;
+    if (__pad == device) __pad = nullptr;
+  }
+
+  void Multitap::select() {
+    __isBatch = false;
+    __asksBatch = false;
+    __target = nullptr;
+    __pad = nullptr;
+    __selectTime = micros();
+  }
+
+  bool Multitap::exchange(uint16_t index, uint8_t command, uint8_t &response, uint16_t &ackDelay) {
+    if (index == 0) {
+      __address = command;
+      // 0x01-0x04: controller, 0x81-0x84: memory card of sub-port A-D
+      uint8_t device = command & 0xf0;
+      int subPort = (command & 0x0f) - 1;
+      if ((device != 0x00 && device != 0x80) || subPort < 0 || subPort >= PSX_SIM_MULTITAP_PORTS) return false;
+      for (Device *candidate : __devices[subPort]) {
+        if (candidate == nullptr) continue;
+        candidate->select();
+        if (candidate->exchange(0, device | 0x01, response, ackDelay)) {
+          __target = candidate;
+          break;
+        }
+      }
+      response = 0xff;
+      ackDelay = this->ackDelay;
+      // Controller address is answered anyway, it might be a batched read
+      return __target != nullptr || command == 0x01;
+    }
+    if (index == 1 && __address == 0x01 && __isBatched) {
+      // Device of sub-port A drops the frame, the batch is answered by the multitap itself
+      __target = nullptr;
+      __isBatch = true;
+    }
+    if (index == 2 && __address == 0x01) __asksBatch = command == 0x01;
+    if (!__isBatch) return __forward(index, command, response, ackDelay);
+
+    ackDelay = index + 1 < __BatchLength ? this->ackDelay : NoAck;
+    if (index == 1) response = 0x80;  // Multitap ID
+    else if (index == 2) response = 0x5a;
+    else if (index < __BatchLength) __batch(index - 3, command, response);
+    else return false;
+    return true;
+  }
+
+  void Multitap::deselect() {
+    if (__address == 0x01) __isBatched = __asksBatch;
+    if (__isBatch) batches++;
+    // Frames forwarded to the device are counted as its own
+    if (__target != nullptr) {
+      __target->frames++;
+      __target->busyUs += micros() - __selectTime;
+    }
+    for (Device *(&devices)[PSX_SIM_DEVICES_PER_SLOT] : __devices) {
+      for (Device *device : devices) {
+        if (device != nullptr) device->deselect();
+      }
+    }
+    __target = nullptr;
+    __pad = nullptr;
+  }
+
+  bool Multitap::__forward(uint16_t index, uint8_t command, uint8_t &response, uint16_t &ackDelay) {
+    if (__target == nullptr || !__target->exchange(index, command, response, ackDelay)) {
+      __target = nullptr;
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Answer a byte of the batch from the controller of the sub-port (`0xff` if nothing answers).
+   * @param offset Byte offset after the 3 header bytes
+   */
+  void Multitap::__batch(uint16_t offset, uint8_t command, uint8_t &response) {
+    int subPort = offset / PSX_SIM_MULTITAP_PORT_LENGTH;
+    uint16_t index = offset % PSX_SIM_MULTITAP_PORT_LENGTH;
+    uint16_t ackDelay;
+    response = 0xff;
+    if (index == 0) {
+      // New controller frame on the sub-port: address, then the forwarded command
+      __pad = nullptr;
+      for (Device *candidate : __devices[subPort]) {
+        if (candidate == nullptr) continue;
+        candidate->select();
+        if (candidate->exchange(0, PSX::Device::Controller, response, ackDelay)) {
+          __pad = candidate;
+          break;
+        }
+      }
+      response = 0xff;
+    }
+    if (__pad != nullptr && !__pad->exchange(index + 1, command, response, ackDelay)) {
+      __pad = nullptr;
+      response = 0xff;
+    }
+  }
+
+  /**
+   * @brief Take over the attention lines.
+   * @param bitrate PSX clock frequency used when `Frame::timing` does not choose one (Hz)
+   */
+  void Transport::begin(uint32_t bitrate) {
+    __bitrate = bitrate;
+    Gpio::Pin<PSX_ATTENTION_PIN_1>::beginOutput(HIGH);
+    Gpio::Pin<PSX_ATTENTION_PIN_2>::beginOutput(HIGH);
+  }
+
+  bool Transport::tryStart(PSX::Frame &frame, CompleteCallback callback, void *context) {
+    if (__frame != nullptr) return false;
+    __frame = &frame;
+    __callback = callback;
+    __context = context;
+    __start = micros();
+    __duration = 0;
+    __transferred = 0;
+    __isLost = ((lostTypes.load() >> frame.type) & 1) && __take(lostFrames);
+    frames++;
+    frame.ackLatency = 0;
+    __attention(PSX::portOf(frame.slot), LOW);
+    if (__isLost) return true;
+
+    uint32_t clock = frame.timing.clock != 0 ? frame.timing.clock : __bitrate;
+    uint32_t bitsUs = (8 * 1000000 + clock - 1) / clock;
+    // Without reliable ACK, the timeout is spent as the delay of the next byte instead
+    uint32_t skippedAck = 0;
+    bool isAckOptional = frame.timing.isAckOptional;
+    bool hasFallenBack = false;
+    for (int i = 0; i < frame.length; i++) {
+      __duration += frame.delay(i) + skippedAck + bitsUs;
+      skippedAck = 0;
+      uint16_t ackDelay;
+      frame.response[i] = __exchange(frame.command[i], ackDelay);
+      __transferred = i + 1;
+      // Nothing answers after the fallback, the port is empty
+      if (hasFallenBack && i == 1 && frame.response[i] == 0xff) break;
+
+      uint16_t timeout = frame.ackTimeout(i);
+      if (timeout == 0) continue;
+      if (isAckOptional) {
+        skippedAck = timeout;
+        continue;
+      }
+      if (ackDelay == NoAck || ackDelay >= timeout) {
+        __duration += timeout;
+        // The rest goes on without ACK, as `PSX::PioTransport` restarts it
+        bool isEmpty = i >= 1 && frame.response[1] == 0xff;
+        if (!frame.timing.hasAckFallback || isEmpty) break;
+        isAckOptional = true;
+        hasFallenBack = true;
+        continue;
+      }
+      __duration += ackDelay;
+      if (!frame.isBusy(i) && ackDelay > frame.ackLatency) frame.ackLatency = ackDelay;
+    }
+    return true;
+  }
+
+  bool Transport::isBusy() const {
+    return __frame != nullptr;
+  }
+
+  /**
+   * @brief Stop the frame being exchanged (e.g. the completion did not come in time).
+   * @note `callback` is called with the bytes exchanged so far (none of a lost frame).
+   */
+  void Transport::abort() {
+    if (__frame != nullptr) __finish(__isLost ? 0 : __transferred);
+  }
+
+  /**
+   * @brief Finish the frame once its bus time has passed (a lost frame never finishes).
+   */
+  void Transport::poll() {
+    if (__frame == nullptr || __isLost) return;
+    if (micros() - __start >= __duration) __finish(__transferred);
+  }
+
+  /**
+   * @brief Deactivate the slot and notify the result.
+   * @param transferred Count of received bytes
+   */
+  void Transport::__finish(uint16_t transferred) {
+    PSX::Frame *frame = __frame;
+    __attention(PSX::portOf(frame->slot), HIGH);
+    frame->transferred = transferred;
+    __frame = nullptr;
+    if (__callback != nullptr) __callback(*frame, __context);
+  }
+
+  /**
+   * @brief Connect the simulated ports to the host SPI and Gpio backends.
+   */
+  void begin() {
+    SPI.hostSetDevice(__transfer);
+    Gpio::setListener(__onLevel);
+  }
+
+  /**
+   * @brief Plug a device into a slot.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param device Device (must be alive while attached)
+   * @return `false` if the slot is full
+   */
+  bool attach(int slot, Device *device) {
+    std::lock_guard<std::mutex> lock(__mutex);
+    for (Device *&entry : __slots[slot].devices) {
+      if (entry != nullptr) continue;
+      entry = device;
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Unplug a device (e.g. card removed).
+   */
+  void detach(int slot, Device *device) {
+    std::lock_guard<std::mutex> lock(__mutex);
+    Slot &entry = __slots[slot];
+    for (Device *&candidate : entry.devices) {
+      if (candidate == device) candidate = nullptr;
+    }
+    if (entry.active == device) {
+      entry.active = nullptr;
+      entry.isSilent = true;
+    }
+  }
+}
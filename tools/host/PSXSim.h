@@ -0,0 +1,259 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <PSXTransport.h>
+
+#ifndef PSX_SIM_DEVICES_PER_SLOT
+// Devices sharing the attention line of a slot (e.g. controller and memory card)
+#define PSX_SIM_DEVICES_PER_SLOT 4
+#endif
+#define PSX_SIM_SLOT_COUNTS 2
+// Sub-ports of a multitap (A-D)
+#define PSX_SIM_MULTITAP_PORTS 4
+// Bytes of each sub-port in a batched read (ID, `0x5a`, 6 data bytes)
+#define PSX_SIM_MULTITAP_PORT_LENGTH 8
+#define PSX_SIM_MEMCARD_FRAMES 1024
+#define PSX_SIM_MEMCARD_FRAME_SIZE 128
+
+/**
+ * @brief Simulated PSX port on the host, byte by byte as PSX.cpp drives it.
+ * @note Attention lines are followed through the Gpio host backend, bytes come from the host SPI,
+ * and ACK is raised on `PSX_ACKNOWLEDGE_PIN` after the delay chosen by the device.
+ */
+namespace PSXSim {
+  /**
+   * @brief `ackDelay` of the last byte (device never sends ACK for it)
+   */
+  const uint16_t NoAck = 0xffff;
+
+  /**
+   * @brief Device on a simulated port
+   */
+  class Device {
+  public:
+    virtual ~Device() {}
+
+    /**
+     * @brief Attention went LOW, a new frame starts.
+     */
+    virtual void select() {}
+
+    /**
+     * @brief Exchange a byte of the frame.
+     * @param index Byte index in the frame
+     * @param command Byte sent by the firmware
+     * @param response Byte driven by the device
+     * @param ackDelay Microseconds from the end of the byte to ACK (`NoAck`: no ACK)
+     * @return `false` if the device is not addressed (it stays silent until the next frame)
+     */
+    virtual bool exchange(uint16_t index, uint8_t command, uint8_t &response, uint16_t &ackDelay) = 0;
+
+    /**
+     * @brief Attention went HIGH, the frame ended.
+     */
+    virtual void deselect() {}
+
+    // Frames this device answered
+    uint32_t frames = 0;
+    // Microseconds from attention LOW to HIGH of the answered frames
+    uint64_t busyUs = 0;
+  };
+
+  /**
+   * @brief PS1 memory card (`0x81`): read, write and the ID bytes, with 'G'/'N' end status and XOR checksum.
+   */
+  class MemoryCard : public Device {
+  public:
+    /**
+     * @brief Response timing of the card
+     */
+    struct Timing {
+      // ACK delay of a normal byte (microseconds)
+      uint16_t ackDelay = 10;
+      // ACK delay while the sector is fetched (after ACK1 of a read)
+      uint16_t readDelay = 100;
+    };
+
+    /**
+     * @brief Faults injected into the next reads (set from any thread)
+     */
+    struct Faults {
+      // Reads answered with a wrong checksum
+      std::atomic<uint32_t> badChecksums{ 0 };
+      // Reads that stop sending ACK in the middle of the data
+      std::atomic<uint32_t> timeouts{ 0 };
+      // Frame reported bad (`0xff` ACK1) until it is written (`-1`: none)
+      std::atomic<int32_t> badFrame{ -1 };
+    };
+
+    Timing timing;
+    Faults faults;
+    uint32_t reads = 0;
+    uint32_t writes = 0;
+    // Writes rejected with 'N'
+    uint32_t badChecksums = 0;
+
+    MemoryCard();
+
+    /**
+     * @brief Load a raw card image (128 KiB, `.mcr`).
+     * @return `false` if the file can not be read
+     */
+    bool load(const char *path);
+
+    /**
+     * @brief Save the card as a raw image.
+     * @return `false` if the file can not be written
+     */
+    bool save(const char *path) const;
+
+    /**
+     * @brief Frame data (128 bytes).
+     * @param address Frame address (`0x000`-`0x3ff`)
+     */
+    uint8_t *frame(uint16_t address);
+
+    void select() override;
+    bool exchange(uint16_t index, uint8_t command, uint8_t &response, uint16_t &ackDelay) override;
+
+  private:
+    uint8_t __data[PSX_SIM_MEMCARD_FRAMES][PSX_SIM_MEMCARD_FRAME_SIZE];
+    // Bit 3: directory not read since power on (cleared by a write)
+    uint8_t __flag = 0x08;
+    // 'R' or 'W' of the current frame
+    uint8_t __command = 0;
+    uint16_t __address = 0;
+    uint8_t __checksum = 0;
+    uint8_t __buffer[PSX_SIM_MEMCARD_FRAME_SIZE];
+    // Faults taken by the current read
+    bool __isCorrupted = false;
+    bool __isStalled = false;
+
+    bool __read(uint16_t index, uint8_t command, uint8_t &response, uint16_t &ackDelay);
+    bool __write(uint16_t index, uint8_t command, uint8_t &response, uint16_t &ackDelay);
+  };
+
+  /**
+   * @brief PS1 digital pad (`0x01`, ID `0x5a41`): answers `'B'` with the switches.
+   */
+  class DigitalPad : public Device {
+  public:
+    // ACK delay of each byte but the last (microseconds)
+    uint16_t ackDelay = 10;
+    // Digital switches, active low (`0xffff`: nothing pressed)
+    std::atomic<uint16_t> buttons{ 0xffff };
+
+    bool exchange(uint16_t index, uint8_t command, uint8_t &response, uint16_t &ackDelay) override;
+  };
+
+  /**
+   * @brief PS1 multitap: forwards frames addressed to sub-ports A-D (`0x01`-`0x04`, `0x81`-`0x84`), and answers the
+   * batched read {`0x01`, `'B'`, `0x01`} with the ID `0x80` and 8 bytes of every sub-port's controller.
+   * @note Like the real one, the ID `0x80` is answered only if the previous controller frame asked for the batch,
+   * the first one goes to the controller on sub-port A.
+   */
+  class Multitap : public Device {
+  public:
+    // ACK delay of each byte of a batched read but the last (microseconds)
+    uint16_t ackDelay = 10;
+    // Batched reads answered
+    uint32_t batches = 0;
+
+    /**
+     * @brief Plug a device into a sub-port.
+     * @param subPort Sub-port (`0`-`3`: A-D)
+     * @param device Device (must be alive while attached)
+     * @return `false` if the sub-port is full
+     */
+    bool attach(int subPort, Device *device);
+
+    /**
+     * @brief Unplug a device from a sub-port.
+     */
+    void detach(int subPort, Device *device);
+
+    void select() override;
+    bool exchange(uint16_t index, uint8_t command, uint8_t &response, uint16_t &ackDelay) override;
+    void deselect() override;
+
+  private:
+    Device *__devices[PSX_SIM_MULTITAP_PORTS][PSX_SIM_DEVICES_PER_SLOT] = {};
+    // Previous controller frame asked for the batch
+    bool __isBatched = false;
+    // Current frame asks for the batch (taken over on `deselect`)
+    bool __asksBatch = false;
+    // Current frame is answered as a batch
+    bool __isBatch = false;
+    // First byte of the frame
+    uint8_t __address = 0;
+    // Device the frame is forwarded to
+    Device *__target = nullptr;
+    // Controller answering the current sub-port of the batch
+    Device *__pad = nullptr;
+    uint32_t __selectTime = 0;
+
+    bool __forward(uint16_t index, uint8_t command, uint8_t &response, uint16_t &ackDelay);
+    void __batch(uint16_t index, uint8_t command, uint8_t &response);
+  };
+
+  /**
+   * @brief Whole frames exchanged in the background with the simulated devices, as `PSX::PioTransport` does.
+   * @note Bytes are exchanged at `tryStart`, the completion comes from `poll` once the bus time of the frame
+   * (delays, bits at the clock, ACK delays or spent timeouts) has passed. Call `PSXSim::begin` first.
+   */
+  class Transport : public PSX::Transport {
+  public:
+    /**
+     * @brief Frames that never complete until aborted, like a lost completion interrupt (set from any thread)
+     */
+    std::atomic<uint32_t> lostFrames{ 0 };
+    // Frame types taken by `lostFrames` (bit N: `PSX::FrameType` N), set before `lostFrames`
+    std::atomic<uint32_t> lostTypes{ 0xffffffff };
+    // Frames started
+    uint32_t frames = 0;
+
+    /**
+     * @brief Take over the attention lines.
+     * @param bitrate PSX clock frequency used when `Frame::timing` does not choose one (Hz)
+     */
+    void begin(uint32_t bitrate = 250000);
+
+    bool tryStart(PSX::Frame &frame, CompleteCallback callback, void *context) override;
+    bool isBusy() const override;
+    void abort() override;
+    void poll() override;
+
+  private:
+    uint32_t __bitrate = 250000;
+    PSX::Frame *__frame = nullptr;
+    CompleteCallback __callback = nullptr;
+    void *__context = nullptr;
+    uint32_t __start = 0;
+    // Bus time of the frame in microseconds
+    uint32_t __duration = 0;
+    // Bytes exchanged before the frame stopped
+    uint16_t __transferred = 0;
+    bool __isLost = false;
+
+    void __finish(uint16_t transferred);
+  };
+
+  /**
+   * @brief Connect the simulated ports to the host SPI and Gpio backends.
+   */
+  void begin();
+
+  /**
+   * @brief Plug a device into a slot.
+   * @param slot Slot number (`0`: Port 1, `1`: Port 2)
+   * @param device Device (must be alive while attached)
+   * @return `false` if the slot is full
+   */
+  bool attach(int slot, Device *device);
+
+  /**
+   * @brief Unplug a device (e.g. card removed).
+   */
+  void detach(int slot, Device *device);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Arduino.h"
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+#define SPI_MODE0 0
+#define SPI_MODE3 3
+#define MISO 0
+
+struct SPISettings {
+  SPISettings(uint32_t clock, uint8_t, uint8_t) : clock(clock) {}
+  uint32_t clock;
+};
+
+/**
+ * @brief SPI bus of the host, bytes go to the simulated device set by `hostSetDevice`.
+ */
+class SPIClass {
+public:
+  /**
+   * @brief Simulated device on the bus.
+   * @param data Byte sent by the firmware
+   * @return Byte driven by the device (`0xff` if nothing drives the line)
+   */
+  typedef uint8_t (*Device)(uint8_t data);
+
+  void begin() {}
+  void end() {}
+  void beginTransaction(SPISettings settings) {
+    __clock = settings.clock;
+  }
+  void endTransaction() {}
+
+  /**
+   * @brief Exchange a byte, taking 8 clocks of time.
+   * @param data Byte to send
+   * @return Received byte
+   */
+  uint8_t transfer(uint8_t data);
+
+  void hostSetDevice(Device device) {
+    __device = device;
+  }
+
+private:
+  uint32_t __clock = 250000;
+  Device __device = nullptr;
+};
+
+extern SPIClass SPI;
@@ -0,0 +1,296 @@
+/*
+  Replay a JVS capture against the firmware built for the host, with simulated memory cards.
+
+  Capture on the cabinet (firmware built with -D TRACE_ENABLED=1):
+    tools/trace_decode.py /dev/ttyACM0 --capture 120 --output boot.cap
+  Build and replay:
+    pio run -e replay
+    .pio/build/replay/program boot.cap [--fast] [--deadline US] [--card0 PATH] [--card1 PATH] [--empty SLOT]
+
+  Requests are fed into `JVS::tryGetRequest` through the host UART at the captured timing (or back to back
+  with `--fast`), core 1 runs in its own thread, and the simulated cards answer byte by byte with ACK delays.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <thread>
+#include <vector>
+#include <Arduino.h>
+#include <JVS.h>
+#include <JVSUart.h>
+#include <PSXSim.h>
+#include <Trace.h>
+
+void setup();
+void loop();
+void setup1();
+void loop1();
+
+namespace {
+  struct Request {
+    // Capture time of the record that carried the [SYNC]
+    uint32_t time;
+    std::vector<uint8_t> bytes;
+    uint8_t nodeNo = 0;
+    // First command code (`-1`: packet too short)
+    int command = -1;
+    // Device answered it during the capture
+    bool isAnswered = false;
+    uint32_t originalLatency = 0;
+    std::vector<uint8_t> originalResponse;
+
+    // Replay results
+    uint32_t injectTime = 0;
+    bool hasResponse = false;
+    uint32_t latency = 0;
+    bool isSameResponse = false;
+  };
+
+  struct Options {
+    const char *capturePath = nullptr;
+    const char *cardPaths[PSX_SIM_SLOT_COUNTS] = {};
+    bool isSlotEmpty[PSX_SIM_SLOT_COUNTS] = {};
+    bool isFast = false;
+    uint32_t deadlineUs = 1000;
+    // Longest wait for a response in `--fast` mode
+    uint32_t timeoutUs = 100000;
+  };
+
+  std::vector<Request> __requests;
+  // Request waiting for its response (`-1`: none)
+  int __outstanding = -1;
+  std::atomic<bool> __isRunning{ true };
+
+  bool __readFile(const char *path, std::vector<uint8_t> &data) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) return false;
+    uint8_t buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) data.insert(data.end(), buffer, buffer + length);
+    fclose(file);
+    return true;
+  }
+
+  /**
+   * @brief Read the node, [Byte Count] and the first data byte of a packet starting with [SYNC].
+   */
+  void __decodeHeader(Request &request) {
+    uint8_t header[3];
+    int count = 0;
+    bool isEscaped = false;
+    for (size_t i = 1; i < request.bytes.size() && count < 3; i++) {
+      uint8_t b = request.bytes[i];
+      if (b == JVS::SpecialChar::Escape) {
+        isEscaped = true;
+        continue;
+      }
+      header[count++] = isEscaped ? b + 1 : b;
+      isEscaped = false;
+    }
+    if (count >= 1) request.nodeNo = header[0];
+    if (count >= 3 && header[1] >= 2) request.command = header[2];
+  }
+
+  /**
+   * @brief Split the captured bytes into requests, and pair them with the captured responses.
+   * @return `false` if the capture has no request
+   */
+  bool __load(const std::vector<uint8_t> &capture) {
+    size_t offset = 0;
+    while (offset + 4 <= capture.size()) {
+      if (capture[offset] != TRACE_RECORD_MAGIC) {
+        offset++;
+        continue;
+      }
+      uint8_t type = capture[offset + 1];
+      size_t length = capture[offset + 2] | capture[offset + 3] << 8;
+      if (offset + 4 + length > capture.size()) break;
+      const uint8_t *payload = &capture[offset + 4];
+      offset += 4 + length;
+      if (type != Trace::RecordType::Capture || length < 5) continue;
+
+      uint32_t time = payload[0] | payload[1] << 8 | payload[2] << 16 | (uint32_t)payload[3] << 24;
+      uint8_t direction = payload[4] & ~TRACE_CAPTURE_GAP;
+      const uint8_t *data = payload + 5;
+      size_t count = length - 5;
+      if (direction == Trace::Direction::Sent) {
+        if (__requests.empty() || __requests.back().isAnswered) continue;
+        Request &request = __requests.back();
+        request.isAnswered = true;
+        request.originalLatency = time - request.time;
+        request.originalResponse.assign(data, data + count);
+        continue;
+      }
+      for (size_t i = 0; i < count; i++) {
+        if (data[i] == JVS::SpecialChar::Sync) {
+          __requests.emplace_back();
+          __requests.back().time = time;
+        }
+        // Bytes before the first [SYNC] belong to a packet that was not captured
+        if (!__requests.empty()) __requests.back().bytes.push_back(data[i]);
+      }
+    }
+    for (Request &request : __requests) __decodeHeader(request);
+    return !__requests.empty();
+  }
+
+  void __onSent(const uint8_t *data, size_t length, void *) {
+    if (__outstanding < 0) return;
+    Request &request = __requests[__outstanding];
+    request.hasResponse = true;
+    request.latency = micros() - request.injectTime;
+    request.isSameResponse = request.originalResponse.size() == length && memcmp(request.originalResponse.data(), data, length) == 0;
+    __outstanding = -1;
+  }
+
+  void __step() {
+    loop();
+    JVS::Uart::hostPoll();
+    std::this_thread::yield();
+  }
+
+  /**
+   * @brief Run the firmware until the request was answered (or timed out) and the RX ring is drained.
+   */
+  void __settle(const Request &request, const Options &options) {
+    uint32_t start = micros();
+    while (micros() - start < options.timeoutUs) {
+      __step();
+      if (JVS::hasReceived()) continue;
+      if (!request.isAnswered || request.hasResponse) break;
+    }
+  }
+
+  /**
+   * @brief Give the firmware the node address the capture was made with, if `SetAddress` was not captured.
+   */
+  void __assignAddress() {
+    for (const Request &request : __requests) {
+      if (request.command == JVS::Command::SetAddress) return;
+      if (request.nodeNo != JVS_ADDRESS_BROADCAST && request.nodeNo != 0) {
+        JVS::setAddress(request.nodeNo);
+        return;
+      }
+    }
+  }
+
+  uint32_t __percentile(std::vector<uint32_t> &values, double ratio) {
+    size_t index = (size_t)(ratio * (values.size() - 1) + 0.5);
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+  }
+
+  void __report(const Options &options, uint32_t elapsedUs, PSXSim::MemoryCard *cards) {
+    std::map<int, std::vector<uint32_t>> latencies;
+    int missed = 0;
+    int unanswered = 0;
+    int differing = 0;
+    for (const Request &request : __requests) {
+      if (!request.isAnswered) continue;
+      if (!request.hasResponse) {
+        unanswered++;
+        missed++;
+        continue;
+      }
+      if (request.latency > options.deadlineUs) missed++;
+      if (!request.isSameResponse) differing++;
+      latencies[request.command].push_back(request.latency);
+    }
+
+    printf("%-8s %8s %8s %8s %8s %8s\n", "command", "count", "p50", "p90", "p99", "max");
+    for (auto &entry : latencies) {
+      std::vector<uint32_t> &values = entry.second;
+      printf("0x%02x     %8zu %8u %8u %8u %8u\n", entry.first & 0xff, values.size(), __percentile(values, 0.5),
+             __percentile(values, 0.9), __percentile(values, 0.99), __percentile(values, 1.0));
+    }
+    uint32_t originalUs = __requests.back().time - __requests.front().time;
+    printf("requests %zu, replayed in %u ms (captured %u ms)\n", __requests.size(), elapsedUs / 1000, originalUs / 1000);
+    printf("deadline %u us missed %d (no response %d), responses differing from the capture %d\n", options.deadlineUs, missed,
+           unanswered, differing);
+    for (int slot = 0; slot < PSX_SIM_SLOT_COUNTS; slot++) {
+      if (options.isSlotEmpty[slot]) continue;
+      const PSXSim::MemoryCard &card = cards[slot];
+      printf("card %d: frames %u (read %u, write %u), busy %llu ms (%.1f%%)\n", slot, card.frames, card.reads, card.writes,
+             (unsigned long long)(card.busyUs / 1000), elapsedUs > 0 ? card.busyUs * 100.0 / elapsedUs : 0.0);
+    }
+  }
+
+  bool __parseOptions(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; i++) {
+      const char *arg = argv[i];
+      bool hasValue = i + 1 < argc;
+      if (strcmp(arg, "--fast") == 0) options.isFast = true;
+      else if (strcmp(arg, "--deadline") == 0 && hasValue) options.deadlineUs = strtoul(argv[++i], nullptr, 0);
+      else if (strcmp(arg, "--card0") == 0 && hasValue) options.cardPaths[0] = argv[++i];
+      else if (strcmp(arg, "--card1") == 0 && hasValue) options.cardPaths[1] = argv[++i];
+      else if (strcmp(arg, "--empty") == 0 && hasValue) options.isSlotEmpty[atoi(argv[++i]) & 1] = true;
+      else if (arg[0] != '-' && options.capturePath == nullptr) options.capturePath = arg;
+      else return false;
+    }
+    return options.capturePath != nullptr;
+  }
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!__parseOptions(argc, argv, options)) {
+    fprintf(stderr, "usage: %s CAPTURE [--fast] [--deadline US] [--card0 PATH] [--card1 PATH] [--empty SLOT]\n", argv[0]);
+    return 2;
+  }
+  std::vector<uint8_t> capture;
+  if (!__readFile(options.capturePath, capture) || !__load(capture)) {
+    fprintf(stderr, "no JVS request in %s\n", options.capturePath);
+    return 1;
+  }
+
+  static PSXSim::MemoryCard cards[PSX_SIM_SLOT_COUNTS];
+  PSXSim::begin();
+  for (int slot = 0; slot < PSX_SIM_SLOT_COUNTS; slot++) {
+    if (options.isSlotEmpty[slot]) continue;
+    if (options.cardPaths[slot] != nullptr && !cards[slot].load(options.cardPaths[slot])) {
+      fprintf(stderr, "can not read %s\n", options.cardPaths[slot]);
+      return 1;
+    }
+    PSXSim::attach(slot, &cards[slot]);
+  }
+
+  // Core 1
+  std::thread core1([] {
+    setup1();
+    while (__isRunning.load(std::memory_order_relaxed)) {
+      loop1();
+      std::this_thread::yield();
+    }
+  });
+  // Core 0
+  setup();
+  JVS::Uart::hostSetSink(__onSent, nullptr);
+  __assignAddress();
+
+  uint32_t start = micros();
+  for (size_t i = 0; i < __requests.size(); i++) {
+    Request &request = __requests[i];
+    if (options.isFast) {
+      // Master sends the next request after the response is on the wire
+      while (JVS::Uart::isWriting()) __step();
+    } else {
+      uint32_t due = request.time - __requests.front().time;
+      while (micros() - start < due) __step();
+    }
+    __outstanding = request.isAnswered ? i : -1;
+    request.injectTime = micros();
+    JVS::Uart::hostReceive(request.bytes.data(), request.bytes.size());
+    if (options.isFast) __settle(request, options);
+  }
+  // Last response
+  __settle(__requests.back(), options);
+  uint32_t elapsed = micros() - start;
+
+  __isRunning.store(false, std::memory_order_relaxed);
+  core1.join();
+  __report(options, elapsed, cards);
+  return 0;
+}
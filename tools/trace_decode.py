@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+"""Decode the trace records sent over USB CDC (build with -D TRACE_ENABLED=1).
+
+  trace_decode.py /dev/ttyACM0            dump the latency histograms and print percentiles
+  trace_decode.py /dev/ttyACM0 --stream 5 stream events for 5 seconds and print them
+  trace_decode.py capture.bin             decode records saved from the port
+  trace_decode.py /dev/ttyACM0 --capture 120 --output boot.cap
+                                          save the JVS traffic for tools/replay
+"""
+import argparse
+import os
+import select
+import stat
+import struct
+import sys
+import termios
+import time
+import tty
+
+RECORD_MAGIC = 0xA5
+EVENTS, HISTOGRAM, SUMMARY, CAPTURE = 1, 2, 3, 4
+CAPTURE_GAP = 0x80
+KEY_FRAME = 0x100
+
+POINTS = ["Sync", "Dispatch", "FrameStart", "FrameEnd", "Release"]
+SOURCES = ["core0", "core0-irq", "core1"]
+COMMANDS = {
+    0xF0: "Reset", 0xF1: "SetAddress", 0xF2: "CommMethodChange", 0xD2: "CommSupported",
+    0x10: "IOId", 0x11: "CommandRev", 0x12: "JvRev", 0x13: "ProtocolVer", 0x14: "FunctionCheck",
+    0x2F: "Retry", 0x70: "K573Buffer", 0x71: "K573Status", 0x72: "K573SecurityPlate",
+    0x73: "K573Execute", 0x76: "K573MemoryCard", 0x77: "K573Controller",
+    0x78: "K573Multitap",
+}
+FRAMES = ["ControllerRead", "MemoryCardRead", "MemoryCardWrite", "MemoryCardProbe", "MultitapControllerRead"]
+
+
+def bucket_bounds(bucket):
+    """Microseconds covered by the bucket [low, high) (same scheme as `Trace::bucketOf`)."""
+    if bucket < 16:
+        return bucket, bucket + 1
+    msb = bucket // 8 + 2
+    low = (8 + bucket % 8) << (msb - 3)
+    return low, low + (1 << (msb - 3))
+
+
+def percentile(counts, ratio):
+    total = sum(counts)
+    target = total * ratio
+    seen = 0
+    for bucket, count in enumerate(counts):
+        seen += count
+        if count and seen >= target:
+            return bucket_bounds(bucket)[1] - 1
+    return 0
+
+
+def key_name(key):
+    if key & KEY_FRAME:
+        kind = key & 0x0F
+        return "frame " + (FRAMES[kind] if kind < len(FRAMES) else hex(kind))
+    return COMMANDS.get(key, "cmd 0x%02x" % key)
+
+
+def parse_records(buffer):
+    """Yield (type, payload) and return the unparsed tail length through the generator value."""
+    offset = 0
+    while True:
+        start = buffer.find(bytes([RECORD_MAGIC]), offset)
+        if start < 0 or len(buffer) - start < 4:
+            return start if start >= 0 else len(buffer)
+        kind = buffer[start + 1]
+        (length,) = struct.unpack_from("<H", buffer, start + 2)
+        if kind not in (EVENTS, HISTOGRAM, SUMMARY, CAPTURE):
+            offset = start + 1
+            continue
+        if len(buffer) - start - 4 < length:
+            return start
+        yield kind, bytes(buffer[start + 4:start + 4 + length])
+        offset = start + 4 + length
+
+
+class Decoder:
+    def __init__(self, output=None):
+        self.buffer = bytearray()
+        self.histograms = {}
+        self.summary = None
+        self.output = output
+        self.captured = 0
+
+    def feed(self, data):
+        self.buffer += data
+        records = parse_records(self.buffer)
+        while True:
+            try:
+                kind, payload = next(records)
+            except StopIteration as stop:
+                del self.buffer[:stop.value]
+                return
+            self.handle(kind, payload)
+
+    def handle(self, kind, payload):
+        if kind == EVENTS:
+            for time_us, point, source, arg in struct.iter_unpack("<IBBH", payload):
+                name = POINTS[point] if point < len(POINTS) else str(point)
+                source_name = SOURCES[source] if source < len(SOURCES) else str(source)
+                print("%10u %-9s %-10s 0x%04x" % (time_us, source_name, name, arg))
+        elif kind == HISTOGRAM:
+            key, buckets = struct.unpack_from("<HH", payload)
+            self.histograms[key] = list(struct.unpack_from("<%dI" % buckets, payload, 4))
+        elif kind == SUMMARY:
+            self.summary = struct.unpack("<III", payload)
+        elif kind == CAPTURE:
+            self.captured += 1
+            if self.output:
+                # Saved as framed records, as tools/replay reads them
+                self.output.write(struct.pack("<BBH", RECORD_MAGIC, kind, len(payload)) + payload)
+                return
+            time_us, direction = struct.unpack_from("<IB", payload)
+            gap = " (bytes lost before)" if direction & CAPTURE_GAP else ""
+            name = "sent" if direction & ~CAPTURE_GAP else "received"
+            print("%10u %-8s %s%s" % (time_us, name, payload[5:].hex(" "), gap))
+
+    def report(self):
+        print("%-22s %8s %8s %8s %8s %8s" % ("key", "count", "p50", "p90", "p99", "max"))
+        for key in sorted(self.histograms):
+            counts = self.histograms[key]
+            total = sum(counts)
+            if total == 0:
+                continue
+            print("%-22s %8d %8d %8d %8d %8d" % (
+                key_name(key), total, percentile(counts, 0.5), percentile(counts, 0.9),
+                percentile(counts, 0.99), percentile(counts, 1.0)))
+        if self.summary:
+            print("events %d, dropped %d, not streamed %d (latencies in us, upper bound of the bucket)" % self.summary)
+
+
+def open_port(path):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)
+    attributes = termios.tcgetattr(fd)
+    attributes[6][termios.VMIN] = 0
+    attributes[6][termios.VTIME] = 0
+    termios.tcsetattr(fd, termios.TCSANOW, attributes)
+    return fd
+
+
+def read_for(fd, decoder, seconds, until_summary=False):
+    deadline = time.monotonic() + seconds
+    while time.monotonic() < deadline:
+        if until_summary and decoder.summary:
+            return
+        ready, _, _ = select.select([fd], [], [], 0.1)
+        if ready:
+            decoder.feed(os.read(fd, 4096))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("path", help="USB CDC device or a saved capture")
+    parser.add_argument("--stream", type=float, metavar="SECONDS", help="print raw events for a while before dumping")
+    parser.add_argument("--reset", action="store_true", help="clear the histograms after dumping")
+    parser.add_argument("--capture", type=float, metavar="SECONDS", help="capture the JVS traffic for a while")
+    parser.add_argument("--output", metavar="FILE", help="file receiving the capture (required with --capture)")
+    args = parser.parse_args()
+    if args.capture and not args.output:
+        parser.error("--capture needs --output")
+
+    decoder = Decoder()
+    if not os.path.exists(args.path) or not stat.S_ISCHR(os.stat(args.path).st_mode):
+        with open(args.path, "rb") as capture:
+            decoder.feed(capture.read())
+        decoder.report()
+        return
+
+    fd = open_port(args.path)
+    if args.capture:
+        with open(args.output, "wb") as output:
+            decoder.output = output
+            try:
+                os.write(fd, b"c")
+                read_for(fd, decoder, args.capture)
+                os.write(fd, b"q")
+                # Records already queued on the device
+                read_for(fd, decoder, 0.5)
+            finally:
+                os.close(fd)
+        print("%d records saved to %s" % (decoder.captured, args.output))
+        return
+
+    try:
+        if args.stream:
+            os.write(fd, b"s")
+            read_for(fd, decoder, args.stream)
+            os.write(fd, b"q")
+        os.write(fd, b"d")
+        read_for(fd, decoder, 2.0, until_summary=True)
+        if args.reset:
+            os.write(fd, b"r")
+    finally:
+        os.close(fd)
+    decoder.report()
+    if not decoder.summary:
+        sys.exit("no summary received (is the firmware built with TRACE_ENABLED=1?)")
+
+
+if __name__ == "__main__":
+    main()